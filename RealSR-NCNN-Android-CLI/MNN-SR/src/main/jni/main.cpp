@@ -1,6 +1,7 @@
 
 #include <stdio.h>
 
+#include <iostream>
 #include <queue>
 #include <vector>
 #include <clocale>
@@ -107,6 +108,8 @@ static std::vector<int> parse_optarg_int_array(const char *optarg) {
 
 #include "mnnsr.h"
 #include "filesystem_utils.h"
+#include "task_budget.h"
+#include "json_line.h"
 #include <opencv2/opencv.hpp>
 #include <opencv2/core/hal/interface.h>
 
@@ -128,9 +131,13 @@ static void print_usage() {
             "  -j load:proc:save    thread count for load/proc/save (default=1:2:2) can be 1:2,2,2:2 for multi-gpu\n");
 //    fprintf(stderr, "  -x                   enable tta mode\n");
     fprintf(stderr, "  -f format            output image format (jpg/png/webp, default=ext/png)\n");
+    fprintf(stderr, "  -r memory-mb         memory ceiling for queued images in MB (0=quarter of ram, default=0)\n");
+    fprintf(stderr, "  -k tile-batch        tiles per inference run, larger values take more session memory (default=1)\n");
+    fprintf(stderr, "  -n session-count     inference runs in flight, tiles are prepared and placed while the others run (default=2)\n");
     fprintf(stderr,
             "  -b backend           forward backend type(CPU=0,AUTO=4,CUDA=2,OPENCL=3,OPENGL=6,VULKAN=7,NN=5,USER_0=8,USER_1=9, default=3)\n");
     fprintf(stderr, "  -c color-type             model & output color space type (RGB=1, BGR=2, YCbCr=5, YUV=6, GRAY=10, GRAY model & YCbCr output=11, GRAY model & YUV output=12, default=1)\n");
+    fprintf(stderr, "  -S                   serve json jobs from stdin, one per line, models stay loaded\n");
 }
 
 class Task {
@@ -144,6 +151,9 @@ public:
     path_t inpath;
     path_t outpath;
 
+    // input and output bytes held against task_budget
+    size_t footprint;
+
     cv::Mat inimage;
     cv::Mat outimage;
     cv::Mat inalpha;
@@ -157,11 +167,7 @@ public:
     void put(const Task &v) {
         lock.lock();
 
-        while (tasks.size() >= 8) // FIXME hardcode queue length
-        {
-            condition.wait(lock);
-        }
-
+        // no length limit, the loaders wait on task_budget instead
         tasks.push(v);
 
         lock.unlock();
@@ -192,6 +198,7 @@ private:
 
 TaskQueue toproc;
 TaskQueue tosave;
+TaskBudget task_budget;
 
 class LoadThreadParams {
 public:
@@ -203,6 +210,80 @@ public:
     std::vector<path_t> output_files;
 };
 
+// decodes imagepath into v, a 4 channel image keeps its alpha aside, returns 0 on success
+static int load_task(Task &v, const path_t &imagepath, const path_t &outpath, int scale) {
+    // 读取图像
+    Mat image = imread(imagepath, IMREAD_UNCHANGED);
+
+    if (image.empty()) {
+#if _WIN32
+        fwprintf(stderr, L"decode image %ls failed\n", imagepath.c_str());
+#else // _WIN32
+
+        fprintf(stderr, "decode image %s failed\n", imagepath.c_str());
+#endif // _WIN32
+        return -1;
+    }
+
+    v.inpath = imagepath;
+    v.outpath = outpath;
+    v.scale = scale;
+
+    cv::Mat inimage;
+    int c = image.channels();
+
+    if (c == 1) {
+        // 如果图像有1个通道，转换为3个通道
+        cvtColor(image, inimage, COLOR_GRAY2BGR);
+        c = 3;
+        v.inimage = inimage;
+    } else if (image.channels() == 4) {
+        // 如果图像有4个通道，分离通道
+        std::vector<cv::Mat> channels;
+        split(image, channels);
+        Mat alphaChannel = channels[3];
+
+        // 判断 alpha 通道是否为单一颜色
+        if (countNonZero(alphaChannel != alphaChannel.at<uchar>(0, 0)) == 0) {
+            fprintf(stderr, "ignore alpha channel, %s\n", imagepath.c_str());
+            c = 3;
+        } else {
+            v.inalpha = alphaChannel;
+        }
+        merge(channels.data(), 3, inimage);
+        v.inimage = inimage;
+    } else if (c == 3) {
+        v.inimage = image;
+    } else {
+        fprintf(stderr, "[error] channel=%d, %s\n", image.channels(), imagepath.c_str());
+        return -1;
+    }
+
+    fprintf(stderr, "scale=%d, w/h/c %d/%d/%d -> %d/%d/%d (%d)\n", scale,
+            v.inimage.cols, v.inimage.rows, v.inimage.channels(),
+            v.inimage.cols * scale, v.inimage.rows * scale, 3, c
+    );
+
+    path_t ext = get_file_extension(v.outpath);
+    if (c == 4 &&
+        (ext == PATHSTR("jpg") || ext == PATHSTR("JPG") || ext == PATHSTR("jpeg") ||
+         ext == PATHSTR("JPEG"))) {
+        path_t output_filename2 = outpath + PATHSTR(".png");
+        v.outpath = output_filename2;
+#if _WIN32
+        fwprintf(stderr, L"image %ls has alpha channel ! %ls will output %ls\n", imagepath.c_str(), imagepath.c_str(), output_filename2.c_str());
+#else // _WIN32
+        fprintf(stderr, "image %s has alpha channel ! %s will output %s\n",
+                imagepath.c_str(), imagepath.c_str(), output_filename2.c_str());
+#endif // _WIN32
+    }
+
+    // input and output pixels, held until the result is saved
+    v.footprint = (size_t) v.inimage.cols * v.inimage.rows * c * (1 + scale * scale);
+
+    return 0;
+}
+
 void *load(void *args) {
 
     const LoadThreadParams *ltp = (const LoadThreadParams *) args;
@@ -220,76 +301,13 @@ void *load(void *args) {
             fprintf(stderr, "load %s \n", imagepath.c_str());
 #endif
         }
-        // 读取图像
-        Mat image = imread(imagepath, IMREAD_UNCHANGED);
-
-        if (image.empty()) {
-#if _WIN32
-            fwprintf(stderr, L"decode image %ls failed\n", imagepath.c_str());
-#else // _WIN32
-
-            fprintf(stderr, "decode image %s failed\n", imagepath.c_str());
-#endif // _WIN32
-            continue;
-        }
-
 
         Task v;
         v.id = i;
-        v.inpath = imagepath;
-        v.outpath = ltp->output_files[i];
-        v.scale = scale;
-
-        cv::Mat inimage;
-        int c = image.channels();
-
-        if (c == 1) {
-            // 如果图像有1个通道，转换为3个通道
-            cvtColor(image, inimage, COLOR_GRAY2BGR);
-            c = 3;
-            v.inimage = inimage;
-        } else if (image.channels() == 4) {
-            // 如果图像有4个通道，分离通道
-            std::vector<cv::Mat> channels;
-            split(image, channels);
-            Mat alphaChannel = channels[3];
-
-            // 判断 alpha 通道是否为单一颜色
-            if (countNonZero(alphaChannel != alphaChannel.at<uchar>(0, 0)) == 0) {
-                fprintf(stderr, "ignore alpha channel, %s\n", imagepath.c_str());
-                c = 3;
-            } else {
-                v.inalpha = alphaChannel;
-            }
-            merge(channels.data(), 3, inimage);
-            v.inimage = inimage;
-        } else if (c == 3) {
-            v.inimage = image;
-        } else {
-            fprintf(stderr, "[error] channel=%d, %s\n", image.channels(), imagepath.c_str());
+        if (load_task(v, imagepath, ltp->output_files[i], scale) != 0)
             continue;
-        }
-
-        v.outimage = cv::Mat(v.inimage.rows * scale, v.inimage.cols * scale, CV_8UC3);
 
-        fprintf(stderr, "scale=%d, w/h/c %d/%d/%d -> %d/%d/%d (%d)\n", scale,
-                v.inimage.cols, v.inimage.rows, v.inimage.channels(),
-                v.outimage.cols, v.outimage.rows, v.outimage.channels(), c
-        );
-
-        path_t ext = get_file_extension(v.outpath);
-        if (c == 4 &&
-            (ext == PATHSTR("jpg") || ext == PATHSTR("JPG") || ext == PATHSTR("jpeg") ||
-             ext == PATHSTR("JPEG"))) {
-            path_t output_filename2 = ltp->output_files[i] + PATHSTR(".png");
-            v.outpath = output_filename2;
-#if _WIN32
-            fwprintf(stderr, L"image %ls has alpha channel ! %ls will output %ls\n", imagepath.c_str(), imagepath.c_str(), output_filename2.c_str());
-#else // _WIN32
-            fprintf(stderr, "image %s has alpha channel ! %s will output %s\n",
-                    imagepath.c_str(), imagepath.c_str(), output_filename2.c_str());
-#endif // _WIN32
-        }
+        task_budget.acquire(v.footprint);
 
         toproc.put(v);
 
@@ -316,6 +334,8 @@ void *proc(void *args) {
         if (v.id == -233)
             break;
 
+        // allocated only now, queued tasks hold just their input
+        v.outimage = cv::Mat(v.inimage.rows * v.scale, v.inimage.cols * v.scale, CV_8UC3);
         mnnsr->process(v.inimage, v.outimage);
 
         tosave.put(v);
@@ -330,9 +350,83 @@ public:
     bool f_print;
 };
 
+// writes one processed task, the alpha kept aside is scaled back in, returns 0 on failure
+static int save_task(Task &v, const SaveThreadParams *stp) {
+    const int verbose = stp->verbose;
+
+    if (v.outimage.empty()) {
+        fprintf(stderr, "[err] invalid result %s\n", v.inpath.c_str());
+        return 0;
+    }
+
+    high_resolution_clock::time_point begin = high_resolution_clock::now();
+
+    int success = 0;
+
+    path_t ext = get_file_extension(v.outpath);
+
+    if (ext == PATHSTR("jpg") || ext == PATHSTR("JPG") || ext == PATHSTR("jpeg") ||
+        ext == PATHSTR("JPEG")) {
+        // 设置 JPEG 压缩率
+        std::vector<int> compressionParams;
+        compressionParams.push_back(cv::IMWRITE_JPEG_QUALITY); // 指定参数类型
+        compressionParams.push_back(90);
+
+#if _WIN32
+        std::wstring outpath_wstr = v.outpath;
+        std::string outpath_str(outpath_wstr.begin(), outpath_wstr.end());
+        success = (cv::imwrite(outpath_str, v.outimage, compressionParams));
+#else
+        success = (cv::imwrite(v.outpath.c_str(), v.outimage, compressionParams));
+#endif
+    } else {
+        if (!v.inalpha.empty()) {
+            cv::Mat scaledAlphaChannel;
+            cv::resize(v.inalpha, scaledAlphaChannel, cv::Size(), v.scale, v.scale,
+                       cv::INTER_LINEAR);
+            std::vector<cv::Mat> outChannels;
+            cv::split(v.outimage, outChannels);
+            scaledAlphaChannel.copyTo(outChannels[3]); // 更新 alpha 通道
+            cv::Mat outputImageWithAlpha(v.outimage.rows, v.outimage.cols, CV_8UC4);
+            cv::merge(outChannels, outputImageWithAlpha); // 合并回输出图像
+            v.outimage = outputImageWithAlpha;
+        }
+
+#if _WIN32
+        std::wstring outpath_wstr = v.outpath;
+        std::string outpath_str(outpath_wstr.begin(), outpath_wstr.end());
+        success = (cv::imwrite(outpath_str, v.outimage ));
+#else
+        success = (cv::imwrite(v.outpath.c_str(), v.outimage));
+#endif
+    }
+    if (success) {
+        high_resolution_clock::time_point end = high_resolution_clock::now();
+        duration<double> time_span = duration_cast<duration<double>>(end - begin);
+        if (stp->f_print)
+            fprintf(stderr, "save result use time: %.3lf\n", time_span.count());
+
+        if (verbose) {
+#if _WIN32
+            fwprintf(stdout, L"%ls -> %ls done\n", v.inpath.c_str(), v.outpath.c_str());
+#else
+            fprintf(stdout, "%s -> %s done\n", v.inpath.c_str(), v.outpath.c_str());
+#endif
+        }
+
+    } else {
+#if _WIN32
+        fwprintf(stderr, L"save result failed: %ls\n", v.outpath.c_str());
+#else
+        fprintf(stderr, "save result failed: %s\n", v.outpath.c_str());
+#endif
+    }
+
+    return success;
+}
+
 void *save(void *args) {
     const SaveThreadParams *stp = (const SaveThreadParams *) args;
-    const int verbose = stp->verbose;
     for (;;) {
         Task v;
 
@@ -341,74 +435,337 @@ void *save(void *args) {
         if (v.id == -233)
             break;
 
-        if (v.outimage.empty()) {
-            fprintf(stderr, "[err] invalid result %s\n", v.inpath.c_str());
-            continue;
-        }
+        TaskBudgetScope budget_scope(task_budget, v.footprint);
 
-        high_resolution_clock::time_point begin = high_resolution_clock::now();
-
-        int success = 0;
+        save_task(v, stp);
+    }
 
-        path_t ext = get_file_extension(v.outpath);
+    return 0;
+}
 
-        if (ext == PATHSTR("jpg") || ext == PATHSTR("JPG") || ext == PATHSTR("jpeg") ||
-            ext == PATHSTR("JPEG")) {
-            // 设置 JPEG 压缩率
-            std::vector<int> compressionParams;
-            compressionParams.push_back(cv::IMWRITE_JPEG_QUALITY); // 指定参数类型
-            compressionParams.push_back(90);
+// the .mnn file of the model for scale, a missing scale falls back to the first of 4, 2, 1, 8 found
+// returns the scale of that file and its size in MB, -1 when there is none
+static int model_file(const path_t &model, int scale, path_t &modelfullpath, long &modelsize) {
+    int scales[] = {4, 2, 1, 8};
+    int sp = 0;
 
 #if _WIN32
-            std::wstring outpath_wstr = v.outpath;
-            std::string outpath_str(outpath_wstr.begin(), outpath_wstr.end());
-            success = (cv::imwrite(outpath_str, v.outimage, compressionParams));
+    wchar_t modelpath[256];
+    if(model.ends_with(".mnn")){
+        swprintf(modelpath, 256, L"%s", model.c_str());
+    }else{
+        swprintf(modelpath, 256, L"%s/x%d.mnn", model.c_str(), scale);
+    }
+    fprintf(stderr, "search model: %ws\n", modelpath);
+
+    modelfullpath = sanitize_filepath(modelpath);
+    FILE* mp = _wfopen(modelfullpath.c_str(), L"rb");
 #else
-            success = (cv::imwrite(v.outpath.c_str(), v.outimage, compressionParams));
+    char modelpath[256];
+    if ( model.ends_with(".mnn"))
+        sprintf(modelpath, "%s", model.c_str());
+    else
+        sprintf(modelpath, "%s/x%d.mnn", model.c_str(), scale);
+    fprintf(stderr, "search model: %s\n", modelpath);
+
+    modelfullpath = sanitize_filepath(modelpath);
+    FILE *mp = fopen(modelfullpath.c_str(), "rb");
 #endif
-        } else {
-            if (!v.inalpha.empty()) {
-                cv::Mat scaledAlphaChannel;
-                cv::resize(v.inalpha, scaledAlphaChannel, cv::Size(), v.scale, v.scale,
-                           cv::INTER_LINEAR);
-                std::vector<cv::Mat> outChannels;
-                cv::split(v.outimage, outChannels);
-                scaledAlphaChannel.copyTo(outChannels[3]); // 更新 alpha 通道
-                cv::Mat outputImageWithAlpha(v.outimage.rows, v.outimage.cols, CV_8UC4);
-                cv::merge(outChannels, outputImageWithAlpha); // 合并回输出图像
-                v.outimage = outputImageWithAlpha;
-            }
 
+    while (!mp && sp < 4) {
+        int s = scales[sp];
 #if _WIN32
-            std::wstring outpath_wstr = v.outpath;
-            std::string outpath_str(outpath_wstr.begin(), outpath_wstr.end());
-            success = (cv::imwrite(outpath_str, v.outimage ));
+        swprintf(modelpath, 256, L"%s/x%d.bin", model.c_str(), s);
+
+        modelfullpath = sanitize_filepath(modelpath);
+        mp = _wfopen(modelfullpath.c_str(), L"rb");
 #else
-            success = (cv::imwrite(v.outpath.c_str(), v.outimage));
+        sprintf(modelpath, "%s/x%d.mnn", model.c_str(), s);
+
+        modelfullpath = sanitize_filepath(modelpath);
+        mp = fopen(modelfullpath.c_str(), "rb");
 #endif
+        if (mp) {
+            fprintf(stderr, "Fix scale: %d -> %d\n", scale, s);
+            scale = s;
+            break;
+        } else {
+            fprintf(stderr, "Fix scale fail -> %d\n", s);
+            sp++;
         }
-        if (success) {
-            high_resolution_clock::time_point end = high_resolution_clock::now();
-            duration<double> time_span = duration_cast<duration<double>>(end - begin);
-            if (stp->f_print)
-                fprintf(stderr, "save result use time: %.3lf\n", time_span.count());
+    };
 
-            if (verbose) {
+    if (!mp) {
 #if _WIN32
-                fwprintf(stdout, L"%ls -> %ls done\n", v.inpath.c_str(), v.outpath.c_str());
+        fprintf(stderr, "Unknow scale for the model (%ws)\n", modelfullpath.c_str());
 #else
-                fprintf(stdout, "%s -> %s done\n", v.inpath.c_str(), v.outpath.c_str());
+        fprintf(stderr, "Unknow scale for the model (%s)\n", modelfullpath.c_str());
 #endif
-            }
+        return -1;
+    }
 
-        } else {
+    // 移动到文件末尾
+    fseek(mp, 0, SEEK_END);
+    // 获取文件大小
+    modelsize = ftell(mp)/1000000;
+    // 重置文件指针到开头
+    fseek(mp, 0, SEEK_SET);
+    fclose(mp);
+
+    return scale;
+}
+
+// color space named by the model dir, rgb otherwise
+static int model_color_type(const path_t &model) {
+    if (model.find(PATHSTR("Grayscale")) != path_t::npos)
+        return GRAY;
+    if (model.find(PATHSTR("Gray2YCbCr")) != path_t::npos)
+        return Gray2YCbCr;
+    if (model.find(PATHSTR("Gray2YUV")) != path_t::npos)
+        return Gray2YUV;
+    if (model.find(PATHSTR("YCbCr")) != path_t::npos)
+        return YCbCr;
+    if (model.find(PATHSTR("YUV")) != path_t::npos)
+        return YUV;
+    return RGB;
+}
+
+// larger models take smaller tiles, modelsize is in MB
+static int auto_tilesize(long modelsize) {
+    if (modelsize <10)
+        return 256;
+    else if (modelsize<16)
+        return 128;
+    else if (modelsize<24)
+        return 96;
+    else
+        return 64;
+}
+
+static MNNSR *create_mnnsr(const path_t &modelfullpath, long modelsize, int scale, int color_type,
+                           int backend_type, int tilesize, int prepadding, int batch, int session_count) {
+    MNNSR *mnnsr = new MNNSR(color_type);
+    mnnsr->tilesize = tilesize;
+    mnnsr->prepadding = prepadding;
+    if (backend_type >= 0 && backend_type <= 14)
+        mnnsr->backend_type = static_cast<MNNForwardType>(backend_type);
+
+    mnnsr->scale = scale;
+    mnnsr->batch = batch;
+    mnnsr->session_count = session_count;
+    mnnsr->load(modelfullpath, modelsize > 10);
+
+    return mnnsr;
+}
+
+// job paths are utf-8 json strings
 #if _WIN32
-            fwprintf(stderr, L"save result failed: %ls\n", v.outpath.c_str());
+static path_t path_from_utf8(const std::string& s)
+{
+    int length = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, NULL, 0);
+    std::vector<wchar_t> buffer(std::max(length, 1), 0);
+    MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, buffer.data(), length);
+    return path_t(buffer.data());
+}
+
+static std::string path_to_utf8(const path_t& path)
+{
+    int length = WideCharToMultiByte(CP_UTF8, 0, path.c_str(), -1, NULL, 0, NULL, NULL);
+    std::vector<char> buffer(std::max(length, 1), 0);
+    WideCharToMultiByte(CP_UTF8, 0, path.c_str(), -1, buffer.data(), length, NULL, NULL);
+    return std::string(buffer.data());
+}
 #else
-            fprintf(stderr, "save result failed: %s\n", v.outpath.c_str());
+static path_t path_from_utf8(const std::string &s) {
+    return s;
+}
+
+static std::string path_to_utf8(const path_t &path) {
+    return path;
+}
 #endif
+
+class ServerEngine {
+public:
+    path_t model;
+    // the scale of the model file, may differ from the one asked for
+    int scale;
+    MNNSR *mnnsr;
+    // what a job with tile 0 runs
+    int tilesize;
+};
+
+class ServerParams {
+public:
+    int backend_type;
+    // 0 picks one for each model
+    int tilesize;
+    path_t model;
+    int scale;
+    // UnSet takes it from each model dir
+    int color_type;
+    int batch;
+    int session_count;
+
+    // loaded on first use and kept until stdin closes
+    std::vector<ServerEngine> engines;
+};
+
+static ServerEngine *server_engine(ServerParams *sp, const path_t &model, int scale, std::string &error) {
+    if (model.find(PATHSTR("models-")) == path_t::npos && !model.ends_with(".mnn")) {
+        error = "unknown model dir type";
+        return 0;
+    }
+
+    path_t modelfullpath;
+    long modelsize = 0;
+    scale = model_file(model, scale, modelfullpath, modelsize);
+    if (scale < 0) {
+        error = "no model for the scale";
+        return 0;
+    }
+
+    for (int i = 0; i < (int) sp->engines.size(); i++) {
+        ServerEngine &engine = sp->engines[i];
+        if (engine.model == model && engine.scale == scale)
+            return &engine;
+    }
+
+    const int color_type = sp->color_type == UnSet ? model_color_type(model) : sp->color_type;
+
+    ServerEngine engine;
+    engine.model = model;
+    engine.scale = scale;
+    engine.tilesize = std::max(sp->tilesize ? sp->tilesize : auto_tilesize(modelsize), 64);
+    engine.mnnsr = create_mnnsr(modelfullpath, modelsize, scale, color_type, sp->backend_type,
+                                engine.tilesize, 4, sp->batch, sp->session_count);
+
+    sp->engines.push_back(engine);
+    return &sp->engines.back();
+}
+
+// one job start to end, outpath is the file actually written
+// progress goes to stdout as json lines for id, the quoted job id
+static int serve_job(ServerParams *sp, const std::map<std::string, std::string> &job, const std::string &id,
+                     path_t &outpath, std::string &error) {
+    std::map<std::string, std::string>::const_iterator input = job.find("input");
+    std::map<std::string, std::string>::const_iterator output = job.find("output");
+    if (input == job.end() || output == job.end() || input->second.empty() || output->second.empty()) {
+        error = "input and output are required";
+        return -1;
+    }
+
+    std::map<std::string, std::string>::const_iterator model = job.find("model");
+    const path_t inpath = path_from_utf8(input->second);
+    outpath = path_from_utf8(output->second);
+
+    const int scale = json_line_int(job, "scale", sp->scale);
+    const int tilesize = json_line_int(job, "tile", 0);
+    if (scale < 1) {
+        error = "invalid scale";
+        return -1;
+    }
+    if (tilesize < 0) {
+        error = "invalid tile";
+        return -1;
+    }
+
+    path_t ext = get_file_extension(outpath);
+    if (ext != PATHSTR("png") && ext != PATHSTR("PNG") && ext != PATHSTR("webp") && ext != PATHSTR("WEBP")
+        && ext != PATHSTR("jpg") && ext != PATHSTR("JPG") && ext != PATHSTR("jpeg") && ext != PATHSTR("JPEG")) {
+        error = "invalid output extension type";
+        return -1;
+    }
+
+    ServerEngine *engine = server_engine(sp, model == job.end() ? sp->model : path_from_utf8(model->second), scale, error);
+    if (!engine)
+        return -1;
+
+    // 0 keeps the tile size picked for this model, smaller ones are raised to 64 like -t
+    engine->mnnsr->tilesize = tilesize ? std::max(tilesize, 64) : engine->tilesize;
+    engine->mnnsr->progress_callback = json_line_progress;
+    engine->mnnsr->progress_userdata = (void *) &id;
+
+    Task v;
+    v.id = 0;
+    if (load_task(v, inpath, outpath, engine->scale) != 0) {
+        error = "decode image failed";
+        return -1;
+    }
+    outpath = v.outpath;
+
+    v.outimage = cv::Mat(v.inimage.rows * v.scale, v.inimage.cols * v.scale, CV_8UC3);
+    if (engine->mnnsr->process(v.inimage, v.outimage) != 0) {
+        error = "process failed";
+        return -1;
+    }
+
+    // stdout carries the replies only
+    SaveThreadParams stp;
+    stp.verbose = 0;
+    stp.f_print = false;
+
+    if (!save_task(v, &stp)) {
+        error = "save result failed";
+        return -1;
+    }
+
+    return 0;
+}
+
+// jobs come on stdin and replies go to stdout, one json object per line
+// {"id":"1","input":"a.jpg","output":"b.png","model":"models-Real-ESRGAN-anime","scale":4,"tile":0}
+// only input and output are required, the rest default to the command line
+static int serve(ServerParams *sp) {
+    std::string error;
+    if (!server_engine(sp, sp->model, sp->scale, error))
+        fprintf(stderr, "preload model failed: %s\n", error.c_str());
+
+    fprintf(stdout, "{\"status\":\"ready\"}\n");
+    fflush(stdout);
+
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+
+        high_resolution_clock::time_point begin = high_resolution_clock::now();
+
+        std::map<std::string, std::string> job;
+        std::string id = "null";
+        path_t outpath;
+        int ret = -1;
+
+        error.clear();
+        if (json_line_parse(line, job) != 0) {
+            error = "invalid json job";
+        } else {
+            if (job.find("id") != job.end())
+                id = json_line_quote(job["id"]);
+
+            fprintf(stdout, "{\"id\":%s,\"status\":\"processing\"}\n", id.c_str());
+            fflush(stdout);
+
+            ret = serve_job(sp, job, id, outpath, error);
+        }
+
+        high_resolution_clock::time_point end = high_resolution_clock::now();
+        duration<double> time_span = duration_cast<duration<double>>(end - begin);
+
+        if (ret == 0) {
+            fprintf(stdout, "{\"id\":%s,\"status\":\"done\",\"output\":%s,\"time\":%.3lf}\n", id.c_str(),
+                    json_line_quote(path_to_utf8(outpath)).c_str(), time_span.count());
+        } else {
+            fprintf(stdout, "{\"id\":%s,\"status\":\"error\",\"message\":%s}\n", id.c_str(),
+                    json_line_quote(error).c_str());
         }
+        fflush(stdout);
+    }
+
+    for (int i = 0; i < (int) sp->engines.size(); i++) {
+        delete sp->engines[i].mnnsr;
     }
+    sp->engines.clear();
 
     return 0;
 }
@@ -449,11 +806,15 @@ int main(int argc, char **argv)
     int jobs_save = 1;
     int verbose = 0;
     path_t format = PATHSTR("png");
+    int budget_mb = 0;
+    int batch = 1;
+    int session_count = 2;
+    int server = 0;
 
 #if _WIN32
     setlocale(LC_ALL, "");
     wchar_t opt;
-    while ((opt = getopt(argc, argv, L"b:i:o:s:c:t:m:g:j:f:vxh")) != (wchar_t)-1)
+    while ((opt = getopt(argc, argv, L"b:i:o:s:c:t:m:g:j:f:r:k:n:vxSh")) != (wchar_t)-1)
     {
         switch (opt)
         {
@@ -497,6 +858,18 @@ int main(int argc, char **argv)
             if(backend_type != MNN_FORWARD_CPU)
                 backend_type =_wtoi(optarg);
             break;
+        case L'r':
+            budget_mb = _wtoi(optarg);
+            break;
+        case L'k':
+            batch = _wtoi(optarg);
+            break;
+        case L'n':
+            session_count = _wtoi(optarg);
+            break;
+        case L'S':
+            server = 1;
+            break;
         case L'h':
         default:
             print_usage();
@@ -505,7 +878,7 @@ int main(int argc, char **argv)
     }
 #else // _WIN32
     int opt;
-    while ((opt = getopt(argc, argv, "b:i:o:s:c:t:m:g:j:f:vxh")) != -1) {
+    while ((opt = getopt(argc, argv, "b:i:o:s:c:t:m:g:j:f:r:k:n:vxSh")) != -1) {
         switch (opt) {
             case 'i':
                 inputpath = optarg;
@@ -547,6 +920,18 @@ int main(int argc, char **argv)
                 if (backend_type != MNN_FORWARD_CPU)
                     backend_type = atoi(optarg);
                 break;
+            case 'r':
+                budget_mb = atoi(optarg);
+                break;
+            case 'k':
+                batch = atoi(optarg);
+                break;
+            case 'n':
+                session_count = atoi(optarg);
+                break;
+            case 'S':
+                server = 1;
+                break;
             case 'h':
             default:
                 print_usage();
@@ -556,7 +941,7 @@ int main(int argc, char **argv)
 #endif // _WIN32
 
 
-    if (inputpath.empty()) {
+    if (inputpath.empty() && !server) {
         print_usage();
 #if _DEMO_PATH
         fprintf(stderr, "demo input argument\n");
@@ -567,7 +952,7 @@ int main(int argc, char **argv)
     }
 
 
-    if (outputpath.empty()) {
+    if (outputpath.empty() && !server) {
         print_usage();
 #if _DEMO_PATH
         fprintf(stderr, "demo output argument\n");
@@ -583,7 +968,22 @@ int main(int argc, char **argv)
         return -1;
     }
 
-    if (!path_is_directory(outputpath)) {
+    if (budget_mb < 0) {
+        fprintf(stderr, "invalid memory-mb argument\n");
+        return -1;
+    }
+
+    if (batch < 1) {
+        fprintf(stderr, "invalid tile-batch argument\n");
+        return -1;
+    }
+
+    if (session_count < 1) {
+        fprintf(stderr, "invalid session-count argument\n");
+        return -1;
+    }
+
+    if (!server && !path_is_directory(outputpath)) {
         // guess format from outputpath no matter what format argument specified
         path_t ext = get_file_extension(outputpath);
 
@@ -608,7 +1008,7 @@ int main(int argc, char **argv)
     // collect input and output filepath
     std::vector<path_t> input_files;
     std::vector<path_t> output_files;
-    {
+    if (!server) {
         if (path_is_directory(inputpath) && path_is_directory(outputpath)) {
             std::vector<path_t> filenames;
             int lr = list_directory(inputpath, filenames);
@@ -654,97 +1054,27 @@ int main(int argc, char **argv)
         }
     }
 
+    // the server checks the model of every job instead
     int prepadding = 0;
-
-    if (model.find(PATHSTR("models-")) != path_t::npos||model.ends_with(".mnn")) {
-        prepadding = 4;
-    } else {
-        fprintf(stderr, "unknown model dir type\n");
-        return -1;
-    }
-
-    std::cout << "build time: " << __DATE__ << " " << __TIME__ << std::endl;
-
-    if (color_type == UnSet) {
-        if (model.find(PATHSTR("Grayscale")) != path_t::npos)
-            color_type = GRAY;
-        else if (model.find(PATHSTR("Gray2YCbCr")) != path_t::npos)
-            color_type = Gray2YCbCr;
-        else if (model.find(PATHSTR("Gray2YUV")) != path_t::npos)
-            color_type = Gray2YUV;
-        else if (model.find(PATHSTR("YCbCr")) != path_t::npos)
-            color_type = YCbCr;
-        else if (model.find(PATHSTR("YUV")) != path_t::npos)
-            color_type = YUV;
-        else
-            color_type = RGB;
-    }
-
-    int scales[] = {4, 2, 1, 8};
-    int sp = 0;
-
-#if _WIN32
-    wchar_t modelpath[256];
-    if(model.ends_with(".mnn")){
-        swprintf(modelpath, 256, L"%s", model.c_str());
-    }else{
-        swprintf(modelpath, 256, L"%s/x%d.mnn", model.c_str(), scale);
-    }
-    fprintf(stderr, "search model: %ws\n", modelpath);
-
-    path_t modelfullpath = sanitize_filepath(modelpath);
-    FILE* mp = _wfopen(modelfullpath.c_str(), L"rb");
-#else
-    char modelpath[256];
-    if ( model.ends_with(".mnn"))
-        sprintf(modelpath, "%s", model.c_str());
-    else
-        sprintf(modelpath, "%s/x%d.mnn", model.c_str(), scale);
-    fprintf(stderr, "search model: %s\n", modelpath);
-
-    path_t modelfullpath = sanitize_filepath(modelpath);
-    FILE *mp = fopen(modelfullpath.c_str(), "rb");
-#endif
-
-    while (!mp && sp < 4) {
-        int s = scales[sp];
-#if _WIN32
-        swprintf(modelpath, 256, L"%s/x%d.bin", model.c_str(), s);
-
-        modelfullpath = sanitize_filepath(modelpath);
-        mp = _wfopen(modelfullpath.c_str(), L"rb");
-#else
-        sprintf(modelpath, "%s/x%d.mnn", model.c_str(), s);
-
-        modelfullpath = sanitize_filepath(modelpath);
-        mp = fopen(modelfullpath.c_str(), "rb");
-#endif
-        if (mp) {
-            fprintf(stderr, "Fix scale: %d -> %d\n", scale, s);
-            scale = s;
-            break;
+    path_t modelfullpath;
+    long modelsize = 0;
+    if (!server) {
+        if (model.find(PATHSTR("models-")) != path_t::npos||model.ends_with(".mnn")) {
+            prepadding = 4;
         } else {
-            fprintf(stderr, "Fix scale fail -> %d\n", s);
-            sp++;
+            fprintf(stderr, "unknown model dir type\n");
+            return -1;
         }
-    };
 
-    if (!mp) {
-#if _WIN32
-        fprintf(stderr, "Unknow scale for the model (%ws)\n", modelfullpath.c_str());
-#else
-        fprintf(stderr, "Unknow scale for the model (%s)\n", modelfullpath.c_str());
-#endif
-        return -1;
-    }
+        std::cout << "build time: " << __DATE__ << " " << __TIME__ << std::endl;
 
-    // 移动到文件末尾
-    fseek(mp, 0, SEEK_END);
-    // 获取文件大小
-    long modelsize = ftell(mp)/1000000;
-    // 重置文件指针到开头
-    fseek(mp, 0, SEEK_SET);
-    fclose(mp);
+        if (color_type == UnSet)
+            color_type = model_color_type(model);
+
+        scale = model_file(model, scale, modelfullpath, modelsize);
+        if (scale < 0)
+            return -1;
+    }
 
 #if _WIN32
     CoInitializeEx(NULL, COINIT_MULTITHREADED);
@@ -755,30 +1085,34 @@ int main(int argc, char **argv)
     jobs_load = std::min(jobs_load, cpu_count);
     jobs_save = 1;
 
+    task_budget.set_ceiling((size_t) budget_mb * 1024 * 1024);
+    if (verbose)
+        fprintf(stderr, "task memory budget %zu MB\n", task_budget.get_ceiling() / 1024 / 1024);
+
+    if (server) {
+        ServerParams sp;
+        sp.backend_type = backend_type;
+        sp.tilesize = tilesize;
+        sp.model = model;
+        sp.scale = scale;
+        sp.color_type = color_type;
+        sp.batch = batch;
+        sp.session_count = session_count;
+
+        serve(&sp);
+
+        return 0;
+    }
+
     fprintf(stderr, "busy...\n");
     {
-
-        MNNSR mnnsr = MNNSR(color_type);
-        if (tilesize == 0) {
-            tilesize = 128;
-            if (modelsize <10)
-                tilesize = 256;
-            else if (modelsize<16)
-                tilesize = 128;
-            else if (modelsize<24)
-                tilesize = 96;
-            else
-                tilesize = 64;
-        }
+        if (tilesize == 0)
+            tilesize = auto_tilesize(modelsize);
         if (tilesize < 64)
             tilesize = 64;
-        mnnsr.tilesize = tilesize;
-        mnnsr.prepadding = prepadding;
-        if (backend_type >= 0 && backend_type <= 14)
-            mnnsr.backend_type = static_cast<MNNForwardType>(backend_type);
 
-        mnnsr.scale = scale;
-        mnnsr.load(modelfullpath, modelsize > 10);
+        MNNSR *mnnsr = create_mnnsr(modelfullpath, modelsize, scale, color_type, backend_type,
+                                    tilesize, prepadding, batch, session_count);
 
         // main routine
         {
@@ -792,7 +1126,7 @@ int main(int argc, char **argv)
             ncnn::Thread load_thread(load, (void *) &ltp);
 
             ProcThreadParams ptp;
-            ptp .mnnsr = &mnnsr;
+            ptp .mnnsr = mnnsr;
 
             ncnn::Thread * proc_thread;
             proc_thread = new ncnn::Thread(proc, (void *) &ptp);
@@ -821,6 +1155,8 @@ int main(int argc, char **argv)
             save_thread->join();
             delete save_thread ;
         }
+
+        delete mnnsr;
     }
 
 
@@ -3,12 +3,47 @@
 //
 #include "mnnsr.h"
 #include "utils.hpp"
+#include "tile_pixels.h"
+#include "tile_plan.h"
 #include <thread>
 
 #include "MNN/ErrorCode.hpp"
 
 using namespace MNN;
 
+static void *run_session(void *args) {
+    MNNSRSession *slot = (MNNSRSession *) args;
+    slot->interpreter_input->copyFromHostTensor(slot->input_tensor);
+    slot->interpreter->runSession(slot->session);
+    slot->interpreter_output->copyToHostTensor(slot->output_tensor);
+    return 0;
+}
+
+// bgr u8 to ycrcb (Y Cr Cb) or yuv (Y U V) in place, the fixed point coefficients of cvtColor
+template<bool crcb>
+static void bgr_to_ycc_row(unsigned char *p, int n) {
+    const int shift = 14;
+    const int round = 1 << (shift - 1);
+    const int delta = 128 << shift;
+    // scale of r - y and b - y
+    const int cr = crcb ? 11682 : 14369;
+    const int cb = crcb ? 9241 : 8061;
+
+    for (int j = 0; j < n; j++) {
+        const int b = p[0];
+        const int g = p[1];
+        const int r = p[2];
+        const int y = (b * 1868 + g * 9617 + r * 4899 + round) >> shift;
+        const int u = ((b - y) * cb + delta + round) >> shift;
+        const int v = ((r - y) * cr + delta + round) >> shift;
+
+        p[0] = (unsigned char) y;
+        p[1] = (unsigned char) std::min(std::max(crcb ? v : u, 0), 255);
+        p[2] = (unsigned char) std::min(std::max(crcb ? u : v, 0), 255);
+        p += 3;
+    }
+}
+
 MNNSR::MNNSR(int color_type) {
     color = static_cast<ColorType>(color_type);
     if (color == ColorType::RGB)
@@ -37,9 +72,16 @@ MNNSR::MNNSR(int color_type) {
 }
 
 MNNSR::~MNNSR() {
-    MNN::Tensor::destroy(input_tensor);
-    MNN::Tensor::destroy(output_tensor);
-    interpreter->releaseSession(session);
+    for (size_t i = 0; i < sessions.size(); i++) {
+        MNN::Tensor::destroy(sessions[i].input_tensor);
+        MNN::Tensor::destroy(sessions[i].output_tensor);
+        interpreter->releaseSession(sessions[i].session);
+    }
+    if (tile_tensor)
+        MNN::Tensor::destroy(tile_tensor);
+    // nothing was loaded
+    if (!interpreter)
+        return;
     interpreter->releaseModel();
     MNN::Interpreter::destroy(interpreter);
 }
@@ -72,6 +114,8 @@ int MNNSR::load(const std::string &modelpath, bool cachemodel)
     int num_threads = std::thread::hardware_concurrency();
     if (num_threads < 1)
         num_threads = 2;
+    // the runs of the sessions take turns on the interpreter, each one gets every cpu thread
+    // on the gpu backends numThread is a mode mask and has to stay as is
     config.numThread = num_threads;
 
     fprintf(stderr, "set backend: %s, color type: %s\n", get_backend_name(config.type).c_str(), colorTypeToStr(color));
@@ -79,14 +123,16 @@ int MNNSR::load(const std::string &modelpath, bool cachemodel)
     const auto start = std::chrono::high_resolution_clock::now();
 
 #if _WIN32
-    interpreter = MNN::Interpreter::createFromFile(std::wstring_convert<std::codecvt_utf8<wchar_t>>().to_bytes(modelpath).c_str());
+    const std::string modelfile = std::wstring_convert<std::codecvt_utf8<wchar_t>>().to_bytes(modelpath);
 #else
-    interpreter = MNN::Interpreter::createFromFile((modelpath).c_str());
+    const std::string modelfile = modelpath;
 #endif
+    interpreter = MNN::Interpreter::createFromFile(modelfile.c_str());
 
 
     if (interpreter == nullptr) {
         fprintf(stderr, "interpreter null\n");
+        return -1;
     }
 
     this->cachemodel = cachemodel;
@@ -95,39 +141,56 @@ int MNNSR::load(const std::string &modelpath, bool cachemodel)
         interpreter->setCacheFile(cachefile.c_str());
     }
 
-    session = interpreter->createSession(config);
-    if (session == nullptr) {
-        fprintf(stderr, "session null\n");
-    }
+    // the sessions share the weights of the one interpreter, each has its own input and output tensors
+    // runSession locks the interpreter, the copies and the tile filling and placing of the others overlap the run
+    sessions.resize(session_count);
+    for (int i = 0; i < session_count; i++) {
+        MNNSRSession &slot = sessions[i];
+        slot.interpreter = interpreter;
+        slot.session = slot.interpreter->createSession(config);
+        if (slot.session == nullptr) {
+            fprintf(stderr, "session null\n");
+            return -1;
+        }
 
 
-    interpreter_input = interpreter->getSessionInput(session, nullptr);
+        slot.interpreter_input = slot.interpreter->getSessionInput(slot.session, nullptr);
 //    fprintf(stderr, "model input tensor(b/c/h/w): %d/%d/%d/%d -> 1/%d/%d/%d\n"
 //            , input_tensor->batch(), input_tensor->channel(), input_tensor->height(), input_tensor->width()
 //            ,model_channel, tilesize, tilesize
 //            );
-    interpreter->resizeTensor(interpreter_input, 1, model_channel, tilesize, tilesize);
-    interpreter->resizeSession(session);
-    interpreter_output = interpreter->getSessionOutput(session, nullptr);
+        // several tiles run as one batch
+        slot.interpreter->resizeTensor(slot.interpreter_input, batch, model_channel, tilesize, tilesize);
+        slot.interpreter->resizeSession(slot.session);
+        slot.interpreter_output = slot.interpreter->getSessionOutput(slot.session, nullptr);
+
+        slot.input_tensor = new MNN::Tensor(slot.interpreter_input, MNN::Tensor::CAFFE);
+        slot.output_tensor = new MNN::Tensor(slot.interpreter_output, MNN::Tensor::CAFFE);
+    }
 
-    input_tensor = new MNN::Tensor(interpreter_input, MNN::Tensor::CAFFE);
-    output_tensor = new MNN::Tensor(interpreter_output, MNN::Tensor::CAFFE);
+    // 转换为目标颜色空间, the row kernel is picked here once for the model output
+    const int output_channels = sessions[0].output_tensor->channel();
+    if (output_channels != 1 && color == YCbCr)
+        ycc_row = bgr_to_ycc_row<true>;
+    else if (output_channels != 1 && color == YUV)
+        ycc_row = bgr_to_ycc_row<false>;
 
-    input_buffer = input_tensor->host<float>();
-    output_buffer = output_tensor->host<float>();
+    // tiles are converted one at a time, then copied into their slot of the batch
+    if (batch > 1)
+        tile_tensor = MNN::Tensor::create<float>(std::vector<int>{1, model_channel, tilesize, tilesize}, nullptr, MNN::Tensor::CAFFE);
 
     float memoryUsage = 0.0f;
-    interpreter->getSessionInfo(session, MNN::Interpreter::MEMORY, &memoryUsage);
+    interpreter->getSessionInfo(sessions[0].session, MNN::Interpreter::MEMORY, &memoryUsage);
     float flops = 0.0f;
-    interpreter->getSessionInfo(session, MNN::Interpreter::FLOPS, &flops);
+    interpreter->getSessionInfo(sessions[0].session, MNN::Interpreter::FLOPS, &flops);
     MNNForwardType backendType[2];
-    interpreter->getSessionInfo(session, MNN::Interpreter::BACKENDS, backendType);
+    interpreter->getSessionInfo(sessions[0].session, MNN::Interpreter::BACKENDS, backendType);
 
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
             std::chrono::high_resolution_clock::now() - start);
-    fprintf(stderr, "load model %.3f s, session memory %sB, flops %s, ",
+    fprintf(stderr, "load model %.3f s, session memory %sB x %d, flops %s, ",
             static_cast<double>(duration.count()) / 1000, float2str(memoryUsage, 6).c_str(),
-            float2str(flops, 6).c_str());
+            session_count, float2str(flops, 6).c_str());
 
     if (backendType[0] == MNN_FORWARD_CPU)
         fprintf(stderr, "backend: CPU, numThread=%d\n", config.numThread);
@@ -139,52 +202,42 @@ int MNNSR::load(const std::string &modelpath, bool cachemodel)
 }
 
 
-cv::Mat MNNSR::TensorToCvMat(void) {
-    interpreter_output->copyToHostTensor(output_tensor);
-    int C = output_tensor->channel();
-    int H = output_tensor->height();
-    int W = output_tensor->width();
-    float *data = output_tensor->host<float>();
-
-    cv::Mat result;
-    if (C == 1) {
-        // 灰度模式直接处理
-        cv::Mat gray = cv::Mat(H, W, CV_32FC1, data);
-        gray.convertTo(gray, CV_8UC1, 255.0);
-        cv::cvtColor(gray, result, cv::COLOR_GRAY2BGR);
-        return result;
-    } else {
-        // 处理彩色图像
-        std::vector<cv::Mat> channels;
-        for (int i = 0; i < C; i++) {
-            channels.emplace_back(H, W, CV_32FC1, data + i * H * W);
-        }
+// tensor has to be copied back from the session before
+// writes the cropped tile of batch slot index straight into the rows of outimage
+int MNNSR::TensorToImage(const MNN::Tensor *tensor, int index, const MNNSRTile &tile, cv::Mat &outimage) {
+    int C = tensor->channel();
+    int H = tensor->height();
+    int W = tensor->width();
+
+    if (W != tilesize * scale || H != tilesize * scale) {
+        fprintf(stderr,
+                "[err] The model is x%.2f not x%d. input tile: %d x %d, output tile: %d x %d.\n",
+                sqrt(W * H / tilesize / tilesize),
+                scale,
+                tilesize, tilesize, W, H);
+        return -1;
+    }
 
-        // 合并通道（注意OpenCV默认是BGR顺序）
-        if (color ==  RGB) {
-            // 如果是RGB输入，需要交换R和B通道
-            std::swap(channels[0], channels[2]); // RGB -> BGR
-            cv::merge(channels, result);
-        } else {
-            // 先合并为RGB格式
-            cv::Mat rgb;
-            cv::merge(channels, rgb);
-            rgb.convertTo(rgb, CV_8UC3, 255.0);
-
-            // 转换为目标颜色空间
-            if (color == YCbCr) {
-                cv::cvtColor(rgb, result, cv::COLOR_BGR2YCrCb);
-            } else if (color == YUV) {
-                cv::cvtColor(rgb, result, cv::COLOR_BGR2YUV);
-            }
-            return result;
-        }
+    const float *data = tensor->host<float>() + (size_t) index * C * H * W;
+    const float *c0 = data;
+    const float *c1 = C == 1 ? data : data + (size_t) H * W;
+    const float *c2 = C == 1 ? data : data + (size_t) 2 * H * W;
+
+    // 合并通道（注意OpenCV默认是BGR顺序），RGB输入需要交换R和B通道
+    if (color == RGB)
+        std::swap(c0, c2);
+
+    for (int i = 0; i < tile.out_tile_h; i++) {
+        const size_t offset = (size_t) (tile.out_tile_y0 + i) * W + tile.out_tile_x0;
+        unsigned char *p = outimage.ptr<unsigned char>(tile.out_y0 + i) + tile.out_x0 * 3;
 
-        // 转换为8位
-        result.convertTo(result, CV_8UC3, 255.0);
+        tile_pack_row<3>(c0 + offset, c1 + offset, c2 + offset, 0, tile.out_tile_w, 255.f, p);
+
+        if (ycc_row)
+            ycc_row(p, tile.out_tile_w);
     }
 
-    return result;
+    return 0;
 }
 
 int MNNSR::process(const cv::Mat &inimage, cv::Mat &outimage) {
@@ -194,82 +247,47 @@ int MNNSR::process(const cv::Mat &inimage, cv::Mat &outimage) {
     int outWidth = inWidth * scale;
     int outHeight = inHeight * scale;
 
-    // 每个tile的有效大小
-    int tileWidth = tilesize - prepadding * 2;
-    int tileHeight = tilesize - prepadding * 2;
-
+    // the model input is fixed at tilesize, the windows are spread so every tile keeps prepadding of context
+    std::vector<int> xorigins, xcores, yorigins, ycores;
+    tile_plan_windows(inWidth, tilesize, prepadding, xorigins, xcores);
+    tile_plan_windows(inHeight, tilesize, prepadding, yorigins, ycores);
 
-    int xtiles = (inWidth + tileWidth - 1) / tileWidth;
-    int ytiles = (inHeight + tileHeight - 1) / tileHeight;
-
-
-    int xPrepadding = prepadding, yPrepadding = prepadding;
-
-    int left = inWidth % tileWidth;
-    if (left > 0) {
-        if (left < prepadding) {
-            // 倒数第2个tile的prepadding已经包含了推理结果
-            xtiles--;
-        } else {
-            if (left / 2 <= prepadding)
-                xtiles--;
-            // xtiles * (tilesize - 2 * xPrepadding) + xPrepadding = inWidth
-            xPrepadding = (xtiles * tilesize - inWidth) / (2 * xtiles - 1);
-            tileWidth = tilesize - xPrepadding * 2;
-        }
-    }
-    left = inHeight % tileHeight;
-    if (left > 0) {
-        if (left < prepadding) {
-            // 倒数第2个tile的prepadding已经包含了推理结果
-            ytiles--;
-        } else {
-            if (left / 2 <= prepadding)
-                ytiles--;
-            // ytiles * (tilesize - 2 * yPrepadding) + yPrepadding = inHeight
-            yPrepadding = (ytiles * tilesize - inHeight) / (2 * ytiles - 1);
-            tileHeight = tilesize - yPrepadding * 2;
-        }
-    }
+    const int xtiles = (int) xorigins.size();
+    const int ytiles = (int) yorigins.size();
 
-    fprintf(stderr,
-            "process tiles: %d x %d, tilesize: %d -> %d %d, prepadding: %d -> %d %d\n",
-            xtiles, ytiles, tilesize, tileWidth, tileHeight, prepadding, xPrepadding, yPrepadding);
+    fprintf(stderr, "process tiles: %d x %d, tilesize: %d, prepadding: %d\n",
+            xtiles, ytiles, tilesize, prepadding);
 
     high_resolution_clock::time_point begin = high_resolution_clock::now();
     high_resolution_clock::time_point time_print_progress;
 
 //    cv::Mat imageOut(outHeight, outWidth, inimage.type()); // 填充灰色背景
 
-    for (uint yi = 0; yi < ytiles; yi++) {
-        // 从inimage中裁剪出含padding的tile （但是四边的tile需要再次padding）
-        int in_tile_y0 = (yi * tileHeight - yPrepadding);
-        if (in_tile_y0 < 0)
-            in_tile_y0 = 0;
-        int in_tile_y1 = (yi + 1) * tileHeight + yPrepadding;
-        if (in_tile_y1 > inHeight)
-            in_tile_y1 = inHeight;
+    // batches go round the sessions, one is placed and refilled while the others run
+    size_t current = 0;
+    const size_t tile_floats = (size_t) model_channel * tilesize * tilesize;
+
+    for (int yi = 0; yi < ytiles; yi++) {
+        // 从inimage中裁剪出含padding的tile （图像比tile小时需要再次padding）
+        int in_tile_y0 = yorigins[yi];
+        int in_tile_y1 = std::min(in_tile_y0 + tilesize, inHeight);
         // 从tile推理结果去除padding部分
-        int out_tile_y0 = scale * yPrepadding;
+        int out_tile_y0 = scale * (ycores[yi] - in_tile_y0);
 
         // 绘制到outimage的位置
-        int out_y0 = yi * tileHeight * scale;
-        int out_tile_h = (yi + 1 == ytiles) ? inHeight * scale - out_y0 : tileHeight * scale;
-
-        for (uint xi = 0; xi < xtiles; xi++) {
-            // 从inimage中裁剪出含padding的tile （但是四边的tile需要再次padding）
-            int in_tile_x0 = (xi * tileWidth - xPrepadding);
-            if (in_tile_x0 < 0)
-                in_tile_x0 = 0;
-            int in_tile_x1 = ((xi + 1) * tileWidth + xPrepadding);
-            if (in_tile_x1 > inWidth)
-                in_tile_x1 = inWidth;
+        int out_y0 = ycores[yi] * scale;
+        int out_tile_h = (ycores[yi + 1] - ycores[yi]) * scale;
+
+        for (int xi = 0; xi < xtiles; xi++) {
+            // 从inimage中裁剪出含padding的tile （图像比tile小时需要再次padding）
+            int in_tile_x0 = xorigins[xi];
+            int in_tile_x1 = std::min(in_tile_x0 + tilesize, inWidth);
             // 从tile推理结果去除padding部分
-            int out_tile_x0 = scale * xPrepadding;
+            int out_tile_x0 = scale * (xcores[xi] - in_tile_x0);
 
             // 绘制到outimage的位置
-            int out_x0 = xi * tileWidth * scale;
-            int out_tile_w = (xi + 1 == xtiles) ? inWidth * scale - out_x0 : tileWidth * scale;
+            int out_x0 = xcores[xi] * scale;
+            int out_tile_w = (xcores[xi + 1] - xcores[xi]) * scale;
 
 //            fprintf(stderr, "\nprocess y=%d, x=%d inputTile: x0=%d y0=%d x1=%d y1=%d w=%d h=%d\n",
 //                    yi, xi,
@@ -283,62 +301,67 @@ int MNNSR::process(const cv::Mat &inimage, cv::Mat &outimage) {
 //                    inputTile.cols, inputTile.rows, inputTile.channels());
             cv::Mat paddedTile;
             if (inputTile.cols < tilesize || inputTile.rows < tilesize) {
-                int t = (yi == 0) ? yPrepadding : 0;
-                int b = tilesize + in_tile_y0 - in_tile_y1 - t;
-                int l = (xi == 0) ? xPrepadding : 0;
-                int r = tilesize + in_tile_x0 - in_tile_x1 - l;
+                int t = 0;
+                int b = tilesize + in_tile_y0 - in_tile_y1;
+                int l = 0;
+                int r = tilesize + in_tile_x0 - in_tile_x1;
 
 //                fprintf(stderr, "process y=%d, x=%d copyMakeBorder %d %d %d %d\n", yi, xi, t, b, l,
 //                        r);
 //                cv::Mat paddedTile;
                 cv::copyMakeBorder(inputTile, paddedTile, t, b, l, r, cv::BORDER_CONSTANT);
-
-                pretreat_->convert(paddedTile.data, paddedTile.cols, paddedTile.rows,
-                                   paddedTile.cols * paddedTile.channels(),
-                                   input_tensor);
-
             } else {
 //                cv::Mat paddedTile;
                 cv::copyMakeBorder(inputTile, paddedTile, 0, 0, 0, 0, cv::BORDER_CONSTANT);
+            }
 
+            MNNSRSession &slot = sessions[current];
+            if (slot.thread && place(slot, outimage) != 0) {
+                for (size_t i = 0; i < sessions.size(); i++) {
+                    if (sessions[i].thread)
+                        place(sessions[i], outimage);
+                }
+                return -1;
+            }
+
+            if (batch == 1) {
                 pretreat_->convert(paddedTile.data, paddedTile.cols, paddedTile.rows,
                                    paddedTile.cols * paddedTile.channels(),
-                                   input_tensor);
+                                   slot.input_tensor);
+            } else {
+                pretreat_->convert(paddedTile.data, paddedTile.cols, paddedTile.rows,
+                                   paddedTile.cols * paddedTile.channels(),
+                                   tile_tensor);
+                memcpy(slot.input_tensor->host<float>() + slot.pending.size() * tile_floats,
+                       tile_tensor->host<float>(), tile_floats * sizeof(float));
             }
 
-            bool r = interpreter_input->copyFromHostTensor(input_tensor);
+            MNNSRTile tile;
+            tile.out_x0 = out_x0;
+            tile.out_y0 = out_y0;
+            tile.out_tile_x0 = out_tile_x0;
+            tile.out_tile_y0 = out_tile_y0;
+            tile.out_tile_w = out_tile_w;
+            tile.out_tile_h = out_tile_h;
+            slot.pending.push_back(tile);
 
-            interpreter->runSession(session);
-            cv::Mat outputTile = TensorToCvMat();
+            // the last batch of the image runs part full
+            const bool last = yi + 1 == ytiles && xi + 1 == xtiles;
+            if ((int) slot.pending.size() < batch && !last)
+                continue;
 
-            if (outputTile.cols != tilesize * scale || outputTile.rows != tilesize * scale) {
-                fprintf(stderr,
-                        "[err] The model is x%.2f not x%d. input tile: %d x %d, output tile: %d x %d.\n",
-                        sqrt(outputTile.cols * outputTile.rows / paddedTile.cols / paddedTile.rows),
-                        scale,
-                        paddedTile.cols, paddedTile.rows, outputTile.cols, outputTile.rows);
-                return -1;
-            }
-
-//            fprintf(stderr,
-//                    "croppe outputTile from x0=%d, y0=%d, x1=%d, y1=%d, %d x %d\n",
-//                    out_tile_x0, out_tile_y0, out_tile_x0 + out_tile_w, out_tile_y0 + out_tile_h,
-//                    outputTile.cols, outputTile.rows);
-            cv::Rect cropRect(out_tile_x0, out_tile_y0, out_tile_w, out_tile_h);
-            cv::Mat croppedTile = outputTile(cropRect);
-
-//            fprintf(stderr,
-//                    "cropped to outimage to x0=%d, y0=%d, x1=%d, y1=%d, %d x %d\n",
-//                    out_x0, out_y0, out_x0 + croppedTile.cols, out_y0 + croppedTile.rows,
-//                    croppedTile.cols, croppedTile.rows);
-            croppedTile.copyTo(
-                    outimage(cv::Rect(out_x0, out_y0, croppedTile.cols, croppedTile.rows)));
+            slot.thread = new ncnn::Thread(run_session, (void *) &slot);
+            current = (current + 1) % sessions.size();
 
+            float progress_tile = (float) (yi * xtiles + xi + 1);
+            if (progress_callback) {
+                progress_callback(progress_userdata, progress_tile / (ytiles * xtiles));
+                continue;
+            }
 
             high_resolution_clock::time_point end = high_resolution_clock::now();
             float time_span_print_progress = duration_cast<duration<double>>(
                     end - time_print_progress).count();
-            float progress_tile = (float) (yi * xtiles + xi + 1);
             if (time_span_print_progress > 0.5 || (yi + 1 == ytiles && xi + 3 > xtiles)) {
                 double progress = progress_tile / (ytiles * xtiles);
                 double time_span = duration_cast<duration<double>>(end - begin).count();
@@ -350,6 +373,14 @@ int MNNSR::process(const cv::Mat &inimage, cv::Mat &outimage) {
         }
     }
 
+    int ret = 0;
+    for (size_t i = 0; i < sessions.size(); i++) {
+        if (sessions[i].thread && place(sessions[i], outimage) != 0)
+            ret = -1;
+    }
+    if (ret != 0)
+        return ret;
+
     if (color == Gray2YUV) {
         // 把inimage转为YCbCr格式，放大scale倍，把通道2通道3复制给outimage的通道2通道3
         cv::Mat yuv;
@@ -372,6 +403,21 @@ int MNNSR::process(const cv::Mat &inimage, cv::Mat &outimage) {
 
 
     if (cachemodel)
-        interpreter->updateCacheFile(session);
+        interpreter->updateCacheFile(sessions[0].session);
     return 0;
+}
+
+// wait for the run of the session and copy its tiles into outimage
+int MNNSR::place(MNNSRSession &slot, cv::Mat &outimage) {
+    slot.thread->join();
+    delete slot.thread;
+    slot.thread = nullptr;
+
+    int ret = 0;
+    for (size_t k = 0; k < slot.pending.size() && ret == 0; k++) {
+        ret = TensorToImage(slot.output_tensor, (int) k, slot.pending[k], outimage);
+    }
+
+    slot.pending.clear();
+    return ret;
 }
\ No newline at end of file
@@ -15,9 +15,37 @@
 #include "MNN/Interpreter.hpp"
 #include "MNN/ImageProcess.hpp"
 #include "utils.hpp"
+#include "tile_progress.h"
 
 using namespace std::chrono;
 
+// where a tile of the batch lands in the output
+class MNNSRTile {
+public:
+    int out_x0;
+    int out_y0;
+    int out_tile_x0;
+    int out_tile_y0;
+    int out_tile_w;
+    int out_tile_h;
+};
+
+// one session with its own host tensors, runs on its own thread while the others are filled
+class MNNSRSession {
+public:
+    MNN::Session *session = nullptr;
+    MNN::Tensor *interpreter_input = nullptr;
+    MNN::Tensor *interpreter_output = nullptr;
+    MNN::Tensor *input_tensor = nullptr;
+    MNN::Tensor *output_tensor = nullptr;
+
+    // tiles in the running batch, placed once the run is done
+    std::vector<MNNSRTile> pending;
+    ncnn::Thread *thread = nullptr;
+    // the interpreter of the engine, shared by every session
+    MNN::Interpreter *interpreter = nullptr;
+};
+
 class MNNSR {
 public:
     MNNSR(int color_type);
@@ -33,7 +61,7 @@ public:
 #endif
 
     int process(const cv::Mat &inimage, cv::Mat &outimage);
-    cv::Mat TensorToCvMat(void);
+    int TensorToImage(const MNN::Tensor *tensor, int index, const MNNSRTile &tile, cv::Mat &outimage);
 
 public:
     int scale;
@@ -41,18 +69,23 @@ public:
     int model_channel =3;
     int tilesize;
     int prepadding;
+    // tiles per session run, set before load
+    int batch = 1;
+    // sessions in flight, set before load
+    int session_count = 1;
+    // per submitted batch, the stderr progress is printed only when unset
+    tile_progress_callback progress_callback = nullptr;
+    void *progress_userdata = nullptr;
 
-    float *input_buffer;
-    float *output_buffer;
     MNNForwardType backend_type;
 
 private:
-    MNN::Interpreter *interpreter;
-    MNN::Session *session;
-    MNN::Tensor *interpreter_input;
-    MNN::Tensor *interpreter_output;
-    MNN::Tensor *input_tensor;
-    MNN::Tensor *output_tensor;
+    MNN::Interpreter *interpreter = nullptr;
+    std::vector<MNNSRSession> sessions;
+    MNN::Tensor *tile_tensor = nullptr;
+    int place(MNNSRSession &slot, cv::Mat &outimage);
+    // in place on the bgr output rows for the ycc color types, null for the others
+    void (*ycc_row)(unsigned char *p, int n) = nullptr;
     std::shared_ptr<MNN::CV::ImageProcess> pretreat_ = nullptr;
     const float meanVals_[3] = {0, 0, 0};
     const float normVals_[3] = { 1.0 / 255, 1.0 / 255, 1.0 / 255 };
@@ -0,0 +1,203 @@
+// c api of the mnn engine
+
+#define MNNSR_C_BUILD
+#include "mnnsr_c.h"
+
+#include "mnnsr.h"
+
+#include "engine_c.h"
+
+// what engine_c.h runs, the ncnn::Mat of a job wraps the caller rows and goes to the engine as bgr cv::Mat
+class MNNSRC {
+public:
+    MNNSRC(int color_type) : mnnsr(new MNNSR(color_type)), scale(1), input_bgr(false), output_bgr(false) {
+    }
+
+    ~MNNSRC() {
+        delete mnnsr;
+    }
+
+    int process(const ncnn::Mat &inimage, ncnn::Mat &outimage) const;
+
+public:
+    MNNSR *mnnsr;
+    int scale;
+    bool input_bgr;
+    bool output_bgr;
+
+private:
+    // the engine keeps its sessions in its members, process and submit take turns
+    mutable ncnn::Mutex lock;
+};
+
+int MNNSRC::process(const ncnn::Mat &inimage, ncnn::Mat &outimage) const {
+    const int channels = inimage.elempack;
+    const cv::Mat src(inimage.h, inimage.w, CV_8UC(channels), inimage.data);
+    cv::Mat dst(outimage.h, outimage.w, CV_8UC(channels), outimage.data);
+
+    // the alpha is kept aside and scaled back in, as the cli does
+    cv::Mat in;
+    cv::Mat inalpha;
+    if (channels == 4) {
+        cv::cvtColor(src, in, input_bgr ? cv::COLOR_BGRA2BGR : cv::COLOR_RGBA2BGR);
+        cv::extractChannel(src, inalpha, 3);
+    } else if (input_bgr) {
+        in = src;
+    } else {
+        cv::cvtColor(src, in, cv::COLOR_RGB2BGR);
+    }
+
+    // bgr rows go straight to dst
+    cv::Mat out;
+    if (channels == 3 && output_bgr)
+        out = dst;
+    else
+        out = cv::Mat(dst.rows, dst.cols, CV_8UC3);
+
+    lock.lock();
+    int ret = mnnsr->process(in, out);
+    lock.unlock();
+    if (ret != 0)
+        return ret;
+
+    if (channels == 4) {
+        cv::cvtColor(out, dst, output_bgr ? cv::COLOR_BGR2BGRA : cv::COLOR_BGR2RGBA);
+        cv::Mat outalpha;
+        cv::resize(inalpha, outalpha, dst.size(), 0, 0, cv::INTER_LINEAR);
+        cv::insertChannel(outalpha, dst, 3);
+    } else if (!output_bgr) {
+        cv::cvtColor(out, dst, cv::COLOR_BGR2RGB);
+    }
+
+    return 0;
+}
+
+typedef EngineCInstance<MNNSRC, mnnsr_error, mnnsr_callback> MNNSRInstance;
+
+static_assert(MNNSR_ERROR_PROCESS == (int) ENGINE_C_ERROR_PROCESS, "mnnsr_error follows the engine_c.h order");
+
+void MNNSR_C_API mnnsr_default_parameters(mnnsr_parameters *parameters) {
+    if (!parameters)
+        return;
+
+    parameters->backend_type = MNN_FORWARD_OPENCL;
+    parameters->color_type = RGB;
+    parameters->scale = 4;
+    parameters->tilesize = 0;
+    parameters->prepadding = 4;
+    parameters->batch = 1;
+    parameters->session_count = 2;
+    parameters->input_bgr = 0;
+    parameters->output_bgr = 0;
+}
+
+mnnsr_instance MNNSR_C_API mnnsr_create(const mnnsr_parameters *parameters, mnnsr_error *error) {
+    mnnsr_error dummy;
+    if (!error)
+        error = &dummy;
+
+    if (!parameters) {
+        *error = MNNSR_ERROR_NULL_DATA;
+        return 0;
+    }
+
+    // the color types the engine has a pretreat for, it exits on the others
+    const int color_type = parameters->color_type;
+    const bool color_known = color_type == RGB || color_type == YCbCr || color_type == YUV
+                             || color_type == GRAY || color_type == Gray2YCbCr || color_type == Gray2YUV;
+
+    if (!color_known || parameters->backend_type < 0 || parameters->backend_type > 14
+        || parameters->scale < 1 || parameters->prepadding < 0 || parameters->batch < 1
+        || parameters->session_count < 1 || (parameters->tilesize != 0 && parameters->tilesize < 64)) {
+        *error = MNNSR_ERROR_INVALID_PARAMETERS;
+        return 0;
+    }
+
+    MNNSRInstance *instance = new MNNSRInstance(new MNNSRC(color_type), false);
+
+    MNNSRC *engine = instance->engine;
+    engine->scale = parameters->scale;
+    engine->input_bgr = parameters->input_bgr != 0;
+    engine->output_bgr = parameters->output_bgr != 0;
+
+    MNNSR *mnnsr = engine->mnnsr;
+    mnnsr->backend_type = static_cast<MNNForwardType>(parameters->backend_type);
+    mnnsr->scale = parameters->scale;
+    // 0 is resolved by load
+    mnnsr->tilesize = parameters->tilesize;
+    mnnsr->prepadding = parameters->prepadding;
+    mnnsr->batch = parameters->batch;
+    mnnsr->session_count = parameters->session_count;
+    // the engine prints tile progress to stderr without a callback, keep the host quiet
+    mnnsr->progress_callback = tile_progress_ignore;
+
+    *error = MNNSR_OK;
+    return instance;
+}
+
+void MNNSR_C_API mnnsr_destroy(mnnsr_instance instance) {
+    engine_c_destroy((MNNSRInstance *) instance);
+}
+
+mnnsr_error MNNSR_C_API mnnsr_load(mnnsr_instance instance, const char *modelpath) {
+    MNNSRInstance *engine_instance = (MNNSRInstance *) instance;
+    if (!engine_instance)
+        return MNNSR_ERROR_NULL_INSTANCE;
+
+    if (!modelpath)
+        return MNNSR_ERROR_NULL_DATA;
+
+    // the sessions are sized for the tiles once, a second model needs another instance
+    if (engine_instance->loaded)
+        return MNNSR_ERROR_INVALID_PARAMETERS;
+
+    const auto path = engine_c_path_from_utf8(modelpath);
+
+    // the size in MB picks the tile and the cache, as the cli does
+#if _WIN32
+    FILE *mp = _wfopen(path.c_str(), L"rb");
+#else
+    FILE *mp = fopen(path.c_str(), "rb");
+#endif
+    if (!mp)
+        return MNNSR_ERROR_LOAD_MODEL;
+    fseek(mp, 0, SEEK_END);
+    const long modelsize = ftell(mp) / 1000000;
+    fclose(mp);
+
+    MNNSR *mnnsr = engine_instance->engine->mnnsr;
+    if (mnnsr->tilesize == 0) {
+        // larger models take smaller tiles
+        if (modelsize < 10)
+            mnnsr->tilesize = 256;
+        else if (modelsize < 16)
+            mnnsr->tilesize = 128;
+        else if (modelsize < 24)
+            mnnsr->tilesize = 96;
+        else
+            mnnsr->tilesize = 64;
+    }
+
+    if (mnnsr->load(path, modelsize > 10) != 0)
+        return MNNSR_ERROR_LOAD_MODEL;
+
+    engine_instance->loaded = true;
+    return MNNSR_OK;
+}
+
+mnnsr_error MNNSR_C_API mnnsr_process(mnnsr_instance instance,
+                                      const unsigned char *src, int w, int h, int channels, size_t src_stride,
+                                      unsigned char *dst, size_t dst_stride) {
+    return (mnnsr_error) engine_c_process((const MNNSRInstance *) instance, src, w, h, channels, src_stride, dst, dst_stride);
+}
+
+mnnsr_error MNNSR_C_API mnnsr_submit(mnnsr_instance instance,
+                                     const unsigned char *src, int w, int h, int channels, size_t src_stride,
+                                     unsigned char *dst, size_t dst_stride,
+                                     mnnsr_callback callback, void *userdata) {
+    return (mnnsr_error) engine_c_submit((MNNSRInstance *) instance, src, w, h, channels, src_stride, dst, dst_stride, callback, userdata);
+}
+
+void MNNSR_C_API mnnsr_wait(mnnsr_instance instance) {
+    engine_c_wait((MNNSRInstance *) instance);
+}
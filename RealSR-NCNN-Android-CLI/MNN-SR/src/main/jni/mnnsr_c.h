@@ -0,0 +1,91 @@
+// c api of the mnn engine, for host apps that keep models loaded and hand over pixels directly
+
+#ifndef MNNSR_C_H
+#define MNNSR_C_H
+
+#include <stddef.h>
+
+#ifdef _WIN32
+#ifdef MNNSR_C_BUILD
+#define MNNSR_C_EXPORT __declspec(dllexport)
+#else
+#define MNNSR_C_EXPORT __declspec(dllimport)
+#endif
+#define MNNSR_C_API __stdcall
+#else
+#define MNNSR_C_EXPORT __attribute__((visibility("default")))
+#define MNNSR_C_API
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+    typedef enum mnnsr_error
+    {
+        MNNSR_OK = 0,
+        MNNSR_ERROR_NULL_INSTANCE,
+        MNNSR_ERROR_NULL_DATA,
+        MNNSR_ERROR_INVALID_PARAMETERS,
+        MNNSR_ERROR_LOAD_MODEL,
+        MNNSR_ERROR_NOT_LOADED,
+        MNNSR_ERROR_PROCESS
+    } mnnsr_error;
+
+    typedef struct mnnsr_parameters
+    {
+        // MNNForwardType, 0 cpu, 3 opencl, 7 vulkan
+        int backend_type;
+        // ColorType of utils.hpp the model was trained in, 1 rgb, 5 ycbcr, 6 yuv, 10 gray, 11 gray2ycbcr, 12 gray2yuv
+        int color_type;
+        // the x of the model file
+        int scale;
+        // >= 64, or 0 to pick one from the size of the model file at load
+        int tilesize;
+        int prepadding;
+        // tiles per session run
+        int batch;
+        // sessions in flight
+        int session_count;
+        // src in bgr(a) order, rgb(a) otherwise
+        int input_bgr;
+        // dst in bgr(a) order, rgb(a) otherwise
+        int output_bgr;
+    } mnnsr_parameters;
+
+    typedef void* mnnsr_instance;
+
+    // runs on the worker thread of the instance once a submitted job is done
+    typedef void (*mnnsr_callback)(void* userdata, mnnsr_error error);
+
+    MNNSR_C_EXPORT void MNNSR_C_API mnnsr_default_parameters(mnnsr_parameters* parameters);
+
+    MNNSR_C_EXPORT mnnsr_instance MNNSR_C_API mnnsr_create(const mnnsr_parameters* parameters, mnnsr_error* error);
+    MNNSR_C_EXPORT void MNNSR_C_API mnnsr_destroy(mnnsr_instance instance);
+
+    // utf-8 path of the .mnn file, a model over 10 MB keeps a .cache file next to it as the cli does
+    MNNSR_C_EXPORT mnnsr_error MNNSR_C_API mnnsr_load(mnnsr_instance instance, const char* modelpath);
+
+    // src is w x h with channels 3 or 4, in the order of input_bgr
+    // dst is w * scale x h * scale with the same channels, both owned by the caller
+    // a stride of 0 means packed rows, packed rows are used in place and others are repacked
+    // the alpha of 4 channel images is scaled apart from the model, as the cli does
+    MNNSR_C_EXPORT mnnsr_error MNNSR_C_API mnnsr_process(mnnsr_instance instance,
+        const unsigned char* src, int w, int h, int channels, size_t src_stride,
+        unsigned char* dst, size_t dst_stride);
+
+    // queues the same work and returns, src and dst must stay valid until callback
+    MNNSR_C_EXPORT mnnsr_error MNNSR_C_API mnnsr_submit(mnnsr_instance instance,
+        const unsigned char* src, int w, int h, int channels, size_t src_stride,
+        unsigned char* dst, size_t dst_stride,
+        mnnsr_callback callback, void* userdata);
+
+    // blocks until every submitted job has called back
+    MNNSR_C_EXPORT void MNNSR_C_API mnnsr_wait(mnnsr_instance instance);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MNNSR_C_H
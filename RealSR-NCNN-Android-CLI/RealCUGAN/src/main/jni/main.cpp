@@ -2,6 +2,8 @@
 
 #include <stdio.h>
 #include <algorithm>
+#include <chrono>
+#include <iostream>
 #include <queue>
 #include <vector>
 #include <clocale>
@@ -97,6 +99,13 @@ static std::vector<int> parse_optarg_int_array(const char* optarg)
 #include "realcugan.h"
 
 #include "filesystem_utils.h"
+#include "image_loader.h"
+#include "json_line.h"
+#include "task_budget.h"
+#include "tile_autotune.h"
+#include "spirv_cache.h"
+#include "tile_split.h"
+#include "tile_stripe.h"
 #include <opencv2/opencv.hpp>
 #include <opencv2/core/hal/interface.h>
 using namespace cv;
@@ -112,11 +121,16 @@ static void print_usage()
     fprintf(stdout, "  -s scale             upscale ratio (1/2/3/4, default=2)\n");
     fprintf(stdout, "  -t tile-size         tile size (>=32/0=auto, default=0) can be 0,0,0 for multi-gpu\n");
     fprintf(stdout, "  -c syncgap-mode      sync gap mode (0/1/2/3, default=3)\n");
+    fprintf(stdout, "  -b syncgap-mb        gpu memory for syncgap features in MB, the rest spills to ram then disk (0=unlimited, default=0)\n");
     fprintf(stdout, "  -m model-path        realcugan model path (default=models-se)\n");
     fprintf(stdout, "  -g gpu-id            gpu device to use (-1=cpu, default=auto) can be 0,1,2 for multi-gpu\n");
     fprintf(stdout, "  -j load:proc:save    thread count for load/proc/save (default=1:2:2) can be 1:2,2,2:2 for multi-gpu\n");
     fprintf(stdout, "  -x                   enable tta mode\n");
+    fprintf(stdout, "  -a                   autotune tile-size for auto tiles and cache the result\n");
+    fprintf(stdout, "  -l                   stream large images in tile-row stripes (png output only)\n");
+    fprintf(stdout, "  -r memory-mb         memory ceiling for queued images in MB (0=quarter of ram, default=0)\n");
     fprintf(stdout, "  -f format            output image format (jpg/png/webp, default=ext/png)\n");
+    fprintf(stdout, "  -S                   serve json jobs from stdin, one per line, models stay loaded\n");
 }
 
 class Task
@@ -129,6 +143,9 @@ public:
     path_t inpath;
     path_t outpath;
 
+    // input and output bytes held against task_budget
+    size_t footprint;
+
     ncnn::Mat inimage;
     ncnn::Mat outimage;
 };
@@ -144,11 +161,7 @@ public:
     {
         lock.lock();
 
-        while (tasks.size() >= 8) // FIXME hardcode queue length
-        {
-            condition.wait(lock);
-        }
-
+        // no length limit, the loaders wait on task_budget instead
         tasks.push(v);
 
         lock.unlock();
@@ -181,6 +194,7 @@ private:
 
 TaskQueue toproc;
 TaskQueue tosave;
+TaskBudget task_budget;
 
 class LoadThreadParams
 {
@@ -211,66 +225,7 @@ void* load(void* args)
         int h;
         int c;
 
-#if _WIN32
-        FILE* fp = _wfopen(imagepath.c_str(), L"rb");
-#else
-        FILE* fp = fopen(imagepath.c_str(), "rb");
-#endif
-        if (fp)
-        {
-            // read whole file
-            unsigned char* filedata = 0;
-            int length = 0;
-            {
-                fseek(fp, 0, SEEK_END);
-                length = ftell(fp);
-                rewind(fp);
-                filedata = (unsigned char*)malloc(length);
-                if (filedata)
-                {
-                    fread(filedata, 1, length, fp);
-                }
-                fclose(fp);
-            }
-
-            if (filedata)
-            {
-                pixeldata = webp_load(filedata, length, &w, &h, &c);
-                if (pixeldata)
-                {
-                    webp = 1;
-                }
-                else
-                {
-                    // not webp, try jpg png etc.
-#if _WIN32
-                    pixeldata = wic_decode_image(imagepath.c_str(), &w, &h, &c);
-#else // _WIN32
-                    pixeldata = stbi_load_from_memory(filedata, length, &w, &h, &c, 0);
-                    if (pixeldata)
-                    {
-                        // stb_image auto channel
-                        if (c == 1)
-                        {
-                            // grayscale -> rgb
-                            stbi_image_free(pixeldata);
-                            pixeldata = stbi_load_from_memory(filedata, length, &w, &h, &c, 3);
-                            c = 3;
-                        }
-                        else if (c == 2)
-                        {
-                            // grayscale + alpha -> rgba
-                            stbi_image_free(pixeldata);
-                            pixeldata = stbi_load_from_memory(filedata, length, &w, &h, &c, 4);
-                            c = 4;
-                        }
-                    }
-#endif // _WIN32
-                }
-
-                free(filedata);
-            }
-        }
+        pixeldata = image_load(imagepath, &w, &h, &c, &webp);
         if (pixeldata)
         {
             Task v;
@@ -294,6 +249,10 @@ void* load(void* args)
 #endif // _WIN32
             }
 
+            // input and output pixels, held until the result is saved
+            v.footprint = (size_t)w * h * c * (1 + scale * scale);
+            task_budget.acquire(v.footprint);
+
             toproc.put(v);
         }
         else
@@ -313,12 +272,30 @@ class ProcThreadParams
 {
 public:
     const RealCUGAN* realcugan;
+
+    // when set, every image is split by tile rows across these instead
+    std::vector<const RealCUGAN*> split;
+
+    // whole image progress of a split, optional
+    tile_progress_callback progress;
+    void* progress_userdata;
+
+    ProcThreadParams() : realcugan(0), progress(0), progress_userdata(0)
+    {
+    }
 };
 
+static int process_image(const ProcThreadParams* ptp, const ncnn::Mat& inimage, ncnn::Mat& outimage)
+{
+    if (!ptp->split.empty())
+        return tile_split_process(ptp->split, inimage, outimage, ptp->progress, ptp->progress_userdata);
+
+    return ptp->realcugan->process(inimage, outimage);
+}
+
 void* proc(void* args)
 {
     const ProcThreadParams* ptp = (const ProcThreadParams*)args;
-    const RealCUGAN* realcugan = ptp->realcugan;
 
     for (;;)
     {
@@ -333,14 +310,14 @@ void* proc(void* args)
         if (scale == 1)
         {
             v.outimage = ncnn::Mat(v.inimage.w, v.inimage.h, (size_t)v.inimage.elemsize, (int)v.inimage.elemsize);
-            realcugan->process(v.inimage, v.outimage);
+            process_image(ptp, v.inimage, v.outimage);
 
             tosave.put(v);
             continue;
         }
 
         v.outimage = ncnn::Mat(v.inimage.w * scale, v.inimage.h * scale, (size_t)v.inimage.elemsize, (int)v.inimage.elemsize);
-        realcugan->process(v.inimage, v.outimage);
+        process_image(ptp, v.inimage, v.outimage);
 
         tosave.put(v);
     }
@@ -352,12 +329,115 @@ class SaveThreadParams
 {
 public:
     int verbose;
+    // outimage comes in bgr(a) order, imwrite takes it as is
+    int bgr;
 };
 
+// encodes one processed task and frees its input pixels, returns 0 on failure
+static int save_task(Task& v, const SaveThreadParams* stp)
+{
+    const int verbose = stp->verbose;
+    const int bgr = stp->bgr;
+
+    fprintf(stderr, "save result...\n");
+    float begin = clock();
+
+    // free input pixel data
+    {
+        unsigned char* pixeldata = (unsigned char*)v.inimage.data;
+        if (v.webp == 1)
+        {
+            free(pixeldata);
+        }
+        else
+        {
+#if _WIN32
+            free(pixeldata);
+#else
+            stbi_image_free(pixeldata);
+#endif
+        }
+    }
+
+    int success = 0;
+
+    path_t ext = get_file_extension(v.outpath);
+
+    if (ext != PATHSTR("gif")) {
+        // 使用opencv保存图片，速度比默认的stb更快
+        cv::Mat image;
+        switch (v.outimage.elempack) {
+            case 1:
+                image = cv::Mat( v.outimage.h, v.outimage.w, CV_8UC1, v.outimage.data); // 单通道图像
+                break;
+            case 3:
+                image = cv::Mat(v.outimage.h, v.outimage.w, CV_8UC3, v.outimage.data); // 3通道图像
+                if (!bgr)
+                    cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
+                break;
+            case 4:
+                image = cv::Mat(v.outimage.h, v.outimage.w, CV_8UC4, v.outimage.data); // 4通道图像
+                if (!bgr)
+                    cv::cvtColor(image, image, cv::COLOR_RGBA2BGRA);
+                break;
+        }
+        if (image.empty()) {
+            std::cerr << "Error: Image data not loaded." << std::endl;
+            success = false;
+        } else {
+            success = imwrite(v.outpath.c_str(), image);
+        }
+
+
+    }else if (ext == PATHSTR("webp") || ext == PATHSTR("WEBP"))
+    {
+        success = webp_save(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack, (const unsigned char*)v.outimage.data);
+    }
+    else if (ext == PATHSTR("png") || ext == PATHSTR("PNG"))
+    {
+#if _WIN32
+        success = wic_encode_image(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack, v.outimage.data);
+#else
+        success = stbi_write_png(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack, v.outimage.data, 0);
+#endif
+    }
+    else if (ext == PATHSTR("jpg") || ext == PATHSTR("JPG") || ext == PATHSTR("jpeg") || ext == PATHSTR("JPEG"))
+    {
+#if _WIN32
+        success = wic_encode_jpeg_image(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack, v.outimage.data);
+#else
+        success = stbi_write_jpg(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack, v.outimage.data, 100);
+#endif
+    }
+    if (success)
+    {
+        float end = clock();
+        fprintf(stderr, "save result use time: %.3lf\n", (end - begin) / CLOCKS_PER_SEC);
+
+        if (verbose)
+        {
+#if _WIN32
+            fwprintf(stdout, L"%ls -> %ls done\n", v.inpath.c_str(), v.outpath.c_str());
+#else
+            fprintf(stdout, "%s -> %s done\n", v.inpath.c_str(), v.outpath.c_str());
+#endif
+        }
+    }
+    else
+    {
+#if _WIN32
+        fwprintf(stderr, L"encode image %ls failed\n", v.outpath.c_str());
+#else
+        fprintf(stderr, "encode image %s failed\n", v.outpath.c_str());
+#endif
+    }
+
+    return success;
+}
+
 void* save(void* args)
 {
     const SaveThreadParams* stp = (const SaveThreadParams*)args;
-    const int verbose = stp->verbose;
 
     for (;;)
     {
@@ -368,101 +448,539 @@ void* save(void* args)
         if (v.id == -233)
             break;
 
-        fprintf(stderr, "save result...\n");
-        float begin = clock();
+        TaskBudgetScope budget_scope(task_budget, v.footprint);
+
+        save_task(v, stp);
+    }
 
-        // free input pixel data
+    return 0;
+}
+
+// the full size output never exists in memory, png inputs are decoded row by row as well
+static int process_stripes(const RealCUGAN* realcugan, const path_t& inpath, const path_t& outpath, int verbose,
+                           tile_progress_callback progress = 0, void* userdata = 0)
+{
+    StripeReader reader;
+    unsigned char* pixeldata = 0;
+    int webp = 0;
+
+    if (reader.open_png(inpath, realcugan->input_bgr) != 0)
+    {
+        // other formats are decoded whole, the output is still streamed
+        int w = 0;
+        int h = 0;
+        int c = 0;
+        pixeldata = image_load(inpath, &w, &h, &c, &webp);
+        if (!pixeldata)
         {
-            unsigned char* pixeldata = (unsigned char*)v.inimage.data;
-            if (v.webp == 1)
-            {
-                free(pixeldata);
-            }
-            else
-            {
 #if _WIN32
-                free(pixeldata);
+            fwprintf(stderr, L"decode image %ls failed\n", inpath.c_str());
 #else
-                stbi_image_free(pixeldata);
+            fprintf(stderr, "decode image %s failed\n", inpath.c_str());
 #endif
-            }
+            return -1;
         }
 
-        int success = 0;
+        reader.open_memory(pixeldata, w, h, c);
+    }
 
-        path_t ext = get_file_extension(v.outpath);
+    const int scale = realcugan->scale;
+    fprintf(stderr, "stripe scale=%d, w/h/c %d/%d/%d -> %d/%d/%d\n", scale, reader.w, reader.h, reader.c, reader.w * scale, reader.h * scale, reader.c);
 
-        if (ext != PATHSTR("gif")) {
-            // 使用opencv保存图片，速度比默认的stb更快
-            cv::Mat image;
-            switch (v.outimage.elempack) {
-                case 1:
-                    image = cv::Mat( v.outimage.h, v.outimage.w, CV_8UC1, v.outimage.data); // 单通道图像
-                    break;
-                case 3:
-                    image = cv::Mat(v.outimage.h, v.outimage.w, CV_8UC3, v.outimage.data); // 3通道图像
-                    cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
-                    break;
-                case 4:
-                    image = cv::Mat(v.outimage.h, v.outimage.w, CV_8UC4, v.outimage.data); // 4通道图像
-                    cv::cvtColor(image, image, cv::COLOR_RGBA2BGRA);
-                    break;
-            }
-            if (image.empty()) {
-                std::cerr << "Error: Image data not loaded." << std::endl;
-                success = false;
-            } else {
-                success = imwrite(v.outpath.c_str(), image);
-            }
+    StripeWriter writer;
+    int ret = writer.open_png(outpath, reader.w * scale, reader.h * scale, reader.c, realcugan->output_bgr);
+    if (ret == 0)
+        ret = stripe_process(realcugan, reader, writer, progress, userdata);
+    if (writer.close() != 0)
+        ret = -1;
 
+    reader.close();
+    if (webp == 1)
+    {
+        free(pixeldata);
+    }
+    else if (pixeldata)
+    {
+#if _WIN32
+        free(pixeldata);
+#else
+        stbi_image_free(pixeldata);
+#endif
+    }
 
-        }else if (ext == PATHSTR("webp") || ext == PATHSTR("WEBP"))
-        {
-            success = webp_save(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack, (const unsigned char*)v.outimage.data);
-        }
-        else if (ext == PATHSTR("png") || ext == PATHSTR("PNG"))
-        {
+    if (ret != 0)
+    {
 #if _WIN32
-            success = wic_encode_image(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack, v.outimage.data);
+        fwprintf(stderr, L"encode image %ls failed\n", outpath.c_str());
 #else
-            success = stbi_write_png(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack, v.outimage.data, 0);
+        fprintf(stderr, "encode image %s failed\n", outpath.c_str());
 #endif
-        }
-        else if (ext == PATHSTR("jpg") || ext == PATHSTR("JPG") || ext == PATHSTR("jpeg") || ext == PATHSTR("JPEG"))
-        {
+    }
+    else if (verbose)
+    {
 #if _WIN32
-            success = wic_encode_jpeg_image(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack, v.outimage.data);
+        fwprintf(stdout, L"%ls -> %ls done\n", inpath.c_str(), outpath.c_str());
 #else
-            success = stbi_write_jpg(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack, v.outimage.data, 100);
+        fprintf(stdout, "%s -> %s done\n", inpath.c_str(), outpath.c_str());
 #endif
-        }
-        if (success)
-        {
-            float end = clock();
-            fprintf(stderr, "save result use time: %.3lf\n", (end - begin) / CLOCKS_PER_SEC);
+    }
 
-            if (verbose)
-            {
+    return ret;
+}
+
+
+// the context each tile needs around it, -1 for an unknown model dir
+static int model_prepadding(const path_t& model, int scale)
+{
+    if (model.find(PATHSTR("models-se")) == path_t::npos
+        && model.find(PATHSTR("models-nose")) == path_t::npos
+        && model.find(PATHSTR("models-pro")) == path_t::npos)
+    {
+        return -1;
+    }
+
+    if (scale == 2)
+        return 18;
+    if (scale == 3)
+        return 14;
+    if (scale == 4)
+        return 19;
+
+    return 0;
+}
+
+// param and bin of the model for scale and noise
+static void model_paths(const path_t& model, int scale, int noise, path_t& paramfullpath, path_t& modelfullpath)
+{
 #if _WIN32
-                fwprintf(stdout, L"%ls -> %ls done\n", v.inpath.c_str(), v.outpath.c_str());
+    wchar_t parampath[256];
+    wchar_t modelpath[256];
+    if (noise == -1)
+    {
+        swprintf(parampath, 256, L"%s/up%dx-conservative.param", model.c_str(), scale);
+        swprintf(modelpath, 256, L"%s/up%dx-conservative.bin", model.c_str(), scale);
+    }
+    else if (noise == 0)
+    {
+        swprintf(parampath, 256, L"%s/up%dx-no-denoise.param", model.c_str(), scale);
+        swprintf(modelpath, 256, L"%s/up%dx-no-denoise.bin", model.c_str(), scale);
+    }
+    else
+    {
+        swprintf(parampath, 256, L"%s/up%dx-denoise%dx.param", model.c_str(), scale, noise);
+        swprintf(modelpath, 256, L"%s/up%dx-denoise%dx.bin", model.c_str(), scale, noise);
+    }
 #else
-                fprintf(stdout, "%s -> %s done\n", v.inpath.c_str(), v.outpath.c_str());
+    char parampath[256];
+    char modelpath[256];
+    if (noise == -1)
+    {
+        sprintf(parampath, "%s/up%dx-conservative.param", model.c_str(), scale);
+        sprintf(modelpath, "%s/up%dx-conservative.bin", model.c_str(), scale);
+    }
+    else if (noise == 0)
+    {
+        sprintf(parampath, "%s/up%dx-no-denoise.param", model.c_str(), scale);
+        sprintf(modelpath, "%s/up%dx-no-denoise.bin", model.c_str(), scale);
+    }
+    else
+    {
+        sprintf(parampath, "%s/up%dx-denoise%dx.param", model.c_str(), scale, noise);
+        sprintf(modelpath, "%s/up%dx-denoise%dx.bin", model.c_str(), scale, noise);
+    }
 #endif
-            }
+
+    paramfullpath = sanitize_filepath(parampath);
+    modelfullpath = sanitize_filepath(modelpath);
+}
+
+// tile size for the heap of the device, the model and the scale, cpu tiles are fixed
+// heap_share is the number of proc jobs running on the device at once
+static int auto_tilesize(int gpuid, const path_t& model, int scale, int heap_share)
+{
+    if (gpuid == -1)
+        return 400;
+
+    uint32_t heap_budget = ncnn::get_gpu_device(gpuid)->get_heap_budget() / heap_share;
+
+    // more fine-grained tilesize policy here
+    if (model.find(PATHSTR("models-nose")) != path_t::npos || model.find(PATHSTR("models-se")) != path_t::npos || model.find(PATHSTR("models-pro")) != path_t::npos)
+    {
+        if (scale == 2)
+        {
+            if (heap_budget > 1300)
+                return 400;
+            else if (heap_budget > 800)
+                return 300;
+            else if (heap_budget > 400)
+                return 200;
+            else if (heap_budget > 200)
+                return 100;
+            else
+                return 32;
         }
-        else
+        if (scale == 3)
+        {
+            if (heap_budget > 3300)
+                return 400;
+            else if (heap_budget > 1900)
+                return 300;
+            else if (heap_budget > 950)
+                return 200;
+            else if (heap_budget > 320)
+                return 100;
+            else
+                return 32;
+        }
+        if (scale == 4)
         {
+            if (heap_budget > 1690)
+                return 400;
+            else if (heap_budget > 980)
+                return 300;
+            else if (heap_budget > 530)
+                return 200;
+            else if (heap_budget > 240)
+                return 100;
+            else
+                return 32;
+        }
+    }
+
+    return 0;
+}
+
+static RealCUGAN* create_realcugan(int gpuid, int jobs_proc, int tta_mode, int stripe,
+                                   const path_t& paramfullpath, const path_t& modelfullpath,
+                                   int noise, int scale, int tilesize, int prepadding, int syncgap, int syncgap_mb)
+{
+    int num_threads = gpuid == -1 ? jobs_proc : 1;
+
+    RealCUGAN* realcugan = new RealCUGAN(gpuid, tta_mode, num_threads);
+
+    // imwrite takes bgr(a), the stripe writer keeps the input order
+    if (!stripe)
+        realcugan->output_bgr = true;
+
+    realcugan->load(paramfullpath, modelfullpath);
+
+    realcugan->noise = noise;
+    realcugan->scale = scale;
+    realcugan->tilesize = tilesize;
+    realcugan->prepadding = prepadding;
+    realcugan->syncgap = syncgap;
+    realcugan->syncgap_budget = (size_t)syncgap_mb * 1024 * 1024;
+
+    return realcugan;
+}
+
+// job paths are utf-8 json strings
 #if _WIN32
-            fwprintf(stderr, L"encode image %ls failed\n", v.outpath.c_str());
+static path_t path_from_utf8(const std::string& s)
+{
+    int length = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, NULL, 0);
+    std::vector<wchar_t> buffer(std::max(length, 1), 0);
+    MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, buffer.data(), length);
+    return path_t(buffer.data());
+}
+
+static std::string path_to_utf8(const path_t& path)
+{
+    int length = WideCharToMultiByte(CP_UTF8, 0, path.c_str(), -1, NULL, 0, NULL, NULL);
+    std::vector<char> buffer(std::max(length, 1), 0);
+    WideCharToMultiByte(CP_UTF8, 0, path.c_str(), -1, buffer.data(), length, NULL, NULL);
+    return std::string(buffer.data());
+}
 #else
-            fprintf(stderr, "encode image %s failed\n", v.outpath.c_str());
+static path_t path_from_utf8(const std::string& s)
+{
+    return s;
+}
+
+static std::string path_to_utf8(const path_t& path)
+{
+    return path;
+}
 #endif
+
+class ServerEngine
+{
+public:
+    path_t model;
+    int scale;
+    int noise;
+    int tta_mode;
+    std::vector<RealCUGAN*> realcugan;
+    // per device, what a job with tile 0 runs
+    std::vector<int> tilesize;
+};
+
+class ServerParams
+{
+public:
+    std::vector<int> gpuid;
+    std::vector<int> jobs_proc;
+    // per device, 0 picks one for each model
+    std::vector<int> tilesize;
+    // per device, proc jobs sharing its heap
+    std::vector<int> heap_share;
+    path_t model;
+    int scale;
+    int noise;
+    int syncgap;
+    int syncgap_mb;
+    int tta_mode;
+    int stripe;
+
+    // loaded on first use and kept until stdin closes
+    std::vector<ServerEngine> engines;
+};
+
+static ServerEngine* server_engine(ServerParams* sp, const path_t& model, int scale, int noise, int tta_mode, std::string& error)
+{
+    for (int i = 0; i < (int)sp->engines.size(); i++)
+    {
+        ServerEngine& engine = sp->engines[i];
+        if (engine.model == model && engine.scale == scale && engine.noise == noise && engine.tta_mode == tta_mode)
+            return &engine;
+    }
+
+    const int prepadding = model_prepadding(model, scale);
+    if (prepadding < 0)
+    {
+        error = "unknown model dir type";
+        return 0;
+    }
+
+    path_t paramfullpath;
+    path_t modelfullpath;
+    model_paths(model, scale, noise, paramfullpath, modelfullpath);
+    if (!filepath_is_readable(paramfullpath) || !filepath_is_readable(modelfullpath))
+    {
+        error = "no model for the scale and noise";
+        return 0;
+    }
+
+    // force syncgap off for nose models
+    const int syncgap = model.find(PATHSTR("models-nose")) != path_t::npos ? 0 : sp->syncgap;
+
+    ServerEngine engine;
+    engine.model = model;
+    engine.scale = scale;
+    engine.noise = noise;
+    engine.tta_mode = tta_mode;
+    for (int i = 0; i < (int)sp->gpuid.size(); i++)
+    {
+        const int tilesize = sp->tilesize[i] ? sp->tilesize[i] : auto_tilesize(sp->gpuid[i], model, scale, sp->heap_share[i]);
+        engine.tilesize.push_back(tilesize);
+        engine.realcugan.push_back(create_realcugan(sp->gpuid[i], sp->jobs_proc[i], tta_mode, sp->stripe,
+                                                    paramfullpath, modelfullpath, noise, scale,
+                                                    tilesize, prepadding, syncgap, sp->syncgap_mb));
+    }
+
+    sp->engines.push_back(engine);
+    return &sp->engines.back();
+}
+
+// one job start to end on every device, outpath is the file actually written
+// progress goes to stdout as json lines for id, the quoted job id
+static int serve_job(ServerParams* sp, const std::map<std::string, std::string>& job, const std::string& id, path_t& outpath, std::string& error)
+{
+    std::map<std::string, std::string>::const_iterator input = job.find("input");
+    std::map<std::string, std::string>::const_iterator output = job.find("output");
+    if (input == job.end() || output == job.end() || input->second.empty() || output->second.empty())
+    {
+        error = "input and output are required";
+        return -1;
+    }
+
+    std::map<std::string, std::string>::const_iterator model = job.find("model");
+    const path_t inpath = path_from_utf8(input->second);
+    outpath = path_from_utf8(output->second);
+
+    const int scale = json_line_int(job, "scale", sp->scale);
+    const int noise = json_line_int(job, "noise", sp->noise);
+    const int tta_mode = json_line_int(job, "tta", sp->tta_mode);
+    const int tilesize = json_line_int(job, "tile", 0);
+    if (!(scale == 1 || scale == 2 || scale == 3 || scale == 4))
+    {
+        error = "invalid scale";
+        return -1;
+    }
+    if (noise < -1 || noise > 3)
+    {
+        error = "invalid noise";
+        return -1;
+    }
+    if (tilesize != 0 && tilesize < 32)
+    {
+        error = "invalid tile";
+        return -1;
+    }
+
+    path_t ext = get_file_extension(outpath);
+    const bool png = ext == PATHSTR("png") || ext == PATHSTR("PNG");
+    const bool jpg = ext == PATHSTR("jpg") || ext == PATHSTR("JPG") || ext == PATHSTR("jpeg") || ext == PATHSTR("JPEG");
+    if (!png && !jpg && ext != PATHSTR("webp") && ext != PATHSTR("WEBP"))
+    {
+        error = "invalid output extension type";
+        return -1;
+    }
+
+    if (sp->stripe && !png)
+    {
+        error = "stripe mode only writes png";
+        return -1;
+    }
+
+    ServerEngine* engine = server_engine(sp, model == job.end() ? sp->model : path_from_utf8(model->second), scale, noise, tta_mode, error);
+    if (!engine)
+        return -1;
+
+    // the se statistics span the whole image, so only syncgap 0 splits it across devices
+    const bool split = engine->realcugan.size() > 1 && engine->realcugan[0]->syncgap == 0;
+
+    // 0 keeps the tile size picked for this model
+    // a single engine reports its own tiles, the stripe and split drivers report the whole image
+    for (int i = 0; i < (int)engine->realcugan.size(); i++)
+    {
+        engine->realcugan[i]->tilesize = tilesize ? tilesize : engine->tilesize[i];
+        engine->realcugan[i]->progress_callback = sp->stripe || split ? tile_progress_ignore : json_line_progress;
+        engine->realcugan[i]->progress_userdata = (void*)&id;
+    }
+
+    if (sp->stripe)
+    {
+        if (process_stripes(engine->realcugan[0], inpath, outpath, 0, json_line_progress, (void*)&id) != 0)
+        {
+            error = "stripe process failed";
+            return -1;
+        }
+        return 0;
+    }
+
+    Task v;
+    int w;
+    int h;
+    int c;
+    unsigned char* pixeldata = image_load(inpath, &w, &h, &c, &v.webp);
+    if (!pixeldata)
+    {
+        error = "decode image failed";
+        return -1;
+    }
+
+    // like load(), jpg has no alpha
+    if (c == 4 && jpg)
+        outpath = outpath + PATHSTR(".png");
+
+    v.id = 0;
+    v.scale = scale;
+    v.inpath = inpath;
+    v.outpath = outpath;
+    v.footprint = 0;
+    v.inimage = ncnn::Mat(w, h, (void*)pixeldata, (size_t)c, c);
+
+    // jobs come one at a time, so every device works on each of them when the model allows it
+    ProcThreadParams ptp;
+    ptp.realcugan = engine->realcugan[0];
+    ptp.progress = json_line_progress;
+    ptp.progress_userdata = (void*)&id;
+    if (split)
+    {
+        for (int i = 0; i < (int)engine->realcugan.size(); i++)
+        {
+            const int workers = sp->gpuid[i] == -1 ? 1 : sp->jobs_proc[i];
+            for (int j = 0; j < workers; j++)
+            {
+                ptp.split.push_back(engine->realcugan[i]);
+            }
         }
     }
 
+    v.outimage = ncnn::Mat(w * scale, h * scale, (size_t)c, c);
+    process_image(&ptp, v.inimage, v.outimage);
+
+    // stdout carries the replies only
+    SaveThreadParams stp;
+    stp.verbose = 0;
+    stp.bgr = engine->realcugan[0]->output_bgr;
+
+    if (!save_task(v, &stp))
+    {
+        error = "save result failed";
+        return -1;
+    }
+
     return 0;
 }
 
+// jobs come on stdin and replies go to stdout, one json object per line
+// {"id":"1","input":"a.jpg","output":"b.png","model":"models-se","scale":2,"noise":-1,"tile":0,"tta":false}
+// only input and output are required, the rest default to the command line
+static int serve(ServerParams* sp)
+{
+    std::string error;
+    if (!server_engine(sp, sp->model, sp->scale, sp->noise, sp->tta_mode, error))
+        fprintf(stderr, "preload model failed: %s\n", error.c_str());
+
+    fprintf(stdout, "{\"status\":\"ready\"}\n");
+    fflush(stdout);
+
+    std::string line;
+    while (std::getline(std::cin, line))
+    {
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+
+        std::chrono::high_resolution_clock::time_point begin = std::chrono::high_resolution_clock::now();
+
+        std::map<std::string, std::string> job;
+        std::string id = "null";
+        path_t outpath;
+        int ret = -1;
+
+        error.clear();
+        if (json_line_parse(line, job) != 0)
+        {
+            error = "invalid json job";
+        }
+        else
+        {
+            if (job.find("id") != job.end())
+                id = json_line_quote(job["id"]);
+
+            fprintf(stdout, "{\"id\":%s,\"status\":\"processing\"}\n", id.c_str());
+            fflush(stdout);
+
+            ret = serve_job(sp, job, id, outpath, error);
+        }
+
+        std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+        const double time_span = std::chrono::duration<double>(end - begin).count();
+
+        if (ret == 0)
+        {
+            fprintf(stdout, "{\"id\":%s,\"status\":\"done\",\"output\":%s,\"time\":%.3lf}\n", id.c_str(), json_line_quote(path_to_utf8(outpath)).c_str(), time_span);
+        }
+        else
+        {
+            fprintf(stdout, "{\"id\":%s,\"status\":\"error\",\"message\":%s}\n", id.c_str(), json_line_quote(error).c_str());
+        }
+        fflush(stdout);
+    }
+
+    for (int i = 0; i < (int)sp->engines.size(); i++)
+    {
+        for (int j = 0; j < (int)sp->engines[i].realcugan.size(); j++)
+        {
+            delete sp->engines[i].realcugan[j];
+        }
+    }
+    sp->engines.clear();
+
+    return 0;
+}
 
 #if _WIN32
 int wmain(int argc, wchar_t** argv)
@@ -482,13 +1000,18 @@ int main(int argc, char** argv)
     int jobs_save = 2;
     int verbose = 0;
     int syncgap = 3;
+    int syncgap_mb = 0;
     int tta_mode = 0;
+    int autotune = 0;
+    int stripe = 0;
+    int budget_mb = 0;
     path_t format = PATHSTR("png");
+    int server = 0;
 
 #if _WIN32
     setlocale(LC_ALL, "");
     wchar_t opt;
-    while ((opt = getopt(argc, argv, L"i:o:n:s:t:c:m:g:j:f:vxh")) != (wchar_t)-1)
+    while ((opt = getopt(argc, argv, L"i:o:n:s:t:c:b:m:g:j:f:r:vxlaSh")) != (wchar_t)-1)
     {
         switch (opt)
         {
@@ -510,6 +1033,9 @@ int main(int argc, char** argv)
         case L'c':
             syncgap = _wtoi(optarg);
             break;
+        case L'b':
+            syncgap_mb = _wtoi(optarg);
+            break;
         case L'm':
             model = optarg;
             break;
@@ -529,6 +1055,18 @@ int main(int argc, char** argv)
         case L'x':
             tta_mode = 1;
             break;
+        case L'a':
+            autotune = 1;
+            break;
+        case L'l':
+            stripe = 1;
+            break;
+        case L'r':
+            budget_mb = _wtoi(optarg);
+            break;
+        case L'S':
+            server = 1;
+            break;
         case L'h':
         default:
             print_usage();
@@ -537,7 +1075,7 @@ int main(int argc, char** argv)
     }
 #else // _WIN32
     int opt;
-    while ((opt = getopt(argc, argv, "i:o:n:s:t:c:m:g:j:f:vxh")) != -1)
+    while ((opt = getopt(argc, argv, "i:o:n:s:t:c:b:m:g:j:f:r:vxlaSh")) != -1)
     {
         switch (opt)
         {
@@ -559,6 +1097,9 @@ int main(int argc, char** argv)
         case 'c':
             syncgap = atoi(optarg);
             break;
+        case 'b':
+            syncgap_mb = atoi(optarg);
+            break;
         case 'm':
             model = optarg;
             break;
@@ -578,6 +1119,18 @@ int main(int argc, char** argv)
         case 'x':
             tta_mode = 1;
             break;
+        case 'a':
+            autotune = 1;
+            break;
+        case 'l':
+            stripe = 1;
+            break;
+        case 'r':
+            budget_mb = atoi(optarg);
+            break;
+        case 'S':
+            server = 1;
+            break;
         case 'h':
         default:
             print_usage();
@@ -586,7 +1139,7 @@ int main(int argc, char** argv)
     }
 #endif // _WIN32
 
-    if (inputpath.empty() || outputpath.empty())
+    if ((inputpath.empty() || outputpath.empty()) && !server)
     {
         print_usage();
         return -1;
@@ -616,6 +1169,12 @@ int main(int argc, char** argv)
         return -1;
     }
 
+    if (syncgap_mb < 0)
+    {
+        fprintf(stderr, "invalid syncgap-mb argument\n");
+        return -1;
+    }
+
     for (int i=0; i<(int)tilesize.size(); i++)
     {
         if (tilesize[i] != 0 && tilesize[i] < 32)
@@ -631,6 +1190,12 @@ int main(int argc, char** argv)
         return -1;
     }
 
+    if (budget_mb < 0)
+    {
+        fprintf(stderr, "invalid memory-mb argument\n");
+        return -1;
+    }
+
     if (jobs_proc.size() != (gpuid.empty() ? 1 : gpuid.size()) && !jobs_proc.empty())
     {
         fprintf(stderr, "invalid jobs_proc thread count argument\n");
@@ -646,7 +1211,7 @@ int main(int argc, char** argv)
         }
     }
 
-    if (!path_is_directory(outputpath))
+    if (!server && !path_is_directory(outputpath))
     {
         // guess format from outputpath no matter what format argument specified
         path_t ext = get_file_extension(outputpath);
@@ -676,9 +1241,16 @@ int main(int argc, char** argv)
         return -1;
     }
 
+    if (stripe && format != PATHSTR("png"))
+    {
+        fprintf(stderr, "stripe mode only writes png\n");
+        return -1;
+    }
+
     // collect input and output filepath
     std::vector<path_t> input_files;
     std::vector<path_t> output_files;
+    if (!server)
     {
         if (path_is_directory(inputpath) && path_is_directory(outputpath))
         {
@@ -732,77 +1304,27 @@ int main(int argc, char** argv)
         }
     }
 
+    // the server checks the model of every job instead
     int prepadding = 0;
-
-    if (model.find(PATHSTR("models-se")) != path_t::npos
-        || model.find(PATHSTR("models-nose")) != path_t::npos
-        || model.find(PATHSTR("models-pro")) != path_t::npos)
+    path_t paramfullpath;
+    path_t modelfullpath;
+    if (!server)
     {
-        if (scale == 2)
+        prepadding = model_prepadding(model, scale);
+        if (prepadding < 0)
         {
-            prepadding = 18;
-        }
-        if (scale == 3)
-        {
-            prepadding = 14;
+            fprintf(stderr, "unknown model dir type\n");
+            return -1;
         }
-        if (scale == 4)
+
+        model_paths(model, scale, noise, paramfullpath, modelfullpath);
+
+        if (model.find(PATHSTR("models-nose")) != path_t::npos)
         {
-            prepadding = 19;
+            // force syncgap off for nose models
+            syncgap = 0;
         }
     }
-    else
-    {
-        fprintf(stderr, "unknown model dir type\n");
-        return -1;
-    }
-
-    if (model.find(PATHSTR("models-nose")) != path_t::npos)
-    {
-        // force syncgap off for nose models
-        syncgap = 0;
-    }
-
-#if _WIN32
-    wchar_t parampath[256];
-    wchar_t modelpath[256];
-    if (noise == -1)
-    {
-        swprintf(parampath, 256, L"%s/up%dx-conservative.param", model.c_str(), scale);
-        swprintf(modelpath, 256, L"%s/up%dx-conservative.bin", model.c_str(), scale);
-    }
-    else if (noise == 0)
-    {
-        swprintf(parampath, 256, L"%s/up%dx-no-denoise.param", model.c_str(), scale);
-        swprintf(modelpath, 256, L"%s/up%dx-no-denoise.bin", model.c_str(), scale);
-    }
-    else
-    {
-        swprintf(parampath, 256, L"%s/up%dx-denoise%dx.param", model.c_str(), scale, noise);
-        swprintf(modelpath, 256, L"%s/up%dx-denoise%dx.bin", model.c_str(), scale, noise);
-    }
-#else
-    char parampath[256];
-    char modelpath[256];
-    if (noise == -1)
-    {
-        sprintf(parampath, "%s/up%dx-conservative.param", model.c_str(), scale);
-        sprintf(modelpath, "%s/up%dx-conservative.bin", model.c_str(), scale);
-    }
-    else if (noise == 0)
-    {
-        sprintf(parampath, "%s/up%dx-no-denoise.param", model.c_str(), scale);
-        sprintf(modelpath, "%s/up%dx-no-denoise.bin", model.c_str(), scale);
-    }
-    else
-    {
-        sprintf(parampath, "%s/up%dx-denoise%dx.param", model.c_str(), scale, noise);
-        sprintf(modelpath, "%s/up%dx-denoise%dx.bin", model.c_str(), scale, noise);
-    }
-#endif
-
-    path_t paramfullpath = sanitize_filepath(parampath);
-    path_t modelfullpath = sanitize_filepath(modelpath);
 
 #if _WIN32
     CoInitializeEx(NULL, COINIT_MULTITHREADED);
@@ -810,6 +1332,9 @@ int main(int argc, char** argv)
 
     ncnn::create_gpu_instance();
 
+    // pre/post shaders compiled by an earlier run
+    spirv_cache_set_directory(get_executable_directory() + PATHSTR("spirv-cache"));
+
     if (gpuid.empty())
     {
         gpuid.push_back(ncnn::get_default_gpu_index());
@@ -831,6 +1356,10 @@ int main(int argc, char** argv)
     jobs_load = std::min(jobs_load, cpu_count);
     jobs_save = std::min(jobs_save, cpu_count);
 
+    task_budget.set_ceiling((size_t)budget_mb * 1024 * 1024);
+    if (verbose)
+        fprintf(stderr, "task memory budget %zu MB\n", task_budget.get_ceiling() / 1024 / 1024);
+
     int gpu_count = ncnn::get_gpu_count();
     for (int i=0; i<use_gpu_count; i++)
     {
@@ -859,69 +1388,48 @@ int main(int argc, char** argv)
         }
     }
 
+    // tiles left to the policy below may be autotuned later
+    std::vector<int> tilesize_auto(use_gpu_count);
     for (int i=0; i<use_gpu_count; i++)
     {
-        if (tilesize[i] != 0)
-            continue;
+        tilesize_auto[i] = tilesize[i] == 0;
+    }
 
-        if (gpuid[i] == -1)
+    if (server)
+    {
+        ServerParams sp;
+        sp.gpuid = gpuid;
+        sp.jobs_proc = jobs_proc;
+        // 0 stays auto, the engines pick their tile size for the model they load
+        sp.tilesize = tilesize;
+        // a job runs alone, only its split across several devices runs proc jobs side by side
+        for (int i=0; i<use_gpu_count; i++)
         {
-            // cpu only
-            tilesize[i] = 400;
-            continue;
+            sp.heap_share.push_back(use_gpu_count > 1 && gpuid[i] != -1 ? jobs_proc_per_gpu[gpuid[i]] : 1);
         }
+        sp.model = model;
+        sp.scale = scale;
+        sp.noise = noise;
+        sp.syncgap = syncgap;
+        sp.syncgap_mb = syncgap_mb;
+        sp.tta_mode = tta_mode;
+        sp.stripe = stripe;
+
+        serve(&sp);
+
+        ncnn::destroy_gpu_instance();
+        return 0;
+    }
 
-        uint32_t heap_budget = ncnn::get_gpu_device(gpuid[i])->get_heap_budget();
+    for (int i=0; i<use_gpu_count; i++)
+    {
+        if (tilesize[i] != 0)
+            continue;
 
-        if (path_is_directory(inputpath) && path_is_directory(outputpath))
-        {
-            // multiple gpu jobs share the same heap
-            heap_budget /= jobs_proc_per_gpu[gpuid[i]];
-        }
+        // multiple gpu jobs share the same heap
+        const int heap_share = gpuid[i] != -1 && path_is_directory(inputpath) && path_is_directory(outputpath) ? jobs_proc_per_gpu[gpuid[i]] : 1;
 
-        // more fine-grained tilesize policy here
-        if (model.find(PATHSTR("models-nose")) != path_t::npos || model.find(PATHSTR("models-se")) != path_t::npos || model.find(PATHSTR("models-pro")) != path_t::npos)
-        {
-            if (scale == 2)
-            {
-                if (heap_budget > 1300)
-                    tilesize[i] = 400;
-                else if (heap_budget > 800)
-                    tilesize[i] = 300;
-                else if (heap_budget > 400)
-                    tilesize[i] = 200;
-                else if (heap_budget > 200)
-                    tilesize[i] = 100;
-                else
-                    tilesize[i] = 32;
-            }
-            if (scale == 3)
-            {
-                if (heap_budget > 3300)
-                    tilesize[i] = 400;
-                else if (heap_budget > 1900)
-                    tilesize[i] = 300;
-                else if (heap_budget > 950)
-                    tilesize[i] = 200;
-                else if (heap_budget > 320)
-                    tilesize[i] = 100;
-                else
-                    tilesize[i] = 32;
-            }
-            if (scale == 4)
-            {
-                if (heap_budget > 1690)
-                    tilesize[i] = 400;
-                else if (heap_budget > 980)
-                    tilesize[i] = 300;
-                else if (heap_budget > 530)
-                    tilesize[i] = 200;
-                else if (heap_budget > 240)
-                    tilesize[i] = 100;
-                else
-                    tilesize[i] = 32;
-            }
-        }
+        tilesize[i] = auto_tilesize(gpuid[i], model, scale, heap_share);
     }
 
     {
@@ -929,20 +1437,49 @@ int main(int argc, char** argv)
 
         for (int i=0; i<use_gpu_count; i++)
         {
-            int num_threads = gpuid[i] == -1 ? jobs_proc[i] : 1;
+            realcugan[i] = create_realcugan(gpuid[i], jobs_proc[i], tta_mode, stripe, paramfullpath, modelfullpath,
+                                            noise, scale, tilesize[i], prepadding, syncgap, syncgap_mb);
+        }
+
+        if (autotune)
+        {
+            const path_t cache_path = tile_autotune_cache_path();
+
+            for (int i=0; i<use_gpu_count; i++)
+            {
+                if (!tilesize_auto[i])
+                    continue;
 
-            realcugan[i] = new RealCUGAN(gpuid[i], tta_mode, num_threads);
+                const std::string key = tile_autotune_key(gpuid[i], jobs_proc[i], 1, modelfullpath, scale, tta_mode);
 
-            realcugan[i]->load(paramfullpath, modelfullpath);
+                int cached = tile_autotune_load(cache_path, key);
+                if (cached != 0)
+                {
+                    realcugan[i]->tilesize = cached;
+                    fprintf(stderr, "autotune gpu[%d], cached tilesize=%d\n", i, cached);
+                    continue;
+                }
 
-            realcugan[i]->noise = noise;
-            realcugan[i]->scale = scale;
-            realcugan[i]->tilesize = tilesize[i];
-            realcugan[i]->prepadding = prepadding;
-            realcugan[i]->syncgap = syncgap;
+                fprintf(stderr, "autotune gpu[%d], calibrating from tilesize=%d\n", i, tilesize[i]);
+                int tuned = tile_autotune(realcugan[i], 3, tilesize[i], gpuid[i], jobs_proc[i], verbose);
+                tile_autotune_store(cache_path, key, tuned);
+                fprintf(stderr, "autotune gpu[%d], tilesize=%d\n", i, tuned);
+            }
         }
 
         // main routine
+        if (stripe)
+        {
+            // one image at a time on the first device, rows are streamed from and to disk
+            if (syncgap != 0)
+                fprintf(stderr, "stripe mode syncs the se statistics per stripe\n");
+
+            for (int i = 0; i < (int)input_files.size(); i++)
+            {
+                process_stripes(realcugan[0], input_files[i], output_files[i], verbose);
+            }
+        }
+        else
         {
             // load image
             LoadThreadParams ltp;
@@ -960,21 +1497,43 @@ int main(int argc, char** argv)
                 ptp[i].realcugan = realcugan[i];
             }
 
-            std::vector<ncnn::Thread*> proc_threads(total_jobs_proc);
+            // fewer images than devices, one proc thread splits each image across all of them
+            const bool split = use_gpu_count > 1 && (int)input_files.size() < use_gpu_count && syncgap == 0;
+            if (split)
             {
-                int total_jobs_proc_id = 0;
                 for (int i=0; i<use_gpu_count; i++)
                 {
-                    if (gpuid[i] == -1)
+                    const int workers = gpuid[i] == -1 ? 1 : jobs_proc[i];
+                    for (int j=0; j<workers; j++)
                     {
-                        proc_threads[total_jobs_proc_id++] = new ncnn::Thread(proc, (void*)&ptp[i]);
+                        ptp[0].split.push_back(realcugan[i]);
                     }
-                    else
+                }
+                total_jobs_proc = 1;
+            }
+
+            std::vector<ncnn::Thread*> proc_threads(total_jobs_proc);
+            {
+                int total_jobs_proc_id = 0;
+                if (split)
+                {
+                    proc_threads[total_jobs_proc_id++] = new ncnn::Thread(proc, (void*)&ptp[0]);
+                }
+                else
+                {
+                    for (int i=0; i<use_gpu_count; i++)
                     {
-                        for (int j=0; j<jobs_proc[i]; j++)
+                        if (gpuid[i] == -1)
                         {
                             proc_threads[total_jobs_proc_id++] = new ncnn::Thread(proc, (void*)&ptp[i]);
                         }
+                        else
+                        {
+                            for (int j=0; j<jobs_proc[i]; j++)
+                            {
+                                proc_threads[total_jobs_proc_id++] = new ncnn::Thread(proc, (void*)&ptp[i]);
+                            }
+                        }
                     }
                 }
             }
@@ -982,6 +1541,7 @@ int main(int argc, char** argv)
             // save image
             SaveThreadParams stp;
             stp.verbose = verbose;
+            stp.bgr = realcugan[0]->output_bgr;
 
             std::vector<ncnn::Thread*> save_threads(jobs_save);
             for (int i=0; i<jobs_save; i++)
@@ -1,10 +1,17 @@
 // realcugan implemented with ncnn library
 
 #include "realcugan.h"
-
+#include "realcugan_feature_sum.h"
+#include "tile_arena.h"
+#include "spirv_cache.h"
+#include "tile_pixels.h"
+#include "tile_plan.h"
+#include "tile_tta.h"
+
+#include <stdio.h>
 #include <algorithm>
+#include <deque>
 #include <vector>
-#include <map>
 
 // ncnn
 #include "cpu.h"
@@ -15,46 +22,431 @@
 #include "realcugan_preproc_tta.comp.hex.h"
 #include "realcugan_postproc_tta.comp.hex.h"
 #include "realcugan_4x_postproc_tta.comp.hex.h"
+#include "realcugan_feature_sum.comp.hex.h"
+
+// gap0 to gap3
+static const int FEATURE_SLOTS = 4;
+
+// a feature moved out to the scratch file
+class FeatureSpill
+{
+public:
+    FeatureSpill() : offset(-1)
+    {
+    }
+
+    long offset;
+    int dims;
+    int w;
+    int h;
+    int c;
+    size_t elemsize;
+    int elempack;
+};
 
+// se features of every tile, tta and gap slot in one flat table
+// gpu features live in the blob allocator of the call, cpu features and blobs in a pool of their own
+// with a budget the oldest gpu features over it go to host memory, and from there to a scratch file
+// stage0 outputs go to a running sum of their slot, only a feature in another layout is kept per tile
 class FeatureCache
 {
 public:
+    // the grid of the smallest tiles any stage walks, budget 0 keeps everything in place
+    FeatureCache(int _xtiles, int ytiles, bool tta_mode, size_t _budget)
+    {
+        xtiles = _xtiles;
+        ttas = tta_mode ? 8 : 1;
+
+        size = ytiles * xtiles * ttas * FEATURE_SLOTS;
+
+        budget = _budget;
+        gpu_bytes = 0;
+        host_bytes = 0;
+
+        scratch = 0;
+        scratch_size = 0;
+    }
+
+    ~FeatureCache()
+    {
+        clear();
+
+        if (scratch)
+            fclose(scratch);
+    }
+
     void clear()
     {
         gpu_cache.clear();
         cpu_cache.clear();
+        disk_cache.clear();
+        owned.clear();
+        gpu_queue.clear();
+        host_queue.clear();
+        gpu_bytes = 0;
+        host_bytes = 0;
+
+        for (int i = 0; i < FEATURE_SLOTS; i++)
+        {
+            sums[i].clear();
+            kept[i].clear();
+        }
+    }
+
+    void set_extractor(ncnn::Extractor& ex)
+    {
+        ex.set_blob_allocator(&blob_allocator);
+        ex.set_workspace_allocator(&workspace_allocator);
+    }
+
+    // spilled features are uploaded again through cmd
+    void load(int yi, int xi, int ti, int slot, ncnn::VkMat& feat, ncnn::VkCompute& cmd, const ncnn::Option& opt)
+    {
+        const int i = index(yi, xi, ti, slot);
+        if (!gpu(i).empty())
+        {
+            feat = gpu(i);
+            return;
+        }
+
+        ncnn::Mat feat_cpu;
+        load_host(i, feat_cpu);
+
+        feat.release();
+        if (!feat_cpu.empty())
+            cmd.record_upload(feat_cpu, feat, opt);
     }
 
-    std::string make_key(int yi, int xi, int ti, const std::string& name) const
+    // host copy for the gap sync, downloaded through cmd while still on the gpu
+    void load(int yi, int xi, int ti, int slot, ncnn::Mat& feat, ncnn::VkCompute& cmd, const ncnn::Option& opt)
     {
-        return std::to_string(yi) + "-" + std::to_string(xi) + "-" + std::to_string(ti) + "-" + name;
+        const int i = index(yi, xi, ti, slot);
+        if (!gpu(i).empty())
+        {
+            cmd.record_download(gpu(i), feat, opt);
+            return;
+        }
+
+        load_host(i, feat);
+    }
+
+    void save(int yi, int xi, int ti, int slot, ncnn::VkMat& feat)
+    {
+        const int i = index(yi, xi, ti, slot);
+        drop(i);
+
+        gpu(i) = feat;
+
+        if (budget)
+        {
+            owned[i] = feat.total() * feat.elemsize;
+            gpu_bytes += owned[i];
+            gpu_queue.push_back(i);
+        }
     }
 
-    void load(int yi, int xi, int ti, const std::string& name, ncnn::VkMat& feat)
+    // one average stored for many tiles, outside the budget
+    void save_shared(int yi, int xi, int ti, int slot, ncnn::VkMat& feat)
     {
-        feat = gpu_cache[make_key(yi, xi, ti, name)];
+        const int i = index(yi, xi, ti, slot);
+        drop(i);
+
+        gpu(i) = feat;
     }
 
-    void save(int yi, int xi, int ti, const std::string& name, ncnn::VkMat& feat)
+    void load(int yi, int xi, int ti, int slot, ncnn::Mat& feat)
     {
-        gpu_cache[make_key(yi, xi, ti, name)] = feat;
+        load_host(index(yi, xi, ti, slot), feat);
     }
 
-    void load(int yi, int xi, int ti, const std::string& name, ncnn::Mat& feat)
+    // cpu features stay in the pool, the budget is for the gpu path
+    void save(int yi, int xi, int ti, int slot, ncnn::Mat& feat)
     {
-        feat = cpu_cache[make_key(yi, xi, ti, name)];
+        const int i = index(yi, xi, ti, slot);
+        drop(i);
+
+        host(i) = feat;
     }
 
-    void save(int yi, int xi, int ti, const std::string& name, ncnn::Mat& feat)
+    void save_shared(int yi, int xi, int ti, int slot, ncnn::Mat& feat)
     {
-        cpu_cache[make_key(yi, xi, ti, name)] = feat;
+        save(yi, xi, ti, slot, feat);
     }
 
-public:
-    std::map<std::string, ncnn::VkMat> gpu_cache;
-    std::map<std::string, ncnn::Mat> cpu_cache;
+    // stage0 output of one tile, added to the sum of its slot in cmd
+    void accumulate(int yi, int xi, int ti, int slot, ncnn::VkMat& feat, const ncnn::Pipeline* feature_sum, ncnn::VkCompute& cmd, const ncnn::Option& opt)
+    {
+        if (sums[slot].add(feat, feature_sum, cmd, opt) == 0)
+            return;
+
+        // a transposed tta pass may pad its channels another way, added at the gap sync
+        save(yi, xi, ti, slot, feat);
+        kept[slot].push_back(index(yi, xi, ti, slot));
+    }
+
+    void accumulate(int yi, int xi, int ti, int slot, ncnn::Mat& feat)
+    {
+        if (sums[slot].add(feat) == 0)
+            return;
+
+        save(yi, xi, ti, slot, feat);
+        kept[slot].push_back(index(yi, xi, ti, slot));
+    }
+
+    // the gap average of one slot in fp32 with elempack 1, the slot starts over
+    // the kept features are downloaded along with the sum, cmd is reset on return
+    int average(int slot, ncnn::Mat& avgfeat, ncnn::VkCompute& cmd, const ncnn::Option& opt)
+    {
+        std::vector<ncnn::Mat> feats(kept[slot].size());
+        for (size_t j = 0; j < feats.size(); j++)
+        {
+            const int i = kept[slot][j];
+            if (!gpu(i).empty())
+                cmd.record_download(gpu(i), feats[j], opt);
+            else
+                load_host(i, feats[j]);
+        }
+
+        avgfeat = sums[slot].download(cmd, opt);
+
+        return finish_average(slot, feats, avgfeat, opt);
+    }
+
+    int average(int slot, ncnn::Mat& avgfeat, const ncnn::Option& opt)
+    {
+        std::vector<ncnn::Mat> feats(kept[slot].size());
+        for (size_t j = 0; j < feats.size(); j++)
+        {
+            load_host(kept[slot][j], feats[j]);
+        }
+
+        avgfeat = sums[slot].download(opt);
+
+        return finish_average(slot, feats, avgfeat, opt);
+    }
+
+    // call between tiles, cmd is reset on return
+    void spill(ncnn::VkCompute& cmd, const ncnn::Option& opt)
+    {
+        if (budget == 0)
+            return;
+
+        std::vector<int> moved;
+        while (gpu_bytes > budget && !gpu_queue.empty())
+        {
+            const int i = gpu_queue.front();
+            gpu_queue.pop_front();
+
+            // replaced since
+            if (owned[i] == 0 || gpu(i).empty())
+                continue;
+
+            cmd.record_download(gpu(i), host(i), opt);
+            gpu(i).release();
+            gpu_bytes -= owned[i];
+
+            moved.push_back(i);
+        }
+
+        if (!moved.empty())
+        {
+            cmd.submit_and_wait();
+            cmd.reset();
+        }
+
+        for (size_t j = 0; j < moved.size(); j++)
+        {
+            const int i = moved[j];
+            owned[i] = host(i).total() * host(i).elemsize;
+            host_bytes += owned[i];
+            host_queue.push_back(i);
+        }
+
+        while (host_bytes > budget && !host_queue.empty())
+        {
+            const int i = host_queue.front();
+            host_queue.pop_front();
+
+            if (owned[i] == 0 || host(i).empty())
+                continue;
+
+            // no scratch file, the rest stays in memory
+            if (write_scratch(i) != 0)
+                break;
+        }
+    }
+
+private:
+    int index(int yi, int xi, int ti, int slot) const
+    {
+        return ((yi * xtiles + xi) * ttas + ti) * FEATURE_SLOTS + slot;
+    }
+
+    // -1 when a kept feature does not have the channel count and channel size of the sum
+    int finish_average(int slot, const std::vector<ncnn::Mat>& feats, ncnn::Mat& avgfeat, const ncnn::Option& opt)
+    {
+        const int count = sums[slot].count + (int)feats.size();
+
+        int ret = avgfeat.empty() ? -1 : 0;
+        for (size_t j = 0; j < feats.size() && ret == 0; j++)
+        {
+            ret = feature_add(feature_unpacked(feats[j], opt), avgfeat);
+        }
+
+        if (ret == 0)
+        {
+            const int size = avgfeat.w * avgfeat.h;
+            for (int q = 0; q < avgfeat.c; q++)
+            {
+                float* ptr = avgfeat.channel(q);
+                for (int k = 0; k < size; k++)
+                {
+                    ptr[k] /= count;
+                }
+            }
+        }
+
+        for (size_t j = 0; j < kept[slot].size(); j++)
+        {
+            drop(kept[slot][j]);
+        }
+
+        kept[slot].clear();
+        sums[slot].clear();
+
+        return ret;
+    }
+
+    ncnn::VkMat& gpu(int i)
+    {
+        if (gpu_cache.empty())
+            gpu_cache.resize(size);
+
+        return gpu_cache[i];
+    }
+
+    ncnn::Mat& host(int i)
+    {
+        if (cpu_cache.empty())
+            cpu_cache.resize(size);
+
+        return cpu_cache[i];
+    }
+
+    // forget whatever the entry held before
+    void drop(int i)
+    {
+        if (budget && owned.empty())
+        {
+            owned.resize(size, 0);
+            disk_cache.resize(size);
+        }
+
+        if (budget && owned[i])
+        {
+            if (!gpu(i).empty())
+                gpu_bytes -= owned[i];
+            else if (!host(i).empty())
+                host_bytes -= owned[i];
+
+            owned[i] = 0;
+            disk_cache[i].offset = -1;
+        }
+
+        gpu(i).release();
+        host(i).release();
+    }
+
+    void load_host(int i, ncnn::Mat& feat)
+    {
+        if (!host(i).empty() || disk_cache.empty() || disk_cache[i].offset < 0)
+        {
+            feat = host(i);
+            return;
+        }
+
+        const FeatureSpill& spilled = disk_cache[i];
+        if (spilled.dims == 1)
+            feat.create(spilled.w, spilled.elemsize, spilled.elempack);
+        else if (spilled.dims == 2)
+            feat.create(spilled.w, spilled.h, spilled.elemsize, spilled.elempack);
+        else
+            feat.create(spilled.w, spilled.h, spilled.c, spilled.elemsize, spilled.elempack);
+
+        const size_t bytes = feat.total() * feat.elemsize;
+        if (fseek(scratch, spilled.offset, SEEK_SET) != 0 || fread(feat.data, 1, bytes, scratch) != bytes)
+        {
+            fprintf(stderr, "feature scratch read failed\n");
+            feat.release();
+        }
+    }
+
+    int write_scratch(int i)
+    {
+        if (!scratch)
+            scratch = tmpfile();
+        if (!scratch)
+            return -1;
+
+        const ncnn::Mat& feat = host(i);
+        const size_t bytes = feat.total() * feat.elemsize;
+        if (fseek(scratch, scratch_size, SEEK_SET) != 0 || fwrite(feat.data, 1, bytes, scratch) != bytes)
+            return -1;
+
+        FeatureSpill& spilled = disk_cache[i];
+        spilled.offset = scratch_size;
+        spilled.dims = feat.dims;
+        spilled.w = feat.w;
+        spilled.h = feat.h;
+        spilled.c = feat.c;
+        spilled.elemsize = feat.elemsize;
+        spilled.elempack = feat.elempack;
+
+        scratch_size += (long)bytes;
+
+        host(i).release();
+        host_bytes -= owned[i];
+
+        return 0;
+    }
+
+private:
+    int xtiles;
+    int ttas;
+    int size;
+
+    size_t budget;
+    size_t gpu_bytes;
+    size_t host_bytes;
+
+    // declared first so the cached mats are gone before the pools
+    ncnn::UnlockedPoolAllocator blob_allocator;
+    ncnn::UnlockedPoolAllocator workspace_allocator;
+
+    std::vector<ncnn::VkMat> gpu_cache;
+    std::vector<ncnn::Mat> cpu_cache;
+    std::vector<FeatureSpill> disk_cache;
+
+    // bytes counted against the budget, oldest first in the queues
+    std::vector<size_t> owned;
+    std::deque<int> gpu_queue;
+    std::deque<int> host_queue;
+
+    FILE* scratch;
+    long scratch_size;
+
+    // the running sums are small and stay outside the budget
+    FeatureSum sums[FEATURE_SLOTS];
+    std::vector<int> kept[FEATURE_SLOTS];
 };
 
+// the net takes inputs of a multiple of 4 at 1x and 3x and of 2 at 2x and 4x
+// tiles of that multiple leave the extra bottom and right padding to the last row and column
+static int realcugan_tile_align(int scale)
+{
+    return scale == 2 || scale == 4 ? 2 : 4;
+}
+
 RealCUGAN::RealCUGAN(int gpuid, bool _tta_mode, int num_threads)
 {
     vkdev = gpuid == -1 ? 0 : ncnn::get_gpu_device(gpuid);
@@ -64,10 +456,26 @@ RealCUGAN::RealCUGAN(int gpuid, bool _tta_mode, int num_threads)
     realcugan_preproc = 0;
     realcugan_postproc = 0;
     realcugan_4x_postproc = 0;
+    realcugan_feature_sum = 0;
     bicubic_2x = 0;
     bicubic_3x = 0;
     bicubic_4x = 0;
     tta_mode = _tta_mode;
+    syncgap_budget = 0;
+
+#if _WIN32
+    input_bgr = true;
+    output_bgr = true;
+#else
+    input_bgr = false;
+    output_bgr = false;
+#endif
+
+    progress_callback = 0;
+    progress_userdata = 0;
+
+    tile_arenas = new TileArenaPool;
+    tile_kernels = new TilePixels;
 }
 
 RealCUGAN::~RealCUGAN()
@@ -76,6 +484,7 @@ RealCUGAN::~RealCUGAN()
     {
         delete realcugan_preproc;
         delete realcugan_postproc;
+        delete realcugan_feature_sum;
     }
 
     bicubic_2x->destroy_pipeline(net.opt);
@@ -86,6 +495,9 @@ RealCUGAN::~RealCUGAN()
 
     bicubic_4x->destroy_pipeline(net.opt);
     delete bicubic_4x;
+
+    delete tile_arenas;
+    delete tile_kernels;
 }
 
 #if _WIN32
@@ -130,15 +542,34 @@ int RealCUGAN::load(const std::string& parampath, const std::string& modelpath)
     net.load_model(modelpath.c_str());
 #endif
 
+    // the se stages address the gap blobs by index
+    {
+        const std::vector<ncnn::Blob>& blobs = net.blobs();
+        for (int i = 0; i < FEATURE_SLOTS; i++)
+        {
+            const std::string name = "gap" + std::to_string(i);
+
+            feature_blobs[i] = -1;
+            for (size_t j = 0; j < blobs.size(); j++)
+            {
+                if (blobs[j].name == name)
+                {
+                    feature_blobs[i] = (int)j;
+                    break;
+                }
+            }
+        }
+    }
+
     // initialize preprocess and postprocess pipeline
     if (vkdev)
     {
         std::vector<ncnn::vk_specialization_type> specializations(1);
-#if _WIN32
-        specializations[0].i = 1;
-#else
-        specializations[0].i = 0;
-#endif
+        specializations[0].i = input_bgr ? 1 : 0;
+
+        // the postprocess may write another order than the preprocess reads
+        std::vector<ncnn::vk_specialization_type> output_specializations(1);
+        output_specializations[0].i = output_bgr ? 1 : 0;
 
         {
             static std::vector<uint32_t> spirv;
@@ -148,9 +579,9 @@ int RealCUGAN::load(const std::string& parampath, const std::string& modelpath)
                 if (spirv.empty())
                 {
                     if (tta_mode)
-                        compile_spirv_module(realcugan_preproc_tta_comp_data, sizeof(realcugan_preproc_tta_comp_data), net.opt, spirv);
+                        compile_spirv_module_cached(realcugan_preproc_tta_comp_data, sizeof(realcugan_preproc_tta_comp_data), net.opt, vkdev, spirv);
                     else
-                        compile_spirv_module(realcugan_preproc_comp_data, sizeof(realcugan_preproc_comp_data), net.opt, spirv);
+                        compile_spirv_module_cached(realcugan_preproc_comp_data, sizeof(realcugan_preproc_comp_data), net.opt, vkdev, spirv);
                 }
             }
 
@@ -167,15 +598,15 @@ int RealCUGAN::load(const std::string& parampath, const std::string& modelpath)
                 if (spirv.empty())
                 {
                     if (tta_mode)
-                        compile_spirv_module(realcugan_postproc_tta_comp_data, sizeof(realcugan_postproc_tta_comp_data), net.opt, spirv);
+                        compile_spirv_module_cached(realcugan_postproc_tta_comp_data, sizeof(realcugan_postproc_tta_comp_data), net.opt, vkdev, spirv);
                     else
-                        compile_spirv_module(realcugan_postproc_comp_data, sizeof(realcugan_postproc_comp_data), net.opt, spirv);
+                        compile_spirv_module_cached(realcugan_postproc_comp_data, sizeof(realcugan_postproc_comp_data), net.opt, vkdev, spirv);
                 }
             }
 
             realcugan_postproc = new ncnn::Pipeline(vkdev);
             realcugan_postproc->set_optimal_local_size_xyz(8, 8, 3);
-            realcugan_postproc->create(spirv.data(), spirv.size() * 4, specializations);
+            realcugan_postproc->create(spirv.data(), spirv.size() * 4, output_specializations);
         }
 
         {
@@ -186,15 +617,31 @@ int RealCUGAN::load(const std::string& parampath, const std::string& modelpath)
                 if (spirv.empty())
                 {
                     if (tta_mode)
-                        compile_spirv_module(realcugan_4x_postproc_tta_comp_data, sizeof(realcugan_4x_postproc_tta_comp_data), net.opt, spirv);
+                        compile_spirv_module_cached(realcugan_4x_postproc_tta_comp_data, sizeof(realcugan_4x_postproc_tta_comp_data), net.opt, vkdev, spirv);
                     else
-                        compile_spirv_module(realcugan_4x_postproc_comp_data, sizeof(realcugan_4x_postproc_comp_data), net.opt, spirv);
+                        compile_spirv_module_cached(realcugan_4x_postproc_comp_data, sizeof(realcugan_4x_postproc_comp_data), net.opt, vkdev, spirv);
                 }
             }
 
             realcugan_4x_postproc = new ncnn::Pipeline(vkdev);
             realcugan_4x_postproc->set_optimal_local_size_xyz(8, 8, 3);
-            realcugan_4x_postproc->create(spirv.data(), spirv.size() * 4, specializations);
+            realcugan_4x_postproc->create(spirv.data(), spirv.size() * 4, output_specializations);
+        }
+
+        {
+            static std::vector<uint32_t> spirv;
+            static ncnn::Mutex lock;
+            {
+                ncnn::MutexLockGuard guard(lock);
+                if (spirv.empty())
+                {
+                    compile_spirv_module_cached(realcugan_feature_sum_comp_data, sizeof(realcugan_feature_sum_comp_data), net.opt, vkdev, spirv);
+                }
+            }
+
+            realcugan_feature_sum = new ncnn::Pipeline(vkdev);
+            realcugan_feature_sum->set_optimal_local_size_xyz(64, 1, 1);
+            realcugan_feature_sum->create(spirv.data(), spirv.size() * 4, std::vector<ncnn::vk_specialization_type>());
         }
     }
 
@@ -241,7 +688,8 @@ int RealCUGAN::load(const std::string& parampath, const std::string& modelpath)
 
 int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
 {
-    bool syncgap_needed = tilesize < std::max(inimage.w, inimage.h);
+    const TilePlan plan = tile_plan(inimage.w, inimage.h, tilesize, prepadding, realcugan_tile_align(scale));
+    bool syncgap_needed = plan.xtiles * plan.ytiles > 1;
 
     if (!vkdev)
     {
@@ -280,8 +728,8 @@ int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
     const int h = inimage.h;
     const int channels = inimage.elempack;
 
-    const int TILE_SIZE_X = tilesize;
-    const int TILE_SIZE_Y = tilesize;
+    const int TILE_SIZE_X = plan.tile_w;
+    const int TILE_SIZE_Y = plan.tile_h;
 
     ncnn::VkAllocator* blob_vkallocator = vkdev->acquire_blob_allocator();
     ncnn::VkAllocator* staging_vkallocator = vkdev->acquire_staging_allocator();
@@ -324,19 +772,11 @@ int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
         {
             if (channels == 3)
             {
-#if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGR2RGB, w, (in_tile_y1 - in_tile_y0));
-#else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
-#endif
+                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, input_bgr ? ncnn::Mat::PIXEL_BGR2RGB : ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
             }
             if (channels == 4)
             {
-#if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGRA2RGBA, w, (in_tile_y1 - in_tile_y0));
-#else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
-#endif
+                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, input_bgr ? ncnn::Mat::PIXEL_BGRA2RGBA : ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
             }
         }
 
@@ -705,7 +1145,10 @@ int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                 cmd.reset();
             }
 
-            fprintf(stderr, "%.2f%%\n", (float)(yi * xtiles + xi) / (ytiles * xtiles) * 100);
+            if (progress_callback)
+                progress_callback(progress_userdata, (float)(yi * xtiles + xi + 1) / (ytiles * xtiles));
+            else
+                fprintf(stderr, "%.2f%%\n", (float)(yi * xtiles + xi) / (ytiles * xtiles) * 100);
         }
 
         // download
@@ -725,19 +1168,11 @@ int RealCUGAN::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
             {
                 if (channels == 3)
                 {
-#if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGB2BGR);
-#else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGB);
-#endif
+                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, output_bgr ? ncnn::Mat::PIXEL_RGB2BGR : ncnn::Mat::PIXEL_RGB);
                 }
                 if (channels == 4)
                 {
-#if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGBA2BGRA);
-#else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGBA);
-#endif
+                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, output_bgr ? ncnn::Mat::PIXEL_RGBA2BGRA : ncnn::Mat::PIXEL_RGBA);
                 }
             }
         }
@@ -762,11 +1197,15 @@ int RealCUGAN::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
     const int h = inimage.h;
     const int channels = inimage.elempack;
 
-    const int TILE_SIZE_X = tilesize;
-    const int TILE_SIZE_Y = tilesize;
+    const TilePlan plan = tile_plan(w, h, tilesize, prepadding, realcugan_tile_align(scale));
+    const int TILE_SIZE_X = plan.tile_w;
+    const int TILE_SIZE_Y = plan.tile_h;
 
     ncnn::Option opt = net.opt;
 
+    TileArena* arena = tile_arenas->acquire();
+    arena->set_option(opt);
+
     // each tile 400x400
     const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
     const int ytiles = (h + TILE_SIZE_Y - 1) / TILE_SIZE_Y;
@@ -805,122 +1244,29 @@ int RealCUGAN::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
             int in_tile_x0 = std::max(xi * TILE_SIZE_X - prepadding, 0);
             int in_tile_x1 = std::min((xi + 1) * TILE_SIZE_X + prepadding_right, w);
 
-            // crop tile
-            ncnn::Mat in;
-            {
-                if (channels == 3)
-                {
-#if _WIN32
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_BGR2RGB, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#else
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_RGB, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#endif
-                }
-                if (channels == 4)
-                {
-#if _WIN32
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_BGRA2RGBA, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#else
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_RGBA, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#endif
-                }
-            }
+            unsigned char* outpixels = (unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels;
 
-            ncnn::Mat out;
+            int pad_top = std::max(prepadding - yi * TILE_SIZE_Y, 0);
+            int pad_bottom = std::max(std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom - h, prepadding_bottom), 0);
+            int pad_left = std::max(prepadding - xi * TILE_SIZE_X, 0);
+            int pad_right = std::max(std::min((xi + 1) * TILE_SIZE_X + prepadding_right - w, prepadding_right), 0);
 
             if (tta_mode)
             {
-                // split alpha and preproc
+                // crop, preproc and border padding
                 ncnn::Mat in_tile[8];
-                ncnn::Mat in_alpha_tile, in_alpah_tile_nocrop;
+                ncnn::Mat in_alpha_tile;
                 {
-                    in_tile[0].create(in.w, in.h, 3);
-                    for (int q = 0; q < 3; q++)
-                    {
-                        const float* ptr = in.channel(q);
-                        float* outptr0 = in_tile[0].channel(q);
-
-                        for (int i = 0; i < in.h; i++)
-                        {
-                            for (int j = 0; j < in.w; j++)
-                            {
-                                *outptr0++ = *ptr++ * (1 / 255.f);
-                            }
-                        }
-                    }
+                    tile_from_pixels(pixeldata, w, channels, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0, pad_top, pad_bottom, pad_left, pad_right, ncnn::BORDER_REFLECT, *tile_kernels, in_tile[0], opt.blob_allocator, input_bgr);
 
                     if (channels == 4)
                     {
-                        in_alpah_tile_nocrop = in.channel_range(3, 1).clone();
-                        int crop_top=(yi*TILE_SIZE_Y-in_tile_y0);
-                        int crop_bottom=in_tile_y1-std::min(yi*TILE_SIZE_Y+TILE_SIZE_Y ,h);
-                        int crop_left=(xi*TILE_SIZE_X-in_tile_x0);
-                        int crop_right=in_tile_x1-std::min(xi*TILE_SIZE_X+TILE_SIZE_X ,w);
-                        ncnn::copy_cut_border(in_alpah_tile_nocrop, in_alpha_tile, crop_top, crop_bottom, crop_left, crop_right);
-
+                        tile_alpha_from_pixels(pixeldata, w, xi * TILE_SIZE_X, yi * TILE_SIZE_Y, tile_w_nopad, tile_h_nopad, in_alpha_tile, opt.blob_allocator);
                     }
                 }
 
-                // border padding
-                {
-                    int pad_top = std::max(prepadding - yi * TILE_SIZE_Y, 0);
-                    int pad_bottom = std::max(std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom - h, prepadding_bottom), 0);
-                    int pad_left = std::max(prepadding - xi * TILE_SIZE_X, 0);
-                    int pad_right = std::max(std::min((xi + 1) * TILE_SIZE_X + prepadding_right - w, prepadding_right), 0);
-
-                    ncnn::Mat in_tile_padded;
-                    ncnn::copy_make_border(in_tile[0], in_tile_padded, pad_top, pad_bottom, pad_left, pad_right, 2, 0.f, net.opt);
-                    in_tile[0] = in_tile_padded;
-                }
-
                 // the other 7 directions
-                {
-                    in_tile[1].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[2].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[3].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[4].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[5].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[6].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[7].create(in_tile[0].h, in_tile[0].w, 3);
-
-                    for (int q = 0; q < 3; q++)
-                    {
-                        const ncnn::Mat in_tile_0 = in_tile[0].channel(q);
-                        ncnn::Mat in_tile_1 = in_tile[1].channel(q);
-                        ncnn::Mat in_tile_2 = in_tile[2].channel(q);
-                        ncnn::Mat in_tile_3 = in_tile[3].channel(q);
-                        ncnn::Mat in_tile_4 = in_tile[4].channel(q);
-                        ncnn::Mat in_tile_5 = in_tile[5].channel(q);
-                        ncnn::Mat in_tile_6 = in_tile[6].channel(q);
-                        ncnn::Mat in_tile_7 = in_tile[7].channel(q);
-
-                        for (int i = 0; i < in_tile[0].h; i++)
-                        {
-                            const float* outptr0 = in_tile_0.row(i);
-                            float* outptr1 = in_tile_1.row(in_tile[0].h - 1 - i);
-                            float* outptr2 = in_tile_2.row(i) + in_tile[0].w - 1;
-                            float* outptr3 = in_tile_3.row(in_tile[0].h - 1 - i) + in_tile[0].w - 1;
-
-                            for (int j = 0; j < in_tile[0].w; j++)
-                            {
-                                float* outptr4 = in_tile_4.row(j) + i;
-                                float* outptr5 = in_tile_5.row(in_tile[0].w - 1 - j) + i;
-                                float* outptr6 = in_tile_6.row(j) + in_tile[0].h - 1 - i;
-                                float* outptr7 = in_tile_7.row(in_tile[0].w - 1 - j) + in_tile[0].h - 1 - i;
-
-                                float v = *outptr0++;
-
-                                *outptr1++ = v;
-                                *outptr2-- = v;
-                                *outptr3-- = v;
-                                *outptr4 = v;
-                                *outptr5 = v;
-                                *outptr6 = v;
-                                *outptr7 = v;
-                            }
-                        }
-                    }
-                }
+                tta_transform(in_tile, opt.blob_allocator);
 
                 // realcugan
                 ncnn::Mat out_tile[8];
@@ -928,6 +1274,8 @@ int RealCUGAN::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                 {
                     ncnn::Extractor ex = net.create_extractor();
 
+                    arena->set_extractor(ex);
+
                     ex.input("in0", in_tile[ti]);
 
                     ex.extract("out0", out_tile[ti]);
@@ -956,132 +1304,40 @@ int RealCUGAN::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
 
                 // postproc and merge alpha
                 {
-                    out.create(tile_w_nopad * scale, tile_h_nopad * scale, channels);
+                    ncnn::Mat out;
+                    tta_merge(out_tile, 0, 0, tile_w_nopad * scale, tile_h_nopad * scale, out, opt.blob_allocator);
+
                     if (scale == 4)
                     {
-                        for (int q = 0; q < 3; q++)
-                        {
-                            const ncnn::Mat out_tile_0 = out_tile[0].channel(q);
-                            const ncnn::Mat out_tile_1 = out_tile[1].channel(q);
-                            const ncnn::Mat out_tile_2 = out_tile[2].channel(q);
-                            const ncnn::Mat out_tile_3 = out_tile[3].channel(q);
-                            const ncnn::Mat out_tile_4 = out_tile[4].channel(q);
-                            const ncnn::Mat out_tile_5 = out_tile[5].channel(q);
-                            const ncnn::Mat out_tile_6 = out_tile[6].channel(q);
-                            const ncnn::Mat out_tile_7 = out_tile[7].channel(q);
-                            float* outptr = out.channel(q);
-
-                            for (int i = 0; i < out.h; i++)
-                            {
-                                const float* inptr = in_tile[0].channel(q).row(prepadding + i / 4) + prepadding;
-                                const float* ptr0 = out_tile_0.row(i);
-                                const float* ptr1 = out_tile_1.row(out_tile[0].h - 1 - i);
-                                const float* ptr2 = out_tile_2.row(i) + out_tile[0].w - 1;
-                                const float* ptr3 = out_tile_3.row(out_tile[0].h - 1 - i) + out_tile[0].w - 1;
-
-                                for (int j = 0; j < out.w; j++)
-                                {
-                                    const float* ptr4 = out_tile_4.row(j) + i;
-                                    const float* ptr5 = out_tile_5.row(out_tile[0].w - 1 - j) + i;
-                                    const float* ptr6 = out_tile_6.row(j) + out_tile[0].h - 1 - i;
-                                    const float* ptr7 = out_tile_7.row(out_tile[0].w - 1 - j) + out_tile[0].h - 1 - i;
-
-                                    float v = (*ptr0++ + *ptr1++ + *ptr2-- + *ptr3-- + *ptr4 + *ptr5 + *ptr6 + *ptr7) / 8;
-
-                                    *outptr++ = v * 255.f + 0.5f + inptr[j / 4] * 255.f;
-                                }
-                            }
-                        }
+                        tile_to_pixels_residual(out, 0, 0, out.w, out.h, in_tile[0], prepadding, prepadding, 4, out_alpha_tile, *tile_kernels, outpixels, w * scale * channels, channels, output_bgr);
                     }
                     else
                     {
-                        for (int q = 0; q < 3; q++)
-                        {
-                            const ncnn::Mat out_tile_0 = out_tile[0].channel(q);
-                            const ncnn::Mat out_tile_1 = out_tile[1].channel(q);
-                            const ncnn::Mat out_tile_2 = out_tile[2].channel(q);
-                            const ncnn::Mat out_tile_3 = out_tile[3].channel(q);
-                            const ncnn::Mat out_tile_4 = out_tile[4].channel(q);
-                            const ncnn::Mat out_tile_5 = out_tile[5].channel(q);
-                            const ncnn::Mat out_tile_6 = out_tile[6].channel(q);
-                            const ncnn::Mat out_tile_7 = out_tile[7].channel(q);
-                            float* outptr = out.channel(q);
-
-                            for (int i = 0; i < out.h; i++)
-                            {
-                                const float* ptr0 = out_tile_0.row(i);
-                                const float* ptr1 = out_tile_1.row(out_tile[0].h - 1 - i);
-                                const float* ptr2 = out_tile_2.row(i) + out_tile[0].w - 1;
-                                const float* ptr3 = out_tile_3.row(out_tile[0].h - 1 - i) + out_tile[0].w - 1;
-
-                                for (int j = 0; j < out.w; j++)
-                                {
-                                    const float* ptr4 = out_tile_4.row(j) + i;
-                                    const float* ptr5 = out_tile_5.row(out_tile[0].w - 1 - j) + i;
-                                    const float* ptr6 = out_tile_6.row(j) + out_tile[0].h - 1 - i;
-                                    const float* ptr7 = out_tile_7.row(out_tile[0].w - 1 - j) + out_tile[0].h - 1 - i;
-
-                                    float v = (*ptr0++ + *ptr1++ + *ptr2-- + *ptr3-- + *ptr4 + *ptr5 + *ptr6 + *ptr7) / 8;
-
-                                    *outptr++ = v * 255.f + 0.5f;
-                                }
-                            }
-                        }
-                    }
-
-                    if (channels == 4)
-                    {
-                        memcpy(out.channel_range(3, 1), out_alpha_tile, out_alpha_tile.total() * sizeof(float));
+                        tile_to_pixels(out, 0, 0, out.w, out.h, out_alpha_tile, *tile_kernels, outpixels, w * scale * channels, channels, output_bgr);
                     }
                 }
             }
             else
             {
-                // split alpha and preproc
+                // crop, preproc and border padding
                 ncnn::Mat in_tile;
-                ncnn::Mat in_alpha_tile, in_alpah_tile_nocrop;
+                ncnn::Mat in_alpha_tile;
                 {
-                    in_tile.create(in.w, in.h, 3);
-                    for (int q = 0; q < 3; q++)
-                    {
-                        const float* ptr = in.channel(q);
-                        float* outptr = in_tile.channel(q);
-
-                        for (int i = 0; i < in.w * in.h; i++)
-                        {
-                            *outptr++ = *ptr++ * (1 / 255.f);
-                        }
-                    }
+                    tile_from_pixels(pixeldata, w, channels, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0, pad_top, pad_bottom, pad_left, pad_right, ncnn::BORDER_REFLECT, *tile_kernels, in_tile, opt.blob_allocator, input_bgr);
 
                     if (channels == 4)
                     {
-                        in_alpah_tile_nocrop = in.channel_range(3, 1).clone();
-                        int crop_top=(yi*TILE_SIZE_Y-in_tile_y0);
-                        int crop_bottom=in_tile_y1-std::min(yi*TILE_SIZE_Y+TILE_SIZE_Y ,h);
-                        int crop_left=(xi*TILE_SIZE_X-in_tile_x0);
-                        int crop_right=in_tile_x1-std::min(xi*TILE_SIZE_X+TILE_SIZE_X ,w);
-                        ncnn::copy_cut_border(in_alpah_tile_nocrop, in_alpha_tile, crop_top, crop_bottom, crop_left, crop_right);
-
+                        tile_alpha_from_pixels(pixeldata, w, xi * TILE_SIZE_X, yi * TILE_SIZE_Y, tile_w_nopad, tile_h_nopad, in_alpha_tile, opt.blob_allocator);
                     }
                 }
 
-                // border padding
-                {
-                    int pad_top = std::max(prepadding - yi * TILE_SIZE_Y, 0);
-                    int pad_bottom = std::max(std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom - h, prepadding_bottom), 0);
-                    int pad_left = std::max(prepadding - xi * TILE_SIZE_X, 0);
-                    int pad_right = std::max(std::min((xi + 1) * TILE_SIZE_X + prepadding_right - w, prepadding_right), 0);
-
-                    ncnn::Mat in_tile_padded;
-                    ncnn::copy_make_border(in_tile, in_tile_padded, pad_top, pad_bottom, pad_left, pad_right, 2, 0.f, net.opt);
-                    in_tile = in_tile_padded;
-                }
-
                 // realcugan
                 ncnn::Mat out_tile;
                 {
                     ncnn::Extractor ex = net.create_extractor();
 
+                    arena->set_extractor(ex);
+
                     ex.input("in0", in_tile);
 
                     ex.extract("out0", out_tile);
@@ -1109,74 +1365,25 @@ int RealCUGAN::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                 }
 
                 // postproc and merge alpha
+                if (scale == 4)
                 {
-                    out.create(tile_w_nopad * scale, tile_h_nopad * scale, channels);
-                    if (scale == 4)
-                    {
-                        for (int q = 0; q < 3; q++)
-                        {
-                            float* outptr = out.channel(q);
-
-                            for (int i = 0; i < out.h; i++)
-                            {
-                                const float* inptr = in_tile.channel(q).row(prepadding + i / 4) + prepadding;
-                                const float* ptr = out_tile.channel(q).row(i);
-
-                                for (int j = 0; j < out.w; j++)
-                                {
-                                    *outptr++ = *ptr++ * 255.f + 0.5f + inptr[j / 4] * 255.f;
-                                }
-                            }
-                        }
-                    }
-                    else
-                    {
-                        for (int q = 0; q < 3; q++)
-                        {
-                            float* outptr = out.channel(q);
-
-                            for (int i = 0; i < out.h; i++)
-                            {
-                                const float* ptr = out_tile.channel(q).row(i);
-
-                                for (int j = 0; j < out.w; j++)
-                                {
-                                    *outptr++ = *ptr++ * 255.f + 0.5f;
-                                }
-                            }
-                        }
-                    }
-
-                    if (channels == 4)
-                    {
-                        memcpy(out.channel_range(3, 1), out_alpha_tile, out_alpha_tile.total() * sizeof(float));
-                    }
-                }
-            }
-
-            {
-                if (channels == 3)
-                {
-#if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGB2BGR, w * scale * channels);
-#else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGB, w * scale * channels);
-#endif
+                    tile_to_pixels_residual(out_tile, 0, 0, tile_w_nopad * scale, tile_h_nopad * scale, in_tile, prepadding, prepadding, 4, out_alpha_tile, *tile_kernels, outpixels, w * scale * channels, channels, output_bgr);
                 }
-                if (channels == 4)
+                else
                 {
-#if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGBA2BGRA, w * scale * channels);
-#else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGBA, w * scale * channels);
-#endif
+                    tile_to_pixels(out_tile, 0, 0, tile_w_nopad * scale, tile_h_nopad * scale, out_alpha_tile, *tile_kernels, outpixels, w * scale * channels, channels, output_bgr);
                 }
             }
 
-            fprintf(stderr, "%.2f%%\n", (float)(yi * xtiles + xi) / (ytiles * xtiles) * 100);
+            if (progress_callback)
+                progress_callback(progress_userdata, (float)(yi * xtiles + xi + 1) / (ytiles * xtiles));
+            else
+                fprintf(stderr, "%.2f%%\n", (float)(yi * xtiles + xi) / (ytiles * xtiles) * 100);
         }
     }
 
+    tile_arenas->reclaim(arena);
+
     return 0;
 }
 
@@ -1190,45 +1397,54 @@ int RealCUGAN::process_se(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
     opt.workspace_vkallocator = blob_vkallocator;
     opt.staging_vkallocator = staging_vkallocator;
 
-    FeatureCache cache;
+    const TilePlan plan = tile_plan(inimage.w, inimage.h, tilesize, prepadding, realcugan_tile_align(scale));
+    FeatureCache cache(plan.xtiles, plan.ytiles, tta_mode, syncgap_budget);
 
-    std::vector<std::string> in0 = {};
-    std::vector<std::string> out0 = {"gap0"};
-    process_se_stage0(inimage, in0, out0, opt, cache);
+    std::vector<int> in0 = {};
+    std::vector<int> out0 = {0};
+    int ret = process_se_stage0(inimage, in0, out0, opt, cache);
 
-    std::vector<std::string> gap0 = {"gap0"};
-    process_se_sync_gap(inimage, gap0, opt, cache);
+    std::vector<int> gap0 = {0};
+    if (ret == 0)
+        ret = process_se_sync_gap(inimage, gap0, opt, cache);
 
-    std::vector<std::string> in1 = {"gap0"};
-    std::vector<std::string> out1 = {"gap1"};
-    process_se_stage0(inimage, in1, out1, opt, cache);
+    std::vector<int> in1 = {0};
+    std::vector<int> out1 = {1};
+    if (ret == 0)
+        ret = process_se_stage0(inimage, in1, out1, opt, cache);
 
-    std::vector<std::string> gap1 = {"gap1"};
-    process_se_sync_gap(inimage, gap1, opt, cache);
+    std::vector<int> gap1 = {1};
+    if (ret == 0)
+        ret = process_se_sync_gap(inimage, gap1, opt, cache);
 
-    std::vector<std::string> in2 = {"gap0", "gap1"};
-    std::vector<std::string> out2 = {"gap2"};
-    process_se_stage0(inimage, in2, out2, opt, cache);
+    std::vector<int> in2 = {0, 1};
+    std::vector<int> out2 = {2};
+    if (ret == 0)
+        ret = process_se_stage0(inimage, in2, out2, opt, cache);
 
-    std::vector<std::string> gap2 = {"gap2"};
-    process_se_sync_gap(inimage, gap2, opt, cache);
+    std::vector<int> gap2 = {2};
+    if (ret == 0)
+        ret = process_se_sync_gap(inimage, gap2, opt, cache);
 
-    std::vector<std::string> in3 = {"gap0", "gap1", "gap2"};
-    std::vector<std::string> out3 = {"gap3"};
-    process_se_stage0(inimage, in3, out3, opt, cache);
+    std::vector<int> in3 = {0, 1, 2};
+    std::vector<int> out3 = {3};
+    if (ret == 0)
+        ret = process_se_stage0(inimage, in3, out3, opt, cache);
 
-    std::vector<std::string> gap3 = {"gap3"};
-    process_se_sync_gap(inimage, gap3, opt, cache);
+    std::vector<int> gap3 = {3};
+    if (ret == 0)
+        ret = process_se_sync_gap(inimage, gap3, opt, cache);
 
-    std::vector<std::string> in4 = {"gap0", "gap1", "gap2", "gap3"};
-    process_se_stage2(inimage, in4, outimage, opt, cache);
+    std::vector<int> in4 = {0, 1, 2, 3};
+    if (ret == 0)
+        ret = process_se_stage2(inimage, in4, outimage, opt, cache);
 
     cache.clear();
 
     vkdev->reclaim_blob_allocator(blob_vkallocator);
     vkdev->reclaim_staging_allocator(staging_vkallocator);
 
-    return 0;
+    return ret;
 }
 
 int RealCUGAN::process_se_rough(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
@@ -1241,24 +1457,27 @@ int RealCUGAN::process_se_rough(const ncnn::Mat& inimage, ncnn::Mat& outimage) c
     opt.workspace_vkallocator = blob_vkallocator;
     opt.staging_vkallocator = staging_vkallocator;
 
-    FeatureCache cache;
+    const TilePlan plan = tile_plan(inimage.w, inimage.h, tilesize, prepadding, realcugan_tile_align(scale));
+    FeatureCache cache(plan.xtiles, plan.ytiles, tta_mode, syncgap_budget);
 
-    std::vector<std::string> in0 = {};
-    std::vector<std::string> out0 = {"gap0", "gap1", "gap2", "gap3"};
-    process_se_stage0(inimage, in0, out0, opt, cache);
+    std::vector<int> in0 = {};
+    std::vector<int> out0 = {0, 1, 2, 3};
+    int ret = process_se_stage0(inimage, in0, out0, opt, cache);
 
-    std::vector<std::string> gap0 = {"gap0", "gap1", "gap2", "gap3"};
-    process_se_sync_gap(inimage, gap0, opt, cache);
+    std::vector<int> gap0 = {0, 1, 2, 3};
+    if (ret == 0)
+        ret = process_se_sync_gap(inimage, gap0, opt, cache);
 
-    std::vector<std::string> in4 = {"gap0", "gap1", "gap2", "gap3"};
-    process_se_stage2(inimage, in4, outimage, opt, cache);
+    std::vector<int> in4 = {0, 1, 2, 3};
+    if (ret == 0)
+        ret = process_se_stage2(inimage, in4, outimage, opt, cache);
 
     cache.clear();
 
     vkdev->reclaim_blob_allocator(blob_vkallocator);
     vkdev->reclaim_staging_allocator(staging_vkallocator);
 
-    return 0;
+    return ret;
 }
 
 int RealCUGAN::process_se_very_rough(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
@@ -1271,113 +1490,140 @@ int RealCUGAN::process_se_very_rough(const ncnn::Mat& inimage, ncnn::Mat& outima
     opt.workspace_vkallocator = blob_vkallocator;
     opt.staging_vkallocator = staging_vkallocator;
 
-    FeatureCache cache;
+    // the gap walks 32x32 tiles, stage2 the planned ones
+    const TilePlan plan = tile_plan(inimage.w, inimage.h, tilesize, prepadding, realcugan_tile_align(scale));
+    const int gap_tilesize = std::min(tilesize, 32);
+    const int gap_xtiles = (inimage.w + gap_tilesize - 1) / gap_tilesize;
+    const int gap_ytiles = (inimage.h + gap_tilesize - 1) / gap_tilesize;
+    FeatureCache cache(std::max(plan.xtiles, gap_xtiles), std::max(plan.ytiles, gap_ytiles), tta_mode, syncgap_budget);
 
-    std::vector<std::string> in0 = {};
-    std::vector<std::string> out0 = {"gap0", "gap1", "gap2", "gap3"};
-    process_se_very_rough_stage0(inimage, in0, out0, opt, cache);
+    std::vector<int> in0 = {};
+    std::vector<int> out0 = {0, 1, 2, 3};
+    int ret = process_se_very_rough_stage0(inimage, in0, out0, opt, cache);
 
-    std::vector<std::string> gap0 = {"gap0", "gap1", "gap2", "gap3"};
-    process_se_very_rough_sync_gap(inimage, gap0, opt, cache);
+    std::vector<int> gap0 = {0, 1, 2, 3};
+    if (ret == 0)
+        ret = process_se_very_rough_sync_gap(inimage, gap0, opt, cache);
 
-    std::vector<std::string> in4 = {"gap0", "gap1", "gap2", "gap3"};
-    process_se_stage2(inimage, in4, outimage, opt, cache);
+    std::vector<int> in4 = {0, 1, 2, 3};
+    if (ret == 0)
+        ret = process_se_stage2(inimage, in4, outimage, opt, cache);
 
     cache.clear();
 
     vkdev->reclaim_blob_allocator(blob_vkallocator);
     vkdev->reclaim_staging_allocator(staging_vkallocator);
 
-    return 0;
+    return ret;
 }
 
 int RealCUGAN::process_cpu_se(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
 {
-    FeatureCache cache;
+    const TilePlan plan = tile_plan(inimage.w, inimage.h, tilesize, prepadding, realcugan_tile_align(scale));
+    FeatureCache cache(plan.xtiles, plan.ytiles, tta_mode, 0);
 
-    std::vector<std::string> in0 = {};
-    std::vector<std::string> out0 = {"gap0"};
-    process_cpu_se_stage0(inimage, in0, out0, cache);
+    std::vector<int> in0 = {};
+    std::vector<int> out0 = {0};
+    int ret = process_cpu_se_stage0(inimage, in0, out0, cache);
 
-    std::vector<std::string> gap0 = {"gap0"};
-    process_cpu_se_sync_gap(inimage, gap0, cache);
+    std::vector<int> gap0 = {0};
+    if (ret == 0)
+        ret = process_cpu_se_sync_gap(inimage, gap0, cache);
 
-    std::vector<std::string> in1 = {"gap0"};
-    std::vector<std::string> out1 = {"gap1"};
-    process_cpu_se_stage0(inimage, in1, out1, cache);
+    std::vector<int> in1 = {0};
+    std::vector<int> out1 = {1};
+    if (ret == 0)
+        ret = process_cpu_se_stage0(inimage, in1, out1, cache);
 
-    std::vector<std::string> gap1 = {"gap1"};
-    process_cpu_se_sync_gap(inimage, gap1, cache);
+    std::vector<int> gap1 = {1};
+    if (ret == 0)
+        ret = process_cpu_se_sync_gap(inimage, gap1, cache);
 
-    std::vector<std::string> in2 = {"gap0", "gap1"};
-    std::vector<std::string> out2 = {"gap2"};
-    process_cpu_se_stage0(inimage, in2, out2, cache);
+    std::vector<int> in2 = {0, 1};
+    std::vector<int> out2 = {2};
+    if (ret == 0)
+        ret = process_cpu_se_stage0(inimage, in2, out2, cache);
 
-    std::vector<std::string> gap2 = {"gap2"};
-    process_cpu_se_sync_gap(inimage, gap2, cache);
+    std::vector<int> gap2 = {2};
+    if (ret == 0)
+        ret = process_cpu_se_sync_gap(inimage, gap2, cache);
 
-    std::vector<std::string> in3 = {"gap0", "gap1", "gap2"};
-    std::vector<std::string> out3 = {"gap3"};
-    process_cpu_se_stage0(inimage, in3, out3, cache);
+    std::vector<int> in3 = {0, 1, 2};
+    std::vector<int> out3 = {3};
+    if (ret == 0)
+        ret = process_cpu_se_stage0(inimage, in3, out3, cache);
 
-    std::vector<std::string> gap3 = {"gap3"};
-    process_cpu_se_sync_gap(inimage, gap3, cache);
+    std::vector<int> gap3 = {3};
+    if (ret == 0)
+        ret = process_cpu_se_sync_gap(inimage, gap3, cache);
 
-    std::vector<std::string> in4 = {"gap0", "gap1", "gap2", "gap3"};
-    process_cpu_se_stage2(inimage, in4, outimage, cache);
+    std::vector<int> in4 = {0, 1, 2, 3};
+    if (ret == 0)
+        ret = process_cpu_se_stage2(inimage, in4, outimage, cache);
 
     cache.clear();
 
-    return 0;
+    return ret;
 }
 
 int RealCUGAN::process_cpu_se_rough(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
 {
-    FeatureCache cache;
+    const TilePlan plan = tile_plan(inimage.w, inimage.h, tilesize, prepadding, realcugan_tile_align(scale));
+    FeatureCache cache(plan.xtiles, plan.ytiles, tta_mode, 0);
 
-    std::vector<std::string> in0 = {};
-    std::vector<std::string> out0 = {"gap0", "gap1", "gap2", "gap3"};
-    process_cpu_se_stage0(inimage, in0, out0, cache);
+    std::vector<int> in0 = {};
+    std::vector<int> out0 = {0, 1, 2, 3};
+    int ret = process_cpu_se_stage0(inimage, in0, out0, cache);
 
-    std::vector<std::string> gap0 = {"gap0", "gap1", "gap2", "gap3"};
-    process_cpu_se_sync_gap(inimage, gap0, cache);
+    std::vector<int> gap0 = {0, 1, 2, 3};
+    if (ret == 0)
+        ret = process_cpu_se_sync_gap(inimage, gap0, cache);
 
-    std::vector<std::string> in4 = {"gap0", "gap1", "gap2", "gap3"};
-    process_cpu_se_stage2(inimage, in4, outimage, cache);
+    std::vector<int> in4 = {0, 1, 2, 3};
+    if (ret == 0)
+        ret = process_cpu_se_stage2(inimage, in4, outimage, cache);
 
     cache.clear();
 
-    return 0;
+    return ret;
 }
 
 int RealCUGAN::process_cpu_se_very_rough(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
 {
-    FeatureCache cache;
+    // the gap walks 32x32 tiles, stage2 the planned ones
+    const TilePlan plan = tile_plan(inimage.w, inimage.h, tilesize, prepadding, realcugan_tile_align(scale));
+    const int gap_tilesize = std::min(tilesize, 32);
+    const int gap_xtiles = (inimage.w + gap_tilesize - 1) / gap_tilesize;
+    const int gap_ytiles = (inimage.h + gap_tilesize - 1) / gap_tilesize;
+    FeatureCache cache(std::max(plan.xtiles, gap_xtiles), std::max(plan.ytiles, gap_ytiles), tta_mode, 0);
 
-    std::vector<std::string> in0 = {};
-    std::vector<std::string> out0 = {"gap0", "gap1", "gap2", "gap3"};
-    process_cpu_se_very_rough_stage0(inimage, in0, out0, cache);
+    std::vector<int> in0 = {};
+    std::vector<int> out0 = {0, 1, 2, 3};
+    int ret = process_cpu_se_very_rough_stage0(inimage, in0, out0, cache);
 
-    std::vector<std::string> gap0 = {"gap0", "gap1", "gap2", "gap3"};
-    process_cpu_se_very_rough_sync_gap(inimage, gap0, cache);
+    std::vector<int> gap0 = {0, 1, 2, 3};
+    if (ret == 0)
+        ret = process_cpu_se_very_rough_sync_gap(inimage, gap0, cache);
 
-    std::vector<std::string> in4 = {"gap0", "gap1", "gap2", "gap3"};
-    process_cpu_se_stage2(inimage, in4, outimage, cache);
+    std::vector<int> in4 = {0, 1, 2, 3};
+    if (ret == 0)
+        ret = process_cpu_se_stage2(inimage, in4, outimage, cache);
 
     cache.clear();
 
-    return 0;
+    return ret;
 }
 
-int RealCUGAN::process_se_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, const ncnn::Option& opt, FeatureCache& cache) const
+int RealCUGAN::process_se_stage0(const ncnn::Mat& inimage, const std::vector<int>& slots, const std::vector<int>& outslots, const ncnn::Option& opt, FeatureCache& cache) const
 {
     const unsigned char* pixeldata = (const unsigned char*)inimage.data;
     const int w = inimage.w;
     const int h = inimage.h;
     const int channels = inimage.elempack;
 
-    const int TILE_SIZE_X = tilesize;
-    const int TILE_SIZE_Y = tilesize;
+    const TilePlan plan = tile_plan(w, h, tilesize, prepadding, realcugan_tile_align(scale));
+    const int TILE_SIZE_X = plan.tile_w;
+    const int TILE_SIZE_Y = plan.tile_h;
 
     // each tile 400x400
     const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
@@ -1412,19 +1658,11 @@ int RealCUGAN::process_se_stage0(const ncnn::Mat& inimage, const std::vector<std
         {
             if (channels == 3)
             {
-#if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGR2RGB, w, (in_tile_y1 - in_tile_y0));
-#else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
-#endif
+                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, input_bgr ? ncnn::Mat::PIXEL_BGR2RGB : ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
             }
             if (channels == 4)
             {
-#if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGRA2RGBA, w, (in_tile_y1 - in_tile_y0));
-#else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
-#endif
+                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, input_bgr ? ncnn::Mat::PIXEL_BGRA2RGBA : ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
             }
         }
 
@@ -1542,20 +1780,20 @@ int RealCUGAN::process_se_stage0(const ncnn::Mat& inimage, const std::vector<std
 
                     ex.input("in0", in_tile_gpu[ti]);
 
-                    for (size_t i = 0; i < names.size(); i++)
+                    for (size_t i = 0; i < slots.size(); i++)
                     {
                         ncnn::VkMat feat;
-                        cache.load(yi, xi, ti, names[i], feat);
+                        cache.load(yi, xi, ti, slots[i], feat, cmd, opt);
 
-                        ex.input(names[i].c_str(), feat);
+                        ex.input(feature_blobs[slots[i]], feat);
                     }
 
-                    for (size_t i = 0; i < outnames.size(); i++)
+                    for (size_t i = 0; i < outslots.size(); i++)
                     {
                         ncnn::VkMat feat;
-                        ex.extract(outnames[i].c_str(), feat, cmd);
+                        ex.extract(feature_blobs[outslots[i]], feat, cmd);
 
-                        cache.save(yi, xi, ti, outnames[i], feat);
+                        cache.accumulate(yi, xi, ti, outslots[i], feat, realcugan_feature_sum, cmd, opt);
                     }
                 }
             }
@@ -1616,20 +1854,20 @@ int RealCUGAN::process_se_stage0(const ncnn::Mat& inimage, const std::vector<std
 
                     ex.input("in0", in_tile_gpu);
 
-                    for (size_t i = 0; i < names.size(); i++)
+                    for (size_t i = 0; i < slots.size(); i++)
                     {
                         ncnn::VkMat feat;
-                        cache.load(yi, xi, 0, names[i], feat);
+                        cache.load(yi, xi, 0, slots[i], feat, cmd, opt);
 
-                        ex.input(names[i].c_str(), feat);
+                        ex.input(feature_blobs[slots[i]], feat);
                     }
 
-                    for (size_t i = 0; i < outnames.size(); i++)
+                    for (size_t i = 0; i < outslots.size(); i++)
                     {
                         ncnn::VkMat feat;
-                        ex.extract(outnames[i].c_str(), feat, cmd);
+                        ex.extract(feature_blobs[outslots[i]], feat, cmd);
 
-                        cache.save(yi, xi, 0, outnames[i], feat);
+                        cache.accumulate(yi, xi, 0, outslots[i], feat, realcugan_feature_sum, cmd, opt);
                     }
                 }
             }
@@ -1643,20 +1881,24 @@ int RealCUGAN::process_se_stage0(const ncnn::Mat& inimage, const std::vector<std
 
         cmd.submit_and_wait();
         cmd.reset();
+
+        // move what is over the budget off the gpu once the row is done
+        cache.spill(cmd, opt);
     }
 
     return 0;
 }
 
-int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std::string>& names, ncnn::Mat& outimage, const ncnn::Option& opt, FeatureCache& cache) const
+int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<int>& slots, ncnn::Mat& outimage, const ncnn::Option& opt, FeatureCache& cache) const
 {
     const unsigned char* pixeldata = (const unsigned char*)inimage.data;
     const int w = inimage.w;
     const int h = inimage.h;
     const int channels = inimage.elempack;
 
-    const int TILE_SIZE_X = tilesize;
-    const int TILE_SIZE_Y = tilesize;
+    const TilePlan plan = tile_plan(w, h, tilesize, prepadding, realcugan_tile_align(scale));
+    const int TILE_SIZE_X = plan.tile_w;
+    const int TILE_SIZE_Y = plan.tile_h;
 
     // each tile 400x400
     const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
@@ -1691,19 +1933,11 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
         {
             if (channels == 3)
             {
-#if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGR2RGB, w, (in_tile_y1 - in_tile_y0));
-#else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
-#endif
+                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, input_bgr ? ncnn::Mat::PIXEL_BGR2RGB : ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
             }
             if (channels == 4)
             {
-#if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGRA2RGBA, w, (in_tile_y1 - in_tile_y0));
-#else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
-#endif
+                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, input_bgr ? ncnn::Mat::PIXEL_BGRA2RGBA : ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
             }
         }
 
@@ -1821,12 +2055,12 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
 
                     ex.input("in0", in_tile_gpu[ti]);
 
-                    for (size_t i = 0; i < names.size(); i++)
+                    for (size_t i = 0; i < slots.size(); i++)
                     {
                         ncnn::VkMat feat;
-                        cache.load(yi, xi, ti, names[i], feat);
+                        cache.load(yi, xi, ti, slots[i], feat, cmd, opt);
 
-                        ex.input(names[i].c_str(), feat);
+                        ex.input(feature_blobs[slots[i]], feat);
                     }
 
                     ex.extract("out0", out_tile_gpu[ti], cmd);
@@ -1987,12 +2221,12 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
 
                     ex.input("in0", in_tile_gpu);
 
-                    for (size_t i = 0; i < names.size(); i++)
+                    for (size_t i = 0; i < slots.size(); i++)
                     {
                         ncnn::VkMat feat;
-                        cache.load(yi, xi, 0, names[i], feat);
+                        cache.load(yi, xi, 0, slots[i], feat, cmd, opt);
 
-                        ex.input(names[i].c_str(), feat);
+                        ex.input(feature_blobs[slots[i]], feat);
                     }
 
                     ex.extract("out0", out_tile_gpu, cmd);
@@ -2089,7 +2323,10 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
             }
 
 
-            fprintf(stderr, "%.2f%%\n", (float)(yi * xtiles + xi) / (ytiles * xtiles) * 100);
+            if (progress_callback)
+                progress_callback(progress_userdata, (float)(yi * xtiles + xi + 1) / (ytiles * xtiles));
+            else
+                fprintf(stderr, "%.2f%%\n", (float)(yi * xtiles + xi) / (ytiles * xtiles) * 100);
         }
 
         // download
@@ -2109,19 +2346,11 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
             {
                 if (channels == 3)
                 {
-#if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGB2BGR);
-#else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGB);
-#endif
+                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, output_bgr ? ncnn::Mat::PIXEL_RGB2BGR : ncnn::Mat::PIXEL_RGB);
                 }
                 if (channels == 4)
                 {
-#if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGBA2BGRA);
-#else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGBA);
-#endif
+                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, output_bgr ? ncnn::Mat::PIXEL_RGBA2BGRA : ncnn::Mat::PIXEL_RGBA);
                 }
             }
         }
@@ -2130,116 +2359,33 @@ int RealCUGAN::process_se_stage2(const ncnn::Mat& inimage, const std::vector<std
     return 0;
 }
 
-int RealCUGAN::process_se_sync_gap(const ncnn::Mat& inimage, const std::vector<std::string>& names, const ncnn::Option& opt, FeatureCache& cache) const
+int RealCUGAN::process_se_sync_gap(const ncnn::Mat& inimage, const std::vector<int>& slots, const ncnn::Option& opt, FeatureCache& cache) const
 {
     const unsigned char* pixeldata = (const unsigned char*)inimage.data;
     const int w = inimage.w;
     const int h = inimage.h;
     const int channels = inimage.elempack;
 
-    const int TILE_SIZE_X = tilesize;
-    const int TILE_SIZE_Y = tilesize;
+    const TilePlan plan = tile_plan(w, h, tilesize, prepadding, realcugan_tile_align(scale));
+    const int TILE_SIZE_X = plan.tile_w;
+    const int TILE_SIZE_Y = plan.tile_h;
 
     // each tile 400x400
     const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
     const int ytiles = (h + TILE_SIZE_Y - 1) / TILE_SIZE_Y;
 
-    std::vector< std::vector<ncnn::VkMat> > feats(names.size());
-    for (int yi = 0; yi < ytiles; yi++)
-    {
-        for (int xi = 0; xi < xtiles; xi++)
-        {
-            {
-                for (size_t i = 0; i < names.size(); i++)
-                {
-                    if (tta_mode)
-                    {
-                        for (int ti = 0; ti < 8; ti++)
-                        {
-                            ncnn::VkMat feat;
-                            cache.load(yi, xi, ti, names[i], feat);
-
-                            feats[i].push_back(feat);
-                        }
-                    }
-                    else
-                    {
-                        ncnn::VkMat feat;
-                        cache.load(yi, xi, 0, names[i], feat);
-
-                        feats[i].push_back(feat);
-                    }
-                }
-            }
-        }
-    }
-
-    const int tiles = ytiles * xtiles * (tta_mode ? 8 : 1);
-
     ncnn::VkCompute cmd(vkdev);
 
-    // download
-    std::vector< std::vector<ncnn::Mat> > feats_cpu(names.size());
-    for (size_t i = 0; i < names.size(); i++)
-    {
-        feats_cpu[i].resize(tiles);
-
-        for (int j = 0; j < tiles; j++)
-        {
-            cmd.record_download(feats[i][j], feats_cpu[i][j], opt);
-        }
-    }
-
-    cmd.submit_and_wait();
-    cmd.reset();
-
     // global average
     // upload
-    std::vector<ncnn::VkMat> avgfeats(names.size());
-    for (size_t i = 0; i < names.size(); i++)
+    std::vector<ncnn::VkMat> avgfeats(slots.size());
+    for (size_t i = 0; i < slots.size(); i++)
     {
-        for (int j = 0; j < tiles; j++)
-        {
-            if (opt.use_fp16_storage && ncnn::cpu_support_arm_asimdhp() && feats_cpu[i][j].elembits() == 16)
-            {
-                ncnn::Mat feat_fp32;
-                ncnn::cast_float16_to_float32(feats_cpu[i][j], feat_fp32, opt);
-                feats_cpu[i][j] = feat_fp32;
-            }
-
-            if (opt.use_packing_layout && feats_cpu[i][j].elempack != 1)
-            {
-                ncnn::Mat feat_cpu_unpacked;
-                ncnn::convert_packing(feats_cpu[i][j], feat_cpu_unpacked, 1, opt);
-                feats_cpu[i][j] = feat_cpu_unpacked;
-            }
-        }
-
-        // handle feats_cpu[i] vector
-        {
-            ncnn::Mat avgfeat;
-            avgfeat.create_like(feats_cpu[i][0]);
-            avgfeat.fill(0.f);
-
-            int len = avgfeat.total();
+        ncnn::Mat avgfeat;
+        if (cache.average(slots[i], avgfeat, cmd, opt) != 0)
+            return -1;
 
-            for (int j = 0; j < tiles; j++)
-            {
-                const ncnn::Mat f = feats_cpu[i][j];
-
-                for (int k = 0; k < len; k++)
-                {
-                    avgfeat[k] += f[k];
-                }
-            }
-
-            for (int k = 0; k < len; k++)
-            {
-                avgfeat[k] /= tiles;
-            }
-
-            cmd.record_upload(avgfeat, avgfeats[i], opt);
-        }
+        cmd.record_upload(avgfeat, avgfeats[i], opt);
     }
 
     cmd.submit_and_wait();
@@ -2251,18 +2397,18 @@ int RealCUGAN::process_se_sync_gap(const ncnn::Mat& inimage, const std::vector<s
         for (int xi = 0; xi < xtiles; xi++)
         {
             {
-                for (size_t i = 0; i < names.size(); i++)
+                for (size_t i = 0; i < slots.size(); i++)
                 {
                     if (tta_mode)
                     {
                         for (int ti = 0; ti < 8; ti++)
                         {
-                            cache.save(yi, xi, ti, names[i], avgfeats[i]);
+                            cache.save_shared(yi, xi, ti, slots[i], avgfeats[i]);
                         }
                     }
                     else
                     {
-                        cache.save(yi, xi, 0, names[i], avgfeats[i]);
+                        cache.save_shared(yi, xi, 0, slots[i], avgfeats[i]);
                     }
                 }
             }
@@ -2272,7 +2418,7 @@ int RealCUGAN::process_se_sync_gap(const ncnn::Mat& inimage, const std::vector<s
     return 0;
 }
 
-int RealCUGAN::process_se_very_rough_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, const ncnn::Option& opt, FeatureCache& cache) const
+int RealCUGAN::process_se_very_rough_stage0(const ncnn::Mat& inimage, const std::vector<int>& slots, const std::vector<int>& outslots, const ncnn::Option& opt, FeatureCache& cache) const
 {
     const unsigned char* pixeldata = (const unsigned char*)inimage.data;
     const int w = inimage.w;
@@ -2315,19 +2461,11 @@ int RealCUGAN::process_se_very_rough_stage0(const ncnn::Mat& inimage, const std:
         {
             if (channels == 3)
             {
-#if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGR2RGB, w, (in_tile_y1 - in_tile_y0));
-#else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
-#endif
+                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, input_bgr ? ncnn::Mat::PIXEL_BGR2RGB : ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
             }
             if (channels == 4)
             {
-#if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGRA2RGBA, w, (in_tile_y1 - in_tile_y0));
-#else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
-#endif
+                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, input_bgr ? ncnn::Mat::PIXEL_BGRA2RGBA : ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
             }
         }
 
@@ -2445,20 +2583,20 @@ int RealCUGAN::process_se_very_rough_stage0(const ncnn::Mat& inimage, const std:
 
                     ex.input("in0", in_tile_gpu[ti]);
 
-                    for (size_t i = 0; i < names.size(); i++)
+                    for (size_t i = 0; i < slots.size(); i++)
                     {
                         ncnn::VkMat feat;
-                        cache.load(yi, xi, ti, names[i], feat);
+                        cache.load(yi, xi, ti, slots[i], feat, cmd, opt);
 
-                        ex.input(names[i].c_str(), feat);
+                        ex.input(feature_blobs[slots[i]], feat);
                     }
 
-                    for (size_t i = 0; i < outnames.size(); i++)
+                    for (size_t i = 0; i < outslots.size(); i++)
                     {
                         ncnn::VkMat feat;
-                        ex.extract(outnames[i].c_str(), feat, cmd);
+                        ex.extract(feature_blobs[outslots[i]], feat, cmd);
 
-                        cache.save(yi, xi, ti, outnames[i], feat);
+                        cache.accumulate(yi, xi, ti, outslots[i], feat, realcugan_feature_sum, cmd, opt);
                     }
                 }
             }
@@ -2519,20 +2657,20 @@ int RealCUGAN::process_se_very_rough_stage0(const ncnn::Mat& inimage, const std:
 
                     ex.input("in0", in_tile_gpu);
 
-                    for (size_t i = 0; i < names.size(); i++)
+                    for (size_t i = 0; i < slots.size(); i++)
                     {
                         ncnn::VkMat feat;
-                        cache.load(yi, xi, 0, names[i], feat);
+                        cache.load(yi, xi, 0, slots[i], feat, cmd, opt);
 
-                        ex.input(names[i].c_str(), feat);
+                        ex.input(feature_blobs[slots[i]], feat);
                     }
 
-                    for (size_t i = 0; i < outnames.size(); i++)
+                    for (size_t i = 0; i < outslots.size(); i++)
                     {
                         ncnn::VkMat feat;
-                        ex.extract(outnames[i].c_str(), feat, cmd);
+                        ex.extract(feature_blobs[outslots[i]], feat, cmd);
 
-                        cache.save(yi, xi, 0, outnames[i], feat);
+                        cache.accumulate(yi, xi, 0, outslots[i], feat, realcugan_feature_sum, cmd, opt);
                     }
                 }
             }
@@ -2546,12 +2684,15 @@ int RealCUGAN::process_se_very_rough_stage0(const ncnn::Mat& inimage, const std:
 
         cmd.submit_and_wait();
         cmd.reset();
+
+        // move what is over the budget off the gpu once the row is done
+        cache.spill(cmd, opt);
     }
 
     return 0;
 }
 
-int RealCUGAN::process_se_very_rough_sync_gap(const ncnn::Mat& inimage, const std::vector<std::string>& names, const ncnn::Option& opt, FeatureCache& cache) const
+int RealCUGAN::process_se_very_rough_sync_gap(const ncnn::Mat& inimage, const std::vector<int>& slots, const ncnn::Option& opt, FeatureCache& cache) const
 {
     const unsigned char* pixeldata = (const unsigned char*)inimage.data;
     const int w = inimage.w;
@@ -2565,102 +2706,18 @@ int RealCUGAN::process_se_very_rough_sync_gap(const ncnn::Mat& inimage, const st
     const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
     const int ytiles = (h + TILE_SIZE_Y - 1) / TILE_SIZE_Y;
 
-    std::vector< std::vector<ncnn::VkMat> > feats(names.size());
-    for (int yi = 0; yi + 2 < ytiles; yi += 3)
-    {
-        for (int xi = 0; xi + 2 < xtiles; xi += 3)
-        {
-            {
-                for (size_t i = 0; i < names.size(); i++)
-                {
-                    if (tta_mode)
-                    {
-                        for (int ti = 0; ti < 8; ti++)
-                        {
-                            ncnn::VkMat feat;
-                            cache.load(yi, xi, ti, names[i], feat);
-
-                            feats[i].push_back(feat);
-                        }
-                    }
-                    else
-                    {
-                        ncnn::VkMat feat;
-                        cache.load(yi, xi, 0, names[i], feat);
-
-                        feats[i].push_back(feat);
-                    }
-                }
-            }
-        }
-    }
-
-    const int tiles = (ytiles / 3) * (xtiles / 3) * (tta_mode ? 8 : 1);
-
     ncnn::VkCompute cmd(vkdev);
 
-    // download
-    std::vector< std::vector<ncnn::Mat> > feats_cpu(names.size());
-    for (size_t i = 0; i < names.size(); i++)
-    {
-        feats_cpu[i].resize(tiles);
-
-        for (int j = 0; j < tiles; j++)
-        {
-            cmd.record_download(feats[i][j], feats_cpu[i][j], opt);
-        }
-    }
-
-    cmd.submit_and_wait();
-    cmd.reset();
-
     // global average
     // upload
-    std::vector<ncnn::VkMat> avgfeats(names.size());
-    for (size_t i = 0; i < names.size(); i++)
+    std::vector<ncnn::VkMat> avgfeats(slots.size());
+    for (size_t i = 0; i < slots.size(); i++)
     {
-        for (int j = 0; j < tiles; j++)
-        {
-            if (opt.use_fp16_storage && ncnn::cpu_support_arm_asimdhp() && feats_cpu[i][j].elembits() == 16)
-            {
-                ncnn::Mat feat_fp32;
-                ncnn::cast_float16_to_float32(feats_cpu[i][j], feat_fp32, opt);
-                feats_cpu[i][j] = feat_fp32;
-            }
-
-            if (opt.use_packing_layout && feats_cpu[i][j].elempack != 1)
-            {
-                ncnn::Mat feat_cpu_unpacked;
-                ncnn::convert_packing(feats_cpu[i][j], feat_cpu_unpacked, 1, opt);
-                feats_cpu[i][j] = feat_cpu_unpacked;
-            }
-        }
-
-        // handle feats_cpu[i] vector
-        {
-            ncnn::Mat avgfeat;
-            avgfeat.create_like(feats_cpu[i][0]);
-            avgfeat.fill(0.f);
-
-            int len = avgfeat.total();
-
-            for (int j = 0; j < tiles; j++)
-            {
-                const ncnn::Mat f = feats_cpu[i][j];
-
-                for (int k = 0; k < len; k++)
-                {
-                    avgfeat[k] += f[k];
-                }
-            }
-
-            for (int k = 0; k < len; k++)
-            {
-                avgfeat[k] /= tiles;
-            }
+        ncnn::Mat avgfeat;
+        if (cache.average(slots[i], avgfeat, cmd, opt) != 0)
+            return -1;
 
-            cmd.record_upload(avgfeat, avgfeats[i], opt);
-        }
+        cmd.record_upload(avgfeat, avgfeats[i], opt);
     }
 
     cmd.submit_and_wait();
@@ -2672,34 +2729,34 @@ int RealCUGAN::process_se_very_rough_sync_gap(const ncnn::Mat& inimage, const st
         for (int xi = 0; xi + 2 < xtiles; xi += 3)
         {
             {
-                for (size_t i = 0; i < names.size(); i++)
+                for (size_t i = 0; i < slots.size(); i++)
                 {
                     if (tta_mode)
                     {
                         for (int ti = 0; ti < 8; ti++)
                         {
-                            cache.save(yi, xi, ti, names[i], avgfeats[i]);
-                            cache.save(yi, xi + 1, ti, names[i], avgfeats[i]);
-                            cache.save(yi, xi + 2, ti, names[i], avgfeats[i]);
-                            cache.save(yi + 1, xi, ti, names[i], avgfeats[i]);
-                            cache.save(yi + 1, xi + 1, ti, names[i], avgfeats[i]);
-                            cache.save(yi + 1, xi + 2, ti, names[i], avgfeats[i]);
-                            cache.save(yi + 2, xi, ti, names[i], avgfeats[i]);
-                            cache.save(yi + 2, xi + 1, ti, names[i], avgfeats[i]);
-                            cache.save(yi + 2, xi + 2, ti, names[i], avgfeats[i]);
+                            cache.save_shared(yi, xi, ti, slots[i], avgfeats[i]);
+                            cache.save_shared(yi, xi + 1, ti, slots[i], avgfeats[i]);
+                            cache.save_shared(yi, xi + 2, ti, slots[i], avgfeats[i]);
+                            cache.save_shared(yi + 1, xi, ti, slots[i], avgfeats[i]);
+                            cache.save_shared(yi + 1, xi + 1, ti, slots[i], avgfeats[i]);
+                            cache.save_shared(yi + 1, xi + 2, ti, slots[i], avgfeats[i]);
+                            cache.save_shared(yi + 2, xi, ti, slots[i], avgfeats[i]);
+                            cache.save_shared(yi + 2, xi + 1, ti, slots[i], avgfeats[i]);
+                            cache.save_shared(yi + 2, xi + 2, ti, slots[i], avgfeats[i]);
                         }
                     }
                     else
                     {
-                        cache.save(yi, xi, 0, names[i], avgfeats[i]);
-                        cache.save(yi, xi + 1, 0, names[i], avgfeats[i]);
-                        cache.save(yi, xi + 2, 0, names[i], avgfeats[i]);
-                        cache.save(yi + 1, xi, 0, names[i], avgfeats[i]);
-                        cache.save(yi + 1, xi + 1, 0, names[i], avgfeats[i]);
-                        cache.save(yi + 1, xi + 2, 0, names[i], avgfeats[i]);
-                        cache.save(yi + 2, xi, 0, names[i], avgfeats[i]);
-                        cache.save(yi + 2, xi + 1, 0, names[i], avgfeats[i]);
-                        cache.save(yi + 2, xi + 2, 0, names[i], avgfeats[i]);
+                        cache.save_shared(yi, xi, 0, slots[i], avgfeats[i]);
+                        cache.save_shared(yi, xi + 1, 0, slots[i], avgfeats[i]);
+                        cache.save_shared(yi, xi + 2, 0, slots[i], avgfeats[i]);
+                        cache.save_shared(yi + 1, xi, 0, slots[i], avgfeats[i]);
+                        cache.save_shared(yi + 1, xi + 1, 0, slots[i], avgfeats[i]);
+                        cache.save_shared(yi + 1, xi + 2, 0, slots[i], avgfeats[i]);
+                        cache.save_shared(yi + 2, xi, 0, slots[i], avgfeats[i]);
+                        cache.save_shared(yi + 2, xi + 1, 0, slots[i], avgfeats[i]);
+                        cache.save_shared(yi + 2, xi + 2, 0, slots[i], avgfeats[i]);
                     }
                 }
             }
@@ -2709,15 +2766,16 @@ int RealCUGAN::process_se_very_rough_sync_gap(const ncnn::Mat& inimage, const st
     return 0;
 }
 
-int RealCUGAN::process_cpu_se_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, FeatureCache& cache) const
+int RealCUGAN::process_cpu_se_stage0(const ncnn::Mat& inimage, const std::vector<int>& slots, const std::vector<int>& outslots, FeatureCache& cache) const
 {
     const unsigned char* pixeldata = (const unsigned char*)inimage.data;
     const int w = inimage.w;
     const int h = inimage.h;
     const int channels = inimage.elempack;
 
-    const int TILE_SIZE_X = tilesize;
-    const int TILE_SIZE_Y = tilesize;
+    const TilePlan plan = tile_plan(w, h, tilesize, prepadding, realcugan_tile_align(scale));
+    const int TILE_SIZE_X = plan.tile_w;
+    const int TILE_SIZE_Y = plan.tile_h;
 
     ncnn::Option opt = net.opt;
 
@@ -2759,122 +2817,19 @@ int RealCUGAN::process_cpu_se_stage0(const ncnn::Mat& inimage, const std::vector
             int in_tile_x0 = std::max(xi * TILE_SIZE_X - prepadding, 0);
             int in_tile_x1 = std::min((xi + 1) * TILE_SIZE_X + prepadding_right, w);
 
-            // crop tile
-            ncnn::Mat in;
-            {
-                if (channels == 3)
-                {
-#if _WIN32
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_BGR2RGB, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#else
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_RGB, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#endif
-                }
-                if (channels == 4)
-                {
-#if _WIN32
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_BGRA2RGBA, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#else
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_RGBA, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#endif
-                }
-            }
-
-            ncnn::Mat out;
+            int pad_top = std::max(prepadding - yi * TILE_SIZE_Y, 0);
+            int pad_bottom = std::max(std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom - h, prepadding_bottom), 0);
+            int pad_left = std::max(prepadding - xi * TILE_SIZE_X, 0);
+            int pad_right = std::max(std::min((xi + 1) * TILE_SIZE_X + prepadding_right - w, prepadding_right), 0);
 
             if (tta_mode)
             {
-                // split alpha and preproc
+                // crop, preproc and border padding
                 ncnn::Mat in_tile[8];
-                ncnn::Mat in_alpha_tile, in_alpah_tile_nocrop;
-                {
-                    in_tile[0].create(in.w, in.h, 3);
-                    for (int q = 0; q < 3; q++)
-                    {
-                        const float* ptr = in.channel(q);
-                        float* outptr0 = in_tile[0].channel(q);
-
-                        for (int i = 0; i < in.h; i++)
-                        {
-                            for (int j = 0; j < in.w; j++)
-                            {
-                                *outptr0++ = *ptr++ * (1 / 255.f);
-                            }
-                        }
-                    }
-
-                    if (channels == 4)
-                    {
-                        in_alpah_tile_nocrop = in.channel_range(3, 1).clone();
-                        int crop_top=(yi*TILE_SIZE_Y-in_tile_y0);
-                        int crop_bottom=in_tile_y1-std::min(yi*TILE_SIZE_Y+TILE_SIZE_Y ,h);
-                        int crop_left=(xi*TILE_SIZE_X-in_tile_x0);
-                        int crop_right=in_tile_x1-std::min(xi*TILE_SIZE_X+TILE_SIZE_X ,w);
-                        ncnn::copy_cut_border(in_alpah_tile_nocrop, in_alpha_tile, crop_top, crop_bottom, crop_left, crop_right);
-
-                    }
-                }
-
-                // border padding
-                {
-                    int pad_top = std::max(prepadding - yi * TILE_SIZE_Y, 0);
-                    int pad_bottom = std::max(std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom - h, prepadding_bottom), 0);
-                    int pad_left = std::max(prepadding - xi * TILE_SIZE_X, 0);
-                    int pad_right = std::max(std::min((xi + 1) * TILE_SIZE_X + prepadding_right - w, prepadding_right), 0);
-
-                    ncnn::Mat in_tile_padded;
-                    ncnn::copy_make_border(in_tile[0], in_tile_padded, pad_top, pad_bottom, pad_left, pad_right, 2, 0.f, net.opt);
-                    in_tile[0] = in_tile_padded;
-                }
+                tile_from_pixels(pixeldata, w, channels, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0, pad_top, pad_bottom, pad_left, pad_right, ncnn::BORDER_REFLECT, *tile_kernels, in_tile[0], opt.blob_allocator, input_bgr);
 
                 // the other 7 directions
-                {
-                    in_tile[1].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[2].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[3].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[4].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[5].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[6].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[7].create(in_tile[0].h, in_tile[0].w, 3);
-
-                    for (int q = 0; q < 3; q++)
-                    {
-                        const ncnn::Mat in_tile_0 = in_tile[0].channel(q);
-                        ncnn::Mat in_tile_1 = in_tile[1].channel(q);
-                        ncnn::Mat in_tile_2 = in_tile[2].channel(q);
-                        ncnn::Mat in_tile_3 = in_tile[3].channel(q);
-                        ncnn::Mat in_tile_4 = in_tile[4].channel(q);
-                        ncnn::Mat in_tile_5 = in_tile[5].channel(q);
-                        ncnn::Mat in_tile_6 = in_tile[6].channel(q);
-                        ncnn::Mat in_tile_7 = in_tile[7].channel(q);
-
-                        for (int i = 0; i < in_tile[0].h; i++)
-                        {
-                            const float* outptr0 = in_tile_0.row(i);
-                            float* outptr1 = in_tile_1.row(in_tile[0].h - 1 - i);
-                            float* outptr2 = in_tile_2.row(i) + in_tile[0].w - 1;
-                            float* outptr3 = in_tile_3.row(in_tile[0].h - 1 - i) + in_tile[0].w - 1;
-
-                            for (int j = 0; j < in_tile[0].w; j++)
-                            {
-                                float* outptr4 = in_tile_4.row(j) + i;
-                                float* outptr5 = in_tile_5.row(in_tile[0].w - 1 - j) + i;
-                                float* outptr6 = in_tile_6.row(j) + in_tile[0].h - 1 - i;
-                                float* outptr7 = in_tile_7.row(in_tile[0].w - 1 - j) + in_tile[0].h - 1 - i;
-
-                                float v = *outptr0++;
-
-                                *outptr1++ = v;
-                                *outptr2-- = v;
-                                *outptr3-- = v;
-                                *outptr4 = v;
-                                *outptr5 = v;
-                                *outptr6 = v;
-                                *outptr7 = v;
-                            }
-                        }
-                    }
-                }
+                tta_transform(in_tile, opt.blob_allocator);
 
                 // realcugan
                 ncnn::Mat out_tile[8];
@@ -2882,86 +2837,54 @@ int RealCUGAN::process_cpu_se_stage0(const ncnn::Mat& inimage, const std::vector
                 {
                     ncnn::Extractor ex = net.create_extractor();
 
+                    cache.set_extractor(ex);
+
                     ex.input("in0", in_tile[ti]);
 
-                    for (size_t i = 0; i < names.size(); i++)
+                    for (size_t i = 0; i < slots.size(); i++)
                     {
                         ncnn::Mat feat;
-                        cache.load(yi, xi, ti, names[i], feat);
+                        cache.load(yi, xi, ti, slots[i], feat);
 
-                        ex.input(names[i].c_str(), feat);
+                        ex.input(feature_blobs[slots[i]], feat);
                     }
 
-                    for (size_t i = 0; i < outnames.size(); i++)
+                    for (size_t i = 0; i < outslots.size(); i++)
                     {
                         ncnn::Mat feat;
-                        ex.extract(outnames[i].c_str(), feat);
+                        ex.extract(feature_blobs[outslots[i]], feat);
 
-                        cache.save(yi, xi, ti, outnames[i], feat);
+                        cache.accumulate(yi, xi, ti, outslots[i], feat);
                     }
                 }
             }
             else
             {
-                // split alpha and preproc
+                // crop, preproc and border padding
                 ncnn::Mat in_tile;
-                ncnn::Mat in_alpha_tile, in_alpah_tile_nocrop;
-                {
-                    in_tile.create(in.w, in.h, 3);
-                    for (int q = 0; q < 3; q++)
-                    {
-                        const float* ptr = in.channel(q);
-                        float* outptr = in_tile.channel(q);
-
-                        for (int i = 0; i < in.w * in.h; i++)
-                        {
-                            *outptr++ = *ptr++ * (1 / 255.f);
-                        }
-                    }
-
-                    if (channels == 4)
-                    {
-                        in_alpah_tile_nocrop = in.channel_range(3, 1).clone();
-                        int crop_top=(yi*TILE_SIZE_Y-in_tile_y0);
-                        int crop_bottom=in_tile_y1-std::min(yi*TILE_SIZE_Y+TILE_SIZE_Y ,h);
-                        int crop_left=(xi*TILE_SIZE_X-in_tile_x0);
-                        int crop_right=in_tile_x1-std::min(xi*TILE_SIZE_X+TILE_SIZE_X ,w);
-                        ncnn::copy_cut_border(in_alpah_tile_nocrop, in_alpha_tile, crop_top, crop_bottom, crop_left, crop_right);
-
-                    }
-                }
-
-                // border padding
-                {
-                    int pad_top = std::max(prepadding - yi * TILE_SIZE_Y, 0);
-                    int pad_bottom = std::max(std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom - h, prepadding_bottom), 0);
-                    int pad_left = std::max(prepadding - xi * TILE_SIZE_X, 0);
-                    int pad_right = std::max(std::min((xi + 1) * TILE_SIZE_X + prepadding_right - w, prepadding_right), 0);
-
-                    ncnn::Mat in_tile_padded;
-                    ncnn::copy_make_border(in_tile, in_tile_padded, pad_top, pad_bottom, pad_left, pad_right, 2, 0.f, net.opt);
-                    in_tile = in_tile_padded;
-                }
+                tile_from_pixels(pixeldata, w, channels, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0, pad_top, pad_bottom, pad_left, pad_right, ncnn::BORDER_REFLECT, *tile_kernels, in_tile, opt.blob_allocator, input_bgr);
 
                 {
                     ncnn::Extractor ex = net.create_extractor();
 
+                    cache.set_extractor(ex);
+
                     ex.input("in0", in_tile);
 
-                    for (size_t i = 0; i < names.size(); i++)
+                    for (size_t i = 0; i < slots.size(); i++)
                     {
                         ncnn::Mat feat;
-                        cache.load(yi, xi, 0, names[i], feat);
+                        cache.load(yi, xi, 0, slots[i], feat);
 
-                        ex.input(names[i].c_str(), feat);
+                        ex.input(feature_blobs[slots[i]], feat);
                     }
 
-                    for (size_t i = 0; i < outnames.size(); i++)
+                    for (size_t i = 0; i < outslots.size(); i++)
                     {
                         ncnn::Mat feat;
-                        ex.extract(outnames[i].c_str(), feat);
+                        ex.extract(feature_blobs[outslots[i]], feat);
 
-                        cache.save(yi, xi, 0, outnames[i], feat);
+                        cache.accumulate(yi, xi, 0, outslots[i], feat);
                     }
                 }
             }
@@ -2971,15 +2894,16 @@ int RealCUGAN::process_cpu_se_stage0(const ncnn::Mat& inimage, const std::vector
     return 0;
 }
 
-int RealCUGAN::process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector<std::string>& names, ncnn::Mat& outimage, FeatureCache& cache) const
+int RealCUGAN::process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector<int>& slots, ncnn::Mat& outimage, FeatureCache& cache) const
 {
     const unsigned char* pixeldata = (const unsigned char*)inimage.data;
     const int w = inimage.w;
     const int h = inimage.h;
     const int channels = inimage.elempack;
 
-    const int TILE_SIZE_X = tilesize;
-    const int TILE_SIZE_Y = tilesize;
+    const TilePlan plan = tile_plan(w, h, tilesize, prepadding, realcugan_tile_align(scale));
+    const int TILE_SIZE_X = plan.tile_w;
+    const int TILE_SIZE_Y = plan.tile_h;
 
     ncnn::Option opt = net.opt;
 
@@ -3021,122 +2945,29 @@ int RealCUGAN::process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector
             int in_tile_x0 = std::max(xi * TILE_SIZE_X - prepadding, 0);
             int in_tile_x1 = std::min((xi + 1) * TILE_SIZE_X + prepadding_right, w);
 
-            // crop tile
-            ncnn::Mat in;
-            {
-                if (channels == 3)
-                {
-#if _WIN32
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_BGR2RGB, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#else
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_RGB, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#endif
-                }
-                if (channels == 4)
-                {
-#if _WIN32
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_BGRA2RGBA, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#else
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_RGBA, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#endif
-                }
-            }
+            unsigned char* outpixels = (unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels;
 
-            ncnn::Mat out;
+            int pad_top = std::max(prepadding - yi * TILE_SIZE_Y, 0);
+            int pad_bottom = std::max(std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom - h, prepadding_bottom), 0);
+            int pad_left = std::max(prepadding - xi * TILE_SIZE_X, 0);
+            int pad_right = std::max(std::min((xi + 1) * TILE_SIZE_X + prepadding_right - w, prepadding_right), 0);
 
             if (tta_mode)
             {
-                // split alpha and preproc
+                // crop, preproc and border padding
                 ncnn::Mat in_tile[8];
-                ncnn::Mat in_alpha_tile, in_alpah_tile_nocrop;
+                ncnn::Mat in_alpha_tile;
                 {
-                    in_tile[0].create(in.w, in.h, 3);
-                    for (int q = 0; q < 3; q++)
-                    {
-                        const float* ptr = in.channel(q);
-                        float* outptr0 = in_tile[0].channel(q);
-
-                        for (int i = 0; i < in.h; i++)
-                        {
-                            for (int j = 0; j < in.w; j++)
-                            {
-                                *outptr0++ = *ptr++ * (1 / 255.f);
-                            }
-                        }
-                    }
+                    tile_from_pixels(pixeldata, w, channels, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0, pad_top, pad_bottom, pad_left, pad_right, ncnn::BORDER_REFLECT, *tile_kernels, in_tile[0], opt.blob_allocator, input_bgr);
 
                     if (channels == 4)
                     {
-                        in_alpah_tile_nocrop = in.channel_range(3, 1).clone();
-                        int crop_top=(yi*TILE_SIZE_Y-in_tile_y0);
-                        int crop_bottom=in_tile_y1-std::min(yi*TILE_SIZE_Y+TILE_SIZE_Y ,h);
-                        int crop_left=(xi*TILE_SIZE_X-in_tile_x0);
-                        int crop_right=in_tile_x1-std::min(xi*TILE_SIZE_X+TILE_SIZE_X ,w);
-                        ncnn::copy_cut_border(in_alpah_tile_nocrop, in_alpha_tile, crop_top, crop_bottom, crop_left, crop_right);
-
+                        tile_alpha_from_pixels(pixeldata, w, xi * TILE_SIZE_X, yi * TILE_SIZE_Y, tile_w_nopad, tile_h_nopad, in_alpha_tile, opt.blob_allocator);
                     }
                 }
 
-                // border padding
-                {
-                    int pad_top = std::max(prepadding - yi * TILE_SIZE_Y, 0);
-                    int pad_bottom = std::max(std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom - h, prepadding_bottom), 0);
-                    int pad_left = std::max(prepadding - xi * TILE_SIZE_X, 0);
-                    int pad_right = std::max(std::min((xi + 1) * TILE_SIZE_X + prepadding_right - w, prepadding_right), 0);
-
-                    ncnn::Mat in_tile_padded;
-                    ncnn::copy_make_border(in_tile[0], in_tile_padded, pad_top, pad_bottom, pad_left, pad_right, 2, 0.f, net.opt);
-                    in_tile[0] = in_tile_padded;
-                }
-
                 // the other 7 directions
-                {
-                    in_tile[1].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[2].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[3].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[4].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[5].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[6].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[7].create(in_tile[0].h, in_tile[0].w, 3);
-
-                    for (int q = 0; q < 3; q++)
-                    {
-                        const ncnn::Mat in_tile_0 = in_tile[0].channel(q);
-                        ncnn::Mat in_tile_1 = in_tile[1].channel(q);
-                        ncnn::Mat in_tile_2 = in_tile[2].channel(q);
-                        ncnn::Mat in_tile_3 = in_tile[3].channel(q);
-                        ncnn::Mat in_tile_4 = in_tile[4].channel(q);
-                        ncnn::Mat in_tile_5 = in_tile[5].channel(q);
-                        ncnn::Mat in_tile_6 = in_tile[6].channel(q);
-                        ncnn::Mat in_tile_7 = in_tile[7].channel(q);
-
-                        for (int i = 0; i < in_tile[0].h; i++)
-                        {
-                            const float* outptr0 = in_tile_0.row(i);
-                            float* outptr1 = in_tile_1.row(in_tile[0].h - 1 - i);
-                            float* outptr2 = in_tile_2.row(i) + in_tile[0].w - 1;
-                            float* outptr3 = in_tile_3.row(in_tile[0].h - 1 - i) + in_tile[0].w - 1;
-
-                            for (int j = 0; j < in_tile[0].w; j++)
-                            {
-                                float* outptr4 = in_tile_4.row(j) + i;
-                                float* outptr5 = in_tile_5.row(in_tile[0].w - 1 - j) + i;
-                                float* outptr6 = in_tile_6.row(j) + in_tile[0].h - 1 - i;
-                                float* outptr7 = in_tile_7.row(in_tile[0].w - 1 - j) + in_tile[0].h - 1 - i;
-
-                                float v = *outptr0++;
-
-                                *outptr1++ = v;
-                                *outptr2-- = v;
-                                *outptr3-- = v;
-                                *outptr4 = v;
-                                *outptr5 = v;
-                                *outptr6 = v;
-                                *outptr7 = v;
-                            }
-                        }
-                    }
-                }
+                tta_transform(in_tile, opt.blob_allocator);
 
                 // realcugan
                 ncnn::Mat out_tile[8];
@@ -3144,14 +2975,16 @@ int RealCUGAN::process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector
                 {
                     ncnn::Extractor ex = net.create_extractor();
 
+                    cache.set_extractor(ex);
+
                     ex.input("in0", in_tile[ti]);
 
-                    for (size_t i = 0; i < names.size(); i++)
+                    for (size_t i = 0; i < slots.size(); i++)
                     {
                         ncnn::Mat feat;
-                        cache.load(yi, xi, ti, names[i], feat);
+                        cache.load(yi, xi, ti, slots[i], feat);
 
-                        ex.input(names[i].c_str(), feat);
+                        ex.input(feature_blobs[slots[i]], feat);
                     }
 
                     ex.extract("out0", out_tile[ti]);
@@ -3180,140 +3013,48 @@ int RealCUGAN::process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector
 
                 // postproc and merge alpha
                 {
-                    out.create(tile_w_nopad * scale, tile_h_nopad * scale, channels);
+                    ncnn::Mat out;
+                    tta_merge(out_tile, 0, 0, tile_w_nopad * scale, tile_h_nopad * scale, out, opt.blob_allocator);
+
                     if (scale == 4)
                     {
-                        for (int q = 0; q < 3; q++)
-                        {
-                            const ncnn::Mat out_tile_0 = out_tile[0].channel(q);
-                            const ncnn::Mat out_tile_1 = out_tile[1].channel(q);
-                            const ncnn::Mat out_tile_2 = out_tile[2].channel(q);
-                            const ncnn::Mat out_tile_3 = out_tile[3].channel(q);
-                            const ncnn::Mat out_tile_4 = out_tile[4].channel(q);
-                            const ncnn::Mat out_tile_5 = out_tile[5].channel(q);
-                            const ncnn::Mat out_tile_6 = out_tile[6].channel(q);
-                            const ncnn::Mat out_tile_7 = out_tile[7].channel(q);
-                            float* outptr = out.channel(q);
-
-                            for (int i = 0; i < out.h; i++)
-                            {
-                                const float* inptr = in_tile[0].channel(q).row(prepadding + i / 4) + prepadding;
-                                const float* ptr0 = out_tile_0.row(i);
-                                const float* ptr1 = out_tile_1.row(out_tile[0].h - 1 - i);
-                                const float* ptr2 = out_tile_2.row(i) + out_tile[0].w - 1;
-                                const float* ptr3 = out_tile_3.row(out_tile[0].h - 1 - i) + out_tile[0].w - 1;
-
-                                for (int j = 0; j < out.w; j++)
-                                {
-                                    const float* ptr4 = out_tile_4.row(j) + i;
-                                    const float* ptr5 = out_tile_5.row(out_tile[0].w - 1 - j) + i;
-                                    const float* ptr6 = out_tile_6.row(j) + out_tile[0].h - 1 - i;
-                                    const float* ptr7 = out_tile_7.row(out_tile[0].w - 1 - j) + out_tile[0].h - 1 - i;
-
-                                    float v = (*ptr0++ + *ptr1++ + *ptr2-- + *ptr3-- + *ptr4 + *ptr5 + *ptr6 + *ptr7) / 8;
-
-                                    *outptr++ = v * 255.f + 0.5f + inptr[j / 4] * 255.f;
-                                }
-                            }
-                        }
+                        tile_to_pixels_residual(out, 0, 0, out.w, out.h, in_tile[0], prepadding, prepadding, 4, out_alpha_tile, *tile_kernels, outpixels, w * scale * channels, channels, output_bgr);
                     }
                     else
                     {
-                        for (int q = 0; q < 3; q++)
-                        {
-                            const ncnn::Mat out_tile_0 = out_tile[0].channel(q);
-                            const ncnn::Mat out_tile_1 = out_tile[1].channel(q);
-                            const ncnn::Mat out_tile_2 = out_tile[2].channel(q);
-                            const ncnn::Mat out_tile_3 = out_tile[3].channel(q);
-                            const ncnn::Mat out_tile_4 = out_tile[4].channel(q);
-                            const ncnn::Mat out_tile_5 = out_tile[5].channel(q);
-                            const ncnn::Mat out_tile_6 = out_tile[6].channel(q);
-                            const ncnn::Mat out_tile_7 = out_tile[7].channel(q);
-                            float* outptr = out.channel(q);
-
-                            for (int i = 0; i < out.h; i++)
-                            {
-                                const float* ptr0 = out_tile_0.row(i);
-                                const float* ptr1 = out_tile_1.row(out_tile[0].h - 1 - i);
-                                const float* ptr2 = out_tile_2.row(i) + out_tile[0].w - 1;
-                                const float* ptr3 = out_tile_3.row(out_tile[0].h - 1 - i) + out_tile[0].w - 1;
-
-                                for (int j = 0; j < out.w; j++)
-                                {
-                                    const float* ptr4 = out_tile_4.row(j) + i;
-                                    const float* ptr5 = out_tile_5.row(out_tile[0].w - 1 - j) + i;
-                                    const float* ptr6 = out_tile_6.row(j) + out_tile[0].h - 1 - i;
-                                    const float* ptr7 = out_tile_7.row(out_tile[0].w - 1 - j) + out_tile[0].h - 1 - i;
-
-                                    float v = (*ptr0++ + *ptr1++ + *ptr2-- + *ptr3-- + *ptr4 + *ptr5 + *ptr6 + *ptr7) / 8;
-
-                                    *outptr++ = v * 255.f + 0.5f;
-                                }
-                            }
-                        }
-                    }
-
-                    if (channels == 4)
-                    {
-                        memcpy(out.channel_range(3, 1), out_alpha_tile, out_alpha_tile.total() * sizeof(float));
+                        tile_to_pixels(out, 0, 0, out.w, out.h, out_alpha_tile, *tile_kernels, outpixels, w * scale * channels, channels, output_bgr);
                     }
                 }
             }
             else
             {
-                // split alpha and preproc
+                // crop, preproc and border padding
                 ncnn::Mat in_tile;
-                ncnn::Mat in_alpha_tile, in_alpah_tile_nocrop;
+                ncnn::Mat in_alpha_tile;
                 {
-                    in_tile.create(in.w, in.h, 3);
-                    for (int q = 0; q < 3; q++)
-                    {
-                        const float* ptr = in.channel(q);
-                        float* outptr = in_tile.channel(q);
-
-                        for (int i = 0; i < in.w * in.h; i++)
-                        {
-                            *outptr++ = *ptr++ * (1 / 255.f);
-                        }
-                    }
+                    tile_from_pixels(pixeldata, w, channels, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0, pad_top, pad_bottom, pad_left, pad_right, ncnn::BORDER_REFLECT, *tile_kernels, in_tile, opt.blob_allocator, input_bgr);
 
                     if (channels == 4)
                     {
-                        in_alpah_tile_nocrop = in.channel_range(3, 1).clone();
-                        int crop_top=(yi*TILE_SIZE_Y-in_tile_y0);
-                        int crop_bottom=in_tile_y1-std::min(yi*TILE_SIZE_Y+TILE_SIZE_Y ,h);
-                        int crop_left=(xi*TILE_SIZE_X-in_tile_x0);
-                        int crop_right=in_tile_x1-std::min(xi*TILE_SIZE_X+TILE_SIZE_X ,w);
-                        ncnn::copy_cut_border(in_alpah_tile_nocrop, in_alpha_tile, crop_top, crop_bottom, crop_left, crop_right);
-
+                        tile_alpha_from_pixels(pixeldata, w, xi * TILE_SIZE_X, yi * TILE_SIZE_Y, tile_w_nopad, tile_h_nopad, in_alpha_tile, opt.blob_allocator);
                     }
                 }
 
-                // border padding
-                {
-                    int pad_top = std::max(prepadding - yi * TILE_SIZE_Y, 0);
-                    int pad_bottom = std::max(std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom - h, prepadding_bottom), 0);
-                    int pad_left = std::max(prepadding - xi * TILE_SIZE_X, 0);
-                    int pad_right = std::max(std::min((xi + 1) * TILE_SIZE_X + prepadding_right - w, prepadding_right), 0);
-
-                    ncnn::Mat in_tile_padded;
-                    ncnn::copy_make_border(in_tile, in_tile_padded, pad_top, pad_bottom, pad_left, pad_right, 2, 0.f, net.opt);
-                    in_tile = in_tile_padded;
-                }
-
                 // realcugan
                 ncnn::Mat out_tile;
                 {
                     ncnn::Extractor ex = net.create_extractor();
 
+                    cache.set_extractor(ex);
+
                     ex.input("in0", in_tile);
 
-                    for (size_t i = 0; i < names.size(); i++)
+                    for (size_t i = 0; i < slots.size(); i++)
                     {
                         ncnn::Mat feat;
-                        cache.load(yi, xi, 0, names[i], feat);
+                        cache.load(yi, xi, 0, slots[i], feat);
 
-                        ex.input(names[i].c_str(), feat);
+                        ex.input(feature_blobs[slots[i]], feat);
                     }
 
                     ex.extract("out0", out_tile);
@@ -3341,87 +3082,36 @@ int RealCUGAN::process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector
                 }
 
                 // postproc and merge alpha
+                if (scale == 4)
                 {
-                    out.create(tile_w_nopad * scale, tile_h_nopad * scale, channels);
-                    if (scale == 4)
-                    {
-                        for (int q = 0; q < 3; q++)
-                        {
-                            float* outptr = out.channel(q);
-
-                            for (int i = 0; i < out.h; i++)
-                            {
-                                const float* inptr = in_tile.channel(q).row(prepadding + i / 4) + prepadding;
-                                const float* ptr = out_tile.channel(q).row(i);
-
-                                for (int j = 0; j < out.w; j++)
-                                {
-                                    *outptr++ = *ptr++ * 255.f + 0.5f + inptr[j / 4] * 255.f;
-                                }
-                            }
-                        }
-                    }
-                    else
-                    {
-                        for (int q = 0; q < 3; q++)
-                        {
-                            float* outptr = out.channel(q);
-
-                            for (int i = 0; i < out.h; i++)
-                            {
-                                const float* ptr = out_tile.channel(q).row(i);
-
-                                for (int j = 0; j < out.w; j++)
-                                {
-                                    *outptr++ = *ptr++ * 255.f + 0.5f;
-                                }
-                            }
-                        }
-                    }
-
-                    if (channels == 4)
-                    {
-                        memcpy(out.channel_range(3, 1), out_alpha_tile, out_alpha_tile.total() * sizeof(float));
-                    }
-                }
-            }
-
-            {
-                if (channels == 3)
-                {
-#if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGB2BGR, w * scale * channels);
-#else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGB, w * scale * channels);
-#endif
+                    tile_to_pixels_residual(out_tile, 0, 0, tile_w_nopad * scale, tile_h_nopad * scale, in_tile, prepadding, prepadding, 4, out_alpha_tile, *tile_kernels, outpixels, w * scale * channels, channels, output_bgr);
                 }
-                if (channels == 4)
+                else
                 {
-#if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGBA2BGRA, w * scale * channels);
-#else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGBA, w * scale * channels);
-#endif
+                    tile_to_pixels(out_tile, 0, 0, tile_w_nopad * scale, tile_h_nopad * scale, out_alpha_tile, *tile_kernels, outpixels, w * scale * channels, channels, output_bgr);
                 }
             }
 
-
-            fprintf(stderr, "%.2f%%\n", (float)(yi * xtiles + xi) / (ytiles * xtiles) * 100);
+            if (progress_callback)
+                progress_callback(progress_userdata, (float)(yi * xtiles + xi + 1) / (ytiles * xtiles));
+            else
+                fprintf(stderr, "%.2f%%\n", (float)(yi * xtiles + xi) / (ytiles * xtiles) * 100);
         }
     }
 
     return 0;
 }
 
-int RealCUGAN::process_cpu_se_sync_gap(const ncnn::Mat& inimage, const std::vector<std::string>& names, FeatureCache& cache) const
+int RealCUGAN::process_cpu_se_sync_gap(const ncnn::Mat& inimage, const std::vector<int>& slots, FeatureCache& cache) const
 {
     const unsigned char* pixeldata = (const unsigned char*)inimage.data;
     const int w = inimage.w;
     const int h = inimage.h;
     const int channels = inimage.elempack;
 
-    const int TILE_SIZE_X = tilesize;
-    const int TILE_SIZE_Y = tilesize;
+    const TilePlan plan = tile_plan(w, h, tilesize, prepadding, realcugan_tile_align(scale));
+    const int TILE_SIZE_X = plan.tile_w;
+    const int TILE_SIZE_Y = plan.tile_h;
 
     ncnn::Option opt = net.opt;
 
@@ -3429,67 +3119,12 @@ int RealCUGAN::process_cpu_se_sync_gap(const ncnn::Mat& inimage, const std::vect
     const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
     const int ytiles = (h + TILE_SIZE_Y - 1) / TILE_SIZE_Y;
 
-    std::vector< std::vector<ncnn::Mat> > feats(names.size());
-    for (int yi = 0; yi < ytiles; yi++)
-    {
-        for (int xi = 0; xi < xtiles; xi++)
-        {
-            {
-                for (size_t i = 0; i < names.size(); i++)
-                {
-                    if (tta_mode)
-                    {
-                        for (int ti = 0; ti < 8; ti++)
-                        {
-                            ncnn::Mat feat;
-                            cache.load(yi, xi, ti, names[i], feat);
-
-                            feats[i].push_back(feat);
-                        }
-                    }
-                    else
-                    {
-                        ncnn::Mat feat;
-                        cache.load(yi, xi, 0, names[i], feat);
-
-                        feats[i].push_back(feat);
-                    }
-                }
-            }
-        }
-    }
-
-    const int tiles = ytiles * xtiles * (tta_mode ? 8 : 1);
-
     // global average
-    std::vector<ncnn::Mat> avgfeats(names.size());
-    for (size_t i = 0; i < names.size(); i++)
+    std::vector<ncnn::Mat> avgfeats(slots.size());
+    for (size_t i = 0; i < slots.size(); i++)
     {
-        // handle feats[i] vector
-        {
-            ncnn::Mat avgfeat;
-            avgfeat.create_like(feats[i][0]);
-            avgfeat.fill(0.f);
-
-            int len = avgfeat.total();
-
-            for (int j = 0; j < tiles; j++)
-            {
-                const ncnn::Mat f = feats[i][j];
-
-                for (int k = 0; k < len; k++)
-                {
-                    avgfeat[k] += f[k];
-                }
-            }
-
-            for (int k = 0; k < len; k++)
-            {
-                avgfeat[k] /= tiles;
-            }
-
-            avgfeats[i] = avgfeat;
-        }
+        if (cache.average(slots[i], avgfeats[i], opt) != 0)
+            return -1;
     }
 
     for (int yi = 0; yi < ytiles; yi++)
@@ -3497,18 +3132,18 @@ int RealCUGAN::process_cpu_se_sync_gap(const ncnn::Mat& inimage, const std::vect
         for (int xi = 0; xi < xtiles; xi++)
         {
             {
-                for (size_t i = 0; i < names.size(); i++)
+                for (size_t i = 0; i < slots.size(); i++)
                 {
                     if (tta_mode)
                     {
                         for (int ti = 0; ti < 8; ti++)
                         {
-                            cache.save(yi, xi, ti, names[i], avgfeats[i]);
+                            cache.save_shared(yi, xi, ti, slots[i], avgfeats[i]);
                         }
                     }
                     else
                     {
-                        cache.save(yi, xi, 0, names[i], avgfeats[i]);
+                        cache.save_shared(yi, xi, 0, slots[i], avgfeats[i]);
                     }
                 }
             }
@@ -3518,7 +3153,7 @@ int RealCUGAN::process_cpu_se_sync_gap(const ncnn::Mat& inimage, const std::vect
     return 0;
 }
 
-int RealCUGAN::process_cpu_se_very_rough_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, FeatureCache& cache) const
+int RealCUGAN::process_cpu_se_very_rough_stage0(const ncnn::Mat& inimage, const std::vector<int>& slots, const std::vector<int>& outslots, FeatureCache& cache) const
 {
     const unsigned char* pixeldata = (const unsigned char*)inimage.data;
     const int w = inimage.w;
@@ -3568,122 +3203,19 @@ int RealCUGAN::process_cpu_se_very_rough_stage0(const ncnn::Mat& inimage, const
             int in_tile_x0 = std::max(xi * TILE_SIZE_X - prepadding, 0);
             int in_tile_x1 = std::min((xi + 1) * TILE_SIZE_X + prepadding_right, w);
 
-            // crop tile
-            ncnn::Mat in;
-            {
-                if (channels == 3)
-                {
-#if _WIN32
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_BGR2RGB, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#else
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_RGB, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#endif
-                }
-                if (channels == 4)
-                {
-#if _WIN32
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_BGRA2RGBA, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#else
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_RGBA, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#endif
-                }
-            }
-
-            ncnn::Mat out;
+            int pad_top = std::max(prepadding - yi * TILE_SIZE_Y, 0);
+            int pad_bottom = std::max(std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom - h, prepadding_bottom), 0);
+            int pad_left = std::max(prepadding - xi * TILE_SIZE_X, 0);
+            int pad_right = std::max(std::min((xi + 1) * TILE_SIZE_X + prepadding_right - w, prepadding_right), 0);
 
             if (tta_mode)
             {
-                // split alpha and preproc
+                // crop, preproc and border padding
                 ncnn::Mat in_tile[8];
-                ncnn::Mat in_alpha_tile, in_alpah_tile_nocrop;
-                {
-                    in_tile[0].create(in.w, in.h, 3);
-                    for (int q = 0; q < 3; q++)
-                    {
-                        const float* ptr = in.channel(q);
-                        float* outptr0 = in_tile[0].channel(q);
-
-                        for (int i = 0; i < in.h; i++)
-                        {
-                            for (int j = 0; j < in.w; j++)
-                            {
-                                *outptr0++ = *ptr++ * (1 / 255.f);
-                            }
-                        }
-                    }
-
-                    if (channels == 4)
-                    {
-                        in_alpah_tile_nocrop = in.channel_range(3, 1).clone();
-                        int crop_top=(yi*TILE_SIZE_Y-in_tile_y0);
-                        int crop_bottom=in_tile_y1-std::min(yi*TILE_SIZE_Y+TILE_SIZE_Y ,h);
-                        int crop_left=(xi*TILE_SIZE_X-in_tile_x0);
-                        int crop_right=in_tile_x1-std::min(xi*TILE_SIZE_X+TILE_SIZE_X ,w);
-                        ncnn::copy_cut_border(in_alpah_tile_nocrop, in_alpha_tile, crop_top, crop_bottom, crop_left, crop_right);
-
-                    }
-                }
-
-                // border padding
-                {
-                    int pad_top = std::max(prepadding - yi * TILE_SIZE_Y, 0);
-                    int pad_bottom = std::max(std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom - h, prepadding_bottom), 0);
-                    int pad_left = std::max(prepadding - xi * TILE_SIZE_X, 0);
-                    int pad_right = std::max(std::min((xi + 1) * TILE_SIZE_X + prepadding_right - w, prepadding_right), 0);
-
-                    ncnn::Mat in_tile_padded;
-                    ncnn::copy_make_border(in_tile[0], in_tile_padded, pad_top, pad_bottom, pad_left, pad_right, 2, 0.f, net.opt);
-                    in_tile[0] = in_tile_padded;
-                }
+                tile_from_pixels(pixeldata, w, channels, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0, pad_top, pad_bottom, pad_left, pad_right, ncnn::BORDER_REFLECT, *tile_kernels, in_tile[0], opt.blob_allocator, input_bgr);
 
                 // the other 7 directions
-                {
-                    in_tile[1].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[2].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[3].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[4].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[5].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[6].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[7].create(in_tile[0].h, in_tile[0].w, 3);
-
-                    for (int q = 0; q < 3; q++)
-                    {
-                        const ncnn::Mat in_tile_0 = in_tile[0].channel(q);
-                        ncnn::Mat in_tile_1 = in_tile[1].channel(q);
-                        ncnn::Mat in_tile_2 = in_tile[2].channel(q);
-                        ncnn::Mat in_tile_3 = in_tile[3].channel(q);
-                        ncnn::Mat in_tile_4 = in_tile[4].channel(q);
-                        ncnn::Mat in_tile_5 = in_tile[5].channel(q);
-                        ncnn::Mat in_tile_6 = in_tile[6].channel(q);
-                        ncnn::Mat in_tile_7 = in_tile[7].channel(q);
-
-                        for (int i = 0; i < in_tile[0].h; i++)
-                        {
-                            const float* outptr0 = in_tile_0.row(i);
-                            float* outptr1 = in_tile_1.row(in_tile[0].h - 1 - i);
-                            float* outptr2 = in_tile_2.row(i) + in_tile[0].w - 1;
-                            float* outptr3 = in_tile_3.row(in_tile[0].h - 1 - i) + in_tile[0].w - 1;
-
-                            for (int j = 0; j < in_tile[0].w; j++)
-                            {
-                                float* outptr4 = in_tile_4.row(j) + i;
-                                float* outptr5 = in_tile_5.row(in_tile[0].w - 1 - j) + i;
-                                float* outptr6 = in_tile_6.row(j) + in_tile[0].h - 1 - i;
-                                float* outptr7 = in_tile_7.row(in_tile[0].w - 1 - j) + in_tile[0].h - 1 - i;
-
-                                float v = *outptr0++;
-
-                                *outptr1++ = v;
-                                *outptr2-- = v;
-                                *outptr3-- = v;
-                                *outptr4 = v;
-                                *outptr5 = v;
-                                *outptr6 = v;
-                                *outptr7 = v;
-                            }
-                        }
-                    }
-                }
+                tta_transform(in_tile, opt.blob_allocator);
 
                 // realcugan
                 ncnn::Mat out_tile[8];
@@ -3691,86 +3223,54 @@ int RealCUGAN::process_cpu_se_very_rough_stage0(const ncnn::Mat& inimage, const
                 {
                     ncnn::Extractor ex = net.create_extractor();
 
+                    cache.set_extractor(ex);
+
                     ex.input("in0", in_tile[ti]);
 
-                    for (size_t i = 0; i < names.size(); i++)
+                    for (size_t i = 0; i < slots.size(); i++)
                     {
                         ncnn::Mat feat;
-                        cache.load(yi, xi, ti, names[i], feat);
+                        cache.load(yi, xi, ti, slots[i], feat);
 
-                        ex.input(names[i].c_str(), feat);
+                        ex.input(feature_blobs[slots[i]], feat);
                     }
 
-                    for (size_t i = 0; i < outnames.size(); i++)
+                    for (size_t i = 0; i < outslots.size(); i++)
                     {
                         ncnn::Mat feat;
-                        ex.extract(outnames[i].c_str(), feat);
+                        ex.extract(feature_blobs[outslots[i]], feat);
 
-                        cache.save(yi, xi, ti, outnames[i], feat);
+                        cache.accumulate(yi, xi, ti, outslots[i], feat);
                     }
                 }
             }
             else
             {
-                // split alpha and preproc
+                // crop, preproc and border padding
                 ncnn::Mat in_tile;
-                ncnn::Mat in_alpha_tile, in_alpah_tile_nocrop;
-                {
-                    in_tile.create(in.w, in.h, 3);
-                    for (int q = 0; q < 3; q++)
-                    {
-                        const float* ptr = in.channel(q);
-                        float* outptr = in_tile.channel(q);
-
-                        for (int i = 0; i < in.w * in.h; i++)
-                        {
-                            *outptr++ = *ptr++ * (1 / 255.f);
-                        }
-                    }
-
-                    if (channels == 4)
-                    {
-                        in_alpah_tile_nocrop = in.channel_range(3, 1).clone();
-                        int crop_top=(yi*TILE_SIZE_Y-in_tile_y0);
-                        int crop_bottom=in_tile_y1-std::min(yi*TILE_SIZE_Y+TILE_SIZE_Y ,h);
-                        int crop_left=(xi*TILE_SIZE_X-in_tile_x0);
-                        int crop_right=in_tile_x1-std::min(xi*TILE_SIZE_X+TILE_SIZE_X ,w);
-                        ncnn::copy_cut_border(in_alpah_tile_nocrop, in_alpha_tile, crop_top, crop_bottom, crop_left, crop_right);
-
-                    }
-                }
-
-                // border padding
-                {
-                    int pad_top = std::max(prepadding - yi * TILE_SIZE_Y, 0);
-                    int pad_bottom = std::max(std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom - h, prepadding_bottom), 0);
-                    int pad_left = std::max(prepadding - xi * TILE_SIZE_X, 0);
-                    int pad_right = std::max(std::min((xi + 1) * TILE_SIZE_X + prepadding_right - w, prepadding_right), 0);
-
-                    ncnn::Mat in_tile_padded;
-                    ncnn::copy_make_border(in_tile, in_tile_padded, pad_top, pad_bottom, pad_left, pad_right, 2, 0.f, net.opt);
-                    in_tile = in_tile_padded;
-                }
+                tile_from_pixels(pixeldata, w, channels, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0, pad_top, pad_bottom, pad_left, pad_right, ncnn::BORDER_REFLECT, *tile_kernels, in_tile, opt.blob_allocator, input_bgr);
 
                 {
                     ncnn::Extractor ex = net.create_extractor();
 
+                    cache.set_extractor(ex);
+
                     ex.input("in0", in_tile);
 
-                    for (size_t i = 0; i < names.size(); i++)
+                    for (size_t i = 0; i < slots.size(); i++)
                     {
                         ncnn::Mat feat;
-                        cache.load(yi, xi, 0, names[i], feat);
+                        cache.load(yi, xi, 0, slots[i], feat);
 
-                        ex.input(names[i].c_str(), feat);
+                        ex.input(feature_blobs[slots[i]], feat);
                     }
 
-                    for (size_t i = 0; i < outnames.size(); i++)
+                    for (size_t i = 0; i < outslots.size(); i++)
                     {
                         ncnn::Mat feat;
-                        ex.extract(outnames[i].c_str(), feat);
+                        ex.extract(feature_blobs[outslots[i]], feat);
 
-                        cache.save(yi, xi, 0, outnames[i], feat);
+                        cache.accumulate(yi, xi, 0, outslots[i], feat);
                     }
                 }
             }
@@ -3780,7 +3280,7 @@ int RealCUGAN::process_cpu_se_very_rough_stage0(const ncnn::Mat& inimage, const
     return 0;
 }
 
-int RealCUGAN::process_cpu_se_very_rough_sync_gap(const ncnn::Mat& inimage, const std::vector<std::string>& names, FeatureCache& cache) const
+int RealCUGAN::process_cpu_se_very_rough_sync_gap(const ncnn::Mat& inimage, const std::vector<int>& slots, FeatureCache& cache) const
 {
     const unsigned char* pixeldata = (const unsigned char*)inimage.data;
     const int w = inimage.w;
@@ -3796,67 +3296,12 @@ int RealCUGAN::process_cpu_se_very_rough_sync_gap(const ncnn::Mat& inimage, cons
     const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
     const int ytiles = (h + TILE_SIZE_Y - 1) / TILE_SIZE_Y;
 
-    std::vector< std::vector<ncnn::Mat> > feats(names.size());
-    for (int yi = 0; yi + 2 < ytiles; yi += 3)
-    {
-        for (int xi = 0; xi + 2 < xtiles; xi += 3)
-        {
-            {
-                for (size_t i = 0; i < names.size(); i++)
-                {
-                    if (tta_mode)
-                    {
-                        for (int ti = 0; ti < 8; ti++)
-                        {
-                            ncnn::Mat feat;
-                            cache.load(yi, xi, ti, names[i], feat);
-
-                            feats[i].push_back(feat);
-                        }
-                    }
-                    else
-                    {
-                        ncnn::Mat feat;
-                        cache.load(yi, xi, 0, names[i], feat);
-
-                        feats[i].push_back(feat);
-                    }
-                }
-            }
-        }
-    }
-
-    const int tiles = (ytiles / 3) * (xtiles / 3) * (tta_mode ? 8 : 1);
-
     // global average
-    std::vector<ncnn::Mat> avgfeats(names.size());
-    for (size_t i = 0; i < names.size(); i++)
+    std::vector<ncnn::Mat> avgfeats(slots.size());
+    for (size_t i = 0; i < slots.size(); i++)
     {
-        // handle feats[i] vector
-        {
-            ncnn::Mat avgfeat;
-            avgfeat.create_like(feats[i][0]);
-            avgfeat.fill(0.f);
-
-            int len = avgfeat.total();
-
-            for (int j = 0; j < tiles; j++)
-            {
-                const ncnn::Mat f = feats[i][j];
-
-                for (int k = 0; k < len; k++)
-                {
-                    avgfeat[k] += f[k];
-                }
-            }
-
-            for (int k = 0; k < len; k++)
-            {
-                avgfeat[k] /= tiles;
-            }
-
-            avgfeats[i] = avgfeat;
-        }
+        if (cache.average(slots[i], avgfeats[i], opt) != 0)
+            return -1;
     }
 
     for (int yi = 0; yi + 2 < ytiles; yi += 3)
@@ -3864,34 +3309,34 @@ int RealCUGAN::process_cpu_se_very_rough_sync_gap(const ncnn::Mat& inimage, cons
         for (int xi = 0; xi + 2 < xtiles; xi += 3)
         {
             {
-                for (size_t i = 0; i < names.size(); i++)
+                for (size_t i = 0; i < slots.size(); i++)
                 {
                     if (tta_mode)
                     {
                         for (int ti = 0; ti < 8; ti++)
                         {
-                            cache.save(yi, xi, ti, names[i], avgfeats[i]);
-                            cache.save(yi, xi + 1, ti, names[i], avgfeats[i]);
-                            cache.save(yi, xi + 2, ti, names[i], avgfeats[i]);
-                            cache.save(yi + 1, xi, ti, names[i], avgfeats[i]);
-                            cache.save(yi + 1, xi + 1, ti, names[i], avgfeats[i]);
-                            cache.save(yi + 1, xi + 2, ti, names[i], avgfeats[i]);
-                            cache.save(yi + 2, xi, ti, names[i], avgfeats[i]);
-                            cache.save(yi + 2, xi + 1, ti, names[i], avgfeats[i]);
-                            cache.save(yi + 2, xi + 2, ti, names[i], avgfeats[i]);
+                            cache.save_shared(yi, xi, ti, slots[i], avgfeats[i]);
+                            cache.save_shared(yi, xi + 1, ti, slots[i], avgfeats[i]);
+                            cache.save_shared(yi, xi + 2, ti, slots[i], avgfeats[i]);
+                            cache.save_shared(yi + 1, xi, ti, slots[i], avgfeats[i]);
+                            cache.save_shared(yi + 1, xi + 1, ti, slots[i], avgfeats[i]);
+                            cache.save_shared(yi + 1, xi + 2, ti, slots[i], avgfeats[i]);
+                            cache.save_shared(yi + 2, xi, ti, slots[i], avgfeats[i]);
+                            cache.save_shared(yi + 2, xi + 1, ti, slots[i], avgfeats[i]);
+                            cache.save_shared(yi + 2, xi + 2, ti, slots[i], avgfeats[i]);
                         }
                     }
                     else
                     {
-                        cache.save(yi, xi, 0, names[i], avgfeats[i]);
-                        cache.save(yi, xi + 1, 0, names[i], avgfeats[i]);
-                        cache.save(yi, xi + 2, 0, names[i], avgfeats[i]);
-                        cache.save(yi + 1, xi, 0, names[i], avgfeats[i]);
-                        cache.save(yi + 1, xi + 1, 0, names[i], avgfeats[i]);
-                        cache.save(yi + 1, xi + 2, 0, names[i], avgfeats[i]);
-                        cache.save(yi + 2, xi, 0, names[i], avgfeats[i]);
-                        cache.save(yi + 2, xi + 1, 0, names[i], avgfeats[i]);
-                        cache.save(yi + 2, xi + 2, 0, names[i], avgfeats[i]);
+                        cache.save_shared(yi, xi, 0, slots[i], avgfeats[i]);
+                        cache.save_shared(yi, xi + 1, 0, slots[i], avgfeats[i]);
+                        cache.save_shared(yi, xi + 2, 0, slots[i], avgfeats[i]);
+                        cache.save_shared(yi + 1, xi, 0, slots[i], avgfeats[i]);
+                        cache.save_shared(yi + 1, xi + 1, 0, slots[i], avgfeats[i]);
+                        cache.save_shared(yi + 1, xi + 2, 0, slots[i], avgfeats[i]);
+                        cache.save_shared(yi + 2, xi, 0, slots[i], avgfeats[i]);
+                        cache.save_shared(yi + 2, xi + 1, 0, slots[i], avgfeats[i]);
+                        cache.save_shared(yi + 2, xi + 2, 0, slots[i], avgfeats[i]);
                     }
                 }
             }
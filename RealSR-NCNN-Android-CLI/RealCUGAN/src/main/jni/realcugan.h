@@ -4,12 +4,17 @@
 #define REALCUGAN_H
 
 #include <string>
+#include <vector>
 
 // ncnn
 #include "net.h"
 #include "gpu.h"
 #include "layer.h"
 
+#include "tile_progress.h"
+
+class TileArenaPool;
+class TilePixels;
 class FeatureCache;
 class RealCUGAN
 {
@@ -40,19 +45,19 @@ public:
     int process_cpu_se_very_rough(const ncnn::Mat& inimage, ncnn::Mat& outimage) const;
 
 protected:
-    int process_se_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, const ncnn::Option& opt, FeatureCache& cache) const;
-    int process_se_stage2(const ncnn::Mat& inimage, const std::vector<std::string>& names, ncnn::Mat& outimage, const ncnn::Option& opt, FeatureCache& cache) const;
-    int process_se_sync_gap(const ncnn::Mat& inimage, const std::vector<std::string>& names, const ncnn::Option& opt, FeatureCache& cache) const;
+    int process_se_stage0(const ncnn::Mat& inimage, const std::vector<int>& slots, const std::vector<int>& outslots, const ncnn::Option& opt, FeatureCache& cache) const;
+    int process_se_stage2(const ncnn::Mat& inimage, const std::vector<int>& slots, ncnn::Mat& outimage, const ncnn::Option& opt, FeatureCache& cache) const;
+    int process_se_sync_gap(const ncnn::Mat& inimage, const std::vector<int>& slots, const ncnn::Option& opt, FeatureCache& cache) const;
 
-    int process_se_very_rough_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, const ncnn::Option& opt, FeatureCache& cache) const;
-    int process_se_very_rough_sync_gap(const ncnn::Mat& inimage, const std::vector<std::string>& names, const ncnn::Option& opt, FeatureCache& cache) const;
+    int process_se_very_rough_stage0(const ncnn::Mat& inimage, const std::vector<int>& slots, const std::vector<int>& outslots, const ncnn::Option& opt, FeatureCache& cache) const;
+    int process_se_very_rough_sync_gap(const ncnn::Mat& inimage, const std::vector<int>& slots, const ncnn::Option& opt, FeatureCache& cache) const;
 
-    int process_cpu_se_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, FeatureCache& cache) const;
-    int process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector<std::string>& names, ncnn::Mat& outimage, FeatureCache& cache) const;
-    int process_cpu_se_sync_gap(const ncnn::Mat& inimage, const std::vector<std::string>& names, FeatureCache& cache) const;
+    int process_cpu_se_stage0(const ncnn::Mat& inimage, const std::vector<int>& slots, const std::vector<int>& outslots, FeatureCache& cache) const;
+    int process_cpu_se_stage2(const ncnn::Mat& inimage, const std::vector<int>& slots, ncnn::Mat& outimage, FeatureCache& cache) const;
+    int process_cpu_se_sync_gap(const ncnn::Mat& inimage, const std::vector<int>& slots, FeatureCache& cache) const;
 
-    int process_cpu_se_very_rough_stage0(const ncnn::Mat& inimage, const std::vector<std::string>& names, const std::vector<std::string>& outnames, FeatureCache& cache) const;
-    int process_cpu_se_very_rough_sync_gap(const ncnn::Mat& inimage, const std::vector<std::string>& names, FeatureCache& cache) const;
+    int process_cpu_se_very_rough_stage0(const ncnn::Mat& inimage, const std::vector<int>& slots, const std::vector<int>& outslots, FeatureCache& cache) const;
+    int process_cpu_se_very_rough_sync_gap(const ncnn::Mat& inimage, const std::vector<int>& slots, FeatureCache& cache) const;
 
 public:
     // realcugan parameters
@@ -60,7 +65,16 @@ public:
     int scale;
     int tilesize;
     int prepadding;
+    // inimage in bgr(a) order, the default on windows where wic decodes to bgr, set before load
+    bool input_bgr;
+    // outimage in bgr(a) order, the same default as input_bgr, set before load
+    bool output_bgr;
     int syncgap;
+    // bytes of se features kept on the gpu, 0 for no limit
+    size_t syncgap_budget;
+    // tile progress of process, stderr when unset
+    tile_progress_callback progress_callback;
+    void* progress_userdata;
 
 private:
     ncnn::VulkanDevice* vkdev;
@@ -68,10 +82,16 @@ private:
     ncnn::Pipeline* realcugan_preproc;
     ncnn::Pipeline* realcugan_postproc;
     ncnn::Pipeline* realcugan_4x_postproc;
+    ncnn::Pipeline* realcugan_feature_sum;
     ncnn::Layer* bicubic_2x;
     ncnn::Layer* bicubic_3x;
     ncnn::Layer* bicubic_4x;
     bool tta_mode;
+    TileArenaPool* tile_arenas;
+    // pixel row kernels of the cpu path, picked at load
+    TilePixels* tile_kernels;
+    // gap0 to gap3 blob indexes
+    int feature_blobs[4];
 };
 
 #endif // REALCUGAN_H
@@ -0,0 +1,162 @@
+// c api of the realcugan engine
+
+#define REALCUGAN_C_BUILD
+#include "realcugan_c.h"
+
+#include "realcugan.h"
+
+#include "engine_c.h"
+
+typedef EngineCInstance<RealCUGAN, realcugan_error, realcugan_callback> RealCUGANInstance;
+
+static_assert(REALCUGAN_ERROR_PROCESS == (int)ENGINE_C_ERROR_PROCESS, "realcugan_error follows the engine_c.h order");
+
+void REALCUGAN_C_API realcugan_default_parameters(realcugan_parameters* parameters)
+{
+    if (!parameters)
+        return;
+
+    parameters->gpuid = 0;
+    parameters->tta_mode = 0;
+    parameters->num_threads = 1;
+    parameters->noise = -1;
+    parameters->scale = 2;
+    parameters->tilesize = 0;
+    parameters->prepadding = 18;
+    parameters->syncgap = 3;
+    parameters->input_bgr = 0;
+    parameters->output_bgr = 0;
+}
+
+realcugan_instance REALCUGAN_C_API realcugan_create(const realcugan_parameters* parameters, realcugan_error* error)
+{
+    realcugan_error dummy;
+    if (!error)
+        error = &dummy;
+
+    if (!parameters)
+    {
+        *error = REALCUGAN_ERROR_NULL_DATA;
+        return 0;
+    }
+
+    if (parameters->gpuid < -1 || parameters->noise < -1 || parameters->noise > 3 || parameters->scale < 2 || parameters->scale > 4
+            || parameters->prepadding < 0 || parameters->syncgap < 0 || parameters->syncgap > 3 || parameters->num_threads < 1
+            || (parameters->tilesize != 0 && parameters->tilesize < 32))
+    {
+        *error = REALCUGAN_ERROR_INVALID_PARAMETERS;
+        return 0;
+    }
+
+    const bool gpu = parameters->gpuid != -1;
+    if (gpu)
+    {
+        engine_c_gpu_acquire();
+
+        if (parameters->gpuid >= ncnn::get_gpu_count())
+        {
+            engine_c_gpu_release();
+            *error = REALCUGAN_ERROR_INVALID_PARAMETERS;
+            return 0;
+        }
+    }
+
+    int tilesize = parameters->tilesize;
+    if (tilesize == 0)
+    {
+        // the cli policy for the scale
+        if (!gpu)
+        {
+            tilesize = 400;
+        }
+        else
+        {
+            uint32_t heap_budget = ncnn::get_gpu_device(parameters->gpuid)->get_heap_budget();
+            if (parameters->scale == 2)
+            {
+                if (heap_budget > 1300)
+                    tilesize = 400;
+                else if (heap_budget > 800)
+                    tilesize = 300;
+                else if (heap_budget > 400)
+                    tilesize = 200;
+                else if (heap_budget > 200)
+                    tilesize = 100;
+                else
+                    tilesize = 32;
+            }
+            else if (parameters->scale == 3)
+            {
+                if (heap_budget > 3300)
+                    tilesize = 400;
+                else if (heap_budget > 1900)
+                    tilesize = 300;
+                else if (heap_budget > 950)
+                    tilesize = 200;
+                else if (heap_budget > 320)
+                    tilesize = 100;
+                else
+                    tilesize = 32;
+            }
+            else
+            {
+                if (heap_budget > 1690)
+                    tilesize = 400;
+                else if (heap_budget > 980)
+                    tilesize = 300;
+                else if (heap_budget > 530)
+                    tilesize = 200;
+                else if (heap_budget > 240)
+                    tilesize = 100;
+                else
+                    tilesize = 32;
+            }
+        }
+    }
+
+    RealCUGANInstance* instance = new RealCUGANInstance(new RealCUGAN(parameters->gpuid, parameters->tta_mode != 0, gpu ? 1 : parameters->num_threads), gpu);
+
+    RealCUGAN* realcugan = instance->engine;
+    realcugan->input_bgr = parameters->input_bgr != 0;
+    realcugan->output_bgr = parameters->output_bgr != 0;
+    // the engine prints tile progress to stderr without a callback, keep the host quiet
+    realcugan->progress_callback = tile_progress_ignore;
+    realcugan->noise = parameters->noise;
+    realcugan->scale = parameters->scale;
+    realcugan->tilesize = tilesize;
+    realcugan->prepadding = parameters->prepadding;
+    realcugan->syncgap = parameters->syncgap;
+
+    *error = REALCUGAN_OK;
+    return instance;
+}
+
+void REALCUGAN_C_API realcugan_destroy(realcugan_instance instance)
+{
+    engine_c_destroy((RealCUGANInstance*)instance);
+}
+
+realcugan_error REALCUGAN_C_API realcugan_load(realcugan_instance instance, const char* parampath, const char* modelpath)
+{
+    return (realcugan_error)engine_c_load((RealCUGANInstance*)instance, parampath, modelpath);
+}
+
+realcugan_error REALCUGAN_C_API realcugan_process(realcugan_instance instance,
+    const unsigned char* src, int w, int h, int channels, size_t src_stride,
+    unsigned char* dst, size_t dst_stride)
+{
+    return (realcugan_error)engine_c_process((const RealCUGANInstance*)instance, src, w, h, channels, src_stride, dst, dst_stride);
+}
+
+realcugan_error REALCUGAN_C_API realcugan_submit(realcugan_instance instance,
+    const unsigned char* src, int w, int h, int channels, size_t src_stride,
+    unsigned char* dst, size_t dst_stride,
+    realcugan_callback callback, void* userdata)
+{
+    return (realcugan_error)engine_c_submit((RealCUGANInstance*)instance, src, w, h, channels, src_stride, dst, dst_stride, callback, userdata);
+}
+
+void REALCUGAN_C_API realcugan_wait(realcugan_instance instance)
+{
+    engine_c_wait((RealCUGANInstance*)instance);
+}
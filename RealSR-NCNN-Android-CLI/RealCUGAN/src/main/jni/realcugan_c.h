@@ -0,0 +1,93 @@
+// c api of the realcugan engine, for host apps that keep models loaded and hand over pixels directly
+
+#ifndef REALCUGAN_C_H
+#define REALCUGAN_C_H
+
+#include <stddef.h>
+
+#ifdef _WIN32
+#ifdef REALCUGAN_C_BUILD
+#define REALCUGAN_C_EXPORT __declspec(dllexport)
+#else
+#define REALCUGAN_C_EXPORT __declspec(dllimport)
+#endif
+#define REALCUGAN_C_API __stdcall
+#else
+#define REALCUGAN_C_EXPORT __attribute__((visibility("default")))
+#define REALCUGAN_C_API
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+    typedef enum realcugan_error
+    {
+        REALCUGAN_OK = 0,
+        REALCUGAN_ERROR_NULL_INSTANCE,
+        REALCUGAN_ERROR_NULL_DATA,
+        REALCUGAN_ERROR_INVALID_PARAMETERS,
+        REALCUGAN_ERROR_LOAD_MODEL,
+        REALCUGAN_ERROR_NOT_LOADED,
+        REALCUGAN_ERROR_PROCESS
+    } realcugan_error;
+
+    typedef struct realcugan_parameters
+    {
+        // -1 for cpu
+        int gpuid;
+        int tta_mode;
+        // cpu threads, ignored on gpu
+        int num_threads;
+        // -1 conservative, 0 no denoise, 1 to 3 denoise, as in the name of the model files
+        int noise;
+        // 2, 3 or 4, the up2x to up4x models
+        int scale;
+        // >= 32, or 0 to keep the engine default
+        int tilesize;
+        // 18, 14 and 19 for the 2x, 3x and 4x models
+        int prepadding;
+        // 0 to 3, se statistics synced over the whole image, 0 for the nose models
+        int syncgap;
+        // src in bgr(a) order, rgb(a) otherwise
+        int input_bgr;
+        // dst in bgr(a) order, rgb(a) otherwise
+        int output_bgr;
+    } realcugan_parameters;
+
+    typedef void* realcugan_instance;
+
+    // runs on the worker thread of the instance once a submitted job is done
+    typedef void (*realcugan_callback)(void* userdata, realcugan_error error);
+
+    REALCUGAN_C_EXPORT void REALCUGAN_C_API realcugan_default_parameters(realcugan_parameters* parameters);
+
+    // the vulkan instance is created with the first instance and destroyed with the last
+    REALCUGAN_C_EXPORT realcugan_instance REALCUGAN_C_API realcugan_create(const realcugan_parameters* parameters, realcugan_error* error);
+    REALCUGAN_C_EXPORT void REALCUGAN_C_API realcugan_destroy(realcugan_instance instance);
+
+    // utf-8 paths
+    REALCUGAN_C_EXPORT realcugan_error REALCUGAN_C_API realcugan_load(realcugan_instance instance, const char* parampath, const char* modelpath);
+
+    // src is w x h with channels 3 or 4, in the order of input_bgr
+    // dst is w * scale x h * scale with the same channels, both owned by the caller
+    // a stride of 0 means packed rows, packed rows are used in place and others are repacked
+    REALCUGAN_C_EXPORT realcugan_error REALCUGAN_C_API realcugan_process(realcugan_instance instance,
+        const unsigned char* src, int w, int h, int channels, size_t src_stride,
+        unsigned char* dst, size_t dst_stride);
+
+    // queues the same work and returns, src and dst must stay valid until callback
+    REALCUGAN_C_EXPORT realcugan_error REALCUGAN_C_API realcugan_submit(realcugan_instance instance,
+        const unsigned char* src, int w, int h, int channels, size_t src_stride,
+        unsigned char* dst, size_t dst_stride,
+        realcugan_callback callback, void* userdata);
+
+    // blocks until every submitted job has called back
+    REALCUGAN_C_EXPORT void REALCUGAN_C_API realcugan_wait(realcugan_instance instance);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // REALCUGAN_C_H
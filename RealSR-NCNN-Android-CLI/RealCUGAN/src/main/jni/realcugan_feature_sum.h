@@ -0,0 +1,212 @@
+// running sum of the se features of one gap slot, so stage0 does not keep a feature per tile
+
+#ifndef REALCUGAN_FEATURE_SUM_H
+#define REALCUGAN_FEATURE_SUM_H
+
+#include <stdio.h>
+#include <vector>
+
+// ncnn
+#include "command.h"
+#include "gpu.h"
+#include "mat.h"
+#include "pipeline.h"
+
+#include "tile_tta.h"
+
+// fp32 with elempack 1, the layout the gap average is taken in
+static inline ncnn::Mat feature_unpacked(const ncnn::Mat& feat, const ncnn::Option& opt)
+{
+    ncnn::Mat feat_fp32 = feat;
+
+    if (feat_fp32.elembits() == 16)
+    {
+        ncnn::cast_float16_to_float32(feat, feat_fp32, opt);
+    }
+
+    if (feat_fp32.elempack != 1)
+    {
+        ncnn::Mat feat_unpacked;
+        ncnn::convert_packing(feat_fp32, feat_unpacked, 1, opt);
+        feat_fp32 = feat_unpacked;
+    }
+
+    return feat_fp32;
+}
+
+// sum += feat, both fp32 with elempack 1, channels walked with the cstep of each
+// -1 when feat does not have the channel count and channel size of the sum
+static inline int feature_add(const ncnn::Mat& feat, ncnn::Mat& sum)
+{
+    const int channels = sum.c;
+    const int size = sum.w * sum.h;
+
+    if (feat.empty() || feat.c != channels || feat.w * feat.h != size)
+    {
+        fprintf(stderr, "syncgap feature %d x %d x %d does not match %d x %d x %d\n", feat.w, feat.h, feat.c, sum.w, sum.h, channels);
+        return -1;
+    }
+
+    for (int q = 0; q < channels; q++)
+    {
+        tta_add_row(feat.channel(q), size, sum.channel(q));
+    }
+
+    return 0;
+}
+
+// the features are added in the layout of the first one, on the gpu in an fp32 buffer of the blob allocator
+// a feature in another layout is refused and left to the caller
+class FeatureSum
+{
+public:
+    FeatureSum()
+    {
+        count = 0;
+    }
+
+    void clear()
+    {
+        gpu_sum.release();
+        cpu_sum.release();
+        count = 0;
+    }
+
+    // recorded in cmd, feature_sum is the pipeline of realcugan_feature_sum.comp
+    int add(const ncnn::VkMat& feat, const ncnn::Pipeline* feature_sum, ncnn::VkCompute& cmd, const ncnn::Option& opt)
+    {
+        if (count == 0)
+        {
+            set_layout(feat.dims, feat.w, feat.h, feat.c, feat.elempack);
+
+            gpu_sum.create(size * c, (size_t)4u, 1, opt.blob_vkallocator);
+        }
+        else if (!matches(feat.dims, feat.w, feat.h, feat.c, feat.elempack))
+        {
+            return -1;
+        }
+
+        std::vector<ncnn::VkMat> bindings(2);
+        bindings[0] = feat;
+        bindings[1] = gpu_sum;
+
+        // fp16 features are read as half pairs, the channel padding is skipped
+        std::vector<ncnn::vk_constant_type> constants(5);
+        constants[0].i = size;
+        constants[1].i = c;
+        constants[2].i = (int)feat.cstep * feat.elempack;
+        constants[3].i = feat.elembits() == 16 ? 1 : 0;
+        constants[4].i = count == 0 ? 1 : 0;
+
+        ncnn::VkMat dispatcher;
+        dispatcher.w = size;
+        dispatcher.h = c;
+        dispatcher.c = 1;
+
+        cmd.record_pipeline(feature_sum, bindings, constants, dispatcher);
+
+        count++;
+        return 0;
+    }
+
+    // cpu features come out of the extractor in fp32 with elempack 1
+    int add(const ncnn::Mat& feat)
+    {
+        if (count == 0)
+        {
+            set_layout(feat.dims, feat.w, feat.h, feat.c, feat.elempack);
+
+            cpu_sum = feat.clone();
+        }
+        else if (!matches(feat.dims, feat.w, feat.h, feat.c, feat.elempack))
+        {
+            return -1;
+        }
+        else
+        {
+            for (int q = 0; q < c; q++)
+            {
+                tta_add_row(feat.channel(q), size, cpu_sum.channel(q));
+            }
+        }
+
+        count++;
+        return 0;
+    }
+
+    // the gpu sum is downloaded through cmd, submitted here
+    // fp32 with elempack 1 in the layout of the features
+    ncnn::Mat download(ncnn::VkCompute& cmd, const ncnn::Option& opt) const
+    {
+        if (count == 0)
+            return ncnn::Mat();
+
+        ncnn::Mat sum_flat;
+        cmd.record_download(gpu_sum, sum_flat, opt);
+        cmd.submit_and_wait();
+        cmd.reset();
+
+        ncnn::Mat sum;
+        if (dims == 1)
+            sum.create(w, (size_t)4u * elempack, elempack);
+        else if (dims == 2)
+            sum.create(w, h, (size_t)4u * elempack, elempack);
+        else
+            sum.create(w, h, c, (size_t)4u * elempack, elempack);
+
+        for (int q = 0; q < c; q++)
+        {
+            const float* ptr = (const float*)sum_flat.data + (size_t)q * size;
+            float* outptr = sum.channel(q);
+
+            for (int k = 0; k < size; k++)
+            {
+                outptr[k] = ptr[k];
+            }
+        }
+
+        return feature_unpacked(sum, opt);
+    }
+
+    ncnn::Mat download(const ncnn::Option& opt) const
+    {
+        if (count == 0)
+            return ncnn::Mat();
+
+        return feature_unpacked(cpu_sum, opt);
+    }
+
+public:
+    int count;
+
+private:
+    void set_layout(int _dims, int _w, int _h, int _c, int _elempack)
+    {
+        dims = _dims;
+        w = _w;
+        h = _h;
+        c = _c;
+        elempack = _elempack;
+        size = w * h * elempack;
+    }
+
+    bool matches(int _dims, int _w, int _h, int _c, int _elempack) const
+    {
+        return dims == _dims && w == _w && h == _h && c == _c && elempack == _elempack;
+    }
+
+private:
+    int dims;
+    int w;
+    int h;
+    int c;
+    int elempack;
+
+    // scalars of one channel without the padding
+    int size;
+
+    ncnn::VkMat gpu_sum;
+    ncnn::Mat cpu_sum;
+};
+
+#endif // REALCUGAN_FEATURE_SUM_H
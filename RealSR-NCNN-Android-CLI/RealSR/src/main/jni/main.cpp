@@ -108,6 +108,13 @@ static std::vector<int> parse_optarg_int_array(const char *optarg) {
 #include "realsr.h"
 
 #include "filesystem_utils.h"
+#include "image_loader.h"
+#include "json_line.h"
+#include "task_budget.h"
+#include "tile_autotune.h"
+#include "spirv_cache.h"
+#include "tile_split.h"
+#include "tile_stripe.h"
 #include <opencv2/opencv.hpp>
 #include <opencv2/core/hal/interface.h>
 using namespace cv;
@@ -127,7 +134,12 @@ static void print_usage() {
     fprintf(stderr,
             "  -j load:proc:save    thread count for load/proc/save (default=1:2:2) can be 1:2,2,2:2 for multi-gpu\n");
     fprintf(stderr, "  -x                   enable tta mode\n");
+    fprintf(stderr, "  -a                   autotune tile-size for auto tiles and cache the result\n");
+    fprintf(stderr, "  -l                   stream large images in tile-row stripes (png output only)\n");
+    fprintf(stderr, "  -r memory-mb         memory ceiling for queued images in MB (0=quarter of ram, default=0)\n");
+    fprintf(stderr, "  -w row-jobs          tile rows in flight per gpu (default=2)\n");
     fprintf(stderr, "  -f format            output image format (jpg/png/webp, default=ext/png)\n");
+    fprintf(stderr, "  -S                   serve json jobs from stdin, one per line, models stay loaded\n");
 //    fprintf(stderr, "  -c check             check output image match input image\n");
 }
 
@@ -140,6 +152,9 @@ public:
     path_t inpath;
     path_t outpath;
 
+    // input and output bytes held against task_budget
+    size_t footprint;
+
     ncnn::Mat inimage;
     ncnn::Mat outimage;
     ncnn::Mat in;
@@ -153,11 +168,7 @@ public:
     void put(const Task &v) {
         lock.lock();
 
-        while (tasks.size() >= 8) // FIXME hardcode queue length
-        {
-            condition.wait(lock);
-        }
-
+        // no length limit, the loaders wait on task_budget instead
         tasks.push(v);
 
         lock.unlock();
@@ -188,6 +199,7 @@ private:
 
 TaskQueue toproc;
 TaskQueue tosave;
+TaskBudget task_budget;
 
 class LoadThreadParams {
 public:
@@ -210,89 +222,23 @@ void *load(void *args) {
     for (int i = 0; i < count; i++) {
         const path_t &imagepath = ltp->input_files[i];
 
-//        int webp = 0;
+        int webp = 0;
 
         unsigned char *pixeldata = 0;
         int w;
         int h;
         int c;
 
-#if _WIN32
-        FILE* fp = _wfopen(imagepath.c_str(), L"rb");
-#else
-        FILE *fp = fopen(imagepath.c_str(), "rb");
-#endif
-        if (fp) {
-            // read whole file
-            unsigned char *filedata = 0;
-            int length = 0;
-            {
-                fseek(fp, 0, SEEK_END);
-                length = ftell(fp);
-                rewind(fp);
-                filedata = (unsigned char *) malloc(length);
-                if (filedata) {
-                    fread(filedata, 1, length, fp);
-                }
-                fclose(fp);
-            }
-
-            if (filedata) {
-                pixeldata = webp_load(filedata, length, &w, &h, &c);
-                if (!pixeldata) {
-//                    webp = 1;
-//                } else {
-                    // not webp, try jpg png etc.
-#if _WIN32
-                    pixeldata = wic_decode_image(imagepath.c_str(), &w, &h, &c);
-#else // _WIN32
-                    pixeldata = stbi_load_from_memory(filedata, length, &w, &h, &c, 0);
-                    if (pixeldata) {
-                        if (_VERBOSE_LOG) {
-                            fprintf(stderr, "channel=%d, stbi_load_from_memory\n", c);
-                        }
-                        // stb_image auto channel
-                        if (c == 1) {
-                            // grayscale -> rgb
-                            stbi_image_free(pixeldata);
-                            pixeldata = stbi_load_from_memory(filedata, length, &w, &h, &c, 3);
-                            c = 3;
-                        } else if (c == 2) {
-                            // grayscale + alpha -> rgba
-                            stbi_image_free(pixeldata);
-                            pixeldata = stbi_load_from_memory(filedata, length, &w, &h, &c, 4);
-                            c = 4;
-                        }
-                    } else if (_VERBOSE_LOG) {
-                        fprintf(stderr, "no pixeldata 2\n");
-                    }
-#endif // _WIN32
-                }
-            } else if (_VERBOSE_LOG) {
-#if _WIN32
-                fwprintf(stderr, L"no filedata\n");
-#else // _WIN32
-                fprintf(stderr, "no filedata 1\n");
-#endif // _WIN32
-            }
-
-            free(filedata);
-        } else if (_VERBOSE_LOG) {
-#if _WIN32
-            fwprintf(stderr, L"fopen failed\n");
-#else // _WIN32
-            fprintf(stderr, "fopen failed\n");
-#endif // _WIN32
-        }
+        pixeldata = image_load(imagepath, &w, &h, &c, &webp);
         if (pixeldata) {
             Task v;
             v.id = i;
+            v.webp = webp;
             v.inpath = imagepath;
             v.outpath = ltp->output_files[i];
 
 
             v.inimage = ncnn::Mat(w, h, (void *) pixeldata, (size_t) c, c);
-            v.outimage = ncnn::Mat(w * scale, h * scale, (size_t) c, c);
 
             if (check) {
                 if (c == 4) {
@@ -302,8 +248,7 @@ void *load(void *args) {
                 }
             }
             fprintf(stderr, "scale=%d, w/h/c %d/%d/%d -> %d/%d/%d\n", scale,
-                    v.inimage.w, v.inimage.h, v.inimage.c,
-                    v.outimage.w, v.outimage.h, v.outimage.c
+                    w, h, c, w * scale, h * scale, c
             );
 
             path_t ext = get_file_extension(v.outpath);
@@ -320,6 +265,10 @@ void *load(void *args) {
 #endif // _WIN32
             }
 
+            // input and output pixels, held until the result is saved
+            v.footprint = (size_t) w * h * c * (1 + scale * scale);
+            task_budget.acquire(v.footprint);
+
             toproc.put(v);
         } else {
 #if _WIN32
@@ -336,11 +285,27 @@ void *load(void *args) {
 class ProcThreadParams {
 public:
     const RealSR *realsr;
+
+    // when set, every image is split by tile rows across these instead
+    std::vector<const RealSR *> split;
+
+    // whole image progress of a split, optional
+    tile_progress_callback progress;
+    void *progress_userdata;
+
+    ProcThreadParams() : realsr(0), progress(0), progress_userdata(0) {
+    }
 };
 
+static int process_image(const ProcThreadParams *ptp, const ncnn::Mat &inimage, ncnn::Mat &outimage) {
+    if (!ptp->split.empty())
+        return tile_split_process(ptp->split, inimage, outimage, ptp->progress, ptp->progress_userdata);
+
+    return ptp->realsr->process(inimage, outimage);
+}
+
 void *proc(void *args) {
     const ProcThreadParams *ptp = (const ProcThreadParams *) args;
-    const RealSR *realsr = ptp->realsr;
 
     for (;;) {
         Task v;
@@ -350,7 +315,10 @@ void *proc(void *args) {
         if (v.id == -233)
             break;
 
-        realsr->process(v.inimage, v.outimage);
+        // allocated only now, queued tasks hold just their input
+        const int scale = ptp->realsr->scale;
+        v.outimage = ncnn::Mat(v.inimage.w * scale, v.inimage.h * scale, (size_t) v.inimage.elemsize, (int) v.inimage.elemsize);
+        process_image(ptp, v.inimage, v.outimage);
 
         tosave.put(v);
     }
@@ -363,6 +331,8 @@ public:
     int verbose;
 //    bool check;
     int check_threshold;
+    // outimage comes in bgr(a) order, imwrite takes it as is
+    int bgr;
 
 };
 
@@ -448,11 +418,132 @@ float compareImageFiles(const std::string& file1, const std::string& file2)
 */
 
 
-void *save(void *args) {
-    const SaveThreadParams *stp = (const SaveThreadParams *) args;
+// encodes one processed task and frees its input pixels, returns 0 on failure
+static int save_task(Task &v, const SaveThreadParams *stp) {
     const int verbose = stp->verbose;
+    const int bgr = stp->bgr;
     const int check_threshold = stp->check_threshold;
 
+    high_resolution_clock::time_point begin = high_resolution_clock::now();
+
+    // free input pixel data
+    {
+        unsigned char *pixeldata = (unsigned char *) v.inimage.data;
+
+
+        fprintf(stderr, "save result...\n");
+
+        if (v.webp == 1) {
+            free(pixeldata);
+        } else {
+#if _WIN32
+            free(pixeldata);
+#else
+            stbi_image_free(pixeldata);
+#endif
+        }
+    }
+
+    int success = 0;
+
+    path_t ext = get_file_extension(v.outpath);
+
+    if (ext != PATHSTR("gif")) {
+        // 使用opencv保存图片，速度比默认的stb更快
+        cv::Mat image;
+        switch (v.outimage.elempack) {
+            case 1:
+                image = cv::Mat( v.outimage.h, v.outimage.w, CV_8UC1, v.outimage.data); // 单通道图像
+                break;
+            case 3:
+                image = cv::Mat(v.outimage.h, v.outimage.w, CV_8UC3, v.outimage.data); // 3通道图像
+                if (!bgr)
+                    cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
+                break;
+            case 4:
+                image = cv::Mat(v.outimage.h, v.outimage.w, CV_8UC4, v.outimage.data); // 4通道图像
+                if (!bgr)
+                    cv::cvtColor(image, image, cv::COLOR_RGBA2BGRA);
+                break;
+        }
+        if (image.empty()) {
+            std::cerr << "Error: Image data not loaded." << std::endl;
+            success = false;
+        } else {
+            success = imwrite(v.outpath.c_str(), image);
+        }
+    }else if (ext == PATHSTR("webp") || ext == PATHSTR("WEBP")) {
+        success = webp_save(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack,
+                            (const unsigned char *) v.outimage.data);
+    } else if (ext == PATHSTR("png") || ext == PATHSTR("PNG")) {
+#if _WIN32
+        success = wic_encode_image(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack, v.outimage.data);
+#else
+        success = stbi_write_png(v.outpath.c_str(), v.outimage.w, v.outimage.h,
+                                 v.outimage.elempack, v.outimage.data, 0);
+#endif
+    } else if (ext == PATHSTR("jpg") || ext == PATHSTR("JPG") || ext == PATHSTR("jpeg") ||
+               ext == PATHSTR("JPEG")) {
+#if _WIN32
+        success = wic_encode_jpeg_image(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack, v.outimage.data);
+#else
+        success = stbi_write_jpg(v.outpath.c_str(), v.outimage.w, v.outimage.h,
+                                 v.outimage.elempack, v.outimage.data, 100);
+#endif
+    }
+    if (success) {
+        high_resolution_clock::time_point end = high_resolution_clock::now();
+        duration<double> time_span = duration_cast<duration<double>>(end - begin);
+        fprintf(stderr, "save result use time: %.3lf\n", time_span.count());
+
+        if (verbose) {
+#if _WIN32
+            fwprintf(stdout, L"%ls -> %ls done\n", v.inpath.c_str(), v.outpath.c_str());
+#else
+            fprintf(stdout, "%s -> %s done\n", v.inpath.c_str(), v.outpath.c_str());
+#endif
+        }
+
+
+        if (check_threshold > 0) {
+            fprintf(stderr, "check result...\n");
+            ncnn::Mat checkimage1, checkimage2, outimage;
+
+            int w = v.inimage.w, h = v.inimage.h, c = v.inimage.elemsize;
+            if (c == 4) {
+                outimage = ncnn::Mat::from_pixels((const unsigned char *) v.outimage.data,
+                                                  ncnn::Mat::PIXEL_RGBA, w, h);
+            } else {
+                outimage = ncnn::Mat::from_pixels((const unsigned char *) v.outimage.data,
+                                                  ncnn::Mat::PIXEL_RGB, w, h);
+            }
+            ncnn::resize_bilinear(outimage, checkimage2, w / 2, h / 2);
+            ncnn::resize_bilinear(v.in, checkimage1, w / 2, h / 2);
+            float avg_diff = compareNcnnMats(checkimage1, checkimage2);
+            if (avg_diff > check_threshold)
+                fprintf(stderr, "\nResult is not similar to input, avg diff: %f\n",
+                        avg_diff);
+            else if (avg_diff < 0)
+                fprintf(stderr, "\n[Error]compare result and input, error code: %f\n",
+                        avg_diff);
+            else
+                fprintf(stderr, "\ncompare result and input, avg diff: %f\n", avg_diff);
+
+        }
+    } else {
+#if _WIN32
+        fwprintf(stderr, L"save result failed: %ls\n", v.outpath.c_str());
+#else
+        fprintf(stderr, "save result failed: %s\n", v.outpath.c_str());
+#endif
+    }
+
+    return success;
+}
+
+void *save(void *args) {
+    const SaveThreadParams *stp = (const SaveThreadParams *) args;
+
     for (;;) {
         Task v;
 
@@ -461,120 +552,469 @@ void *save(void *args) {
         if (v.id == -233)
             break;
 
+        TaskBudgetScope budget_scope(task_budget, v.footprint);
 
-        high_resolution_clock::time_point begin = high_resolution_clock::now();
+        save_task(v, stp);
+    }
 
-        // free input pixel data
-        {
-            unsigned char *pixeldata = (unsigned char *) v.inimage.data;
+    return 0;
+}
 
+// the full size output never exists in memory, png inputs are decoded row by row as well
+static int process_stripes(const RealSR *realsr, const path_t &inpath, const path_t &outpath, int verbose,
+                           tile_progress_callback progress = 0, void *userdata = 0) {
+    StripeReader reader;
+    unsigned char *pixeldata = 0;
+    int webp = 0;
+
+    if (reader.open_png(inpath, realsr->input_bgr) != 0) {
+        // other formats are decoded whole, the output is still streamed
+        int w = 0, h = 0, c = 0;
+        pixeldata = image_load(inpath, &w, &h, &c, &webp);
+        if (!pixeldata) {
+#if _WIN32
+            fwprintf(stderr, L"decode image %ls failed\n", inpath.c_str());
+#else
+            fprintf(stderr, "decode image %s failed\n", inpath.c_str());
+#endif
+            return -1;
+        }
 
-            fprintf(stderr, "save result...\n");
+        reader.open_memory(pixeldata, w, h, c);
+    }
 
-            if (v.webp == 1) {
-                free(pixeldata);
-            } else {
+    fprintf(stderr, "stripe scale=%d, w/h/c %d/%d/%d -> %d/%d/%d\n", realsr->scale,
+            reader.w, reader.h, reader.c, reader.w * realsr->scale, reader.h * realsr->scale, reader.c);
+
+    StripeWriter writer;
+    int ret = writer.open_png(outpath, reader.w * realsr->scale, reader.h * realsr->scale, reader.c, realsr->output_bgr);
+    if (ret == 0)
+        ret = stripe_process(realsr, reader, writer, progress, userdata);
+    if (writer.close() != 0)
+        ret = -1;
+
+    reader.close();
+    if (webp == 1) {
+        free(pixeldata);
+    } else if (pixeldata) {
 #if _WIN32
-                free(pixeldata);
+        free(pixeldata);
 #else
-                stbi_image_free(pixeldata);
+        stbi_image_free(pixeldata);
 #endif
-            }
-        }
+    }
 
-        int success = 0;
+    if (ret != 0) {
+#if _WIN32
+        fwprintf(stderr, L"save result failed: %ls\n", outpath.c_str());
+#else
+        fprintf(stderr, "save result failed: %s\n", outpath.c_str());
+#endif
+    } else if (verbose) {
+#if _WIN32
+        fwprintf(stdout, L"%ls -> %ls done\n", inpath.c_str(), outpath.c_str());
+#else
+        fprintf(stdout, "%s -> %s done\n", inpath.c_str(), outpath.c_str());
+#endif
+    }
 
-        path_t ext = get_file_extension(v.outpath);
+    return ret;
+}
+
+// the context each tile needs around it, -1 for an unknown model dir
+static int model_prepadding(const path_t &model) {
+    if (model.find(PATHSTR("models-DF2K")) != path_t::npos ||
+        model.find(PATHSTR("models-Real")) != path_t::npos ||
+        model.find(PATHSTR("models-ESRGAN")) != path_t::npos) {
+        return 10;
+    }
+
+    return -1;
+}
+
+// param and bin for scale, scale is changed to the first other one the model has
+static int find_model(const path_t &model, int &scale, path_t &paramfullpath, path_t &modelfullpath) {
+    int scales[] = {4, 2, 1, 8};
+    int sp = 0;
 
-        if (ext != PATHSTR("gif")) {
-            // 使用opencv保存图片，速度比默认的stb更快
-            cv::Mat image;
-            switch (v.outimage.elempack) {
-                case 1:
-                    image = cv::Mat( v.outimage.h, v.outimage.w, CV_8UC1, v.outimage.data); // 单通道图像
-                    break;
-                case 3:
-                    image = cv::Mat(v.outimage.h, v.outimage.w, CV_8UC3, v.outimage.data); // 3通道图像
-                    cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
-                    break;
-                case 4:
-                    image = cv::Mat(v.outimage.h, v.outimage.w, CV_8UC4, v.outimage.data); // 4通道图像
-                    cv::cvtColor(image, image, cv::COLOR_RGBA2BGRA);
-                    break;
-            }
-            if (image.empty()) {
-                std::cerr << "Error: Image data not loaded." << std::endl;
-                success = false;
-            } else {
-                success = imwrite(v.outpath.c_str(), image);
-            }
-        }else if (ext == PATHSTR("webp") || ext == PATHSTR("WEBP")) {
-            success = webp_save(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack,
-                                (const unsigned char *) v.outimage.data);
-        } else if (ext == PATHSTR("png") || ext == PATHSTR("PNG")) {
 #if _WIN32
-            success = wic_encode_image(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack, v.outimage.data);
+    wchar_t modelpath[256];
+    swprintf(modelpath, 256, L"%s/x%d.bin", model.c_str(), scale);
+    fprintf(stderr, "search model: %s\n", modelpath);
+
+    modelfullpath = sanitize_filepath(modelpath);
+    FILE* mp = _wfopen(modelfullpath.c_str(), L"rb");
 #else
-            success = stbi_write_png(v.outpath.c_str(), v.outimage.w, v.outimage.h,
-                                     v.outimage.elempack, v.outimage.data, 0);
+    char modelpath[256];
+    sprintf(modelpath, "%s/x%d.bin", model.c_str(), scale);
+    fprintf(stderr, "search model: %s\n", modelpath);
+
+    modelfullpath = sanitize_filepath(modelpath);
+    FILE *mp = fopen(modelfullpath.c_str(), "rb");
 #endif
-        } else if (ext == PATHSTR("jpg") || ext == PATHSTR("JPG") || ext == PATHSTR("jpeg") ||
-                   ext == PATHSTR("JPEG")) {
+
+    while (!mp && sp < 4) {
+        int s = scales[sp];
 #if _WIN32
-            success = wic_encode_jpeg_image(v.outpath.c_str(), v.outimage.w, v.outimage.h, v.outimage.elempack, v.outimage.data);
+        swprintf(modelpath, 256, L"%s/x%d.bin", model.c_str(), s);
+
+        modelfullpath = sanitize_filepath(modelpath);
+        mp = _wfopen(modelfullpath.c_str(), L"rb");
 #else
-            success = stbi_write_jpg(v.outpath.c_str(), v.outimage.w, v.outimage.h,
-                                     v.outimage.elempack, v.outimage.data, 100);
+        sprintf(modelpath, "%s/x%d.bin", model.c_str(), s);
+
+        modelfullpath = sanitize_filepath(modelpath);
+        mp = fopen(modelfullpath.c_str(), "rb");
 #endif
+        if (mp) {
+            fprintf(stderr, "Fix scale: %d -> %d\n", scale, s);
+            scale = s;
+            break;
+        } else {
+            fprintf(stderr, "Fix scale fail -> %d\n", s);
+            sp++;
         }
-        if (success) {
-            high_resolution_clock::time_point end = high_resolution_clock::now();
-            duration<double> time_span = duration_cast<duration<double>>(end - begin);
-            fprintf(stderr, "save result use time: %.3lf\n", time_span.count());
+    };
 
-            if (verbose) {
+    if (!mp) {
 #if _WIN32
-                fwprintf(stdout, L"%ls -> %ls done\n", v.inpath.c_str(), v.outpath.c_str());
+        fwprintf(stderr, L"Unknow scale for the model (%ls)\n", modelfullpath.c_str());
 #else
-                fprintf(stdout, "%s -> %s done\n", v.inpath.c_str(), v.outpath.c_str());
+        fprintf(stderr, "Unknow scale for the model (%s)\n", modelfullpath.c_str());
 #endif
-            }
+        return -1;
+    }
+
+    fclose(mp);
+
+#if _WIN32
+    wchar_t parampath[256];
+    swprintf(parampath, 256, L"%s/x%d.param", model.c_str(), scale);
+#else
+    char parampath[256];
+    sprintf(parampath, "%s/x%d.param", model.c_str(), scale);
+#endif
+    paramfullpath = sanitize_filepath(parampath);
+
+    return 0;
+}
+
+// tile size for the heap of the device and the model, cpu tiles are fixed
+static int auto_tilesize(int gpuid, const path_t &model) {
+    if (gpuid == -1)
+        return 200;
+
+    // rows in flight share the inference workspace, they only add their stripes
+    uint32_t heap_budget = ncnn::get_gpu_device(gpuid)->get_heap_budget();
+    const char* gpu_name = ncnn::get_gpu_info(gpuid).device_name();
+    const bool is_adreno = nullptr != strstr(gpu_name, "Adreno");
+
+    // more fine-grained tilesize policy here
+    if (model.find(PATHSTR("models-Real-ESRGANv")) != path_t::npos) {
+        if (heap_budget > 3300)
+            return 400;
+        else if (heap_budget > 1900)
+            return 200;
+        else if (heap_budget > 550)
+            return 100;
+        else if (heap_budget > 200)
+            return 64;
+        else
+            return 32;
+    } else {
+        if (heap_budget > 2800) {
+            if(is_adreno)
+                return 160;
+            else
+                return 200;
+        }
+        else if (heap_budget > 900)
+            return 100;
+        else if (heap_budget > 300)
+            return 64;
+        else
+            return 32;
+    }
+}
 
+static RealSR *create_realsr(int gpuid, int jobs_proc, int row_jobs, int tta_mode, int stripe,
+                             const path_t &paramfullpath, const path_t &modelfullpath,
+                             int scale, int tilesize, int prepadding) {
+    int num_threads = gpuid == -1 ? jobs_proc : 1;
 
-            if (check_threshold > 0) {
-                fprintf(stderr, "check result...\n");
-                ncnn::Mat checkimage1, checkimage2, outimage;
+    RealSR *realsr = new RealSR(gpuid, tta_mode, num_threads);
 
-                int w = v.inimage.w, h = v.inimage.h, c = v.inimage.elemsize;
-                if (c == 4) {
-                    outimage = ncnn::Mat::from_pixels((const unsigned char *) v.outimage.data,
-                                                      ncnn::Mat::PIXEL_RGBA, w, h);
-                } else {
-                    outimage = ncnn::Mat::from_pixels((const unsigned char *) v.outimage.data,
-                                                      ncnn::Mat::PIXEL_RGB, w, h);
-                }
-                ncnn::resize_bilinear(outimage, checkimage2, w / 2, h / 2);
-                ncnn::resize_bilinear(v.in, checkimage1, w / 2, h / 2);
-                float avg_diff = compareNcnnMats(checkimage1, checkimage2);
-                if (avg_diff > check_threshold)
-                    fprintf(stderr, "\nResult is not similar to input, avg diff: %f\n",
-                            avg_diff);
-                else if (avg_diff < 0)
-                    fprintf(stderr, "\n[Error]compare result and input, error code: %f\n",
-                            avg_diff);
-                else
-                    fprintf(stderr, "\ncompare result and input, avg diff: %f\n", avg_diff);
+    // imwrite takes bgr(a), the stripe writer keeps the input order
+    if (!stripe)
+        realsr->output_bgr = true;
 
-            }
-        } else {
+    realsr->load(paramfullpath, modelfullpath);
+
+    realsr->scale = scale;
+    realsr->tilesize = tilesize;
+    realsr->prepadding = prepadding;
+    // cpu threads go to concurrent tiles instead of one wide extractor
+    realsr->cpu_tile_jobs = gpuid == -1 ? jobs_proc : 1;
+    realsr->gpu_row_jobs = row_jobs;
+
+    return realsr;
+}
+
+// job paths are utf-8 json strings
 #if _WIN32
-            fwprintf(stderr, L"save result failed: %ls\n", v.outpath.c_str());
+static path_t path_from_utf8(const std::string &s) {
+    int length = MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, NULL, 0);
+    std::vector<wchar_t> buffer(std::max(length, 1), 0);
+    MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, buffer.data(), length);
+    return path_t(buffer.data());
+}
+
+static std::string path_to_utf8(const path_t &path) {
+    int length = WideCharToMultiByte(CP_UTF8, 0, path.c_str(), -1, NULL, 0, NULL, NULL);
+    std::vector<char> buffer(std::max(length, 1), 0);
+    WideCharToMultiByte(CP_UTF8, 0, path.c_str(), -1, buffer.data(), length, NULL, NULL);
+    return std::string(buffer.data());
+}
 #else
-            fprintf(stderr, "save result failed: %s\n", v.outpath.c_str());
+static path_t path_from_utf8(const std::string &s) {
+    return s;
+}
+
+static std::string path_to_utf8(const path_t &path) {
+    return path;
+}
 #endif
+
+class ServerEngine {
+public:
+    path_t model;
+    // as requested, the engines run the scale the model falls back to
+    int scale;
+    int tta_mode;
+    std::vector<RealSR *> realsr;
+    // per device, what a job with tile 0 runs
+    std::vector<int> tilesize;
+};
+
+class ServerParams {
+public:
+    std::vector<int> gpuid;
+    std::vector<int> jobs_proc;
+    int row_jobs;
+    // per device, 0 picks one for each model
+    std::vector<int> tilesize;
+    path_t model;
+    int scale;
+    int tta_mode;
+    int stripe;
+
+    // loaded on first use and kept until stdin closes
+    std::vector<ServerEngine> engines;
+};
+
+static ServerEngine *server_engine(ServerParams *sp, const path_t &model, int scale, int tta_mode, std::string &error) {
+    for (int i = 0; i < (int) sp->engines.size(); i++) {
+        ServerEngine &engine = sp->engines[i];
+        if (engine.model == model && engine.scale == scale && engine.tta_mode == tta_mode)
+            return &engine;
+    }
+
+    const int prepadding = model_prepadding(model);
+    if (prepadding < 0) {
+        error = "unknown model dir type";
+        return 0;
+    }
+
+    int model_scale = scale;
+    path_t paramfullpath;
+    path_t modelfullpath;
+    if (find_model(model, model_scale, paramfullpath, modelfullpath) != 0) {
+        error = "unknown scale for the model";
+        return 0;
+    }
+
+    ServerEngine engine;
+    engine.model = model;
+    engine.scale = scale;
+    engine.tta_mode = tta_mode;
+    for (int i = 0; i < (int) sp->gpuid.size(); i++) {
+        const int tilesize = sp->tilesize[i] ? sp->tilesize[i] : auto_tilesize(sp->gpuid[i], model);
+        engine.tilesize.push_back(tilesize);
+        engine.realsr.push_back(create_realsr(sp->gpuid[i], sp->jobs_proc[i], sp->row_jobs, tta_mode, sp->stripe,
+                                              paramfullpath, modelfullpath, model_scale,
+                                              tilesize, prepadding));
+    }
+
+    sp->engines.push_back(engine);
+    return &sp->engines.back();
+}
+
+// one job start to end on every device, outpath is the file actually written
+// progress goes to stdout as json lines for id, the quoted job id
+static int serve_job(ServerParams *sp, const std::map<std::string, std::string> &job, const std::string &id, path_t &outpath, std::string &error) {
+    std::map<std::string, std::string>::const_iterator input = job.find("input");
+    std::map<std::string, std::string>::const_iterator output = job.find("output");
+    if (input == job.end() || output == job.end() || input->second.empty() || output->second.empty()) {
+        error = "input and output are required";
+        return -1;
+    }
+
+    std::map<std::string, std::string>::const_iterator model = job.find("model");
+    const path_t inpath = path_from_utf8(input->second);
+    outpath = path_from_utf8(output->second);
+
+    const int scale = json_line_int(job, "scale", sp->scale);
+    const int tta_mode = json_line_int(job, "tta", sp->tta_mode);
+    const int tilesize = json_line_int(job, "tile", 0);
+    if (tilesize != 0 && tilesize < 32) {
+        error = "invalid tile";
+        return -1;
+    }
+
+    path_t ext = get_file_extension(outpath);
+    const bool png = ext == PATHSTR("png") || ext == PATHSTR("PNG");
+    const bool jpg = ext == PATHSTR("jpg") || ext == PATHSTR("JPG") || ext == PATHSTR("jpeg") ||
+                     ext == PATHSTR("JPEG");
+    if (!png && !jpg && ext != PATHSTR("webp") && ext != PATHSTR("WEBP")) {
+        error = "invalid output extension type";
+        return -1;
+    }
+
+    if (sp->stripe && !png) {
+        error = "stripe mode only writes png";
+        return -1;
+    }
+
+    ServerEngine *engine = server_engine(sp, model == job.end() ? sp->model : path_from_utf8(model->second),
+                                         scale, tta_mode, error);
+    if (!engine)
+        return -1;
+
+    // 0 keeps the tile size picked for this model
+    // a single engine reports its own tiles, the stripe and split drivers report the whole image
+    const bool whole = sp->stripe || engine->realsr.size() > 1;
+    for (int i = 0; i < (int) engine->realsr.size(); i++) {
+        engine->realsr[i]->tilesize = tilesize ? tilesize : engine->tilesize[i];
+        engine->realsr[i]->progress_callback = whole ? tile_progress_ignore : json_line_progress;
+        engine->realsr[i]->progress_userdata = (void *) &id;
+    }
+
+    if (sp->stripe) {
+        if (process_stripes(engine->realsr[0], inpath, outpath, 0, json_line_progress, (void *) &id) != 0) {
+            error = "stripe process failed";
+            return -1;
+        }
+        return 0;
+    }
+
+    Task v;
+    int w;
+    int h;
+    int c;
+    unsigned char *pixeldata = image_load(inpath, &w, &h, &c, &v.webp);
+    if (!pixeldata) {
+        error = "decode image failed";
+        return -1;
+    }
+
+    // like load(), jpg has no alpha
+    if (c == 4 && jpg)
+        outpath = outpath + PATHSTR(".png");
+
+    v.id = 0;
+    v.inpath = inpath;
+    v.outpath = outpath;
+    v.footprint = 0;
+    v.inimage = ncnn::Mat(w, h, (void *) pixeldata, (size_t) c, c);
+
+    // jobs come one at a time, so every device works on each of them
+    ProcThreadParams ptp;
+    ptp.realsr = engine->realsr[0];
+    ptp.progress = json_line_progress;
+    ptp.progress_userdata = (void *) &id;
+    if (engine->realsr.size() > 1) {
+        for (int i = 0; i < (int) engine->realsr.size(); i++) {
+            const int workers = sp->gpuid[i] == -1 ? 1 : sp->jobs_proc[i];
+            for (int j = 0; j < workers; j++) {
+                ptp.split.push_back(engine->realsr[i]);
+            }
         }
     }
 
+    const int outscale = engine->realsr[0]->scale;
+    v.outimage = ncnn::Mat(w * outscale, h * outscale, (size_t) c, c);
+    process_image(&ptp, v.inimage, v.outimage);
+
+    // stdout carries the replies only
+    SaveThreadParams stp;
+    stp.verbose = 0;
+    stp.bgr = engine->realsr[0]->output_bgr;
+    stp.check_threshold = 0;
+
+    if (!save_task(v, &stp)) {
+        error = "save result failed";
+        return -1;
+    }
+
+    return 0;
+}
+
+// jobs come on stdin and replies go to stdout, one json object per line
+// {"id":"1","input":"a.jpg","output":"b.png","model":"models-Real-ESRGAN-anime","scale":4,"tile":0,"tta":false}
+// only input and output are required, the rest default to the command line
+static int serve(ServerParams *sp) {
+    std::string error;
+    if (!server_engine(sp, sp->model, sp->scale, sp->tta_mode, error))
+        fprintf(stderr, "preload model failed: %s\n", error.c_str());
+
+    fprintf(stdout, "{\"status\":\"ready\"}\n");
+    fflush(stdout);
+
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+
+        high_resolution_clock::time_point begin = high_resolution_clock::now();
+
+        std::map<std::string, std::string> job;
+        std::string id = "null";
+        path_t outpath;
+        int ret = -1;
+
+        error.clear();
+        if (json_line_parse(line, job) != 0) {
+            error = "invalid json job";
+        } else {
+            if (job.find("id") != job.end())
+                id = json_line_quote(job["id"]);
+
+            fprintf(stdout, "{\"id\":%s,\"status\":\"processing\"}\n", id.c_str());
+            fflush(stdout);
+
+            ret = serve_job(sp, job, id, outpath, error);
+        }
+
+        high_resolution_clock::time_point end = high_resolution_clock::now();
+        duration<double> time_span = duration_cast<duration<double>>(end - begin);
+
+        if (ret == 0) {
+            fprintf(stdout, "{\"id\":%s,\"status\":\"done\",\"output\":%s,\"time\":%.3lf}\n", id.c_str(),
+                    json_line_quote(path_to_utf8(outpath)).c_str(), time_span.count());
+        } else {
+            fprintf(stdout, "{\"id\":%s,\"status\":\"error\",\"message\":%s}\n", id.c_str(),
+                    json_line_quote(error).c_str());
+        }
+        fflush(stdout);
+    }
+
+    for (int i = 0; i < (int) sp->engines.size(); i++) {
+        for (int j = 0; j < (int) sp->engines[i].realsr.size(); j++) {
+            delete sp->engines[i].realsr[j];
+        }
+    }
+    sp->engines.clear();
+
     return 0;
 }
 
@@ -611,15 +1051,20 @@ int main(int argc, char **argv)
     int jobs_load = 1;
     std::vector<int> jobs_proc;
     int jobs_save = 2;
+    int row_jobs = 2;
     int verbose = 0;
     int tta_mode = 0;
+    int autotune = 0;
+    int stripe = 0;
+    int budget_mb = 0;
     path_t format = PATHSTR("png");
     int check_threshold = 0;
+    int server = 0;
 
 #if _WIN32
     setlocale(LC_ALL, "");
     wchar_t opt;
-    while ((opt = getopt(argc, argv, L"i:o:s:c:t:m:g:j:f:vxh")) != (wchar_t)-1)
+    while ((opt = getopt(argc, argv, L"i:o:s:c:t:m:g:j:f:r:w:vxlaSh")) != (wchar_t)-1)
     {
         switch (opt)
         {
@@ -654,9 +1099,24 @@ int main(int argc, char **argv)
         case L'x':
             tta_mode = 1;
             break;
+        case L'a':
+            autotune = 1;
+            break;
+        case L'l':
+            stripe = 1;
+            break;
+        case L'r':
+            budget_mb = _wtoi(optarg);
+            break;
+        case L'w':
+            row_jobs = _wtoi(optarg);
+            break;
         case L'c':
             check_threshold = _wtoi(optarg);
             break;
+        case L'S':
+            server = 1;
+            break;
         case L'h':
         default:
             print_usage();
@@ -665,7 +1125,7 @@ int main(int argc, char **argv)
     }
 #else // _WIN32
     int opt;
-    while ((opt = getopt(argc, argv, "i:o:s:c:t:m:g:j:f:vxh")) != -1) {
+    while ((opt = getopt(argc, argv, "i:o:s:c:t:m:g:j:f:r:w:vxlaSh")) != -1) {
         switch (opt) {
             case 'i':
                 inputpath = optarg;
@@ -698,9 +1158,24 @@ int main(int argc, char **argv)
             case 'x':
                 tta_mode = 1;
                 break;
+            case 'a':
+                autotune = 1;
+                break;
+            case 'l':
+                stripe = 1;
+                break;
+            case 'r':
+                budget_mb = atoi(optarg);
+                break;
+            case 'w':
+                row_jobs = atoi(optarg);
+                break;
             case 'c':
                 check_threshold = atoi(optarg);
                 break;
+            case 'S':
+                server = 1;
+                break;
             case 'h':
             default:
                 print_usage();
@@ -710,7 +1185,7 @@ int main(int argc, char **argv)
 #endif // _WIN32
 
 
-    if (inputpath.empty()) {
+    if (inputpath.empty() && !server) {
         print_usage();
 #if _DEMO_PATH
         fprintf(stderr, "demo input argument\n");
@@ -721,7 +1196,7 @@ int main(int argc, char **argv)
     }
 
 
-    if (outputpath.empty()) {
+    if (outputpath.empty() && !server) {
         print_usage();
 #if _DEMO_PATH
         fprintf(stderr, "demo output argument\n");
@@ -753,6 +1228,16 @@ int main(int argc, char **argv)
         return -1;
     }
 
+    if (row_jobs < 1) {
+        fprintf(stderr, "invalid row-jobs argument\n");
+        return -1;
+    }
+
+    if (budget_mb < 0) {
+        fprintf(stderr, "invalid memory-mb argument\n");
+        return -1;
+    }
+
     if (jobs_proc.size() != (gpuid.empty() ? 1 : gpuid.size()) && !jobs_proc.empty()) {
         fprintf(stderr, "invalid jobs_proc thread count argument\n");
         return -1;
@@ -765,7 +1250,7 @@ int main(int argc, char **argv)
         }
     }
 
-    if (!path_is_directory(outputpath)) {
+    if (!server && !path_is_directory(outputpath)) {
         // guess format from outputpath no matter what format argument specified
         path_t ext = get_file_extension(outputpath);
 
@@ -787,10 +1272,15 @@ int main(int argc, char **argv)
         return -1;
     }
 
+    if (stripe && format != PATHSTR("png")) {
+        fprintf(stderr, "stripe mode only writes png\n");
+        return -1;
+    }
+
     // collect input and output filepath
     std::vector<path_t> input_files;
     std::vector<path_t> output_files;
-    {
+    if (!server) {
         if (path_is_directory(inputpath) && path_is_directory(outputpath)) {
             std::vector<path_t> filenames;
             int lr = list_directory(inputpath, filenames);
@@ -838,73 +1328,20 @@ int main(int argc, char **argv)
     }
 
     int prepadding = 0;
-
-    if (model.find(PATHSTR("models-DF2K")) != path_t::npos ||
-        model.find(PATHSTR("models-Real")) != path_t::npos ||
-        model.find(PATHSTR("models-ESRGAN")) != path_t::npos) {
-        prepadding = 10;
-    } else {
-        fprintf(stderr, "unknown model dir type\n");
-        return -1;
-    }
-
-    std::cout << "build time: " << __DATE__ << " " << __TIME__ << std::endl;
-
-    int scales[] = {4, 2, 1, 8};
-    int sp = 0;
-
-#if _WIN32
-    wchar_t modelpath[256];
-    swprintf(modelpath, 256, L"%s/x%d.bin", model.c_str(), scale);
-    fprintf(stderr, "search model: %s\n", modelpath);
-
-    path_t modelfullpath = sanitize_filepath(modelpath);
-    FILE* mp = _wfopen(modelfullpath.c_str(), L"rb");
-#else
-    char modelpath[256];
-    sprintf(modelpath, "%s/x%d.bin", model.c_str(), scale);
-    fprintf(stderr, "search model: %s\n", modelpath);
-
-    path_t modelfullpath = sanitize_filepath(modelpath);
-    FILE *mp = fopen(modelfullpath.c_str(), "rb");
-#endif
-
-    while (!mp && sp < 4) {
-        int s = scales[sp];
-#if _WIN32
-        swprintf(modelpath, 256, L"%s/x%d.bin", model.c_str(), s);
-
-        modelfullpath = sanitize_filepath(modelpath);
-        mp = _wfopen(modelfullpath.c_str(), L"rb");
-#else
-        sprintf(modelpath, "%s/x%d.bin", model.c_str(), s);
-
-        modelfullpath = sanitize_filepath(modelpath);
-        mp = fopen(modelfullpath.c_str(), "rb");
-#endif
-        if (mp) {
-            fprintf(stderr, "Fix scale: %d -> %d\n", scale, s);
-            scale = s;
-            break;
-        } else {
-            fprintf(stderr, "Fix scale fail -> %d\n", s);
-            sp++;
+    path_t paramfullpath;
+    path_t modelfullpath;
+    if (!server) {
+        prepadding = model_prepadding(model);
+        if (prepadding < 0) {
+            fprintf(stderr, "unknown model dir type\n");
+            return -1;
         }
-    };
 
-    if (!mp) {
-        fprintf(stderr, "Unknow scale for the model (%s)\n", modelfullpath.c_str());
-        return -1;
-    }
+        std::cout << "build time: " << __DATE__ << " " << __TIME__ << std::endl;
 
-#if _WIN32
-    wchar_t parampath[256];
-    swprintf(parampath, 256, L"%s/x%d.param", model.c_str(), scale);
-#else
-    char parampath[256];
-    sprintf(parampath, "%s/x%d.param", model.c_str(), scale);
-#endif
-    path_t paramfullpath = sanitize_filepath(parampath);
+        if (find_model(model, scale, paramfullpath, modelfullpath) != 0)
+            return -1;
+    }
 
 
 #if _WIN32
@@ -914,6 +1351,9 @@ int main(int argc, char **argv)
     ncnn::create_gpu_instance();
 //    ncnn::set_cpu_powersave(0);
 
+    // pre/post shaders compiled by an earlier run
+    spirv_cache_set_directory(get_executable_directory() + PATHSTR("spirv-cache"));
+
     if (gpuid.empty()) {
         gpuid.push_back(ncnn::get_default_gpu_index());
     }
@@ -932,6 +1372,10 @@ int main(int argc, char **argv)
     jobs_load = std::min(jobs_load, cpu_count);
     jobs_save = std::min(jobs_save, cpu_count);
 
+    task_budget.set_ceiling((size_t) budget_mb * 1024 * 1024);
+    if (verbose)
+        fprintf(stderr, "task memory budget %zu MB\n", task_budget.get_ceiling() / 1024 / 1024);
+
     int gpu_count = ncnn::get_gpu_count();
     for (int i = 0; i < use_gpu_count; i++) {
         if (gpuid[i] < -1 || gpuid[i] >= gpu_count) {
@@ -954,6 +1398,30 @@ int main(int argc, char **argv)
         }
     }
 
+    // tiles left to the policy below may be autotuned later
+    std::vector<int> tilesize_auto(use_gpu_count);
+    for (int i = 0; i < use_gpu_count; i++) {
+        tilesize_auto[i] = tilesize[i] == 0;
+    }
+
+    if (server) {
+        ServerParams sp;
+        sp.gpuid = gpuid;
+        sp.jobs_proc = jobs_proc;
+        sp.row_jobs = row_jobs;
+        // 0 stays auto, the engines pick their tile size for the model they load
+        sp.tilesize = tilesize;
+        sp.model = model;
+        sp.scale = scale;
+        sp.tta_mode = tta_mode;
+        sp.stripe = stripe;
+
+        serve(&sp);
+
+        ncnn::destroy_gpu_instance();
+        return 0;
+    }
+
     if (verbose)
         fprintf(stderr, "init heap_budget, use_gpu_count=%d\n", use_gpu_count);
     for (int i = 0; i < use_gpu_count; i++) {
@@ -970,39 +1438,8 @@ int main(int argc, char **argv)
             continue;
         }
 
-        uint32_t heap_budget = ncnn::get_gpu_device(gpuid[i])->get_heap_budget();
-        const char* gpu_name = ncnn::get_gpu_info(i).device_name();
-        const bool is_adreno = nullptr != strstr(gpu_name, "Adreno");
-
-        // more fine-grained tilesize policy here
-        if (model.find(PATHSTR("models-Real-ESRGANv")) != path_t::npos) {
-            if (heap_budget > 3300)
-                tilesize[i] = 400;
-            else if (heap_budget > 1900)
-                tilesize[i] = 200;
-            else if (heap_budget > 550)
-                tilesize[i] = 100;
-            else if (heap_budget > 200)
-                tilesize[i] = 64;
-            else
-                tilesize[i] = 32;
-        } else {
-            if (heap_budget > 2800) {
-                if(is_adreno)
-                    tilesize[i] = 160;
-                else
-                    tilesize[i] = 200;
-            }
-            else if (heap_budget > 900)
-                tilesize[i] = 100;
-            else if (heap_budget > 300)
-                tilesize[i] = 64;
-            else
-                tilesize[i] = 32;
-        }
-
-        fprintf(stderr, "config gpu[%d], tilesize=%d, heap_budget=%d\n", i, tilesize[i],
-                heap_budget);
+        tilesize[i] = auto_tilesize(gpuid[i], model);
+        fprintf(stderr, "config gpu[%d], tilesize=%d\n", i, tilesize[i]);
 
         if (verbose) {
             const ncnn::GpuInfo &info = ncnn::get_gpu_info(gpuid[i]);
@@ -1013,6 +1450,7 @@ int main(int argc, char **argv)
             );
         }
     }
+
     if (verbose)
         fprintf(stderr, "init realsr\n");
     else
@@ -1021,19 +1459,40 @@ int main(int argc, char **argv)
         std::vector<RealSR *> realsr(use_gpu_count);
 
         for (int i = 0; i < use_gpu_count; i++) {
-            int num_threads = gpuid[i] == -1 ? jobs_proc[i] : 1;
+            realsr[i] = create_realsr(gpuid[i], jobs_proc[i], row_jobs, tta_mode, stripe, paramfullpath,
+                                      modelfullpath, scale, tilesize[i], prepadding);
+        }
+
+        if (autotune) {
+            const path_t cache_path = tile_autotune_cache_path();
+
+            for (int i = 0; i < use_gpu_count; i++) {
+                if (!tilesize_auto[i])
+                    continue;
 
-            realsr[i] = new RealSR(gpuid[i], tta_mode, num_threads);
+                const std::string key = tile_autotune_key(gpuid[i], jobs_proc[i], row_jobs, modelfullpath, scale, tta_mode);
 
-            realsr[i]->load(paramfullpath, modelfullpath);
+                int cached = tile_autotune_load(cache_path, key);
+                if (cached != 0) {
+                    realsr[i]->tilesize = cached;
+                    fprintf(stderr, "autotune gpu[%d], cached tilesize=%d\n", i, cached);
+                    continue;
+                }
 
-            realsr[i]->scale = scale;
-            realsr[i]->tilesize = tilesize[i];
-            realsr[i]->prepadding = prepadding;
+                fprintf(stderr, "autotune gpu[%d], calibrating from tilesize=%d\n", i, tilesize[i]);
+                int tuned = tile_autotune(realsr[i], 3, tilesize[i], gpuid[i], jobs_proc[i], verbose);
+                tile_autotune_store(cache_path, key, tuned);
+                fprintf(stderr, "autotune gpu[%d], tilesize=%d\n", i, tuned);
+            }
         }
 
         // main routine
-        {
+        if (stripe) {
+            // one image at a time on the first device, rows are streamed from and to disk
+            for (int i = 0; i < (int) input_files.size(); i++) {
+                process_stripes(realsr[0], input_files[i], output_files[i], verbose);
+            }
+        } else {
             // load image
             LoadThreadParams ltp;
             ltp.scale = scale;
@@ -1050,17 +1509,33 @@ int main(int argc, char **argv)
                 ptp[i].realsr = realsr[i];
             }
 
+            // fewer images than devices, one proc thread splits each image across all of them
+            const bool split = use_gpu_count > 1 && (int) input_files.size() < use_gpu_count;
+            if (split) {
+                for (int i = 0; i < use_gpu_count; i++) {
+                    const int workers = gpuid[i] == -1 ? 1 : jobs_proc[i];
+                    for (int j = 0; j < workers; j++) {
+                        ptp[0].split.push_back(realsr[i]);
+                    }
+                }
+                total_jobs_proc = 1;
+            }
+
             std::vector<ncnn::Thread *> proc_threads(total_jobs_proc);
             {
                 int total_jobs_proc_id = 0;
-                for (int i = 0; i < use_gpu_count; i++) {
-                    if (gpuid[i] == -1) {
-                        proc_threads[total_jobs_proc_id++] = new ncnn::Thread(proc,
-                                                                              (void *) &ptp[i]);
-                    } else {
-                        for (int j = 0; j < jobs_proc[i]; j++) {
+                if (split) {
+                    proc_threads[total_jobs_proc_id++] = new ncnn::Thread(proc, (void *) &ptp[0]);
+                } else {
+                    for (int i = 0; i < use_gpu_count; i++) {
+                        if (gpuid[i] == -1) {
                             proc_threads[total_jobs_proc_id++] = new ncnn::Thread(proc,
                                                                                   (void *) &ptp[i]);
+                        } else {
+                            for (int j = 0; j < jobs_proc[i]; j++) {
+                                proc_threads[total_jobs_proc_id++] = new ncnn::Thread(proc,
+                                                                                      (void *) &ptp[i]);
+                            }
                         }
                     }
                 }
@@ -1069,6 +1544,7 @@ int main(int argc, char **argv)
             // save image
             SaveThreadParams stp;
             stp.verbose = verbose;
+            stp.bgr = realsr[0]->output_bgr;
             stp.check_threshold = check_threshold;
 
             std::vector<ncnn::Thread *> save_threads(jobs_save);
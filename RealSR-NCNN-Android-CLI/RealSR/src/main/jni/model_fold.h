@@ -0,0 +1,282 @@
+// load time fold of the 1/255 input and * 255 + 0.5 output scaling into the weights of a plain model,
+// so that the cpu tile conversion is a cast in both directions
+// used by the realsr cpu path only: the gpu preproc and postproc shaders scale in the same pass as their
+// layout conversion, and the realcugan input skips over the net, so its scaling cannot move into the weights
+
+#ifndef MODEL_FOLD_H
+#define MODEL_FOLD_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+// ncnn
+#include "datareader.h"
+
+// the path_t of filesystem_utils.h, which the engine does not include
+#if _WIN32
+typedef std::wstring model_fold_path_t;
+#else
+typedef std::string model_fold_path_t;
+#endif
+
+// fp32 values in the bin that become v * scale + bias
+struct ModelFoldRegion
+{
+    size_t offset;
+    size_t count;
+    float scale;
+    float bias;
+};
+
+struct ModelFoldLayer
+{
+    std::string type;
+    std::vector<std::string> bottoms;
+    std::vector<std::string> tops;
+    std::map<int, double> params;
+
+    double param(int id, double fallback) const
+    {
+        std::map<int, double>::const_iterator it = params.find(id);
+        return it == params.end() ? fallback : it->second;
+    }
+};
+
+static FILE* model_fold_open(const model_fold_path_t& path)
+{
+#if _WIN32
+    return _wfopen(path.c_str(), L"rb");
+#else
+    return fopen(path.c_str(), "rb");
+#endif
+}
+
+// text param only, array values are skipped
+static int model_fold_read_param(const model_fold_path_t& parampath, std::vector<ModelFoldLayer>& layers)
+{
+    FILE* fp = model_fold_open(parampath);
+    if (!fp)
+        return -1;
+
+    std::string text;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    {
+        text.append(buf, n);
+    }
+    fclose(fp);
+
+    std::vector<std::vector<std::string> > lines;
+    {
+        std::vector<std::string> tokens;
+        std::string token;
+        for (size_t i = 0; i <= text.size(); i++)
+        {
+            const char ch = i < text.size() ? text[i] : '\n';
+            if (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n')
+            {
+                if (!token.empty())
+                    tokens.push_back(token);
+                token.clear();
+
+                if (ch == '\n' && !tokens.empty())
+                {
+                    lines.push_back(tokens);
+                    tokens.clear();
+                }
+            }
+            else
+            {
+                token += ch;
+            }
+        }
+    }
+
+    // magic, then layer and blob count
+    if (lines.size() < 3 || lines[0][0] != "7767517")
+        return -1;
+
+    for (size_t i = 2; i < lines.size(); i++)
+    {
+        const std::vector<std::string>& tokens = lines[i];
+        if (tokens.size() < 4)
+            return -1;
+
+        ModelFoldLayer layer;
+        layer.type = tokens[0];
+
+        const size_t bottom_count = atoi(tokens[2].c_str());
+        const size_t top_count = atoi(tokens[3].c_str());
+        if (tokens.size() < 4 + bottom_count + top_count)
+            return -1;
+
+        layer.bottoms.assign(tokens.begin() + 4, tokens.begin() + 4 + bottom_count);
+        layer.tops.assign(tokens.begin() + 4 + bottom_count, tokens.begin() + 4 + bottom_count + top_count);
+
+        for (size_t j = 4 + bottom_count + top_count; j < tokens.size(); j++)
+        {
+            const size_t eq = tokens[j].find('=');
+            if (eq != std::string::npos)
+                layer.params[atoi(tokens[j].substr(0, eq).c_str())] = atof(tokens[j].c_str() + eq + 1);
+        }
+
+        layers.push_back(layer);
+    }
+
+    return 0;
+}
+
+static int model_fold_consumers(const std::vector<ModelFoldLayer>& layers, const std::string& blob)
+{
+    int count = 0;
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+        for (size_t j = 0; j < layers[i].bottoms.size(); j++)
+        {
+            if (layers[i].bottoms[j] == blob)
+                count++;
+        }
+    }
+    return count;
+}
+
+// a plain fp32 convolution without int8 or a non zero pad value
+static bool model_fold_plain_conv(const ModelFoldLayer& layer)
+{
+    if (layer.type != "Convolution" && layer.type != "Deconvolution")
+        return false;
+
+    return layer.bottoms.size() == 1 && layer.tops.size() == 1 && layer.param(6, 0) > 0
+           && layer.param(8, 0) == 0 && layer.param(18, 0) == 0;
+}
+
+static bool model_fold_read_flag(FILE* fp, size_t offset, unsigned int& flag)
+{
+    return fseek(fp, (long)offset, SEEK_SET) == 0 && fread(&flag, sizeof(flag), 1, fp) == 1;
+}
+
+// the input feeds only the first layer after Input and the output comes straight from the last layer,
+// both convolutions with fp32 weights, anything else (residuals of the input, int8, fp16 bins) is left alone
+static int model_fold_plan(const model_fold_path_t& parampath, const model_fold_path_t& modelpath, std::vector<ModelFoldRegion>& regions)
+{
+    regions.clear();
+
+    std::vector<ModelFoldLayer> layers;
+    if (model_fold_read_param(parampath, layers) != 0 || layers.size() < 3)
+        return -1;
+
+    const ModelFoldLayer& input = layers[0];
+    const ModelFoldLayer& first = layers[1];
+    const ModelFoldLayer& last = layers.back();
+
+    if (input.type != "Input" || input.tops.size() != 1 || model_fold_consumers(layers, input.tops[0]) != 1)
+        return -1;
+
+    if (!model_fold_plain_conv(first) || first.bottoms[0] != input.tops[0])
+        return -1;
+
+    // the rounding lands in the bias, and no activation may sit between it and the output
+    if (!model_fold_plain_conv(last) || last.param(5, 0) == 0 || last.param(9, 0) != 0)
+        return -1;
+
+    // its top must be the only output the engine could extract
+    for (size_t i = 0; i < layers.size(); i++)
+    {
+        for (size_t j = 0; j < layers[i].tops.size(); j++)
+        {
+            const bool is_last = i + 1 == layers.size();
+            if (is_last != (model_fold_consumers(layers, layers[i].tops[j]) == 0))
+                return -1;
+        }
+    }
+
+    FILE* fp = model_fold_open(modelpath);
+    if (!fp)
+        return -1;
+
+    fseek(fp, 0, SEEK_END);
+    const long length = ftell(fp);
+
+    // the first weighted layer is read from the start of the bin, the last one ends it
+    const size_t first_weights = (size_t)first.param(6, 0);
+    const size_t last_weights = (size_t)last.param(6, 0);
+    const size_t last_outputs = (size_t)last.param(0, 0);
+    const size_t last_bytes = 4 + last_weights * 4 + last_outputs * 4;
+
+    unsigned int first_flag = 1;
+    unsigned int last_flag = 1;
+    const bool ok = length > 0 && (size_t)length >= 4 + first_weights * 4 + last_bytes
+                    && model_fold_read_flag(fp, 0, first_flag) && model_fold_read_flag(fp, length - last_bytes, last_flag);
+    fclose(fp);
+
+    // 0 tags raw fp32 weights
+    if (!ok || first_flag != 0 || last_flag != 0)
+        return -1;
+
+    ModelFoldRegion region;
+    region.offset = 4;
+    region.count = first_weights;
+    region.scale = 1 / 255.f;
+    region.bias = 0.f;
+    regions.push_back(region);
+
+    region.offset = length - last_bytes + 4;
+    region.count = last_weights;
+    region.scale = 255.f;
+    region.bias = 0.f;
+    regions.push_back(region);
+
+    region.offset = length - last_outputs * 4;
+    region.count = last_outputs;
+    region.scale = 255.f;
+    region.bias = 0.5f;
+    regions.push_back(region);
+
+    return 0;
+}
+
+// patches the planned regions while ncnn reads the bin
+class ModelFoldDataReader : public ncnn::DataReader
+{
+public:
+    ModelFoldDataReader(FILE* _fp, const std::vector<ModelFoldRegion>& _regions) : fp(_fp), regions(_regions), position(0)
+    {
+    }
+
+    virtual size_t read(void* buf, size_t size) const
+    {
+        const size_t n = fread(buf, 1, size, fp);
+
+        for (size_t i = 0; i < regions.size(); i++)
+        {
+            const ModelFoldRegion& region = regions[i];
+            const size_t begin = std::max(region.offset, position);
+            const size_t end = std::min(region.offset + region.count * 4, position + n);
+
+            // the weight arrays are read whole, so the floats never straddle two reads
+            for (size_t offset = begin; offset + 4 <= end; offset += 4)
+            {
+                float v;
+                memcpy(&v, (unsigned char*)buf + offset - position, 4);
+                v = v * region.scale + region.bias;
+                memcpy((unsigned char*)buf + offset - position, &v, 4);
+            }
+        }
+
+        position += n;
+        return n;
+    }
+
+private:
+    FILE* fp;
+    std::vector<ModelFoldRegion> regions;
+    mutable size_t position;
+};
+
+#endif // MODEL_FOLD_H
@@ -1,6 +1,12 @@
 // realsr implemented with ncnn library
 
 #include "realsr.h"
+#include "tile_arena.h"
+#include "model_fold.h"
+#include "spirv_cache.h"
+#include "tile_pixels.h"
+#include "tile_plan.h"
+#include "tile_tta.h"
 
 #include <algorithm>
 #include <vector>
@@ -23,6 +29,26 @@ RealSR::RealSR(int gpuid, bool _tta_mode, int num_threads)
     bicubic_3x = 0;
     bicubic_4x = 0;
     tta_mode = _tta_mode;
+    folded = false;
+
+#if _WIN32
+    input_bgr = true;
+    output_bgr = true;
+#else
+    input_bgr = false;
+    output_bgr = false;
+#endif
+
+    cpu_tile_jobs = 1;
+    // one row uploads or downloads while the other runs inference
+    // the rows share the inference allocator, an extra row only adds its in and out stripes
+    gpu_row_jobs = 2;
+
+    progress_callback = 0;
+    progress_userdata = 0;
+
+    tile_arenas = new TileArenaPool;
+    tile_kernels = new TilePixels;
 }
 
 RealSR::~RealSR()
@@ -41,6 +67,9 @@ RealSR::~RealSR()
 
     bicubic_4x->destroy_pipeline(net.opt);
     delete bicubic_4x;
+
+    delete tile_arenas;
+    delete tile_kernels;
 }
 
 #if _WIN32
@@ -69,7 +98,25 @@ int RealSR::load(const std::string& parampath, const std::string& modelpath)
 
         fclose(fp);
     }
+#else
+    net.load_param(parampath.c_str());
+#endif
+
+    // the gpu path scales in its shaders, so only cpu nets take the scaling into their weights
+    std::vector<ModelFoldRegion> fold_regions;
+    folded = !vkdev && model_fold_plan(parampath, modelpath, fold_regions) == 0;
+    if (folded)
+    {
+        FILE* fp = model_fold_open(modelpath);
+
+        ModelFoldDataReader dr(fp, fold_regions);
+        net.load_model(dr);
+
+        fclose(fp);
+    }
+    else
     {
+#if _WIN32
         FILE* fp = _wfopen(modelpath.c_str(), L"rb");
         if (!fp)
         {
@@ -79,11 +126,16 @@ int RealSR::load(const std::string& parampath, const std::string& modelpath)
         net.load_model(fp);
 
         fclose(fp);
-    }
 #else
-    net.load_param(parampath.c_str());
-    net.load_model(modelpath.c_str());
+        net.load_model(modelpath.c_str());
 #endif
+    }
+
+    // a folded net takes and gives 0~255 values
+    if (folded)
+        tile_kernels->select(1.f, 1.f);
+    else
+        tile_kernels->select(1 / 255.f, 255.f);
 
     // 获取输入和输出名称
     const auto& input_names = net.input_names();
@@ -113,11 +165,11 @@ int RealSR::load(const std::string& parampath, const std::string& modelpath)
     if (vkdev)
     {
         std::vector<ncnn::vk_specialization_type> specializations(1);
-#if _WIN32
-        specializations[0].i = 1;
-#else
-        specializations[0].i = 0;
-#endif
+        specializations[0].i = input_bgr ? 1 : 0;
+
+        // the postprocess may write another order than the preprocess reads
+        std::vector<ncnn::vk_specialization_type> output_specializations(1);
+        output_specializations[0].i = output_bgr ? 1 : 0;
 
         {
             static std::vector<uint32_t> spirv;
@@ -127,9 +179,9 @@ int RealSR::load(const std::string& parampath, const std::string& modelpath)
                 if (spirv.empty())
                 {
                     if (tta_mode)
-                        compile_spirv_module(realsr_preproc_tta_comp_data, sizeof(realsr_preproc_tta_comp_data), net.opt, spirv);
+                        compile_spirv_module_cached(realsr_preproc_tta_comp_data, sizeof(realsr_preproc_tta_comp_data), net.opt, vkdev, spirv);
                     else
-                        compile_spirv_module(realsr_preproc_comp_data, sizeof(realsr_preproc_comp_data), net.opt, spirv);
+                        compile_spirv_module_cached(realsr_preproc_comp_data, sizeof(realsr_preproc_comp_data), net.opt, vkdev, spirv);
                 }
             }
 
@@ -146,15 +198,15 @@ int RealSR::load(const std::string& parampath, const std::string& modelpath)
                 if (spirv.empty())
                 {
                     if (tta_mode)
-                        compile_spirv_module(realsr_postproc_tta_comp_data, sizeof(realsr_postproc_tta_comp_data), net.opt, spirv);
+                        compile_spirv_module_cached(realsr_postproc_tta_comp_data, sizeof(realsr_postproc_tta_comp_data), net.opt, vkdev, spirv);
                     else
-                        compile_spirv_module(realsr_postproc_comp_data, sizeof(realsr_postproc_comp_data), net.opt, spirv);
+                        compile_spirv_module_cached(realsr_postproc_comp_data, sizeof(realsr_postproc_comp_data), net.opt, vkdev, spirv);
                 }
             }
 
             realsr_postproc = new ncnn::Pipeline(vkdev);
             realsr_postproc->set_optimal_local_size_xyz(8, 8, 3);
-            realsr_postproc->create(spirv.data(), spirv.size() * 4, specializations);
+            realsr_postproc->create(spirv.data(), spirv.size() * 4, output_specializations);
         }
     }
 
@@ -200,793 +252,750 @@ int RealSR::load(const std::string& parampath, const std::string& modelpath)
     return 0;
 }
 
-int RealSR::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
+class RealSRTileQueue
 {
-    if (!vkdev)
+public:
+    const RealSR* realsr;
+    const ncnn::Mat* inimage;
+    ncnn::Mat* outimage;
+    int num_threads;
+
+    int xtiles;
+    int ytiles;
+
+    // next tile or row to hand out and tiles finished, guarded by lock
+    int next_tile;
+    int next_row;
+    int done_tiles;
+    ncnn::Mutex lock;
+
+    // held by the row that is currently running inference
+    ncnn::Mutex infer_lock;
+    // tiles and net blobs, only touched under infer_lock so the rows share one workspace
+    ncnn::VkAllocator* infer_vkallocator;
+
+    high_resolution_clock::time_point begin;
+    high_resolution_clock::time_point time_print_progress;
+
+    bool get(int& yi, int& xi)
     {
-        // cpu only
-        return process_cpu(inimage, outimage);
+        ncnn::MutexLockGuard guard(lock);
+        if (next_tile >= xtiles * ytiles)
+            return false;
+
+        yi = next_tile / xtiles;
+        xi = next_tile % xtiles;
+        next_tile++;
+        return true;
     }
 
-    const unsigned char* pixeldata = (const unsigned char*)inimage.data;
-    const int w = inimage.w;
-    const int h = inimage.h;
-    const int channels = inimage.elempack;
+    bool get_row(int& yi)
+    {
+        ncnn::MutexLockGuard guard(lock);
+        if (next_row >= ytiles)
+            return false;
+
+        yi = next_row;
+        next_row++;
+        return true;
+    }
+
+    void finish()
+    {
+        ncnn::MutexLockGuard guard(lock);
+        done_tiles++;
+
+        high_resolution_clock::time_point end = high_resolution_clock::now();
+        float time_span_print_progress = duration_cast<duration<double>>(
+                end - time_print_progress).count();
+        if (time_span_print_progress > 0.5 || done_tiles == xtiles * ytiles) {
+            double progress = (double) done_tiles / (ytiles * xtiles);
+            if (realsr->progress_callback) {
+                realsr->progress_callback(realsr->progress_userdata, (float) progress);
+            } else {
+                double time_span = duration_cast<duration<double>>(end - begin).count();
+                fprintf(stderr, "%5.2f%%\t[%5.2fs /%5.2f ETA]\n", progress * 100, time_span,
+                        time_span / progress - time_span);
+            }
+            time_print_progress = end;
+        }
+    }
+};
 
-    const int TILE_SIZE_X = tilesize;
-    const int TILE_SIZE_Y = tilesize;
+void* RealSR::process_gpu_worker(void* args)
+{
+    RealSRTileQueue* queue = (RealSRTileQueue*)args;
+    const RealSR* realsr = queue->realsr;
+    const ncnn::VulkanDevice* vkdev = realsr->vkdev;
 
+    // every row in flight records into its own command buffer with its own stripe allocators
     ncnn::VkAllocator* blob_vkallocator = vkdev->acquire_blob_allocator();
     ncnn::VkAllocator* staging_vkallocator = vkdev->acquire_staging_allocator();
 
-    ncnn::Option opt = net.opt;
+    ncnn::Option opt = realsr->net.opt;
     opt.blob_vkallocator = blob_vkallocator;
     opt.workspace_vkallocator = blob_vkallocator;
     opt.staging_vkallocator = staging_vkallocator;
 
-    // each tile 100x100
-    const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
-    const int ytiles = (h + TILE_SIZE_Y - 1) / TILE_SIZE_Y;
+    int yi;
+    while (queue->get_row(yi))
+    {
+        realsr->process_gpu_row(*queue->inimage, *queue->outimage, yi, opt, *queue);
+    }
 
-    const size_t in_out_tile_elemsize = opt.use_fp16_storage ? 2u : 4u;
-    high_resolution_clock::time_point begin = high_resolution_clock::now();
-    high_resolution_clock::time_point time_print_progress;
+    vkdev->reclaim_blob_allocator(blob_vkallocator);
+    vkdev->reclaim_staging_allocator(staging_vkallocator);
 
+    return 0;
+}
 
-    //#pragma omp parallel for num_threads(2)
-    for (int yi = 0; yi < ytiles; yi++)
+int RealSR::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
+{
+    if (!vkdev)
     {
-        const int tile_h_nopad = std::min((yi + 1) * TILE_SIZE_Y, h) - yi * TILE_SIZE_Y;
+        // cpu only
+        return process_cpu(inimage, outimage);
+    }
+
+    const int w = inimage.w;
+    const int h = inimage.h;
 
-        int in_tile_y0 = std::max(yi * TILE_SIZE_Y - prepadding, 0);
-        int in_tile_y1 = std::min((yi + 1) * TILE_SIZE_Y + prepadding, h);
+    const TilePlan plan = tile_plan(w, h, tilesize, prepadding);
+    const int TILE_SIZE_X = plan.tile_w;
+    const int TILE_SIZE_Y = plan.tile_h;
 
-        ncnn::Mat in;
-        if (opt.use_fp16_storage && opt.use_int8_storage)
+    // each tile 100x100
+    const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
+    const int ytiles = (h + TILE_SIZE_Y - 1) / TILE_SIZE_Y;
+
+    // tile rows in flight, with two one runs inference while the other uploads or downloads
+    const int workers = std::max(1, std::min(gpu_row_jobs, ytiles));
+
+    RealSRTileQueue queue;
+    queue.realsr = this;
+    queue.inimage = &inimage;
+    queue.outimage = &outimage;
+    queue.num_threads = net.opt.num_threads;
+    queue.xtiles = xtiles;
+    queue.ytiles = ytiles;
+    queue.next_tile = 0;
+    queue.next_row = 0;
+    queue.done_tiles = 0;
+    queue.begin = high_resolution_clock::now();
+    queue.infer_vkallocator = vkdev->acquire_blob_allocator();
+
+    if (workers == 1)
+    {
+        process_gpu_worker((void*)&queue);
+    }
+    else
+    {
+        std::vector<ncnn::Thread*> worker_threads(workers);
+        for (int i = 0; i < workers; i++)
         {
-            in = ncnn::Mat(w, (in_tile_y1 - in_tile_y0), (unsigned char*)pixeldata + in_tile_y0 * w * channels, (size_t)channels, 1);
+            worker_threads[i] = new ncnn::Thread(process_gpu_worker, (void*)&queue);
         }
-        else
+
+        for (int i = 0; i < workers; i++)
         {
-            if (channels == 3)
-            {
-#if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGR2RGB, w, (in_tile_y1 - in_tile_y0));
-#else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
-#endif
-            }
-            if (channels == 4)
-            {
-#if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGRA2RGBA, w, (in_tile_y1 - in_tile_y0));
-#else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
-#endif
-            }
+            worker_threads[i]->join();
+            delete worker_threads[i];
         }
+    }
 
-        ncnn::VkCompute cmd(vkdev);
+    vkdev->reclaim_blob_allocator(queue.infer_vkallocator);
 
-        // upload
-        ncnn::VkMat in_gpu;
-        {
-            cmd.record_clone(in, in_gpu, opt);
+    return 0;
+}
 
-            if (xtiles > 1)
-            {
-                cmd.submit_and_wait();
-                cmd.reset();
-            }
-        }
+int RealSR::process_gpu_row(const ncnn::Mat& inimage, ncnn::Mat& outimage, int yi, const ncnn::Option& opt, RealSRTileQueue& queue) const
+{
+    const unsigned char* pixeldata = (const unsigned char*)inimage.data;
+    const int w = inimage.w;
+    const int h = inimage.h;
+    const int channels = inimage.elempack;
 
-        int out_tile_y0 = std::max(yi * TILE_SIZE_Y, 0);
-        int out_tile_y1 = std::min((yi + 1) * TILE_SIZE_Y, h);
+    const TilePlan plan = tile_plan(w, h, tilesize, prepadding);
+    const int TILE_SIZE_X = plan.tile_w;
+    const int TILE_SIZE_Y = plan.tile_h;
 
-        ncnn::VkMat out_gpu;
-        if (opt.use_fp16_storage && opt.use_int8_storage)
+    // the stripes of the row come from the row allocator, tiles and blobs from the shared one
+    ncnn::VkAllocator* stripe_vkallocator = opt.blob_vkallocator;
+    ncnn::VkAllocator* blob_vkallocator = queue.infer_vkallocator;
+    ncnn::VkAllocator* staging_vkallocator = opt.staging_vkallocator;
+
+    ncnn::Option infer_opt = opt;
+    infer_opt.blob_vkallocator = blob_vkallocator;
+    infer_opt.workspace_vkallocator = blob_vkallocator;
+
+    const int xtiles = queue.xtiles;
+
+    const size_t in_out_tile_elemsize = opt.use_fp16_storage ? 2u : 4u;
+
+    const int tile_h_nopad = std::min((yi + 1) * TILE_SIZE_Y, h) - yi * TILE_SIZE_Y;
+
+    int in_tile_y0 = std::max(yi * TILE_SIZE_Y - prepadding, 0);
+    int in_tile_y1 = std::min((yi + 1) * TILE_SIZE_Y + prepadding, h);
+
+    ncnn::Mat in;
+    if (opt.use_fp16_storage && opt.use_int8_storage)
+    {
+        in = ncnn::Mat(w, (in_tile_y1 - in_tile_y0), (unsigned char*)pixeldata + in_tile_y0 * w * channels, (size_t)channels, 1);
+    }
+    else
+    {
+        if (channels == 3)
         {
-            out_gpu.create(w * scale, (out_tile_y1 - out_tile_y0) * scale, (size_t)channels, 1, blob_vkallocator);
+            in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, input_bgr ? ncnn::Mat::PIXEL_BGR2RGB : ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
         }
-        else
+        if (channels == 4)
         {
-            out_gpu.create(w * scale, (out_tile_y1 - out_tile_y0) * scale, channels, (size_t)4u, 1, blob_vkallocator);
+            in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, input_bgr ? ncnn::Mat::PIXEL_BGRA2RGBA : ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
         }
+    }
+
+    ncnn::VkCompute cmd(vkdev);
+
+    // upload, the staging copy is made here and the transfer overlaps the row that holds infer_lock
+    // a single tile row keeps it in the one submit with its inference, as before
+    ncnn::VkMat in_gpu;
+    {
+        cmd.record_clone(in, in_gpu, opt);
 
-        for (int xi = 0; xi < xtiles; xi++)
+        if (xtiles > 1)
         {
-            const int tile_w_nopad = std::min((xi + 1) * TILE_SIZE_X, w) - xi * TILE_SIZE_X;
+            cmd.submit_and_wait();
+            cmd.reset();
+        }
+    }
+
+    // only one row runs inference at a time, the upload and download of the neighbouring rows overlap it
+    queue.infer_lock.lock();
+
+    int out_tile_y0 = std::max(yi * TILE_SIZE_Y, 0);
+    int out_tile_y1 = std::min((yi + 1) * TILE_SIZE_Y, h);
 
-            if (tta_mode)
+    ncnn::VkMat out_gpu;
+    if (opt.use_fp16_storage && opt.use_int8_storage)
+    {
+        out_gpu.create(w * scale, (out_tile_y1 - out_tile_y0) * scale, (size_t)channels, 1, stripe_vkallocator);
+    }
+    else
+    {
+        out_gpu.create(w * scale, (out_tile_y1 - out_tile_y0) * scale, channels, (size_t)4u, 1, stripe_vkallocator);
+    }
+
+    for (int xi = 0; xi < xtiles; xi++)
+    {
+        const int tile_w_nopad = std::min((xi + 1) * TILE_SIZE_X, w) - xi * TILE_SIZE_X;
+
+        if (tta_mode)
+        {
+            // preproc
+            ncnn::VkMat in_tile_gpu[8];
+            ncnn::VkMat in_alpha_tile_gpu;
             {
-                // preproc
-                ncnn::VkMat in_tile_gpu[8];
-                ncnn::VkMat in_alpha_tile_gpu;
+                // crop tile
+                int tile_x0 = xi * TILE_SIZE_X - prepadding;
+                int tile_x1 = std::min((xi + 1) * TILE_SIZE_X, w) + prepadding;
+                int tile_y0 = yi * TILE_SIZE_Y - prepadding;
+                int tile_y1 = std::min((yi + 1) * TILE_SIZE_Y, h) + prepadding;
+
+                in_tile_gpu[0].create(tile_x1 - tile_x0, tile_y1 - tile_y0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
+                in_tile_gpu[1].create(tile_x1 - tile_x0, tile_y1 - tile_y0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
+                in_tile_gpu[2].create(tile_x1 - tile_x0, tile_y1 - tile_y0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
+                in_tile_gpu[3].create(tile_x1 - tile_x0, tile_y1 - tile_y0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
+                in_tile_gpu[4].create(tile_y1 - tile_y0, tile_x1 - tile_x0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
+                in_tile_gpu[5].create(tile_y1 - tile_y0, tile_x1 - tile_x0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
+                in_tile_gpu[6].create(tile_y1 - tile_y0, tile_x1 - tile_x0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
+                in_tile_gpu[7].create(tile_y1 - tile_y0, tile_x1 - tile_x0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
+
+                if (channels == 4)
                 {
-                    // crop tile
-                    int tile_x0 = xi * TILE_SIZE_X - prepadding;
-                    int tile_x1 = std::min((xi + 1) * TILE_SIZE_X, w) + prepadding;
-                    int tile_y0 = yi * TILE_SIZE_Y - prepadding;
-                    int tile_y1 = std::min((yi + 1) * TILE_SIZE_Y, h) + prepadding;
-
-                    in_tile_gpu[0].create(tile_x1 - tile_x0, tile_y1 - tile_y0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
-                    in_tile_gpu[1].create(tile_x1 - tile_x0, tile_y1 - tile_y0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
-                    in_tile_gpu[2].create(tile_x1 - tile_x0, tile_y1 - tile_y0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
-                    in_tile_gpu[3].create(tile_x1 - tile_x0, tile_y1 - tile_y0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
-                    in_tile_gpu[4].create(tile_y1 - tile_y0, tile_x1 - tile_x0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
-                    in_tile_gpu[5].create(tile_y1 - tile_y0, tile_x1 - tile_x0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
-                    in_tile_gpu[6].create(tile_y1 - tile_y0, tile_x1 - tile_x0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
-                    in_tile_gpu[7].create(tile_y1 - tile_y0, tile_x1 - tile_x0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
-
-                    if (channels == 4)
-                    {
-                        in_alpha_tile_gpu.create(tile_w_nopad, tile_h_nopad, 1, in_out_tile_elemsize, 1, blob_vkallocator);
-                    }
-
-                    std::vector<ncnn::VkMat> bindings(10);
-                    bindings[0] = in_gpu;
-                    bindings[1] = in_tile_gpu[0];
-                    bindings[2] = in_tile_gpu[1];
-                    bindings[3] = in_tile_gpu[2];
-                    bindings[4] = in_tile_gpu[3];
-                    bindings[5] = in_tile_gpu[4];
-                    bindings[6] = in_tile_gpu[5];
-                    bindings[7] = in_tile_gpu[6];
-                    bindings[8] = in_tile_gpu[7];
-                    bindings[9] = in_alpha_tile_gpu;
-
-                    std::vector<ncnn::vk_constant_type> constants(13);
-                    constants[0].i = in_gpu.w;
-                    constants[1].i = in_gpu.h;
-                    constants[2].i = in_gpu.cstep;
-                    constants[3].i = in_tile_gpu[0].w;
-                    constants[4].i = in_tile_gpu[0].h;
-                    constants[5].i = in_tile_gpu[0].cstep;
-                    constants[6].i = prepadding;
-                    constants[7].i = prepadding;
-                    constants[8].i = xi * TILE_SIZE_X;
-                    constants[9].i = std::min(yi * TILE_SIZE_Y, prepadding);
-                    constants[10].i = channels;
-                    constants[11].i = in_alpha_tile_gpu.w;
-                    constants[12].i = in_alpha_tile_gpu.h;
-
-                    ncnn::VkMat dispatcher;
-                    dispatcher.w = in_tile_gpu[0].w;
-                    dispatcher.h = in_tile_gpu[0].h;
-                    dispatcher.c = channels;
-
-                    cmd.record_pipeline(realsr_preproc, bindings, constants, dispatcher);
+                    in_alpha_tile_gpu.create(tile_w_nopad, tile_h_nopad, 1, in_out_tile_elemsize, 1, blob_vkallocator);
                 }
 
-                // realsr
-                ncnn::VkMat out_tile_gpu[8];
-                for (int ti = 0; ti < 8; ti++)
-                {
-                    ncnn::Extractor ex = net.create_extractor();
+                std::vector<ncnn::VkMat> bindings(10);
+                bindings[0] = in_gpu;
+                bindings[1] = in_tile_gpu[0];
+                bindings[2] = in_tile_gpu[1];
+                bindings[3] = in_tile_gpu[2];
+                bindings[4] = in_tile_gpu[3];
+                bindings[5] = in_tile_gpu[4];
+                bindings[6] = in_tile_gpu[5];
+                bindings[7] = in_tile_gpu[6];
+                bindings[8] = in_tile_gpu[7];
+                bindings[9] = in_alpha_tile_gpu;
+
+                std::vector<ncnn::vk_constant_type> constants(13);
+                constants[0].i = in_gpu.w;
+                constants[1].i = in_gpu.h;
+                constants[2].i = in_gpu.cstep;
+                constants[3].i = in_tile_gpu[0].w;
+                constants[4].i = in_tile_gpu[0].h;
+                constants[5].i = in_tile_gpu[0].cstep;
+                constants[6].i = prepadding;
+                constants[7].i = prepadding;
+                constants[8].i = xi * TILE_SIZE_X;
+                constants[9].i = std::min(yi * TILE_SIZE_Y, prepadding);
+                constants[10].i = channels;
+                constants[11].i = in_alpha_tile_gpu.w;
+                constants[12].i = in_alpha_tile_gpu.h;
+
+                ncnn::VkMat dispatcher;
+                dispatcher.w = in_tile_gpu[0].w;
+                dispatcher.h = in_tile_gpu[0].h;
+                dispatcher.c = channels;
+
+                cmd.record_pipeline(realsr_preproc, bindings, constants, dispatcher);
+            }
 
+            // realsr
+            ncnn::VkMat out_tile_gpu[8];
+            for (int ti = 0; ti < 8; ti++)
+            {
+                ncnn::Extractor ex = net.create_extractor();
 
 
-                    ex.set_blob_vkallocator(blob_vkallocator);
-                    ex.set_workspace_vkallocator(blob_vkallocator);
-                    ex.set_staging_vkallocator(staging_vkallocator);
 
+                ex.set_blob_vkallocator(blob_vkallocator);
+                ex.set_workspace_vkallocator(blob_vkallocator);
+                ex.set_staging_vkallocator(staging_vkallocator);
 
-                    ex.input(net_input_name.c_str(), in_tile_gpu[ti]);
 
-                    ex.extract("output", out_tile_gpu[ti], cmd);
+                ex.input(net_input_name.c_str(), in_tile_gpu[ti]);
 
-                    {
-                        cmd.submit_and_wait();
-                        cmd.reset();
-                    }
-                }
+                ex.extract("output", out_tile_gpu[ti], cmd);
 
-                ncnn::VkMat out_alpha_tile_gpu;
-                if (channels == 4)
                 {
-                    if (scale == 1)
-                    {
-                        out_alpha_tile_gpu = in_alpha_tile_gpu;
-                    }
-                    if (scale == 2)
-                    {
-                        bicubic_2x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, opt);
-                    }
-                    if (scale == 3)
-                    {
-                        bicubic_3x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, opt);
-                    }
-                    if (scale == 4)
-                    {
-                        bicubic_4x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, opt);
-                    }
+                    cmd.submit_and_wait();
+                    cmd.reset();
                 }
+            }
 
-                // postproc
+            ncnn::VkMat out_alpha_tile_gpu;
+            if (channels == 4)
+            {
+                if (scale == 1)
                 {
-                    std::vector<ncnn::VkMat> bindings(10);
-                    bindings[0] = out_tile_gpu[0];
-                    bindings[1] = out_tile_gpu[1];
-                    bindings[2] = out_tile_gpu[2];
-                    bindings[3] = out_tile_gpu[3];
-                    bindings[4] = out_tile_gpu[4];
-                    bindings[5] = out_tile_gpu[5];
-                    bindings[6] = out_tile_gpu[6];
-                    bindings[7] = out_tile_gpu[7];
-                    bindings[8] = out_alpha_tile_gpu;
-                    bindings[9] = out_gpu;
-
-                    std::vector<ncnn::vk_constant_type> constants(13);
-                    constants[0].i = out_tile_gpu[0].w;
-                    constants[1].i = out_tile_gpu[0].h;
-                    constants[2].i = out_tile_gpu[0].cstep;
-                    constants[3].i = out_gpu.w;
-                    constants[4].i = out_gpu.h;
-                    constants[5].i = out_gpu.cstep;
-                    constants[6].i = xi * TILE_SIZE_X * scale;
-                    constants[7].i = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
-                    constants[8].i = prepadding * scale;
-                    constants[9].i = prepadding * scale;
-                    constants[10].i = channels;
-                    constants[11].i = out_alpha_tile_gpu.w;
-                    constants[12].i = out_alpha_tile_gpu.h;
-
-                    ncnn::VkMat dispatcher;
-                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
-                    dispatcher.h = out_gpu.h;
-                    dispatcher.c = channels;
-
-                    cmd.record_pipeline(realsr_postproc, bindings, constants, dispatcher);
+                    out_alpha_tile_gpu = in_alpha_tile_gpu;
                 }
+                if (scale == 2)
+                {
+                    bicubic_2x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, infer_opt);
+                }
+                if (scale == 3)
+                {
+                    bicubic_3x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, infer_opt);
+                }
+                if (scale == 4)
+                {
+                    bicubic_4x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, infer_opt);
+                }
+            }
+
+            // postproc
+            {
+                std::vector<ncnn::VkMat> bindings(10);
+                bindings[0] = out_tile_gpu[0];
+                bindings[1] = out_tile_gpu[1];
+                bindings[2] = out_tile_gpu[2];
+                bindings[3] = out_tile_gpu[3];
+                bindings[4] = out_tile_gpu[4];
+                bindings[5] = out_tile_gpu[5];
+                bindings[6] = out_tile_gpu[6];
+                bindings[7] = out_tile_gpu[7];
+                bindings[8] = out_alpha_tile_gpu;
+                bindings[9] = out_gpu;
+
+                std::vector<ncnn::vk_constant_type> constants(13);
+                constants[0].i = out_tile_gpu[0].w;
+                constants[1].i = out_tile_gpu[0].h;
+                constants[2].i = out_tile_gpu[0].cstep;
+                constants[3].i = out_gpu.w;
+                constants[4].i = out_gpu.h;
+                constants[5].i = out_gpu.cstep;
+                constants[6].i = xi * TILE_SIZE_X * scale;
+                constants[7].i = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                constants[8].i = prepadding * scale;
+                constants[9].i = prepadding * scale;
+                constants[10].i = channels;
+                constants[11].i = out_alpha_tile_gpu.w;
+                constants[12].i = out_alpha_tile_gpu.h;
+
+                ncnn::VkMat dispatcher;
+                dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                dispatcher.h = out_gpu.h;
+                dispatcher.c = channels;
+
+                cmd.record_pipeline(realsr_postproc, bindings, constants, dispatcher);
             }
-            else
+        }
+        else
+        {
+            // preproc
+            ncnn::VkMat in_tile_gpu;
+            ncnn::VkMat in_alpha_tile_gpu;
             {
-                // preproc
-                ncnn::VkMat in_tile_gpu;
-                ncnn::VkMat in_alpha_tile_gpu;
+                // crop tile
+                int tile_x0 = xi * TILE_SIZE_X - prepadding;
+                int tile_x1 = std::min((xi + 1) * TILE_SIZE_X, w) + prepadding;
+                int tile_y0 = yi * TILE_SIZE_Y - prepadding;
+                int tile_y1 = std::min((yi + 1) * TILE_SIZE_Y, h) + prepadding;
+
+                in_tile_gpu.create(tile_x1 - tile_x0, tile_y1 - tile_y0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
+
+                if (channels == 4)
                 {
-                    // crop tile
-                    int tile_x0 = xi * TILE_SIZE_X - prepadding;
-                    int tile_x1 = std::min((xi + 1) * TILE_SIZE_X, w) + prepadding;
-                    int tile_y0 = yi * TILE_SIZE_Y - prepadding;
-                    int tile_y1 = std::min((yi + 1) * TILE_SIZE_Y, h) + prepadding;
-
-                    in_tile_gpu.create(tile_x1 - tile_x0, tile_y1 - tile_y0, 3, in_out_tile_elemsize, 1, blob_vkallocator);
-
-                    if (channels == 4)
-                    {
-                        in_alpha_tile_gpu.create(tile_w_nopad, tile_h_nopad, 1, in_out_tile_elemsize, 1, blob_vkallocator);
-                    }
-
-                    std::vector<ncnn::VkMat> bindings(3);
-                    bindings[0] = in_gpu;
-                    bindings[1] = in_tile_gpu;
-                    bindings[2] = in_alpha_tile_gpu;
-
-                    std::vector<ncnn::vk_constant_type> constants(13);
-                    constants[0].i = in_gpu.w;
-                    constants[1].i = in_gpu.h;
-                    constants[2].i = in_gpu.cstep;
-                    constants[3].i = in_tile_gpu.w;
-                    constants[4].i = in_tile_gpu.h;
-                    constants[5].i = in_tile_gpu.cstep;
-                    constants[6].i = prepadding;
-                    constants[7].i = prepadding;
-                    constants[8].i = xi * TILE_SIZE_X;
-                    constants[9].i = std::min(yi * TILE_SIZE_Y, prepadding);
-                    constants[10].i = channels;
-                    constants[11].i = in_alpha_tile_gpu.w;
-                    constants[12].i = in_alpha_tile_gpu.h;
-
-                    ncnn::VkMat dispatcher;
-                    dispatcher.w = in_tile_gpu.w;
-                    dispatcher.h = in_tile_gpu.h;
-                    dispatcher.c = channels;
-
-                    cmd.record_pipeline(realsr_preproc, bindings, constants, dispatcher);
+                    in_alpha_tile_gpu.create(tile_w_nopad, tile_h_nopad, 1, in_out_tile_elemsize, 1, blob_vkallocator);
                 }
 
-                // realsr
-                ncnn::VkMat out_tile_gpu;
-                {
-                    ncnn::Extractor ex = net.create_extractor();
+                std::vector<ncnn::VkMat> bindings(3);
+                bindings[0] = in_gpu;
+                bindings[1] = in_tile_gpu;
+                bindings[2] = in_alpha_tile_gpu;
+
+                std::vector<ncnn::vk_constant_type> constants(13);
+                constants[0].i = in_gpu.w;
+                constants[1].i = in_gpu.h;
+                constants[2].i = in_gpu.cstep;
+                constants[3].i = in_tile_gpu.w;
+                constants[4].i = in_tile_gpu.h;
+                constants[5].i = in_tile_gpu.cstep;
+                constants[6].i = prepadding;
+                constants[7].i = prepadding;
+                constants[8].i = xi * TILE_SIZE_X;
+                constants[9].i = std::min(yi * TILE_SIZE_Y, prepadding);
+                constants[10].i = channels;
+                constants[11].i = in_alpha_tile_gpu.w;
+                constants[12].i = in_alpha_tile_gpu.h;
+
+                ncnn::VkMat dispatcher;
+                dispatcher.w = in_tile_gpu.w;
+                dispatcher.h = in_tile_gpu.h;
+                dispatcher.c = channels;
+
+                cmd.record_pipeline(realsr_preproc, bindings, constants, dispatcher);
+            }
+
+            // realsr
+            ncnn::VkMat out_tile_gpu;
+            {
+                ncnn::Extractor ex = net.create_extractor();
 
-                    ex.set_blob_vkallocator(blob_vkallocator);
-                    ex.set_workspace_vkallocator(blob_vkallocator);
-                    ex.set_staging_vkallocator(staging_vkallocator);
+                ex.set_blob_vkallocator(blob_vkallocator);
+                ex.set_workspace_vkallocator(blob_vkallocator);
+                ex.set_staging_vkallocator(staging_vkallocator);
 
-                    ex.input(net_input_name.c_str(), in_tile_gpu);
+                ex.input(net_input_name.c_str(), in_tile_gpu);
 
-                    ex.extract(net_output_name.c_str(), out_tile_gpu, cmd);
-                }
+                ex.extract(net_output_name.c_str(), out_tile_gpu, cmd);
+            }
 
-                ncnn::VkMat out_alpha_tile_gpu;
-                if (channels == 4)
+            ncnn::VkMat out_alpha_tile_gpu;
+            if (channels == 4)
+            {
+                if (scale == 1)
                 {
-                    if (scale == 1)
-                    {
-                        out_alpha_tile_gpu = in_alpha_tile_gpu;
-                    }
-                    if (scale == 2)
-                    {
-                        bicubic_2x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, opt);
-                    }
-                    if (scale == 3)
-                    {
-                        bicubic_3x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, opt);
-                    }
-                    if (scale == 4)
-                    {
-                        bicubic_4x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, opt);
-                    }
+                    out_alpha_tile_gpu = in_alpha_tile_gpu;
                 }
-
-                // postproc
+                if (scale == 2)
+                {
+                    bicubic_2x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, infer_opt);
+                }
+                if (scale == 3)
+                {
+                    bicubic_3x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, infer_opt);
+                }
+                if (scale == 4)
                 {
-                    std::vector<ncnn::VkMat> bindings(3);
-                    bindings[0] = out_tile_gpu;
-                    bindings[1] = out_alpha_tile_gpu;
-                    bindings[2] = out_gpu;
-
-                    std::vector<ncnn::vk_constant_type> constants(13);
-                    constants[0].i = out_tile_gpu.w;
-                    constants[1].i = out_tile_gpu.h;
-                    constants[2].i = out_tile_gpu.cstep;
-                    constants[3].i = out_gpu.w;
-                    constants[4].i = out_gpu.h;
-                    constants[5].i = out_gpu.cstep;
-                    constants[6].i = xi * TILE_SIZE_X * scale;
-                    constants[7].i = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
-                    constants[8].i = prepadding * scale;
-                    constants[9].i = prepadding * scale;
-                    constants[10].i = channels;
-                    constants[11].i = out_alpha_tile_gpu.w;
-                    constants[12].i = out_alpha_tile_gpu.h;
-
-                    ncnn::VkMat dispatcher;
-                    dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
-                    dispatcher.h = out_gpu.h;
-                    dispatcher.c = channels;
-
-                    cmd.record_pipeline(realsr_postproc, bindings, constants, dispatcher);
+                    bicubic_4x->forward(in_alpha_tile_gpu, out_alpha_tile_gpu, cmd, infer_opt);
                 }
             }
 
-            if (xtiles > 1) {
-                cmd.submit_and_wait();
-                cmd.reset();
-            }
-            high_resolution_clock::time_point end = high_resolution_clock::now();
-            float time_span_print_progress = duration_cast<duration<double>>(
-                    end - time_print_progress).count();
-            float progress_tile = (float) (yi * xtiles + xi + 1);
-            if (time_span_print_progress > 0.5 || (yi + 1 == ytiles && xi + 3 > xtiles)) {
-                double progress = progress_tile / (ytiles * xtiles);
-                double time_span = duration_cast<duration<double>>(end - begin).count();
-                fprintf(stderr, "%5.2f%%\t[%5.2fs /%5.2f ETA]\n", progress * 100, time_span,
-                        time_span / progress - time_span);
-                time_print_progress = end;
+            // postproc
+            {
+                std::vector<ncnn::VkMat> bindings(3);
+                bindings[0] = out_tile_gpu;
+                bindings[1] = out_alpha_tile_gpu;
+                bindings[2] = out_gpu;
+
+                std::vector<ncnn::vk_constant_type> constants(13);
+                constants[0].i = out_tile_gpu.w;
+                constants[1].i = out_tile_gpu.h;
+                constants[2].i = out_tile_gpu.cstep;
+                constants[3].i = out_gpu.w;
+                constants[4].i = out_gpu.h;
+                constants[5].i = out_gpu.cstep;
+                constants[6].i = xi * TILE_SIZE_X * scale;
+                constants[7].i = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                constants[8].i = prepadding * scale;
+                constants[9].i = prepadding * scale;
+                constants[10].i = channels;
+                constants[11].i = out_alpha_tile_gpu.w;
+                constants[12].i = out_alpha_tile_gpu.h;
+
+                ncnn::VkMat dispatcher;
+                dispatcher.w = std::min(TILE_SIZE_X * scale, out_gpu.w - xi * TILE_SIZE_X * scale);
+                dispatcher.h = out_gpu.h;
+                dispatcher.c = channels;
+
+                cmd.record_pipeline(realsr_postproc, bindings, constants, dispatcher);
             }
         }
 
-        // download
-        {
-            ncnn::Mat out;
+        cmd.submit_and_wait();
+        cmd.reset();
 
-            if (opt.use_fp16_storage && opt.use_int8_storage)
-            {
-                out = ncnn::Mat(out_gpu.w, out_gpu.h, (unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, (size_t)channels, 1);
-            }
+        queue.finish();
+    }
 
-            cmd.record_clone(out_gpu, out, opt);
+    queue.infer_lock.unlock();
 
-            cmd.submit_and_wait();
+    // download
+    {
+        ncnn::Mat out;
 
-            if (!(opt.use_fp16_storage && opt.use_int8_storage))
+        if (opt.use_fp16_storage && opt.use_int8_storage)
+        {
+            out = ncnn::Mat(out_gpu.w, out_gpu.h, (unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, (size_t)channels, 1);
+        }
+
+        cmd.record_clone(out_gpu, out, opt);
+
+        cmd.submit_and_wait();
+
+        if (!(opt.use_fp16_storage && opt.use_int8_storage))
+        {
+            if (channels == 3)
             {
-                if (channels == 3)
-                {
-#if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGB2BGR);
-#else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGB);
-#endif
-                }
-                if (channels == 4)
-                {
-#if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGBA2BGRA);
-#else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGBA);
-#endif
-                }
+                out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, output_bgr ? ncnn::Mat::PIXEL_RGB2BGR : ncnn::Mat::PIXEL_RGB);
+            }
+            if (channels == 4)
+            {
+                out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, output_bgr ? ncnn::Mat::PIXEL_RGBA2BGRA : ncnn::Mat::PIXEL_RGBA);
             }
         }
     }
 
-    vkdev->reclaim_blob_allocator(blob_vkallocator);
-    vkdev->reclaim_staging_allocator(staging_vkallocator);
+    return 0;
+}
+
+void* RealSR::process_cpu_worker(void* args)
+{
+    RealSRTileQueue* queue = (RealSRTileQueue*)args;
+    const RealSR* realsr = queue->realsr;
+
+    // every worker owns an arena, so tiles never contend on a shared pool
+    TileArena* arena = realsr->tile_arenas->acquire();
+
+    ncnn::Option opt = realsr->net.opt;
+    opt.num_threads = queue->num_threads;
+    arena->set_option(opt);
+
+    int yi;
+    int xi;
+    while (queue->get(yi, xi))
+    {
+        realsr->process_cpu_tile(*queue->inimage, *queue->outimage, yi, xi, opt);
+
+        queue->finish();
+    }
+
+    realsr->tile_arenas->reclaim(arena);
 
     return 0;
 }
 
 int RealSR::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
 {
-    const unsigned char* pixeldata = (const unsigned char*)inimage.data;
     const int w = inimage.w;
     const int h = inimage.h;
-    const int channels = inimage.elempack;
 
-    const int TILE_SIZE_X = tilesize;
-    const int TILE_SIZE_Y = tilesize;
-
-    ncnn::Option opt = net.opt;
+    const TilePlan plan = tile_plan(w, h, tilesize, prepadding);
+    const int TILE_SIZE_X = plan.tile_w;
+    const int TILE_SIZE_Y = plan.tile_h;
 
     // each tile 100x100
     const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
     const int ytiles = (h + TILE_SIZE_Y - 1) / TILE_SIZE_Y;
 
-    high_resolution_clock::time_point begin = high_resolution_clock::now();
-    high_resolution_clock::time_point time_print_progress;
+    // tiles are independent, split the cpu threads between tile workers
+    const int workers = std::max(1, std::min(cpu_tile_jobs, xtiles * ytiles));
+
+    RealSRTileQueue queue;
+    queue.realsr = this;
+    queue.inimage = &inimage;
+    queue.outimage = &outimage;
+    queue.num_threads = std::max(1, net.opt.num_threads / workers);
+    queue.xtiles = xtiles;
+    queue.ytiles = ytiles;
+    queue.next_tile = 0;
+    queue.next_row = 0;
+    queue.done_tiles = 0;
+    queue.begin = high_resolution_clock::now();
+
+    if (workers == 1)
+    {
+        process_cpu_worker((void*)&queue);
+        return 0;
+    }
 
-    for (int yi = 0; yi < ytiles; yi++)
+    std::vector<ncnn::Thread*> worker_threads(workers);
+    for (int i = 0; i < workers; i++)
     {
-        const int tile_h_nopad = std::min((yi + 1) * TILE_SIZE_Y, h) - yi * TILE_SIZE_Y;
+        worker_threads[i] = new ncnn::Thread(process_cpu_worker, (void*)&queue);
+    }
 
-        int in_tile_y0 = std::max(yi * TILE_SIZE_Y - prepadding, 0);
-        int in_tile_y1 = std::min((yi + 1) * TILE_SIZE_Y + prepadding, h);
+    for (int i = 0; i < workers; i++)
+    {
+        worker_threads[i]->join();
+        delete worker_threads[i];
+    }
 
+    return 0;
+}
 
+int RealSR::process_cpu_tile(const ncnn::Mat& inimage, ncnn::Mat& outimage, int yi, int xi, const ncnn::Option& opt) const
+{
+    const unsigned char* pixeldata = (const unsigned char*)inimage.data;
+    const int w = inimage.w;
+    const int h = inimage.h;
+    const int channels = inimage.elempack;
 
-        for (int xi = 0; xi < xtiles; xi++)
-        {
-            const int tile_w_nopad = std::min((xi + 1) * TILE_SIZE_X, w) - xi * TILE_SIZE_X;
+    const TilePlan plan = tile_plan(w, h, tilesize, prepadding);
+    const int TILE_SIZE_X = plan.tile_w;
+    const int TILE_SIZE_Y = plan.tile_h;
 
-            int in_tile_x0 = std::max(xi * TILE_SIZE_X - prepadding, 0);
-            int in_tile_x1 = std::min((xi + 1) * TILE_SIZE_X + prepadding, w);
+    const int tile_h_nopad = std::min((yi + 1) * TILE_SIZE_Y, h) - yi * TILE_SIZE_Y;
 
-            // crop tile
-            ncnn::Mat in;
-            {
-                if (channels == 3)
-                {
-#if _WIN32
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_BGR2RGB, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#else
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_RGB, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#endif
-                }
-                if (channels == 4)
-                {
-#if _WIN32
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_BGRA2RGBA, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#else
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_RGBA, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#endif
-                }
-            }
+    int in_tile_y0 = std::max(yi * TILE_SIZE_Y - prepadding, 0);
+    int in_tile_y1 = std::min((yi + 1) * TILE_SIZE_Y + prepadding, h);
 
-            ncnn::Mat out;
+    const int tile_w_nopad = std::min((xi + 1) * TILE_SIZE_X, w) - xi * TILE_SIZE_X;
 
-            if (tta_mode)
-            {
-                // split alpha and preproc
-                ncnn::Mat in_tile[8];
-                ncnn::Mat in_alpha_tile, in_alpah_tile_nocrop;
-                {
-                    in_tile[0].create(in.w, in.h, 3);
-                    for (int q = 0; q < 3; q++)
-                    {
-                        const float* ptr = in.channel(q);
-                        float* outptr0 = in_tile[0].channel(q);
-
-                        for (int i = 0; i < in.h; i++)
-                        {
-                            for (int j = 0; j < in.w; j++)
-                            {
-                                *outptr0++ = *ptr++ * (1 / 255.f);
-                            }
-                        }
-                    }
-
-                    if (channels == 4)
-                    {
-                        in_alpah_tile_nocrop = in.channel_range(3, 1).clone();
-                        int crop_top=(yi*TILE_SIZE_Y-in_tile_y0);
-                        int crop_bottom=in_tile_y1-std::min(yi*TILE_SIZE_Y+TILE_SIZE_Y ,h);
-                        int crop_left=(xi*TILE_SIZE_X-in_tile_x0);
-                        int crop_right=in_tile_x1-std::min(xi*TILE_SIZE_X+TILE_SIZE_X ,w);
-                        ncnn::copy_cut_border(in_alpah_tile_nocrop, in_alpha_tile, crop_top, crop_bottom, crop_left, crop_right);
-
-                    }
-                }
+    int in_tile_x0 = std::max(xi * TILE_SIZE_X - prepadding, 0);
+    int in_tile_x1 = std::min((xi + 1) * TILE_SIZE_X + prepadding, w);
 
-                // border padding
-                {
-                    int pad_top = std::max(prepadding - yi * TILE_SIZE_Y, 0);
-                    int pad_bottom = std::max(std::min((yi + 1) * TILE_SIZE_Y + prepadding - h, prepadding), 0);
-                    int pad_left = std::max(prepadding - xi * TILE_SIZE_X, 0);
-                    int pad_right = std::max(std::min((xi + 1) * TILE_SIZE_X + prepadding - w, prepadding), 0);
-
-                    ncnn::Mat in_tile_padded;
-                    ncnn::copy_make_border(in_tile[0], in_tile_padded, pad_top, pad_bottom, pad_left, pad_right, 2, 0.f, net.opt);
-                    in_tile[0] = in_tile_padded;
-                }
+    unsigned char* outpixels = (unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels;
 
-                // the other 7 directions
-                {
-                    in_tile[1].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[2].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[3].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[4].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[5].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[6].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[7].create(in_tile[0].h, in_tile[0].w, 3);
-
-                    for (int q = 0; q < 3; q++)
-                    {
-                        const ncnn::Mat in_tile_0 = in_tile[0].channel(q);
-                        ncnn::Mat in_tile_1 = in_tile[1].channel(q);
-                        ncnn::Mat in_tile_2 = in_tile[2].channel(q);
-                        ncnn::Mat in_tile_3 = in_tile[3].channel(q);
-                        ncnn::Mat in_tile_4 = in_tile[4].channel(q);
-                        ncnn::Mat in_tile_5 = in_tile[5].channel(q);
-                        ncnn::Mat in_tile_6 = in_tile[6].channel(q);
-                        ncnn::Mat in_tile_7 = in_tile[7].channel(q);
-
-                        for (int i = 0; i < in_tile[0].h; i++)
-                        {
-                            const float* outptr0 = in_tile_0.row(i);
-                            float* outptr1 = in_tile_1.row(in_tile[0].h - 1 - i);
-                            float* outptr2 = in_tile_2.row(i) + in_tile[0].w - 1;
-                            float* outptr3 = in_tile_3.row(in_tile[0].h - 1 - i) + in_tile[0].w - 1;
-
-                            for (int j = 0; j < in_tile[0].w; j++)
-                            {
-                                float* outptr4 = in_tile_4.row(j) + i;
-                                float* outptr5 = in_tile_5.row(in_tile[0].w - 1 - j) + i;
-                                float* outptr6 = in_tile_6.row(j) + in_tile[0].h - 1 - i;
-                                float* outptr7 = in_tile_7.row(in_tile[0].w - 1 - j) + in_tile[0].h - 1 - i;
-
-                                float v = *outptr0++;
-
-                                *outptr1++ = v;
-                                *outptr2-- = v;
-                                *outptr3-- = v;
-                                *outptr4 = v;
-                                *outptr5 = v;
-                                *outptr6 = v;
-                                *outptr7 = v;
-                            }
-                        }
-                    }
-                }
+    int pad_top = std::max(prepadding - yi * TILE_SIZE_Y, 0);
+    int pad_bottom = std::max(std::min((yi + 1) * TILE_SIZE_Y + prepadding - h, prepadding), 0);
+    int pad_left = std::max(prepadding - xi * TILE_SIZE_X, 0);
+    int pad_right = std::max(std::min((xi + 1) * TILE_SIZE_X + prepadding - w, prepadding), 0);
 
-                // realsr
-                ncnn::Mat out_tile[8];
-                for (int ti = 0; ti < 8; ti++)
-                {
-                    ncnn::Extractor ex = net.create_extractor();
+    if (tta_mode)
+    {
+        // crop, preproc and border padding
+        ncnn::Mat in_tile[8];
+        ncnn::Mat in_alpha_tile;
+        {
+            tile_from_pixels(pixeldata, w, channels, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0, pad_top, pad_bottom, pad_left, pad_right, ncnn::BORDER_REFLECT, *tile_kernels, in_tile[0], opt.blob_allocator, input_bgr);
 
-                    ex.input(net_input_name.c_str(), in_tile[ti]);
+            if (channels == 4)
+            {
+                tile_alpha_from_pixels(pixeldata, w, xi * TILE_SIZE_X, yi * TILE_SIZE_Y, tile_w_nopad, tile_h_nopad, in_alpha_tile, opt.blob_allocator);
+            }
+        }
 
-                    ex.extract(net_output_name.c_str(), out_tile[ti]);
-                }
+        // the other 7 directions
+        tta_transform(in_tile, opt.blob_allocator);
 
-                ncnn::Mat out_alpha_tile;
-                if (channels == 4)
-                {
-                    if (scale == 1)
-                    {
-                        out_alpha_tile = in_alpha_tile;
-                    }
-                    if (scale == 2)
-                    {
-                        bicubic_2x->forward(in_alpha_tile, out_alpha_tile, opt);
-                    }
-                    if (scale == 3)
-                    {
-                        bicubic_3x->forward(in_alpha_tile, out_alpha_tile, opt);
-                    }
-                    if (scale == 4)
-                    {
-                        bicubic_4x->forward(in_alpha_tile, out_alpha_tile, opt);
-                    }
-                }
+        // realsr
+        ncnn::Mat out_tile[8];
+        for (int ti = 0; ti < 8; ti++)
+        {
+            ncnn::Extractor ex = net.create_extractor();
 
-                // postproc and merge alpha
-                {
-                    out.create(tile_w_nopad * scale, tile_h_nopad * scale, channels);
-                    for (int q = 0; q < 3; q++)
-                    {
-                        const ncnn::Mat out_tile_0 = out_tile[0].channel(q);
-                        const ncnn::Mat out_tile_1 = out_tile[1].channel(q);
-                        const ncnn::Mat out_tile_2 = out_tile[2].channel(q);
-                        const ncnn::Mat out_tile_3 = out_tile[3].channel(q);
-                        const ncnn::Mat out_tile_4 = out_tile[4].channel(q);
-                        const ncnn::Mat out_tile_5 = out_tile[5].channel(q);
-                        const ncnn::Mat out_tile_6 = out_tile[6].channel(q);
-                        const ncnn::Mat out_tile_7 = out_tile[7].channel(q);
-                        float* outptr = out.channel(q);
-
-                        for (int i = 0; i < out.h; i++)
-                        {
-                            const float* ptr0 = out_tile_0.row(i + prepadding * scale) + prepadding * scale;
-                            const float* ptr1 = out_tile_1.row(out_tile[0].h - 1 - i - prepadding * scale) + prepadding * scale;
-                            const float* ptr2 = out_tile_2.row(i + prepadding * scale) + out_tile[0].w - 1 - prepadding * scale;
-                            const float* ptr3 = out_tile_3.row(out_tile[0].h - 1 - i - prepadding * scale) + out_tile[0].w - 1 - prepadding * scale;
-
-                            for (int j = 0; j < out.w; j++)
-                            {
-                                const float* ptr4 = out_tile_4.row(j + prepadding * scale) + i + prepadding * scale;
-                                const float* ptr5 = out_tile_5.row(out_tile[0].w - 1 - j - prepadding * scale) + i + prepadding * scale;
-                                const float* ptr6 = out_tile_6.row(j + prepadding * scale) + out_tile[0].h - 1 - i - prepadding * scale;
-                                const float* ptr7 = out_tile_7.row(out_tile[0].w - 1 - j - prepadding * scale) + out_tile[0].h - 1 - i - prepadding * scale;
-
-                                float v = (*ptr0++ + *ptr1++ + *ptr2-- + *ptr3-- + *ptr4 + *ptr5 + *ptr6 + *ptr7) / 8;
-
-                                *outptr++ = v * 255.f + 0.5f;
-                            }
-                        }
-                    }
-
-                    if (channels == 4)
-                    {
-                        memcpy(out.channel_range(3, 1), out_alpha_tile, out_alpha_tile.total() * sizeof(float));
-                    }
-                }
+            ex.set_num_threads(opt.num_threads);
+            ex.set_blob_allocator(opt.blob_allocator);
+            ex.set_workspace_allocator(opt.workspace_allocator);
+
+            ex.input(net_input_name.c_str(), in_tile[ti]);
+
+            ex.extract(net_output_name.c_str(), out_tile[ti]);
+        }
+
+        ncnn::Mat out_alpha_tile;
+        if (channels == 4)
+        {
+            if (scale == 1)
+            {
+                out_alpha_tile = in_alpha_tile;
             }
-            else
+            if (scale == 2)
             {
-                // split alpha and preproc
-                ncnn::Mat in_tile;
-                ncnn::Mat in_alpha_tile, in_alpah_tile_nocrop;
-                {
-                    in_tile.create(in.w, in.h, 3);
-                    for (int q = 0; q < 3; q++)
-                    {
-                        const float* ptr = in.channel(q);
-                        float* outptr = in_tile.channel(q);
-
-                        for (int i = 0; i < in.w * in.h; i++)
-                        {
-                            *outptr++ = *ptr++ * (1 / 255.f);
-                        }
-                    }
-
-                    if (channels == 4)
-                    {
-                        in_alpah_tile_nocrop = in.channel_range(3, 1).clone();
-                        int crop_top=(yi*TILE_SIZE_Y-in_tile_y0);
-                        int crop_bottom=in_tile_y1-std::min(yi*TILE_SIZE_Y+TILE_SIZE_Y ,h);
-                        int crop_left=(xi*TILE_SIZE_X-in_tile_x0);
-                        int crop_right=in_tile_x1-std::min(xi*TILE_SIZE_X+TILE_SIZE_X ,w);
-                        ncnn::copy_cut_border(in_alpah_tile_nocrop, in_alpha_tile, crop_top, crop_bottom, crop_left, crop_right);
-
-//                        fprintf(stderr,"in_alpah_tile_nocrop: %d/%d/%d, in_alpha_tile: %d/%d/%d, crop: %d/%d/%d/%d, TILE_SIZE_X %d, TILE_SIZE_Y %d\n"
-//                                ,in_alpah_tile_nocrop.w,in_alpah_tile_nocrop.h,in_alpah_tile_nocrop.c
-//                                ,in_alpha_tile.w,in_alpha_tile.h,in_alpha_tile.c
-//                                ,crop_top,crop_bottom,crop_left,crop_right
-//                                ,TILE_SIZE_X,TILE_SIZE_Y
-//                                );
-                    }
-                }
+                bicubic_2x->forward(in_alpha_tile, out_alpha_tile, opt);
+            }
+            if (scale == 3)
+            {
+                bicubic_3x->forward(in_alpha_tile, out_alpha_tile, opt);
+            }
+            if (scale == 4)
+            {
+                bicubic_4x->forward(in_alpha_tile, out_alpha_tile, opt);
+            }
+        }
 
-                // border padding
-                {
-                    int pad_top = std::max(prepadding - yi * TILE_SIZE_Y, 0);
-                    int pad_bottom = std::max(std::min((yi + 1) * TILE_SIZE_Y + prepadding - h, prepadding), 0);
-                    int pad_left = std::max(prepadding - xi * TILE_SIZE_X, 0);
-                    int pad_right = std::max(std::min((xi + 1) * TILE_SIZE_X + prepadding - w, prepadding), 0);
-
-                    ncnn::Mat in_tile_padded;
-                    ncnn::copy_make_border(in_tile, in_tile_padded, pad_top, pad_bottom, pad_left, pad_right, 2, 0.f, net.opt);
-                    in_tile = in_tile_padded;
-                }
+        // postproc and merge alpha
+        {
+            ncnn::Mat out;
+            tta_merge(out_tile, prepadding * scale, prepadding * scale, tile_w_nopad * scale, tile_h_nopad * scale, out, opt.blob_allocator);
 
-                // realsr
-                ncnn::Mat out_tile;
-                {
-                    ncnn::Extractor ex = net.create_extractor();
+            tile_to_pixels(out, 0, 0, out.w, out.h, out_alpha_tile, *tile_kernels, outpixels, w * scale * channels, channels, output_bgr);
+        }
+    }
+    else
+    {
+        // crop, preproc and border padding
+        ncnn::Mat in_tile;
+        ncnn::Mat in_alpha_tile;
+        {
+            tile_from_pixels(pixeldata, w, channels, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0, pad_top, pad_bottom, pad_left, pad_right, ncnn::BORDER_REFLECT, *tile_kernels, in_tile, opt.blob_allocator, input_bgr);
 
-                    ex.input(net_input_name.c_str(), in_tile);
+            if (channels == 4)
+            {
+                tile_alpha_from_pixels(pixeldata, w, xi * TILE_SIZE_X, yi * TILE_SIZE_Y, tile_w_nopad, tile_h_nopad, in_alpha_tile, opt.blob_allocator);
+            }
+        }
 
-                    ex.extract(net_output_name.c_str(), out_tile);
-                }
+        // realsr
+        ncnn::Mat out_tile;
+        {
+            ncnn::Extractor ex = net.create_extractor();
 
-                ncnn::Mat out_alpha_tile;
-                if (channels == 4)
-                {
-                    if (scale == 1)
-                    {
-                        out_alpha_tile = in_alpha_tile;
-                    }
-                    if (scale == 2)
-                    {
-                        bicubic_2x->forward(in_alpha_tile, out_alpha_tile, opt);
-                    }
-                    if (scale == 3)
-                    {
-                        bicubic_3x->forward(in_alpha_tile, out_alpha_tile, opt);
-                    }
-                    if (scale == 4)
-                    {
-                        bicubic_4x->forward(in_alpha_tile, out_alpha_tile, opt);
-                    }
-                }
+            ex.set_num_threads(opt.num_threads);
+            ex.set_blob_allocator(opt.blob_allocator);
+            ex.set_workspace_allocator(opt.workspace_allocator);
 
-                // postproc and merge alpha
-                {
-                    out.create(tile_w_nopad * scale, tile_h_nopad * scale, channels);
-                    for (int q = 0; q < 3; q++)
-                    {
-                        float* outptr = out.channel(q);
-
-                        for (int i = 0; i < out.h; i++)
-                        {
-                            const float* ptr = out_tile.channel(q).row(i + prepadding * scale) + prepadding * scale;
-
-                            for (int j = 0; j < out.w; j++)
-                            {
-                                *outptr++ = *ptr++ * 255.f + 0.5f;
-                            }
-                        }
-                    }
-
-                    if (channels == 4)
-                    {
-//                        fprintf(stderr, "process_cpu 4c memcpy\n");
-//                        fprintf(stderr,"outimage: %d/%d/%d, outtile: %d/%d/%d, offset: %d, outimage size: %d, outtile size: %d, left: %d, outtilealpha: %d/%d/%d, %d * %d\n"
-//                                ,outimage.w,outimage.h,outimage.c,out.w,out.h,out.c
-//                                ,  yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels
-//                                ,outimage.w*outimage.h*outimage.c
-//                                ,out.w*out.h*out.c
-//                                ,outimage.w*outimage.h*outimage.c - out.w*out.h*out.c -(yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels)
-//                        ,out_alpha_tile.w,out_alpha_tile.h,out_alpha_tile.c,out_alpha_tile.total()  ,sizeof(float)
-//                        );
-
-
-                        memcpy(out.channel_range(3, 1), out_alpha_tile, out_alpha_tile.total() * sizeof(float));
-
-//                        fprintf(stderr, "process_cpu 4c memcpy done\n");
-
-                    }
-                }
-            }
+            ex.input(net_input_name.c_str(), in_tile);
+
+            ex.extract(net_output_name.c_str(), out_tile);
+        }
 
+        ncnn::Mat out_alpha_tile;
+        if (channels == 4)
+        {
+            if (scale == 1)
             {
-                if (channels == 3)
-                {
-#if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGB2BGR, w * scale * channels);
-#else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGB, w * scale * channels);
-#endif
-                }
-                if (channels == 4)
-                {
-#if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGBA2BGRA, w * scale * channels);
-#else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGBA, w * scale * channels);
-#endif
-                }
+                out_alpha_tile = in_alpha_tile;
             }
-
-            high_resolution_clock::time_point end = high_resolution_clock::now();
-            float time_span_print_progress = duration_cast<duration<double>>(
-                    end - time_print_progress).count();
-            float progress_tile = (float) (yi * xtiles + xi + 1);
-            if (time_span_print_progress > 0.5 || (yi + 1 == ytiles && xi + 3 > xtiles)) {
-                double progress = progress_tile / (ytiles * xtiles);
-                double time_span = duration_cast<duration<double>>(end - begin).count();
-//                fprintf(stderr, "%5.2f%%\t[%5.2fs /%5.2f] y %d x %d\n", progress * 100,time_span,
-//                        time_span / progress - time_span ,yi,xi, omp_get_thread_num());
-                fprintf(stderr, "%5.2f%%\t[%5.2fs /%5.2f ETA]\n", progress * 100, time_span,
-                        time_span / progress - time_span);
-                time_print_progress = end;
+            if (scale == 2)
+            {
+                bicubic_2x->forward(in_alpha_tile, out_alpha_tile, opt);
+            }
+            if (scale == 3)
+            {
+                bicubic_3x->forward(in_alpha_tile, out_alpha_tile, opt);
+            }
+            if (scale == 4)
+            {
+                bicubic_4x->forward(in_alpha_tile, out_alpha_tile, opt);
             }
         }
+
+        // postproc and merge alpha
+        tile_to_pixels(out_tile, prepadding * scale, prepadding * scale, tile_w_nopad * scale, tile_h_nopad * scale, out_alpha_tile, *tile_kernels, outpixels, w * scale * channels, channels, output_bgr);
     }
 
     return 0;
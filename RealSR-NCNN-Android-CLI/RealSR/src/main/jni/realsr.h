@@ -11,7 +11,12 @@
 #include "layer.h"
 #include <chrono>
 
+#include "tile_progress.h"
+
 using namespace std::chrono;
+class RealSRTileQueue;
+class TileArenaPool;
+class TilePixels;
 class RealSR
 {
 public:
@@ -28,11 +33,31 @@ public:
 
     int process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const;
 
+protected:
+    static void* process_gpu_worker(void* args);
+
+    int process_gpu_row(const ncnn::Mat& inimage, ncnn::Mat& outimage, int yi, const ncnn::Option& opt, RealSRTileQueue& queue) const;
+
+    static void* process_cpu_worker(void* args);
+
+    int process_cpu_tile(const ncnn::Mat& inimage, ncnn::Mat& outimage, int yi, int xi, const ncnn::Option& opt) const;
+
 public:
     // realsr parameters
     int scale;
     int tilesize;
     int prepadding;
+    // inimage in bgr(a) order, the default on windows where wic decodes to bgr, set before load
+    bool input_bgr;
+    // outimage in bgr(a) order, the same default as input_bgr, set before load
+    bool output_bgr;
+    // tiles processed concurrently by process_cpu
+    int cpu_tile_jobs;
+    // tile rows kept in flight by process
+    int gpu_row_jobs;
+    // tile progress of process, stderr when unset
+    tile_progress_callback progress_callback;
+    void* progress_userdata;
     std::string net_input_name = "data";
     std::string net_output_name = "output";
 private:
@@ -44,6 +69,11 @@ private:
     ncnn::Layer* bicubic_3x;
     ncnn::Layer* bicubic_4x;
     bool tta_mode;
+    // the 1/255 and * 255 + 0.5 live in the first and last layer weights, cpu only
+    bool folded;
+    TileArenaPool* tile_arenas;
+    // pixel row kernels of the cpu path, picked at load
+    TilePixels* tile_kernels;
 };
 
 #endif // REALSR_H
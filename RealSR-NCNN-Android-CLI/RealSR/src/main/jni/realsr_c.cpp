@@ -0,0 +1,128 @@
+// c api of the realsr engine
+
+#define REALSR_C_BUILD
+#include "realsr_c.h"
+
+#include "realsr.h"
+
+#include "engine_c.h"
+
+typedef EngineCInstance<RealSR, realsr_error, realsr_callback> RealSRInstance;
+
+static_assert(REALSR_ERROR_PROCESS == (int)ENGINE_C_ERROR_PROCESS, "realsr_error follows the engine_c.h order");
+
+void REALSR_C_API realsr_default_parameters(realsr_parameters* parameters)
+{
+    if (!parameters)
+        return;
+
+    parameters->gpuid = 0;
+    parameters->tta_mode = 0;
+    parameters->num_threads = 1;
+    parameters->scale = 4;
+    parameters->tilesize = 0;
+    parameters->prepadding = 10;
+    parameters->input_bgr = 0;
+    parameters->output_bgr = 0;
+}
+
+realsr_instance REALSR_C_API realsr_create(const realsr_parameters* parameters, realsr_error* error)
+{
+    realsr_error dummy;
+    if (!error)
+        error = &dummy;
+
+    if (!parameters)
+    {
+        *error = REALSR_ERROR_NULL_DATA;
+        return 0;
+    }
+
+    if (parameters->gpuid < -1 || parameters->scale < 1 || parameters->prepadding < 0 || parameters->num_threads < 1
+            || (parameters->tilesize != 0 && parameters->tilesize < 32))
+    {
+        *error = REALSR_ERROR_INVALID_PARAMETERS;
+        return 0;
+    }
+
+    const bool gpu = parameters->gpuid != -1;
+    if (gpu)
+    {
+        engine_c_gpu_acquire();
+
+        if (parameters->gpuid >= ncnn::get_gpu_count())
+        {
+            engine_c_gpu_release();
+            *error = REALSR_ERROR_INVALID_PARAMETERS;
+            return 0;
+        }
+    }
+
+    int tilesize = parameters->tilesize;
+    if (tilesize == 0)
+    {
+        // the cli policy for the non-v models
+        if (!gpu)
+        {
+            tilesize = 200;
+        }
+        else
+        {
+            uint32_t heap_budget = ncnn::get_gpu_device(parameters->gpuid)->get_heap_budget();
+            if (heap_budget > 2800)
+                tilesize = 200;
+            else if (heap_budget > 900)
+                tilesize = 100;
+            else if (heap_budget > 300)
+                tilesize = 64;
+            else
+                tilesize = 32;
+        }
+    }
+
+    RealSRInstance* instance = new RealSRInstance(new RealSR(parameters->gpuid, parameters->tta_mode != 0, gpu ? 1 : parameters->num_threads), gpu);
+
+    RealSR* realsr = instance->engine;
+    realsr->input_bgr = parameters->input_bgr != 0;
+    realsr->output_bgr = parameters->output_bgr != 0;
+    // the engine prints tile progress to stderr without a callback, keep the host quiet
+    realsr->progress_callback = tile_progress_ignore;
+    realsr->scale = parameters->scale;
+    realsr->tilesize = tilesize;
+    realsr->prepadding = parameters->prepadding;
+    // cpu threads go to concurrent tiles instead of one wide extractor
+    realsr->cpu_tile_jobs = gpu ? 1 : parameters->num_threads;
+
+    *error = REALSR_OK;
+    return instance;
+}
+
+void REALSR_C_API realsr_destroy(realsr_instance instance)
+{
+    engine_c_destroy((RealSRInstance*)instance);
+}
+
+realsr_error REALSR_C_API realsr_load(realsr_instance instance, const char* parampath, const char* modelpath)
+{
+    return (realsr_error)engine_c_load((RealSRInstance*)instance, parampath, modelpath);
+}
+
+realsr_error REALSR_C_API realsr_process(realsr_instance instance,
+    const unsigned char* src, int w, int h, int channels, size_t src_stride,
+    unsigned char* dst, size_t dst_stride)
+{
+    return (realsr_error)engine_c_process((const RealSRInstance*)instance, src, w, h, channels, src_stride, dst, dst_stride);
+}
+
+realsr_error REALSR_C_API realsr_submit(realsr_instance instance,
+    const unsigned char* src, int w, int h, int channels, size_t src_stride,
+    unsigned char* dst, size_t dst_stride,
+    realsr_callback callback, void* userdata)
+{
+    return (realsr_error)engine_c_submit((RealSRInstance*)instance, src, w, h, channels, src_stride, dst, dst_stride, callback, userdata);
+}
+
+void REALSR_C_API realsr_wait(realsr_instance instance)
+{
+    engine_c_wait((RealSRInstance*)instance);
+}
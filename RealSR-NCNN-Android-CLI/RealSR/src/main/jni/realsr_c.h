@@ -0,0 +1,88 @@
+// c api of the realsr engine, for host apps that keep models loaded and hand over pixels directly
+
+#ifndef REALSR_C_H
+#define REALSR_C_H
+
+#include <stddef.h>
+
+#ifdef _WIN32
+#ifdef REALSR_C_BUILD
+#define REALSR_C_EXPORT __declspec(dllexport)
+#else
+#define REALSR_C_EXPORT __declspec(dllimport)
+#endif
+#define REALSR_C_API __stdcall
+#else
+#define REALSR_C_EXPORT __attribute__((visibility("default")))
+#define REALSR_C_API
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+    typedef enum realsr_error
+    {
+        REALSR_OK = 0,
+        REALSR_ERROR_NULL_INSTANCE,
+        REALSR_ERROR_NULL_DATA,
+        REALSR_ERROR_INVALID_PARAMETERS,
+        REALSR_ERROR_LOAD_MODEL,
+        REALSR_ERROR_NOT_LOADED,
+        REALSR_ERROR_PROCESS
+    } realsr_error;
+
+    typedef struct realsr_parameters
+    {
+        // -1 for cpu
+        int gpuid;
+        int tta_mode;
+        // cpu threads, ignored on gpu
+        int num_threads;
+        // the x of the xN.param and xN.bin in use
+        int scale;
+        // >= 32, or 0 to keep the engine default
+        int tilesize;
+        int prepadding;
+        // src in bgr(a) order, rgb(a) otherwise
+        int input_bgr;
+        // dst in bgr(a) order, rgb(a) otherwise
+        int output_bgr;
+    } realsr_parameters;
+
+    typedef void* realsr_instance;
+
+    // runs on the worker thread of the instance once a submitted job is done
+    typedef void (*realsr_callback)(void* userdata, realsr_error error);
+
+    REALSR_C_EXPORT void REALSR_C_API realsr_default_parameters(realsr_parameters* parameters);
+
+    // the vulkan instance is created with the first instance and destroyed with the last
+    REALSR_C_EXPORT realsr_instance REALSR_C_API realsr_create(const realsr_parameters* parameters, realsr_error* error);
+    REALSR_C_EXPORT void REALSR_C_API realsr_destroy(realsr_instance instance);
+
+    // utf-8 paths
+    REALSR_C_EXPORT realsr_error REALSR_C_API realsr_load(realsr_instance instance, const char* parampath, const char* modelpath);
+
+    // src is w x h with channels 3 or 4, in the order of input_bgr
+    // dst is w * scale x h * scale with the same channels, both owned by the caller
+    // a stride of 0 means packed rows, packed rows are used in place and others are repacked
+    REALSR_C_EXPORT realsr_error REALSR_C_API realsr_process(realsr_instance instance,
+        const unsigned char* src, int w, int h, int channels, size_t src_stride,
+        unsigned char* dst, size_t dst_stride);
+
+    // queues the same work and returns, src and dst must stay valid until callback
+    REALSR_C_EXPORT realsr_error REALSR_C_API realsr_submit(realsr_instance instance,
+        const unsigned char* src, int w, int h, int channels, size_t src_stride,
+        unsigned char* dst, size_t dst_stride,
+        realsr_callback callback, void* userdata);
+
+    // blocks until every submitted job has called back
+    REALSR_C_EXPORT void REALSR_C_API realsr_wait(realsr_instance instance);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // REALSR_C_H
@@ -123,6 +123,7 @@ static std::vector<int> parse_optarg_int_array(const char *optarg) {
 //#include "resize.h"
 
 #include "filesystem_utils.h"
+#include "image_loader.h"
 
 static void print_usage() {
     fprintf(stderr, "Usage: resize-ncnn -i infile -o outfile [options]...\n\n");
@@ -371,88 +372,14 @@ int main(int argc, char **argv)
         const path_t &imagepath = input_files[i];
         path_t &outputpath = output_files[i];
 
-//        int webp = 0;
+        int webp = 0;
 
         unsigned char *pixeldata = 0;
         int w;
         int h;
         int c;
 
-#if _WIN32
-        FILE* fp = _wfopen(imagepath.c_str(), L"rb");
-#else
-        FILE *fp = fopen(imagepath.c_str(), "rb");
-#endif
-        if (fp) {
-            // read whole file
-            unsigned char *filedata = 0;
-            int length = 0;
-            {
-                fseek(fp, 0, SEEK_END);
-                length = ftell(fp);
-                rewind(fp);
-                filedata = (unsigned char *) malloc(length);
-                if (filedata) {
-                    fread(filedata, 1, length, fp);
-                }
-                fclose(fp);
-            }
-
-            if (filedata) {
-                pixeldata = webp_load(filedata, length, &w, &h, &c);
-                if (!pixeldata) {
-//                    webp = 1;
-//                } else {
-                    // not webp, try jpg png etc.
-#if _WIN32
-                    pixeldata = wic_decode_image(imagepath.c_str(), &w, &h, &c);
-#else // _WIN32
-                    pixeldata = stbi_load_from_memory(filedata, length, &w, &h, &c, 0);
-
-
-                    fprintf(stderr, "pixeldata stbi_load w/h/c %d/%d/%d \n",
-                            w, h, c
-                    );
-
-                    if (pixeldata) {
-                        // stb_image auto channel
-                        if (c == 1) {
-                            // grayscale -> rgb
-                            stbi_image_free(pixeldata);
-                            pixeldata = stbi_load_from_memory(filedata, length, &w, &h, &c, 3);
-                            c = 3;
-                            fprintf(stderr, "pixeldata c==1 w/h/c %d/%d/%d \n",
-                                    w, h, c
-                            );
-                        } else if (c == 2) {
-                            // grayscale + alpha -> rgba
-                            stbi_image_free(pixeldata);
-                            pixeldata = stbi_load_from_memory(filedata, length, &w, &h, &c, 4);
-                            c = 4;
-                            fprintf(stderr, "pixeldata c==2 w/h/c %d/%d/%d \n",
-                                    w, h, c
-                            );
-                        }
-                    }
-#endif // _WIN32
-                }
-            } else if (_VERBOSE_LOG) {
-#if _WIN32
-                fwprintf(stderr, L"no filedata\n");
-#else // _WIN32
-                fprintf(stderr, "no filedata\n");
-#endif // _WIN32
-            }
-
-            free(filedata);
-        } else if (_VERBOSE_LOG) {
-#if _WIN32
-            fwprintf(stderr, L"fopen failed\n");
-#else // _WIN32
-            fprintf(stderr, "fopen failed\n");
-#endif // _WIN32
-        }
-
+        pixeldata = image_load(imagepath, &w, &h, &c, &webp);
 
         // 计算降采样的倍率
         if (pixeldata) {
@@ -97,6 +97,10 @@ static std::vector<int> parse_optarg_int_array(const char* optarg)
 #include "srmd.h"
 
 #include "filesystem_utils.h"
+#include "image_loader.h"
+#include "task_budget.h"
+#include "tile_autotune.h"
+#include "tile_stripe.h"
 #include <opencv2/opencv.hpp>
 #include <opencv2/core/hal/interface.h>
 using namespace cv;
@@ -112,9 +116,12 @@ static void print_usage()
     fprintf(stderr, "  -s scale             upscale ratio (2/3/4, default=2)\n");
     fprintf(stderr, "  -t tile-size         tile size (>=32/0=auto, default=0) can be 0,0,0 for multi-gpu\n");
     fprintf(stderr, "  -m model-path        srmd model path (default=models-srmd)\n");
-    fprintf(stderr, "  -g gpu-id            gpu device to use (default=auto) can be 0,1,2 for multi-gpu\n");
+    fprintf(stderr, "  -g gpu-id            gpu device to use (-1=cpu, default=auto) can be 0,1,2 for multi-gpu\n");
     fprintf(stderr, "  -j load:proc:save    thread count for load/proc/save (default=1:2:2) can be 1:2,2,2:2 for multi-gpu\n");
     fprintf(stderr, "  -x                   enable tta mode\n");
+    fprintf(stderr, "  -a                   autotune tile-size for auto tiles and cache the result\n");
+    fprintf(stderr, "  -l                   stream large images in tile-row stripes (png output only)\n");
+    fprintf(stderr, "  -r memory-mb         memory ceiling for queued images in MB (0=quarter of ram, default=0)\n");
     fprintf(stderr, "  -f format            output image format (jpg/png/webp, default=ext/png)\n");
 }
 
@@ -127,6 +134,9 @@ public:
     path_t inpath;
     path_t outpath;
 
+    // input and output bytes held against task_budget
+    size_t footprint;
+
     ncnn::Mat inimage;
     ncnn::Mat outimage;
 };
@@ -142,11 +152,7 @@ public:
     {
         lock.lock();
 
-        while (tasks.size() >= 8) // FIXME hardcode queue length
-        {
-            condition.wait(lock);
-        }
-
+        // no length limit, the loaders wait on task_budget instead
         tasks.push(v);
 
         lock.unlock();
@@ -179,6 +185,7 @@ private:
 
 TaskQueue toproc;
 TaskQueue tosave;
+TaskBudget task_budget;
 
 class LoadThreadParams
 {
@@ -209,66 +216,7 @@ void* load(void* args)
         int h;
         int c;
 
-#if _WIN32
-        FILE* fp = _wfopen(imagepath.c_str(), L"rb");
-#else
-        FILE* fp = fopen(imagepath.c_str(), "rb");
-#endif
-        if (fp)
-        {
-            // read whole file
-            unsigned char* filedata = 0;
-            int length = 0;
-            {
-                fseek(fp, 0, SEEK_END);
-                length = ftell(fp);
-                rewind(fp);
-                filedata = (unsigned char*)malloc(length);
-                if (filedata)
-                {
-                    fread(filedata, 1, length, fp);
-                }
-                fclose(fp);
-            }
-
-            if (filedata)
-            {
-                pixeldata = webp_load(filedata, length, &w, &h, &c);
-                if (pixeldata)
-                {
-                    webp = 1;
-                }
-                else
-                {
-                    // not webp, try jpg png etc.
-#if _WIN32
-                    pixeldata = wic_decode_image(imagepath.c_str(), &w, &h, &c);
-#else // _WIN32
-                    pixeldata = stbi_load_from_memory(filedata, length, &w, &h, &c, 0);
-                    if (pixeldata)
-                    {
-                        // stb_image auto channel
-                        if (c == 1)
-                        {
-                            // grayscale -> rgb
-                            stbi_image_free(pixeldata);
-                            pixeldata = stbi_load_from_memory(filedata, length, &w, &h, &c, 3);
-                            c = 3;
-                        }
-                        else if (c == 2)
-                        {
-                            // grayscale + alpha -> rgba
-                            stbi_image_free(pixeldata);
-                            pixeldata = stbi_load_from_memory(filedata, length, &w, &h, &c, 4);
-                            c = 4;
-                        }
-                    }
-#endif // _WIN32
-                }
-
-                free(filedata);
-            }
-        }
+        pixeldata = image_load(imagepath, &w, &h, &c, &webp);
         if (pixeldata)
         {
             Task v;
@@ -278,7 +226,6 @@ void* load(void* args)
             v.outpath = ltp->output_files[i];
 
             v.inimage = ncnn::Mat(w, h, (void*)pixeldata, (size_t)c, c);
-            v.outimage = ncnn::Mat(w * scale, h * scale, (size_t)c, c);
 
             path_t ext = get_file_extension(v.outpath);
             if (c == 4 && (ext == PATHSTR("jpg") || ext == PATHSTR("JPG") || ext == PATHSTR("jpeg") || ext == PATHSTR("JPEG")))
@@ -292,6 +239,10 @@ void* load(void* args)
 #endif // _WIN32
             }
 
+            // input and output pixels, held until the result is saved
+            v.footprint = (size_t)w * h * c * (1 + scale * scale);
+            task_budget.acquire(v.footprint);
+
             toproc.put(v);
         }
         else
@@ -327,6 +278,8 @@ void* proc(void* args)
         if (v.id == -233)
             break;
 
+        // allocated only now, queued tasks hold just their input
+        v.outimage = ncnn::Mat(v.inimage.w * srmd->scale, v.inimage.h * srmd->scale, (size_t)v.inimage.elemsize, (int)v.inimage.elemsize);
         srmd->process(v.inimage, v.outimage);
 
         tosave.put(v);
@@ -339,12 +292,15 @@ class SaveThreadParams
 {
 public:
     int verbose;
+    // outimage comes in bgr(a) order, imwrite takes it as is
+    int bgr;
 };
 
 void* save(void* args)
 {
     const SaveThreadParams* stp = (const SaveThreadParams*)args;
     const int verbose = stp->verbose;
+    const int bgr = stp->bgr;
 
     for (;;)
     {
@@ -355,6 +311,8 @@ void* save(void* args)
         if (v.id == -233)
             break;
 
+        TaskBudgetScope budget_scope(task_budget, v.footprint);
+
         // free input pixel data
         {
             unsigned char* pixeldata = (unsigned char*)v.inimage.data;
@@ -385,11 +343,13 @@ void* save(void* args)
                     break;
                 case 3:
                     image = cv::Mat(v.outimage.h, v.outimage.w, CV_8UC3, v.outimage.data); // 3通道图像
-                    cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
+                    if (!bgr)
+                        cv::cvtColor(image, image, cv::COLOR_RGB2BGR);
                     break;
                 case 4:
                     image = cv::Mat(v.outimage.h, v.outimage.w, CV_8UC4, v.outimage.data); // 4通道图像
-                    cv::cvtColor(image, image, cv::COLOR_RGBA2BGRA);
+                    if (!bgr)
+                        cv::cvtColor(image, image, cv::COLOR_RGBA2BGRA);
                     break;
             }
             if (image.empty()) {
@@ -443,6 +403,77 @@ void* save(void* args)
 }
 
 
+// the full size output never exists in memory, png inputs are decoded row by row as well
+static int process_stripes(const SRMD* srmd, const path_t& inpath, const path_t& outpath, int verbose)
+{
+    StripeReader reader;
+    unsigned char* pixeldata = 0;
+    int webp = 0;
+
+    if (reader.open_png(inpath, srmd->input_bgr) != 0)
+    {
+        // other formats are decoded whole, the output is still streamed
+        int w = 0;
+        int h = 0;
+        int c = 0;
+        pixeldata = image_load(inpath, &w, &h, &c, &webp);
+        if (!pixeldata)
+        {
+#if _WIN32
+            fwprintf(stderr, L"decode image %ls failed\n", inpath.c_str());
+#else
+            fprintf(stderr, "decode image %s failed\n", inpath.c_str());
+#endif
+            return -1;
+        }
+
+        reader.open_memory(pixeldata, w, h, c);
+    }
+
+    const int scale = srmd->scale;
+    fprintf(stderr, "stripe scale=%d, w/h/c %d/%d/%d -> %d/%d/%d\n", scale, reader.w, reader.h, reader.c, reader.w * scale, reader.h * scale, reader.c);
+
+    StripeWriter writer;
+    int ret = writer.open_png(outpath, reader.w * scale, reader.h * scale, reader.c, srmd->output_bgr);
+    if (ret == 0)
+        ret = stripe_process(srmd, reader, writer);
+    if (writer.close() != 0)
+        ret = -1;
+
+    reader.close();
+    if (webp == 1)
+    {
+        free(pixeldata);
+    }
+    else if (pixeldata)
+    {
+#if _WIN32
+        free(pixeldata);
+#else
+        stbi_image_free(pixeldata);
+#endif
+    }
+
+    if (ret != 0)
+    {
+#if _WIN32
+        fwprintf(stderr, L"encode image %ls failed\n", outpath.c_str());
+#else
+        fprintf(stderr, "encode image %s failed\n", outpath.c_str());
+#endif
+    }
+    else if (verbose)
+    {
+#if _WIN32
+        fwprintf(stderr, L"%ls -> %ls done\n", inpath.c_str(), outpath.c_str());
+#else
+        fprintf(stderr, "%s -> %s done\n", inpath.c_str(), outpath.c_str());
+#endif
+    }
+
+    return ret;
+}
+
 #if _WIN32
 int wmain(int argc, wchar_t** argv)
 #else
@@ -461,12 +492,15 @@ int main(int argc, char** argv)
     int jobs_save = 2;
     int verbose = 0;
     int tta_mode = 0;
+    int autotune = 0;
+    int stripe = 0;
+    int budget_mb = 0;
     path_t format = PATHSTR("png");
 
 #if _WIN32
     setlocale(LC_ALL, "");
     wchar_t opt;
-    while ((opt = getopt(argc, argv, L"i:o:n:s:t:m:g:j:f:vxh")) != (wchar_t)-1)
+    while ((opt = getopt(argc, argv, L"i:o:n:s:t:m:g:j:f:r:vxlah")) != (wchar_t)-1)
     {
         switch (opt)
         {
@@ -504,6 +538,15 @@ int main(int argc, char** argv)
         case L'x':
             tta_mode = 1;
             break;
+        case L'a':
+            autotune = 1;
+            break;
+        case L'l':
+            stripe = 1;
+            break;
+        case L'r':
+            budget_mb = _wtoi(optarg);
+            break;
         case L'h':
         default:
             print_usage();
@@ -512,7 +555,7 @@ int main(int argc, char** argv)
     }
 #else // _WIN32
     int opt;
-    while ((opt = getopt(argc, argv, "i:o:n:s:t:m:g:j:f:vxh")) != -1)
+    while ((opt = getopt(argc, argv, "i:o:n:s:t:m:g:j:f:r:vxlah")) != -1)
     {
         switch (opt)
         {
@@ -550,6 +593,15 @@ int main(int argc, char** argv)
         case 'x':
             tta_mode = 1;
             break;
+        case 'a':
+            autotune = 1;
+            break;
+        case 'l':
+            stripe = 1;
+            break;
+        case 'r':
+            budget_mb = atoi(optarg);
+            break;
         case 'h':
         default:
             print_usage();
@@ -591,6 +643,12 @@ int main(int argc, char** argv)
         return -1;
     }
 
+    if (budget_mb < 0)
+    {
+        fprintf(stderr, "invalid memory-mb argument\n");
+        return -1;
+    }
+
     if (jobs_proc.size() != (gpuid.empty() ? 1 : gpuid.size()) && !jobs_proc.empty())
     {
         fprintf(stderr, "invalid jobs_proc thread count argument\n");
@@ -636,6 +694,12 @@ int main(int argc, char** argv)
         return -1;
     }
 
+    if (stripe && format != PATHSTR("png"))
+    {
+        fprintf(stderr, "stripe mode only writes png\n");
+        return -1;
+    }
+
     // collect input and output filepath
     std::vector<path_t> input_files;
     std::vector<path_t> output_files;
@@ -762,10 +826,14 @@ int main(int argc, char** argv)
     jobs_load = std::min(jobs_load, cpu_count);
     jobs_save = std::min(jobs_save, cpu_count);
 
+    task_budget.set_ceiling((size_t)budget_mb * 1024 * 1024);
+    if (verbose)
+        fprintf(stderr, "task memory budget %zu MB\n", task_budget.get_ceiling() / 1024 / 1024);
+
     int gpu_count = ncnn::get_gpu_count();
     for (int i=0; i<use_gpu_count; i++)
     {
-        if (gpuid[i] < 0 || gpuid[i] >= gpu_count)
+        if (gpuid[i] < -1 || gpuid[i] >= gpu_count)
         {
             fprintf(stderr, "invalid gpu device\n");
 
@@ -777,9 +845,25 @@ int main(int argc, char** argv)
     int total_jobs_proc = 0;
     for (int i=0; i<use_gpu_count; i++)
     {
-        int gpu_queue_count = ncnn::get_gpu_info(gpuid[i]).compute_queue_count();
-        jobs_proc[i] = std::min(jobs_proc[i], gpu_queue_count);
-        total_jobs_proc += jobs_proc[i];
+        if (gpuid[i] == -1)
+        {
+            // one proc thread, jobs_proc becomes its ncnn thread count
+            jobs_proc[i] = std::min(jobs_proc[i], cpu_count);
+            total_jobs_proc += 1;
+        }
+        else
+        {
+            int gpu_queue_count = ncnn::get_gpu_info(gpuid[i]).compute_queue_count();
+            jobs_proc[i] = std::min(jobs_proc[i], gpu_queue_count);
+            total_jobs_proc += jobs_proc[i];
+        }
+    }
+
+    // tiles left to the policy below may be autotuned later
+    std::vector<int> tilesize_auto(use_gpu_count);
+    for (int i=0; i<use_gpu_count; i++)
+    {
+        tilesize_auto[i] = tilesize[i] == 0;
     }
 
     for (int i=0; i<use_gpu_count; i++)
@@ -787,6 +871,13 @@ int main(int argc, char** argv)
         if (tilesize[i] != 0)
             continue;
 
+        if (gpuid[i] == -1)
+        {
+            // cpu only
+            tilesize[i] = 400;
+            continue;
+        }
+
         uint32_t heap_budget = ncnn::get_gpu_device(gpuid[i])->get_heap_budget();
 
         // more fine-grained tilesize policy here
@@ -808,7 +899,13 @@ int main(int argc, char** argv)
 
         for (int i=0; i<use_gpu_count; i++)
         {
-            srmd[i] = new SRMD(gpuid[i], tta_mode);
+            int num_threads = gpuid[i] == -1 ? jobs_proc[i] : 1;
+
+            srmd[i] = new SRMD(gpuid[i], tta_mode, num_threads);
+
+            // imwrite takes bgr(a), the stripe writer keeps the input order
+            if (!stripe)
+                srmd[i]->output_bgr = true;
 
             srmd[i]->load(paramfullpath, modelfullpath);
 
@@ -818,7 +915,42 @@ int main(int argc, char** argv)
             srmd[i]->prepadding = prepadding;
         }
 
+        if (autotune)
+        {
+            const path_t cache_path = tile_autotune_cache_path();
+
+            for (int i=0; i<use_gpu_count; i++)
+            {
+                if (!tilesize_auto[i])
+                    continue;
+
+                const std::string key = tile_autotune_key(gpuid[i], jobs_proc[i], 1, modelfullpath, scale, tta_mode);
+
+                int cached = tile_autotune_load(cache_path, key);
+                if (cached != 0)
+                {
+                    srmd[i]->tilesize = cached;
+                    fprintf(stderr, "autotune gpu[%d], cached tilesize=%d\n", i, cached);
+                    continue;
+                }
+
+                fprintf(stderr, "autotune gpu[%d], calibrating from tilesize=%d\n", i, tilesize[i]);
+                int tuned = tile_autotune(srmd[i], 3, tilesize[i], gpuid[i], jobs_proc[i], verbose);
+                tile_autotune_store(cache_path, key, tuned);
+                fprintf(stderr, "autotune gpu[%d], tilesize=%d\n", i, tuned);
+            }
+        }
+
         // main routine
+        if (stripe)
+        {
+            // one image at a time on the first device, rows are streamed from and to disk
+            for (int i = 0; i < (int)input_files.size(); i++)
+            {
+                process_stripes(srmd[0], input_files[i], output_files[i], verbose);
+            }
+        }
+        else
         {
             // load image
             LoadThreadParams ltp;
@@ -841,16 +973,24 @@ int main(int argc, char** argv)
                 int total_jobs_proc_id = 0;
                 for (int i=0; i<use_gpu_count; i++)
                 {
-                    for (int j=0; j<jobs_proc[i]; j++)
+                    if (gpuid[i] == -1)
                     {
                         proc_threads[total_jobs_proc_id++] = new ncnn::Thread(proc, (void*)&ptp[i]);
                     }
+                    else
+                    {
+                        for (int j=0; j<jobs_proc[i]; j++)
+                        {
+                            proc_threads[total_jobs_proc_id++] = new ncnn::Thread(proc, (void*)&ptp[i]);
+                        }
+                    }
                 }
             }
 
             // save image
             SaveThreadParams stp;
             stp.verbose = verbose;
+            stp.bgr = srmd[0]->output_bgr;
 
             std::vector<ncnn::Thread*> save_threads(jobs_save);
             for (int i=0; i<jobs_save; i++)
@@ -1,6 +1,10 @@
 // srmd implemented with ncnn library
 
 #include "srmd.h"
+#include "tile_arena.h"
+#include "tile_pixels.h"
+#include "tile_plan.h"
+#include "tile_tta.h"
 
 #include <algorithm>
 #include <vector>
@@ -43,16 +47,52 @@ static const uint32_t srmd_postproc_tta_int8s_spv_data[] = {
     #include "srmd_postproc_tta_int8s.spv.hex.h"
 };
 
-SRMD::SRMD(int gpuid, bool _tta_mode)
+// the degradation kernel projected on its 15 pca components, as baked into srmd_preproc
+static const float srmd_kernel_pca[15] = {
+    -1.1236095609490349e-08f, -1.3689915867587388e-08f, 0.01856379583477974f, 2.8606688573518113e-08f, 0.03352929651737213f,
+    8.372729354277908e-08f, -2.5442400897190964e-07f, -0.03162349760532379f, -0.013516925275325775f, -1.1046608960896265e-08f,
+    0.03847537934780121f, 3.794657388311862e-08f, -0.24491675198078156f, -0.8022134900093079f, -0.5405497550964355f
+};
+
+// an input tile of the given shape whose degradation and noise planes are already filled,
+// they only depend on noise so each shape is filled once and reused, the rgb planes are rewritten per tile
+static ncnn::Mat srmd_input_tile(std::vector<ncnn::Mat>& cache, int w, int h, int noise, ncnn::Allocator* allocator)
+{
+    for (size_t i = 0; i < cache.size(); i++)
+    {
+        if (cache[i].w == w && cache[i].h == h)
+            return cache[i];
+    }
+
+    ncnn::Mat in_tile;
+    in_tile.create(w, h, noise == -1 ? 18 : 19, (size_t)4u, allocator);
+
+    for (int q = 0; q < 15; q++)
+    {
+        in_tile.channel(3 + q).fill(srmd_kernel_pca[q]);
+    }
+    if (noise != -1)
+    {
+        in_tile.channel(18).fill(noise / 255.f);
+    }
+
+    cache.push_back(in_tile);
+    return in_tile;
+}
+
+SRMD::SRMD(int gpuid, bool _tta_mode, int num_threads)
 {
-    net.opt.use_vulkan_compute = true;
+    vkdev = gpuid == -1 ? 0 : ncnn::get_gpu_device(gpuid);
+
+    net.opt.num_threads = num_threads;
+    net.opt.use_vulkan_compute = vkdev ? true : false;
     net.opt.use_fp16_packed = true;
     net.opt.use_fp16_storage = true;
     net.opt.use_fp16_arithmetic = false;
     net.opt.use_int8_storage = true;
     net.opt.use_int8_arithmetic = false;
 
-    net.set_vulkan_device(gpuid);
+    net.set_vulkan_device(vkdev);
 
     srmd_preproc = 0;
     srmd_postproc = 0;
@@ -60,6 +100,17 @@ SRMD::SRMD(int gpuid, bool _tta_mode)
     bicubic_3x = 0;
     bicubic_4x = 0;
     tta_mode = _tta_mode;
+
+#if _WIN32
+    input_bgr = true;
+    output_bgr = true;
+#else
+    input_bgr = false;
+    output_bgr = false;
+#endif
+
+    tile_arenas = new TileArenaPool;
+    tile_kernels = new TilePixels;
 }
 
 SRMD::~SRMD()
@@ -72,6 +123,9 @@ SRMD::~SRMD()
 
     bicubic_2x->destroy_pipeline(net.opt);
     delete bicubic_2x;
+
+    delete tile_arenas;
+    delete tile_kernels;
 }
 
 #if _WIN32
@@ -109,13 +163,14 @@ int SRMD::load(const std::string& parampath, const std::string& modelpath)
 #endif
 
     // initialize preprocess and postprocess pipeline
+    if (vkdev)
     {
         std::vector<ncnn::vk_specialization_type> specializations(1);
-#if _WIN32
-        specializations[0].i = 1;
-#else
-        specializations[0].i = 0;
-#endif
+        specializations[0].i = input_bgr ? 1 : 0;
+
+        // the postprocess may write another order than the preprocess reads
+        std::vector<ncnn::vk_specialization_type> output_specializations(1);
+        output_specializations[0].i = output_bgr ? 1 : 0;
 
         srmd_preproc = new ncnn::Pipeline(net.vulkan_device());
         srmd_preproc->set_optimal_local_size_xyz(32, 32, 3);
@@ -133,11 +188,11 @@ int SRMD::load(const std::string& parampath, const std::string& modelpath)
                 srmd_preproc->create(srmd_preproc_tta_spv_data, sizeof(srmd_preproc_tta_spv_data), specializations);
 
             if (net.opt.use_fp16_storage && net.opt.use_int8_storage)
-                srmd_postproc->create(srmd_postproc_tta_int8s_spv_data, sizeof(srmd_postproc_tta_int8s_spv_data), specializations);
+                srmd_postproc->create(srmd_postproc_tta_int8s_spv_data, sizeof(srmd_postproc_tta_int8s_spv_data), output_specializations);
             else if (net.opt.use_fp16_storage)
-                srmd_postproc->create(srmd_postproc_tta_fp16s_spv_data, sizeof(srmd_postproc_tta_fp16s_spv_data), specializations);
+                srmd_postproc->create(srmd_postproc_tta_fp16s_spv_data, sizeof(srmd_postproc_tta_fp16s_spv_data), output_specializations);
             else
-                srmd_postproc->create(srmd_postproc_tta_spv_data, sizeof(srmd_postproc_tta_spv_data), specializations);
+                srmd_postproc->create(srmd_postproc_tta_spv_data, sizeof(srmd_postproc_tta_spv_data), output_specializations);
         }
         else
         {
@@ -149,18 +204,18 @@ int SRMD::load(const std::string& parampath, const std::string& modelpath)
                 srmd_preproc->create(srmd_preproc_spv_data, sizeof(srmd_preproc_spv_data), specializations);
 
             if (net.opt.use_fp16_storage && net.opt.use_int8_storage)
-                srmd_postproc->create(srmd_postproc_int8s_spv_data, sizeof(srmd_postproc_int8s_spv_data), specializations);
+                srmd_postproc->create(srmd_postproc_int8s_spv_data, sizeof(srmd_postproc_int8s_spv_data), output_specializations);
             else if (net.opt.use_fp16_storage)
-                srmd_postproc->create(srmd_postproc_fp16s_spv_data, sizeof(srmd_postproc_fp16s_spv_data), specializations);
+                srmd_postproc->create(srmd_postproc_fp16s_spv_data, sizeof(srmd_postproc_fp16s_spv_data), output_specializations);
             else
-                srmd_postproc->create(srmd_postproc_spv_data, sizeof(srmd_postproc_spv_data), specializations);
+                srmd_postproc->create(srmd_postproc_spv_data, sizeof(srmd_postproc_spv_data), output_specializations);
         }
     }
 
     // bicubic 2x/3x/4x for alpha channel
     {
         bicubic_2x = ncnn::create_layer("Interp");
-        bicubic_2x->vkdev = net.vulkan_device();
+        bicubic_2x->vkdev = vkdev;
 
         ncnn::ParamDict pd;
         pd.set(0, 3);// bicubic
@@ -172,7 +227,7 @@ int SRMD::load(const std::string& parampath, const std::string& modelpath)
     }
     {
         bicubic_3x = ncnn::create_layer("Interp");
-        bicubic_3x->vkdev = net.vulkan_device();
+        bicubic_3x->vkdev = vkdev;
 
         ncnn::ParamDict pd;
         pd.set(0, 3);// bicubic
@@ -184,7 +239,7 @@ int SRMD::load(const std::string& parampath, const std::string& modelpath)
     }
     {
         bicubic_4x = ncnn::create_layer("Interp");
-        bicubic_4x->vkdev = net.vulkan_device();
+        bicubic_4x->vkdev = vkdev;
 
         ncnn::ParamDict pd;
         pd.set(0, 3);// bicubic
@@ -200,13 +255,20 @@ int SRMD::load(const std::string& parampath, const std::string& modelpath)
 
 int SRMD::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
 {
+    if (!vkdev)
+    {
+        // cpu only
+        return process_cpu(inimage, outimage);
+    }
+
     const unsigned char* pixeldata = (const unsigned char*)inimage.data;
     const int w = inimage.w;
     const int h = inimage.h;
     const int channels = inimage.elempack;
 
-    const int TILE_SIZE_X = tilesize;
-    const int TILE_SIZE_Y = tilesize;
+    const TilePlan plan = tile_plan(w, h, tilesize, prepadding);
+    const int TILE_SIZE_X = plan.tile_w;
+    const int TILE_SIZE_Y = plan.tile_h;
 
     ncnn::VkAllocator* blob_vkallocator = net.vulkan_device()->acquire_blob_allocator();
     ncnn::VkAllocator* staging_vkallocator = net.vulkan_device()->acquire_staging_allocator();
@@ -239,19 +301,11 @@ int SRMD::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
         {
             if (channels == 3)
             {
-#if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGR2RGB, w, (in_tile_y1 - in_tile_y0));
-#else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
-#endif
+                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, input_bgr ? ncnn::Mat::PIXEL_BGR2RGB : ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
             }
             if (channels == 4)
             {
-#if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGRA2RGBA, w, (in_tile_y1 - in_tile_y0));
-#else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
-#endif
+                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, input_bgr ? ncnn::Mat::PIXEL_BGRA2RGBA : ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
             }
         }
 
@@ -559,19 +613,11 @@ int SRMD::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
             {
                 if (channels == 3)
                 {
-#if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGB2BGR);
-#else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGB);
-#endif
+                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, output_bgr ? ncnn::Mat::PIXEL_RGB2BGR : ncnn::Mat::PIXEL_RGB);
                 }
                 if (channels == 4)
                 {
-#if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGBA2BGRA);
-#else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGBA);
-#endif
+                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, output_bgr ? ncnn::Mat::PIXEL_RGBA2BGRA : ncnn::Mat::PIXEL_RGBA);
                 }
             }
         }
@@ -582,3 +628,182 @@ int SRMD::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
 
     return 0;
 }
+
+int SRMD::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
+{
+    const unsigned char* pixeldata = (const unsigned char*)inimage.data;
+    const int w = inimage.w;
+    const int h = inimage.h;
+    const int channels = inimage.elempack;
+
+    const TilePlan plan = tile_plan(w, h, tilesize, prepadding);
+    const int TILE_SIZE_X = plan.tile_w;
+    const int TILE_SIZE_Y = plan.tile_h;
+
+    ncnn::Option opt = net.opt;
+
+    TileArena* arena = tile_arenas->acquire();
+    arena->set_option(opt);
+
+    // input tiles per tta direction, one per tile shape
+    std::vector<ncnn::Mat> in_tile_cache[8];
+
+    // each tile 400x400
+    const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
+    const int ytiles = (h + TILE_SIZE_Y - 1) / TILE_SIZE_Y;
+
+    for (int yi = 0; yi < ytiles; yi++)
+    {
+        const int tile_h_nopad = std::min((yi + 1) * TILE_SIZE_Y, h) - yi * TILE_SIZE_Y;
+
+        int in_tile_y0 = std::max(yi * TILE_SIZE_Y - prepadding, 0);
+        int in_tile_y1 = std::min((yi + 1) * TILE_SIZE_Y + prepadding, h);
+
+        // the border is replicated out to the full prepadding, like the gpu preproc
+        int pad_top = in_tile_y0 - (yi * TILE_SIZE_Y - prepadding);
+        int pad_bottom = std::min((yi + 1) * TILE_SIZE_Y, h) + prepadding - in_tile_y1;
+
+        for (int xi = 0; xi < xtiles; xi++)
+        {
+            const int tile_w_nopad = std::min((xi + 1) * TILE_SIZE_X, w) - xi * TILE_SIZE_X;
+
+            int in_tile_x0 = std::max(xi * TILE_SIZE_X - prepadding, 0);
+            int in_tile_x1 = std::min((xi + 1) * TILE_SIZE_X + prepadding, w);
+
+            int pad_left = in_tile_x0 - (xi * TILE_SIZE_X - prepadding);
+            int pad_right = std::min((xi + 1) * TILE_SIZE_X, w) + prepadding - in_tile_x1;
+
+            const int in_tile_w = tile_w_nopad + prepadding * 2;
+            const int in_tile_h = tile_h_nopad + prepadding * 2;
+
+            unsigned char* outpixels = (unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels;
+
+            if (tta_mode)
+            {
+                // crop, preproc and border padding
+                ncnn::Mat in_tile[8];
+                ncnn::Mat in_alpha_tile;
+                {
+                    for (int ti = 0; ti < 8; ti++)
+                    {
+                        in_tile[ti] = srmd_input_tile(in_tile_cache[ti], ti < 4 ? in_tile_w : in_tile_h, ti < 4 ? in_tile_h : in_tile_w, noise, opt.blob_allocator);
+                    }
+
+                    tile_from_pixels(pixeldata, w, channels, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0, pad_top, pad_bottom, pad_left, pad_right, ncnn::BORDER_REPLICATE, *tile_kernels, in_tile[0], opt.blob_allocator, input_bgr);
+
+                    if (channels == 4)
+                    {
+                        tile_alpha_from_pixels(pixeldata, w, xi * TILE_SIZE_X, yi * TILE_SIZE_Y, tile_w_nopad, tile_h_nopad, in_alpha_tile, opt.blob_allocator);
+                    }
+                }
+
+                // the other 7 directions, the constant planes are the same in all of them
+                tta_transform(in_tile, opt.blob_allocator);
+
+                // srmd
+                ncnn::Mat out_tile[8];
+                for (int ti = 0; ti < 8; ti++)
+                {
+                    ncnn::Extractor ex = net.create_extractor();
+
+                    arena->set_extractor(ex);
+
+                    ex.input("input", in_tile[ti]);
+
+                    ex.extract("output", out_tile[ti]);
+                }
+
+                ncnn::Mat out_alpha_tile;
+                if (channels == 4)
+                {
+                    if (scale == 1)
+                    {
+                        out_alpha_tile = in_alpha_tile;
+                    }
+                    if (scale == 2)
+                    {
+                        bicubic_2x->forward(in_alpha_tile, out_alpha_tile, opt);
+                    }
+                    if (scale == 3)
+                    {
+                        bicubic_3x->forward(in_alpha_tile, out_alpha_tile, opt);
+                    }
+                    if (scale == 4)
+                    {
+                        bicubic_4x->forward(in_alpha_tile, out_alpha_tile, opt);
+                    }
+                }
+
+                // postproc and merge alpha
+                {
+                    ncnn::Mat out;
+                    tta_merge(out_tile, prepadding * scale, prepadding * scale, tile_w_nopad * scale, tile_h_nopad * scale, out, opt.blob_allocator);
+
+                    tile_to_pixels(out, 0, 0, out.w, out.h, out_alpha_tile, *tile_kernels, outpixels, w * scale * channels, channels, output_bgr);
+                }
+            }
+            else
+            {
+                // crop, preproc and border padding
+                ncnn::Mat in_tile;
+                ncnn::Mat in_alpha_tile;
+                {
+                    in_tile = srmd_input_tile(in_tile_cache[0], in_tile_w, in_tile_h, noise, opt.blob_allocator);
+
+                    tile_from_pixels(pixeldata, w, channels, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0, pad_top, pad_bottom, pad_left, pad_right, ncnn::BORDER_REPLICATE, *tile_kernels, in_tile, opt.blob_allocator, input_bgr);
+
+                    if (channels == 4)
+                    {
+                        tile_alpha_from_pixels(pixeldata, w, xi * TILE_SIZE_X, yi * TILE_SIZE_Y, tile_w_nopad, tile_h_nopad, in_alpha_tile, opt.blob_allocator);
+                    }
+                }
+
+                // srmd
+                ncnn::Mat out_tile;
+                {
+                    ncnn::Extractor ex = net.create_extractor();
+
+                    arena->set_extractor(ex);
+
+                    ex.input("input", in_tile);
+
+                    ex.extract("output", out_tile);
+                }
+
+                ncnn::Mat out_alpha_tile;
+                if (channels == 4)
+                {
+                    if (scale == 1)
+                    {
+                        out_alpha_tile = in_alpha_tile;
+                    }
+                    if (scale == 2)
+                    {
+                        bicubic_2x->forward(in_alpha_tile, out_alpha_tile, opt);
+                    }
+                    if (scale == 3)
+                    {
+                        bicubic_3x->forward(in_alpha_tile, out_alpha_tile, opt);
+                    }
+                    if (scale == 4)
+                    {
+                        bicubic_4x->forward(in_alpha_tile, out_alpha_tile, opt);
+                    }
+                }
+
+                // postproc and merge alpha
+                tile_to_pixels(out_tile, prepadding * scale, prepadding * scale, tile_w_nopad * scale, tile_h_nopad * scale, out_alpha_tile, *tile_kernels, outpixels, w * scale * channels, channels, output_bgr);
+            }
+        }
+    }
+
+    // the cached tiles go back to the arena before another worker can take it
+    for (int ti = 0; ti < 8; ti++)
+    {
+        in_tile_cache[ti].clear();
+    }
+
+    tile_arenas->reclaim(arena);
+
+    return 0;
+}
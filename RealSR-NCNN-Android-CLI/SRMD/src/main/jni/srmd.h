@@ -10,10 +10,12 @@
 #include "gpu.h"
 #include "layer.h"
 
+class TileArenaPool;
+class TilePixels;
 class SRMD
 {
 public:
-    SRMD(int gpuid, bool tta_mode = false);
+    SRMD(int gpuid, bool tta_mode = false, int num_threads = 1);
     ~SRMD();
 
 #if _WIN32
@@ -24,14 +26,21 @@ public:
 
     int process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const;
 
+    int process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const;
+
 public:
     // srmd parameters
     int noise;
     int scale;
     int tilesize;
     int prepadding;
+    // inimage in bgr(a) order, the default on windows where wic decodes to bgr, set before load
+    bool input_bgr;
+    // outimage in bgr(a) order, the same default as input_bgr, set before load
+    bool output_bgr;
 
 private:
+    ncnn::VulkanDevice* vkdev;
     ncnn::Net net;
     ncnn::Pipeline* srmd_preproc;
     ncnn::Pipeline* srmd_postproc;
@@ -39,6 +48,9 @@ private:
     ncnn::Layer* bicubic_3x;
     ncnn::Layer* bicubic_4x;
     bool tta_mode;
+    TileArenaPool* tile_arenas;
+    // pixel row kernels of the cpu path, picked at load
+    TilePixels* tile_kernels;
 };
 
 #endif // SRMD_H
@@ -0,0 +1,127 @@
+// c api of the srmd engine
+
+#define SRMD_C_BUILD
+#include "srmd_c.h"
+
+#include "srmd.h"
+
+#include "engine_c.h"
+
+typedef EngineCInstance<SRMD, srmd_error, srmd_callback> SRMDInstance;
+
+static_assert(SRMD_ERROR_PROCESS == (int)ENGINE_C_ERROR_PROCESS, "srmd_error follows the engine_c.h order");
+
+void SRMD_C_API srmd_default_parameters(srmd_parameters* parameters)
+{
+    if (!parameters)
+        return;
+
+    parameters->gpuid = 0;
+    parameters->tta_mode = 0;
+    parameters->num_threads = 1;
+    parameters->noise = 3;
+    parameters->scale = 2;
+    parameters->tilesize = 0;
+    parameters->prepadding = 12;
+    parameters->input_bgr = 0;
+    parameters->output_bgr = 0;
+}
+
+srmd_instance SRMD_C_API srmd_create(const srmd_parameters* parameters, srmd_error* error)
+{
+    srmd_error dummy;
+    if (!error)
+        error = &dummy;
+
+    if (!parameters)
+    {
+        *error = SRMD_ERROR_NULL_DATA;
+        return 0;
+    }
+
+    if (parameters->gpuid < -1 || parameters->noise < -1 || parameters->noise > 10 || parameters->scale < 2 || parameters->scale > 4
+            || parameters->prepadding < 0 || parameters->num_threads < 1
+            || (parameters->tilesize != 0 && parameters->tilesize < 32))
+    {
+        *error = SRMD_ERROR_INVALID_PARAMETERS;
+        return 0;
+    }
+
+    const bool gpu = parameters->gpuid != -1;
+    if (gpu)
+    {
+        engine_c_gpu_acquire();
+
+        if (parameters->gpuid >= ncnn::get_gpu_count())
+        {
+            engine_c_gpu_release();
+            *error = SRMD_ERROR_INVALID_PARAMETERS;
+            return 0;
+        }
+    }
+
+    int tilesize = parameters->tilesize;
+    if (tilesize == 0)
+    {
+        // the cli policy
+        if (!gpu)
+        {
+            tilesize = 400;
+        }
+        else
+        {
+            uint32_t heap_budget = ncnn::get_gpu_device(parameters->gpuid)->get_heap_budget();
+            if (heap_budget > 2600)
+                tilesize = 400;
+            else if (heap_budget > 740)
+                tilesize = 200;
+            else if (heap_budget > 250)
+                tilesize = 100;
+            else
+                tilesize = 32;
+        }
+    }
+
+    SRMDInstance* instance = new SRMDInstance(new SRMD(parameters->gpuid, parameters->tta_mode != 0, gpu ? 1 : parameters->num_threads), gpu);
+
+    SRMD* srmd = instance->engine;
+    srmd->input_bgr = parameters->input_bgr != 0;
+    srmd->output_bgr = parameters->output_bgr != 0;
+    srmd->noise = parameters->noise;
+    srmd->scale = parameters->scale;
+    srmd->tilesize = tilesize;
+    srmd->prepadding = parameters->prepadding;
+
+    *error = SRMD_OK;
+    return instance;
+}
+
+void SRMD_C_API srmd_destroy(srmd_instance instance)
+{
+    engine_c_destroy((SRMDInstance*)instance);
+}
+
+srmd_error SRMD_C_API srmd_load(srmd_instance instance, const char* parampath, const char* modelpath)
+{
+    return (srmd_error)engine_c_load((SRMDInstance*)instance, parampath, modelpath);
+}
+
+srmd_error SRMD_C_API srmd_process(srmd_instance instance,
+    const unsigned char* src, int w, int h, int channels, size_t src_stride,
+    unsigned char* dst, size_t dst_stride)
+{
+    return (srmd_error)engine_c_process((const SRMDInstance*)instance, src, w, h, channels, src_stride, dst, dst_stride);
+}
+
+srmd_error SRMD_C_API srmd_submit(srmd_instance instance,
+    const unsigned char* src, int w, int h, int channels, size_t src_stride,
+    unsigned char* dst, size_t dst_stride,
+    srmd_callback callback, void* userdata)
+{
+    return (srmd_error)engine_c_submit((SRMDInstance*)instance, src, w, h, channels, src_stride, dst, dst_stride, callback, userdata);
+}
+
+void SRMD_C_API srmd_wait(srmd_instance instance)
+{
+    engine_c_wait((SRMDInstance*)instance);
+}
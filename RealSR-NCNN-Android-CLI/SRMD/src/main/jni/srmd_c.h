@@ -0,0 +1,90 @@
+// c api of the srmd engine, for host apps that keep models loaded and hand over pixels directly
+
+#ifndef SRMD_C_H
+#define SRMD_C_H
+
+#include <stddef.h>
+
+#ifdef _WIN32
+#ifdef SRMD_C_BUILD
+#define SRMD_C_EXPORT __declspec(dllexport)
+#else
+#define SRMD_C_EXPORT __declspec(dllimport)
+#endif
+#define SRMD_C_API __stdcall
+#else
+#define SRMD_C_EXPORT __attribute__((visibility("default")))
+#define SRMD_C_API
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+    typedef enum srmd_error
+    {
+        SRMD_OK = 0,
+        SRMD_ERROR_NULL_INSTANCE,
+        SRMD_ERROR_NULL_DATA,
+        SRMD_ERROR_INVALID_PARAMETERS,
+        SRMD_ERROR_LOAD_MODEL,
+        SRMD_ERROR_NOT_LOADED,
+        SRMD_ERROR_PROCESS
+    } srmd_error;
+
+    typedef struct srmd_parameters
+    {
+        // -1 for cpu
+        int gpuid;
+        int tta_mode;
+        // cpu threads, ignored on gpu
+        int num_threads;
+        // -1 to 10, the noise level the model is run with
+        int noise;
+        // 2, 3 or 4, the x of the srmd_xN.param and srmd_xN.bin in use
+        int scale;
+        // >= 32, or 0 to keep the engine default
+        int tilesize;
+        int prepadding;
+        // src in bgr(a) order, rgb(a) otherwise
+        int input_bgr;
+        // dst in bgr(a) order, rgb(a) otherwise
+        int output_bgr;
+    } srmd_parameters;
+
+    typedef void* srmd_instance;
+
+    // runs on the worker thread of the instance once a submitted job is done
+    typedef void (*srmd_callback)(void* userdata, srmd_error error);
+
+    SRMD_C_EXPORT void SRMD_C_API srmd_default_parameters(srmd_parameters* parameters);
+
+    // the vulkan instance is created with the first instance and destroyed with the last
+    SRMD_C_EXPORT srmd_instance SRMD_C_API srmd_create(const srmd_parameters* parameters, srmd_error* error);
+    SRMD_C_EXPORT void SRMD_C_API srmd_destroy(srmd_instance instance);
+
+    // utf-8 paths
+    SRMD_C_EXPORT srmd_error SRMD_C_API srmd_load(srmd_instance instance, const char* parampath, const char* modelpath);
+
+    // src is w x h with channels 3 or 4, in the order of input_bgr
+    // dst is w * scale x h * scale with the same channels, both owned by the caller
+    // a stride of 0 means packed rows, packed rows are used in place and others are repacked
+    SRMD_C_EXPORT srmd_error SRMD_C_API srmd_process(srmd_instance instance,
+        const unsigned char* src, int w, int h, int channels, size_t src_stride,
+        unsigned char* dst, size_t dst_stride);
+
+    // queues the same work and returns, src and dst must stay valid until callback
+    SRMD_C_EXPORT srmd_error SRMD_C_API srmd_submit(srmd_instance instance,
+        const unsigned char* src, int w, int h, int channels, size_t src_stride,
+        unsigned char* dst, size_t dst_stride,
+        srmd_callback callback, void* userdata);
+
+    // blocks until every submitted job has called back
+    SRMD_C_EXPORT void SRMD_C_API srmd_wait(srmd_instance instance);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // SRMD_C_H
@@ -0,0 +1,239 @@
+// chained 2x passes for the larger scales, each pass pulls tile rows from the one before
+// so no intermediate image is held whole
+
+#ifndef TILE_CHAIN_H
+#define TILE_CHAIN_H
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+// ncnn
+#include "mat.h"
+
+#include "tile_stripe.h"
+
+template<class T>
+class TileChainPass
+{
+public:
+    // the first pass reads the image, the others the pass before
+    TileChainPass(const T* _engine, StripeReader* _reader, TileChainPass<T>* _upstream)
+        : engine(_engine), reader(_reader), upstream(_upstream)
+    {
+        inw = reader ? reader->w : upstream->w;
+        inh = reader ? reader->h : upstream->h;
+        c = reader ? reader->c : upstream->c;
+        scale = engine->scale;
+        prepadding = engine->prepadding;
+        w = inw * scale;
+        h = inh * scale;
+
+        // the same windows as stripe_process, each pass sizes its own from its width
+        window_rows = stripe_window_rows(engine->tilesize, prepadding, inw, inh, c, scale);
+
+        instride = (size_t)inw * c;
+        outstride = (size_t)w * c;
+
+        inrows.resize(window_rows * instride);
+        outrows.resize(window_rows * scale * outstride);
+
+        wy0 = 0;
+        wrows = 0;
+        y0 = 0;
+        out_y = 0;
+        out_y1 = 0;
+    }
+
+    // next count output rows, packed like the input
+    int read_rows(unsigned char* dst, int count)
+    {
+        while (count > 0)
+        {
+            if (out_y == out_y1 && next_stripe() != 0)
+                return -1;
+
+            const int n = std::min(count, out_y1 - out_y);
+            memcpy(dst, outrows.data() + (out_y - wy0 * scale) * outstride, n * outstride);
+
+            dst += n * outstride;
+            out_y += n;
+            count -= n;
+        }
+
+        return 0;
+    }
+
+    // output rows produced by one window
+    int stripe_rows() const
+    {
+        return window_rows * scale;
+    }
+
+public:
+    int w;
+    int h;
+    int c;
+
+private:
+    int next_stripe()
+    {
+        if (y0 >= inh)
+            return -1;
+
+        // drop the rows above the context of this stripe
+        const int drop = std::max(y0 - prepadding, 0) - wy0;
+        if (drop > 0)
+        {
+            memmove(inrows.data(), inrows.data() + drop * instride, (wrows - drop) * instride);
+            wy0 += drop;
+            wrows -= drop;
+        }
+
+        const int wy1 = std::min(wy0 + window_rows, inh);
+        const int count = wy1 - wy0 - wrows;
+        if (count > 0)
+        {
+            int ret = reader ? reader->read_rows(inrows.data() + wrows * instride, count) : upstream->read_rows(inrows.data() + wrows * instride, count);
+            if (ret != 0)
+                return -1;
+        }
+        wrows = wy1 - wy0;
+
+        const int y1 = wy1 == inh ? inh : wy1 - prepadding;
+
+        ncnn::Mat inimage(inw, wrows, (void*)inrows.data(), (size_t)c, c);
+        ncnn::Mat outimage(w, wrows * scale, (void*)outrows.data(), (size_t)c, c);
+
+        if (engine->process(inimage, outimage) != 0)
+            return -1;
+
+        out_y = y0 * scale;
+        out_y1 = y1 * scale;
+        y0 = y1;
+
+        return 0;
+    }
+
+private:
+    const T* engine;
+    StripeReader* reader;
+    TileChainPass<T>* upstream;
+
+    int inw;
+    int inh;
+    int scale;
+    int prepadding;
+    int window_rows;
+    size_t instride;
+    size_t outstride;
+
+    std::vector<unsigned char> inrows;
+    std::vector<unsigned char> outrows;
+
+    // input window [wy0, wy0 + wrows), next core row y0, ready output rows [out_y, out_y1)
+    int wy0;
+    int wrows;
+    int y0;
+    int out_y;
+    int out_y1;
+};
+
+template<class T>
+class TileChain
+{
+public:
+    TileChain(const T* engine, int pass_count, StripeReader& reader)
+    {
+        for (int i = 0; i < pass_count; i++)
+        {
+            passes.push_back(new TileChainPass<T>(engine, i == 0 ? &reader : 0, i == 0 ? 0 : passes.back()));
+        }
+
+        w = passes.back()->w;
+        h = passes.back()->h;
+        c = passes.back()->c;
+    }
+
+    ~TileChain()
+    {
+        for (size_t i = 0; i < passes.size(); i++)
+        {
+            delete passes[i];
+        }
+    }
+
+    int read_rows(unsigned char* dst, int count)
+    {
+        return passes.back()->read_rows(dst, count);
+    }
+
+    int stripe_rows() const
+    {
+        return passes.back()->stripe_rows();
+    }
+
+public:
+    int w;
+    int h;
+    int c;
+
+private:
+    std::vector<TileChainPass<T>*> passes;
+};
+
+// outimage is allocated by the caller at the final size
+template<class T>
+static int tile_chain_process(const T* engine, int pass_count, const ncnn::Mat& inimage, ncnn::Mat& outimage, tile_progress_callback progress = 0, void* userdata = 0)
+{
+    StripeReader reader;
+    reader.open_memory((const unsigned char*)inimage.data, inimage.w, inimage.h, inimage.elempack);
+
+    TileChain<T> chain(engine, pass_count, reader);
+
+    const size_t stride = (size_t)chain.w * chain.c;
+    const int rows = chain.stripe_rows();
+
+    for (int y = 0; y < chain.h; y += rows)
+    {
+        const int count = std::min(rows, chain.h - y);
+        if (chain.read_rows((unsigned char*)outimage.data + y * stride, count) != 0)
+            return -1;
+
+        if (progress)
+            progress(userdata, (float)(y + count) / chain.h);
+    }
+
+    return 0;
+}
+
+// the -l mode, the last pass streams into the encoder as well
+template<class T>
+static int tile_chain_stripes(const T* engine, int pass_count, StripeReader& reader, StripeWriter& writer, tile_progress_callback progress = 0, void* userdata = 0)
+{
+    TileChain<T> chain(engine, pass_count, reader);
+
+    const size_t stride = (size_t)chain.w * chain.c;
+    const int rows = chain.stripe_rows();
+    std::vector<unsigned char> buffer(rows * stride);
+
+    for (int y = 0; y < chain.h; y += rows)
+    {
+        const int count = std::min(rows, chain.h - y);
+        if (chain.read_rows(buffer.data(), count) != 0)
+            return -1;
+
+        if (writer.write_rows(buffer.data(), count) != 0)
+        {
+            fprintf(stderr, "stripe encode failed at row %d\n", y);
+            return -1;
+        }
+
+        if (progress)
+            progress(userdata, (float)(y + count) / chain.h);
+    }
+
+    return 0;
+}
+
+#endif // TILE_CHAIN_H
@@ -1,6 +1,11 @@
 // waifu2x implemented with ncnn library
 
 #include "waifu2x.h"
+#include "tile_arena.h"
+#include "spirv_cache.h"
+#include "tile_pixels.h"
+#include "tile_plan.h"
+#include "tile_tta.h"
 
 #include <algorithm>
 #include <vector>
@@ -20,6 +25,20 @@ Waifu2x::Waifu2x(int gpuid, bool _tta_mode, int num_threads)
     waifu2x_postproc = 0;
     bicubic_2x = 0;
     tta_mode = _tta_mode;
+
+#if _WIN32
+    input_bgr = true;
+    output_bgr = true;
+#else
+    input_bgr = false;
+    output_bgr = false;
+#endif
+
+    progress_callback = 0;
+    progress_userdata = 0;
+
+    tile_arenas = new TileArenaPool;
+    tile_kernels = new TilePixels;
 }
 
 Waifu2x::~Waifu2x()
@@ -32,6 +51,9 @@ Waifu2x::~Waifu2x()
 
     bicubic_2x->destroy_pipeline(net.opt);
     delete bicubic_2x;
+
+    delete tile_arenas;
+    delete tile_kernels;
 }
 
 #if _WIN32
@@ -80,11 +102,11 @@ int Waifu2x::load(const std::string& parampath, const std::string& modelpath)
     if (vkdev)
     {
         std::vector<ncnn::vk_specialization_type> specializations(1);
-#if _WIN32
-        specializations[0].i = 1;
-#else
-        specializations[0].i = 0;
-#endif
+        specializations[0].i = input_bgr ? 1 : 0;
+
+        // the postprocess may write another order than the preprocess reads
+        std::vector<ncnn::vk_specialization_type> output_specializations(1);
+        output_specializations[0].i = output_bgr ? 1 : 0;
 
         {
             static std::vector<uint32_t> spirv;
@@ -94,9 +116,9 @@ int Waifu2x::load(const std::string& parampath, const std::string& modelpath)
                 if (spirv.empty())
                 {
                     if (tta_mode)
-                        compile_spirv_module(waifu2x_preproc_tta_comp_data, sizeof(waifu2x_preproc_tta_comp_data), net.opt, spirv);
+                        compile_spirv_module_cached(waifu2x_preproc_tta_comp_data, sizeof(waifu2x_preproc_tta_comp_data), net.opt, vkdev, spirv);
                     else
-                        compile_spirv_module(waifu2x_preproc_comp_data, sizeof(waifu2x_preproc_comp_data), net.opt, spirv);
+                        compile_spirv_module_cached(waifu2x_preproc_comp_data, sizeof(waifu2x_preproc_comp_data), net.opt, vkdev, spirv);
                 }
             }
 
@@ -113,15 +135,15 @@ int Waifu2x::load(const std::string& parampath, const std::string& modelpath)
                 if (spirv.empty())
                 {
                     if (tta_mode)
-                        compile_spirv_module(waifu2x_postproc_tta_comp_data, sizeof(waifu2x_postproc_tta_comp_data), net.opt, spirv);
+                        compile_spirv_module_cached(waifu2x_postproc_tta_comp_data, sizeof(waifu2x_postproc_tta_comp_data), net.opt, vkdev, spirv);
                     else
-                        compile_spirv_module(waifu2x_postproc_comp_data, sizeof(waifu2x_postproc_comp_data), net.opt, spirv);
+                        compile_spirv_module_cached(waifu2x_postproc_comp_data, sizeof(waifu2x_postproc_comp_data), net.opt, vkdev, spirv);
                 }
             }
 
             waifu2x_postproc = new ncnn::Pipeline(vkdev);
             waifu2x_postproc->set_optimal_local_size_xyz(8, 8, 3);
-            waifu2x_postproc->create(spirv.data(), spirv.size() * 4, specializations);
+            waifu2x_postproc->create(spirv.data(), spirv.size() * 4, output_specializations);
         }
     }
 
@@ -161,8 +183,9 @@ int Waifu2x::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
     const int h = inimage.h;
     const int channels = inimage.elempack;
 
-    const int TILE_SIZE_X = tilesize;
-    const int TILE_SIZE_Y = tilesize;
+    const TilePlan plan = tile_plan(w, h, tilesize, prepadding);
+    const int TILE_SIZE_X = plan.tile_w;
+    const int TILE_SIZE_Y = plan.tile_h;
 
     ncnn::VkAllocator* blob_vkallocator = vkdev->acquire_blob_allocator();
     ncnn::VkAllocator* staging_vkallocator = vkdev->acquire_staging_allocator();
@@ -205,19 +228,11 @@ int Waifu2x::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
         {
             if (channels == 3)
             {
-#if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGR2RGB, w, (in_tile_y1 - in_tile_y0));
-#else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
-#endif
+                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, input_bgr ? ncnn::Mat::PIXEL_BGR2RGB : ncnn::Mat::PIXEL_RGB, w, (in_tile_y1 - in_tile_y0));
             }
             if (channels == 4)
             {
-#if _WIN32
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_BGRA2RGBA, w, (in_tile_y1 - in_tile_y0));
-#else
-                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
-#endif
+                in = ncnn::Mat::from_pixels(pixeldata + in_tile_y0 * w * channels, input_bgr ? ncnn::Mat::PIXEL_BGRA2RGBA : ncnn::Mat::PIXEL_RGBA, w, (in_tile_y1 - in_tile_y0));
             }
         }
 
@@ -513,22 +528,17 @@ int Waifu2x::process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
             {
                 if (channels == 3)
                 {
-#if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGB2BGR);
-#else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGB);
-#endif
+                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, output_bgr ? ncnn::Mat::PIXEL_RGB2BGR : ncnn::Mat::PIXEL_RGB);
                 }
                 if (channels == 4)
                 {
-#if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGBA2BGRA);
-#else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, ncnn::Mat::PIXEL_RGBA);
-#endif
+                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels, output_bgr ? ncnn::Mat::PIXEL_RGBA2BGRA : ncnn::Mat::PIXEL_RGBA);
                 }
             }
         }
+
+        if (progress_callback)
+            progress_callback(progress_userdata, (float)(yi + 1) / ytiles);
     }
 
     vkdev->reclaim_blob_allocator(blob_vkallocator);
@@ -550,11 +560,15 @@ int Waifu2x::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
     const int h = inimage.h;
     const int channels = inimage.elempack;
 
-    const int TILE_SIZE_X = tilesize;
-    const int TILE_SIZE_Y = tilesize;
+    const TilePlan plan = tile_plan(w, h, tilesize, prepadding);
+    const int TILE_SIZE_X = plan.tile_w;
+    const int TILE_SIZE_Y = plan.tile_h;
 
     ncnn::Option opt = net.opt;
 
+    TileArena* arena = tile_arenas->acquire();
+    arena->set_option(opt);
+
     // each tile 400x400
     const int xtiles = (w + TILE_SIZE_X - 1) / TILE_SIZE_X;
     const int ytiles = (h + TILE_SIZE_Y - 1) / TILE_SIZE_Y;
@@ -593,122 +607,29 @@ int Waifu2x::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
             int in_tile_x0 = std::max(xi * TILE_SIZE_X - prepadding, 0);
             int in_tile_x1 = std::min((xi + 1) * TILE_SIZE_X + prepadding_right, w);
 
-            // crop tile
-            ncnn::Mat in;
-            {
-                if (channels == 3)
-                {
-#if _WIN32
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_BGR2RGB, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#else
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_RGB, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#endif
-                }
-                if (channels == 4)
-                {
-#if _WIN32
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_BGRA2RGBA, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#else
-                    in = ncnn::Mat::from_pixels_roi(pixeldata, ncnn::Mat::PIXEL_RGBA, w, h, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0);
-#endif
-                }
-            }
+            unsigned char* outpixels = (unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels;
 
-            ncnn::Mat out;
+            int pad_top = std::max(prepadding - yi * TILE_SIZE_Y, 0);
+            int pad_bottom = std::max(std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom - h, prepadding_bottom), 0);
+            int pad_left = std::max(prepadding - xi * TILE_SIZE_X, 0);
+            int pad_right = std::max(std::min((xi + 1) * TILE_SIZE_X + prepadding_right - w, prepadding_right), 0);
 
             if (tta_mode)
             {
-                // split alpha and preproc
+                // crop, preproc and border padding
                 ncnn::Mat in_tile[8];
-                ncnn::Mat in_alpha_tile, in_alpah_tile_nocrop;
+                ncnn::Mat in_alpha_tile;
                 {
-                    in_tile[0].create(in.w, in.h, 3);
-                    for (int q = 0; q < 3; q++)
-                    {
-                        const float* ptr = in.channel(q);
-                        float* outptr0 = in_tile[0].channel(q);
-
-                        for (int i = 0; i < in.h; i++)
-                        {
-                            for (int j = 0; j < in.w; j++)
-                            {
-                                *outptr0++ = *ptr++ * (1 / 255.f);
-                            }
-                        }
-                    }
+                    tile_from_pixels(pixeldata, w, channels, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0, pad_top, pad_bottom, pad_left, pad_right, ncnn::BORDER_REPLICATE, *tile_kernels, in_tile[0], opt.blob_allocator, input_bgr);
 
                     if (channels == 4)
                     {
-                        in_alpah_tile_nocrop = in.channel_range(3, 1).clone();
-                        int crop_top=(yi*TILE_SIZE_Y-in_tile_y0);
-                        int crop_bottom=in_tile_y1-std::min(yi*TILE_SIZE_Y+TILE_SIZE_Y ,h);
-                        int crop_left=(xi*TILE_SIZE_X-in_tile_x0);
-                        int crop_right=in_tile_x1-std::min(xi*TILE_SIZE_X+TILE_SIZE_X ,w);
-                        ncnn::copy_cut_border(in_alpah_tile_nocrop, in_alpha_tile, crop_top, crop_bottom, crop_left, crop_right);
-
+                        tile_alpha_from_pixels(pixeldata, w, xi * TILE_SIZE_X, yi * TILE_SIZE_Y, tile_w_nopad, tile_h_nopad, in_alpha_tile, opt.blob_allocator);
                     }
                 }
 
-                // border padding
-                {
-                    int pad_top = std::max(prepadding - yi * TILE_SIZE_Y, 0);
-                    int pad_bottom = std::max(std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom - h, prepadding_bottom), 0);
-                    int pad_left = std::max(prepadding - xi * TILE_SIZE_X, 0);
-                    int pad_right = std::max(std::min((xi + 1) * TILE_SIZE_X + prepadding_right - w, prepadding_right), 0);
-
-                    ncnn::Mat in_tile_padded;
-                    ncnn::copy_make_border(in_tile[0], in_tile_padded, pad_top, pad_bottom, pad_left, pad_right, ncnn::BORDER_REPLICATE, 0.f, net.opt);
-                    in_tile[0] = in_tile_padded;
-                }
-
                 // the other 7 directions
-                {
-                    in_tile[1].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[2].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[3].create(in_tile[0].w, in_tile[0].h, 3);
-                    in_tile[4].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[5].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[6].create(in_tile[0].h, in_tile[0].w, 3);
-                    in_tile[7].create(in_tile[0].h, in_tile[0].w, 3);
-
-                    for (int q = 0; q < 3; q++)
-                    {
-                        const ncnn::Mat in_tile_0 = in_tile[0].channel(q);
-                        ncnn::Mat in_tile_1 = in_tile[1].channel(q);
-                        ncnn::Mat in_tile_2 = in_tile[2].channel(q);
-                        ncnn::Mat in_tile_3 = in_tile[3].channel(q);
-                        ncnn::Mat in_tile_4 = in_tile[4].channel(q);
-                        ncnn::Mat in_tile_5 = in_tile[5].channel(q);
-                        ncnn::Mat in_tile_6 = in_tile[6].channel(q);
-                        ncnn::Mat in_tile_7 = in_tile[7].channel(q);
-
-                        for (int i = 0; i < in_tile[0].h; i++)
-                        {
-                            const float* outptr0 = in_tile_0.row(i);
-                            float* outptr1 = in_tile_1.row(in_tile[0].h - 1 - i);
-                            float* outptr2 = in_tile_2.row(i) + in_tile[0].w - 1;
-                            float* outptr3 = in_tile_3.row(in_tile[0].h - 1 - i) + in_tile[0].w - 1;
-
-                            for (int j = 0; j < in_tile[0].w; j++)
-                            {
-                                float* outptr4 = in_tile_4.row(j) + i;
-                                float* outptr5 = in_tile_5.row(in_tile[0].w - 1 - j) + i;
-                                float* outptr6 = in_tile_6.row(j) + in_tile[0].h - 1 - i;
-                                float* outptr7 = in_tile_7.row(in_tile[0].w - 1 - j) + in_tile[0].h - 1 - i;
-
-                                float v = *outptr0++;
-
-                                *outptr1++ = v;
-                                *outptr2-- = v;
-                                *outptr3-- = v;
-                                *outptr4 = v;
-                                *outptr5 = v;
-                                *outptr6 = v;
-                                *outptr7 = v;
-                            }
-                        }
-                    }
-                }
+                tta_transform(in_tile, opt.blob_allocator);
 
                 // waifu2x
                 ncnn::Mat out_tile[8];
@@ -716,6 +637,8 @@ int Waifu2x::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                 {
                     ncnn::Extractor ex = net.create_extractor();
 
+                    arena->set_extractor(ex);
+
                     ex.input("Input1", in_tile[ti]);
 
                     ex.extract("Eltwise4", out_tile[ti]);
@@ -736,93 +659,33 @@ int Waifu2x::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
 
                 // postproc and merge alpha
                 {
-                    out.create(tile_w_nopad * scale, tile_h_nopad * scale, channels);
-                    for (int q = 0; q < 3; q++)
-                    {
-                        const ncnn::Mat out_tile_0 = out_tile[0].channel(q);
-                        const ncnn::Mat out_tile_1 = out_tile[1].channel(q);
-                        const ncnn::Mat out_tile_2 = out_tile[2].channel(q);
-                        const ncnn::Mat out_tile_3 = out_tile[3].channel(q);
-                        const ncnn::Mat out_tile_4 = out_tile[4].channel(q);
-                        const ncnn::Mat out_tile_5 = out_tile[5].channel(q);
-                        const ncnn::Mat out_tile_6 = out_tile[6].channel(q);
-                        const ncnn::Mat out_tile_7 = out_tile[7].channel(q);
-                        float* outptr = out.channel(q);
-
-                        for (int i = 0; i < out.h; i++)
-                        {
-                            const float* ptr0 = out_tile_0.row(i);
-                            const float* ptr1 = out_tile_1.row(out_tile[0].h - 1 - i);
-                            const float* ptr2 = out_tile_2.row(i) + out_tile[0].w - 1;
-                            const float* ptr3 = out_tile_3.row(out_tile[0].h - 1 - i) + out_tile[0].w - 1;
-
-                            for (int j = 0; j < out.w; j++)
-                            {
-                                const float* ptr4 = out_tile_4.row(j) + i;
-                                const float* ptr5 = out_tile_5.row(out_tile[0].w - 1 - j) + i;
-                                const float* ptr6 = out_tile_6.row(j) + out_tile[0].h - 1 - i;
-                                const float* ptr7 = out_tile_7.row(out_tile[0].w - 1 - j) + out_tile[0].h - 1 - i;
-
-                                float v = (*ptr0++ + *ptr1++ + *ptr2-- + *ptr3-- + *ptr4 + *ptr5 + *ptr6 + *ptr7) / 8;
-
-                                *outptr++ = v * 255.f + 0.5f;
-                            }
-                        }
-                    }
+                    ncnn::Mat out;
+                    tta_merge(out_tile, 0, 0, tile_w_nopad * scale, tile_h_nopad * scale, out, opt.blob_allocator);
 
-                    if (channels == 4)
-                    {
-                        memcpy(out.channel_range(3, 1), out_alpha_tile, out_alpha_tile.total() * sizeof(float));
-                    }
+                    tile_to_pixels(out, 0, 0, out.w, out.h, out_alpha_tile, *tile_kernels, outpixels, w * scale * channels, channels, output_bgr);
                 }
             }
             else
             {
-                // split alpha and preproc
+                // crop, preproc and border padding
                 ncnn::Mat in_tile;
-                ncnn::Mat in_alpha_tile, in_alpah_tile_nocrop;
+                ncnn::Mat in_alpha_tile;
                 {
-                    in_tile.create(in.w, in.h, 3);
-                    for (int q = 0; q < 3; q++)
-                    {
-                        const float* ptr = in.channel(q);
-                        float* outptr = in_tile.channel(q);
-
-                        for (int i = 0; i < in.w * in.h; i++)
-                        {
-                            *outptr++ = *ptr++ * (1 / 255.f);
-                        }
-                    }
+                    tile_from_pixels(pixeldata, w, channels, in_tile_x0, in_tile_y0, in_tile_x1 - in_tile_x0, in_tile_y1 - in_tile_y0, pad_top, pad_bottom, pad_left, pad_right, ncnn::BORDER_REPLICATE, *tile_kernels, in_tile, opt.blob_allocator, input_bgr);
 
                     if (channels == 4)
                     {
-                        in_alpah_tile_nocrop = in.channel_range(3, 1).clone();
-                        int crop_top=(yi*TILE_SIZE_Y-in_tile_y0);
-                        int crop_bottom=in_tile_y1-std::min(yi*TILE_SIZE_Y+TILE_SIZE_Y ,h);
-                        int crop_left=(xi*TILE_SIZE_X-in_tile_x0);
-                        int crop_right=in_tile_x1-std::min(xi*TILE_SIZE_X+TILE_SIZE_X ,w);
-                        ncnn::copy_cut_border(in_alpah_tile_nocrop, in_alpha_tile, crop_top, crop_bottom, crop_left, crop_right);
-
+                        tile_alpha_from_pixels(pixeldata, w, xi * TILE_SIZE_X, yi * TILE_SIZE_Y, tile_w_nopad, tile_h_nopad, in_alpha_tile, opt.blob_allocator);
                     }
                 }
 
-                // border padding
-                {
-                    int pad_top = std::max(prepadding - yi * TILE_SIZE_Y, 0);
-                    int pad_bottom = std::max(std::min((yi + 1) * TILE_SIZE_Y + prepadding_bottom - h, prepadding_bottom), 0);
-                    int pad_left = std::max(prepadding - xi * TILE_SIZE_X, 0);
-                    int pad_right = std::max(std::min((xi + 1) * TILE_SIZE_X + prepadding_right - w, prepadding_right), 0);
-
-                    ncnn::Mat in_tile_padded;
-                    ncnn::copy_make_border(in_tile, in_tile_padded, pad_top, pad_bottom, pad_left, pad_right, ncnn::BORDER_REPLICATE, 0.f, net.opt);
-                    in_tile = in_tile_padded;
-                }
-
                 // waifu2x
                 ncnn::Mat out_tile;
                 {
                     ncnn::Extractor ex = net.create_extractor();
 
+                    arena->set_extractor(ex);
+
                     ex.input("Input1", in_tile);
 
                     ex.extract("Eltwise4", out_tile);
@@ -842,50 +705,15 @@ int Waifu2x::process_cpu(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
                 }
 
                 // postproc and merge alpha
-                {
-                    out.create(tile_w_nopad * scale, tile_h_nopad * scale, channels);
-                    for (int q = 0; q < 3; q++)
-                    {
-                        float* outptr = out.channel(q);
-
-                        for (int i = 0; i < out.h; i++)
-                        {
-                            const float* ptr = out_tile.channel(q).row(i);
-
-                            for (int j = 0; j < out.w; j++)
-                            {
-                                *outptr++ = *ptr++ * 255.f + 0.5f;
-                            }
-                        }
-                    }
-
-                    if (channels == 4)
-                    {
-                        memcpy(out.channel_range(3, 1), out_alpha_tile, out_alpha_tile.total() * sizeof(float));
-                    }
-                }
-            }
-
-            {
-                if (channels == 3)
-                {
-#if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGB2BGR, w * scale * channels);
-#else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGB, w * scale * channels);
-#endif
-                }
-                if (channels == 4)
-                {
-#if _WIN32
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGBA2BGRA, w * scale * channels);
-#else
-                    out.to_pixels((unsigned char*)outimage.data + yi * scale * TILE_SIZE_Y * w * scale * channels + xi * scale * TILE_SIZE_X * channels, ncnn::Mat::PIXEL_RGBA, w * scale * channels);
-#endif
-                }
+                tile_to_pixels(out_tile, 0, 0, tile_w_nopad * scale, tile_h_nopad * scale, out_alpha_tile, *tile_kernels, outpixels, w * scale * channels, channels, output_bgr);
             }
         }
+
+        if (progress_callback)
+            progress_callback(progress_userdata, (float)(yi + 1) / ytiles);
     }
 
+    tile_arenas->reclaim(arena);
+
     return 0;
 }
@@ -10,6 +10,10 @@
 #include "gpu.h"
 #include "layer.h"
 
+#include "tile_progress.h"
+
+class TileArenaPool;
+class TilePixels;
 class Waifu2x
 {
 public:
@@ -32,6 +36,13 @@ public:
     int scale;
     int tilesize;
     int prepadding;
+    // inimage in bgr(a) order, the default on windows where wic decodes to bgr, set before load
+    bool input_bgr;
+    // outimage in bgr(a) order, the same default as input_bgr, set before load
+    bool output_bgr;
+    // tile row progress of process, nothing is printed when unset
+    tile_progress_callback progress_callback;
+    void* progress_userdata;
 
 private:
     ncnn::VulkanDevice* vkdev;
@@ -40,6 +51,9 @@ private:
     ncnn::Pipeline* waifu2x_postproc;
     ncnn::Layer* bicubic_2x;
     bool tta_mode;
+    TileArenaPool* tile_arenas;
+    // pixel row kernels of the cpu path, picked at load
+    TilePixels* tile_kernels;
 };
 
 #endif // WAIFU2X_H
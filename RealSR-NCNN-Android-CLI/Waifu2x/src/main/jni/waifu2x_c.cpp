@@ -0,0 +1,127 @@
+// c api of the waifu2x engine
+
+#define WAIFU2X_C_BUILD
+#include "waifu2x_c.h"
+
+#include "waifu2x.h"
+
+#include "engine_c.h"
+
+typedef EngineCInstance<Waifu2x, waifu2x_error, waifu2x_callback> Waifu2xInstance;
+
+static_assert(WAIFU2X_ERROR_PROCESS == (int)ENGINE_C_ERROR_PROCESS, "waifu2x_error follows the engine_c.h order");
+
+void WAIFU2X_C_API waifu2x_default_parameters(waifu2x_parameters* parameters)
+{
+    if (!parameters)
+        return;
+
+    parameters->gpuid = 0;
+    parameters->tta_mode = 0;
+    parameters->num_threads = 1;
+    parameters->noise = 0;
+    parameters->scale = 2;
+    parameters->tilesize = 0;
+    parameters->prepadding = 18;
+    parameters->input_bgr = 0;
+    parameters->output_bgr = 0;
+}
+
+waifu2x_instance WAIFU2X_C_API waifu2x_create(const waifu2x_parameters* parameters, waifu2x_error* error)
+{
+    waifu2x_error dummy;
+    if (!error)
+        error = &dummy;
+
+    if (!parameters)
+    {
+        *error = WAIFU2X_ERROR_NULL_DATA;
+        return 0;
+    }
+
+    if (parameters->gpuid < -1 || parameters->noise < -1 || parameters->noise > 3 || (parameters->scale != 1 && parameters->scale != 2)
+            || parameters->prepadding < 0 || parameters->num_threads < 1
+            || (parameters->tilesize != 0 && parameters->tilesize < 32))
+    {
+        *error = WAIFU2X_ERROR_INVALID_PARAMETERS;
+        return 0;
+    }
+
+    const bool gpu = parameters->gpuid != -1;
+    if (gpu)
+    {
+        engine_c_gpu_acquire();
+
+        if (parameters->gpuid >= ncnn::get_gpu_count())
+        {
+            engine_c_gpu_release();
+            *error = WAIFU2X_ERROR_INVALID_PARAMETERS;
+            return 0;
+        }
+    }
+
+    int tilesize = parameters->tilesize;
+    if (tilesize == 0)
+    {
+        // the cli policy for models-cunet, which asks the most of the heap
+        if (!gpu)
+        {
+            tilesize = 400;
+        }
+        else
+        {
+            uint32_t heap_budget = ncnn::get_gpu_device(parameters->gpuid)->get_heap_budget();
+            if (heap_budget > 2600)
+                tilesize = 400;
+            else if (heap_budget > 740)
+                tilesize = 200;
+            else if (heap_budget > 250)
+                tilesize = 100;
+            else
+                tilesize = 32;
+        }
+    }
+
+    Waifu2xInstance* instance = new Waifu2xInstance(new Waifu2x(parameters->gpuid, parameters->tta_mode != 0, gpu ? 1 : parameters->num_threads), gpu);
+
+    Waifu2x* waifu2x = instance->engine;
+    waifu2x->input_bgr = parameters->input_bgr != 0;
+    waifu2x->output_bgr = parameters->output_bgr != 0;
+    waifu2x->noise = parameters->noise;
+    waifu2x->scale = parameters->scale;
+    waifu2x->tilesize = tilesize;
+    waifu2x->prepadding = parameters->prepadding;
+
+    *error = WAIFU2X_OK;
+    return instance;
+}
+
+void WAIFU2X_C_API waifu2x_destroy(waifu2x_instance instance)
+{
+    engine_c_destroy((Waifu2xInstance*)instance);
+}
+
+waifu2x_error WAIFU2X_C_API waifu2x_load(waifu2x_instance instance, const char* parampath, const char* modelpath)
+{
+    return (waifu2x_error)engine_c_load((Waifu2xInstance*)instance, parampath, modelpath);
+}
+
+waifu2x_error WAIFU2X_C_API waifu2x_process(waifu2x_instance instance,
+    const unsigned char* src, int w, int h, int channels, size_t src_stride,
+    unsigned char* dst, size_t dst_stride)
+{
+    return (waifu2x_error)engine_c_process((const Waifu2xInstance*)instance, src, w, h, channels, src_stride, dst, dst_stride);
+}
+
+waifu2x_error WAIFU2X_C_API waifu2x_submit(waifu2x_instance instance,
+    const unsigned char* src, int w, int h, int channels, size_t src_stride,
+    unsigned char* dst, size_t dst_stride,
+    waifu2x_callback callback, void* userdata)
+{
+    return (waifu2x_error)engine_c_submit((Waifu2xInstance*)instance, src, w, h, channels, src_stride, dst, dst_stride, callback, userdata);
+}
+
+void WAIFU2X_C_API waifu2x_wait(waifu2x_instance instance)
+{
+    engine_c_wait((Waifu2xInstance*)instance);
+}
@@ -0,0 +1,91 @@
+// c api of the waifu2x engine, for host apps that keep models loaded and hand over pixels directly
+
+#ifndef WAIFU2X_C_H
+#define WAIFU2X_C_H
+
+#include <stddef.h>
+
+#ifdef _WIN32
+#ifdef WAIFU2X_C_BUILD
+#define WAIFU2X_C_EXPORT __declspec(dllexport)
+#else
+#define WAIFU2X_C_EXPORT __declspec(dllimport)
+#endif
+#define WAIFU2X_C_API __stdcall
+#else
+#define WAIFU2X_C_EXPORT __attribute__((visibility("default")))
+#define WAIFU2X_C_API
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif // __cplusplus
+
+    typedef enum waifu2x_error
+    {
+        WAIFU2X_OK = 0,
+        WAIFU2X_ERROR_NULL_INSTANCE,
+        WAIFU2X_ERROR_NULL_DATA,
+        WAIFU2X_ERROR_INVALID_PARAMETERS,
+        WAIFU2X_ERROR_LOAD_MODEL,
+        WAIFU2X_ERROR_NOT_LOADED,
+        WAIFU2X_ERROR_PROCESS
+    } waifu2x_error;
+
+    typedef struct waifu2x_parameters
+    {
+        // -1 for cpu
+        int gpuid;
+        int tta_mode;
+        // cpu threads, ignored on gpu
+        int num_threads;
+        // -1 to 3, as in the name of the model files
+        int noise;
+        // 1 for the noise models, 2 for the scale2.0x ones, larger scales run the 2x model again
+        int scale;
+        // >= 32, or 0 to keep the engine default
+        int tilesize;
+        // 18 for models-cunet, 28 for its 1x noise models, 7 for the upconv_7 models
+        int prepadding;
+        // src in bgr(a) order, rgb(a) otherwise
+        int input_bgr;
+        // dst in bgr(a) order, rgb(a) otherwise
+        int output_bgr;
+    } waifu2x_parameters;
+
+    typedef void* waifu2x_instance;
+
+    // runs on the worker thread of the instance once a submitted job is done
+    typedef void (*waifu2x_callback)(void* userdata, waifu2x_error error);
+
+    WAIFU2X_C_EXPORT void WAIFU2X_C_API waifu2x_default_parameters(waifu2x_parameters* parameters);
+
+    // the vulkan instance is created with the first instance and destroyed with the last
+    WAIFU2X_C_EXPORT waifu2x_instance WAIFU2X_C_API waifu2x_create(const waifu2x_parameters* parameters, waifu2x_error* error);
+    WAIFU2X_C_EXPORT void WAIFU2X_C_API waifu2x_destroy(waifu2x_instance instance);
+
+    // utf-8 paths
+    WAIFU2X_C_EXPORT waifu2x_error WAIFU2X_C_API waifu2x_load(waifu2x_instance instance, const char* parampath, const char* modelpath);
+
+    // src is w x h with channels 3 or 4, in the order of input_bgr
+    // dst is w * scale x h * scale with the same channels, both owned by the caller
+    // a stride of 0 means packed rows, packed rows are used in place and others are repacked
+    WAIFU2X_C_EXPORT waifu2x_error WAIFU2X_C_API waifu2x_process(waifu2x_instance instance,
+        const unsigned char* src, int w, int h, int channels, size_t src_stride,
+        unsigned char* dst, size_t dst_stride);
+
+    // queues the same work and returns, src and dst must stay valid until callback
+    WAIFU2X_C_EXPORT waifu2x_error WAIFU2X_C_API waifu2x_submit(waifu2x_instance instance,
+        const unsigned char* src, int w, int h, int channels, size_t src_stride,
+        unsigned char* dst, size_t dst_stride,
+        waifu2x_callback callback, void* userdata);
+
+    // blocks until every submitted job has called back
+    WAIFU2X_C_EXPORT void WAIFU2X_C_API waifu2x_wait(waifu2x_instance instance);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // WAIFU2X_C_H
@@ -0,0 +1,343 @@
+// instance, job queue and worker shared by the c apis of the ncnn engines
+// each api keeps its own public header and only adds its parameters and create
+
+#ifndef ENGINE_C_H
+#define ENGINE_C_H
+
+#include <string.h>
+#include <queue>
+#include <string>
+#include <vector>
+
+#if _WIN32
+#include <windows.h>
+#endif
+
+// ncnn
+#include "gpu.h"
+#include "platform.h"
+
+// every c api lists its error enum in this order
+enum
+{
+    ENGINE_C_OK = 0,
+    ENGINE_C_ERROR_NULL_INSTANCE,
+    ENGINE_C_ERROR_NULL_DATA,
+    ENGINE_C_ERROR_INVALID_PARAMETERS,
+    ENGINE_C_ERROR_LOAD_MODEL,
+    ENGINE_C_ERROR_NOT_LOADED,
+    ENGINE_C_ERROR_PROCESS
+};
+
+// one vulkan instance for every instance of the library on a gpu
+static ncnn::Mutex engine_c_gpu_lock;
+static int engine_c_gpu_users = 0;
+
+static inline void engine_c_gpu_acquire()
+{
+    engine_c_gpu_lock.lock();
+    if (engine_c_gpu_users++ == 0)
+        ncnn::create_gpu_instance();
+    engine_c_gpu_lock.unlock();
+}
+
+static inline void engine_c_gpu_release()
+{
+    engine_c_gpu_lock.lock();
+    if (--engine_c_gpu_users == 0)
+        ncnn::destroy_gpu_instance();
+    engine_c_gpu_lock.unlock();
+}
+
+// Error and Callback are the enum and callback types of the public header
+template<class Engine, typename Error, typename Callback>
+class EngineCInstance
+{
+public:
+    typedef Error error_type;
+
+    class Job
+    {
+    public:
+        const unsigned char* src;
+        int w;
+        int h;
+        int channels;
+        size_t src_stride;
+        unsigned char* dst;
+        size_t dst_stride;
+
+        Callback callback;
+        void* userdata;
+    };
+
+    EngineCInstance(Engine* _engine, bool _gpu) : engine(_engine), gpu(_gpu), loaded(false), worker(0), pending(0), quit(false)
+    {
+    }
+
+    Engine* engine;
+    bool gpu;
+    bool loaded;
+
+    // submitted jobs, the worker starts with the first one
+    ncnn::Thread* worker;
+    ncnn::Mutex lock;
+    ncnn::ConditionVariable condition;
+    std::queue<Job> jobs;
+    // queued or running
+    int pending;
+    bool quit;
+};
+
+template<class Instance>
+static int engine_c_check(const Instance* instance, const typename Instance::Job& job)
+{
+    if (!instance)
+        return ENGINE_C_ERROR_NULL_INSTANCE;
+
+    if (!instance->loaded)
+        return ENGINE_C_ERROR_NOT_LOADED;
+
+    if (!job.src || !job.dst)
+        return ENGINE_C_ERROR_NULL_DATA;
+
+    if (job.w <= 0 || job.h <= 0 || (job.channels != 3 && job.channels != 4))
+        return ENGINE_C_ERROR_INVALID_PARAMETERS;
+
+    const size_t in_packed = (size_t)job.w * job.channels;
+    const size_t out_packed = in_packed * instance->engine->scale;
+    if ((job.src_stride && job.src_stride < in_packed) || (job.dst_stride && job.dst_stride < out_packed))
+        return ENGINE_C_ERROR_INVALID_PARAMETERS;
+
+    return ENGINE_C_OK;
+}
+
+template<class Instance>
+static int engine_c_run(const Instance* instance, const typename Instance::Job& job)
+{
+    const int scale = instance->engine->scale;
+    const int outh = job.h * scale;
+    const size_t in_packed = (size_t)job.w * job.channels;
+    const size_t out_packed = in_packed * scale;
+    const size_t src_stride = job.src_stride ? job.src_stride : in_packed;
+    const size_t dst_stride = job.dst_stride ? job.dst_stride : out_packed;
+
+    // the engines walk packed rows, padded ones go through a copy
+    std::vector<unsigned char> src_rows;
+    const unsigned char* src = job.src;
+    if (src_stride != in_packed)
+    {
+        src_rows.resize(in_packed * job.h);
+        for (int y = 0; y < job.h; y++)
+        {
+            memcpy(src_rows.data() + y * in_packed, job.src + y * src_stride, in_packed);
+        }
+        src = src_rows.data();
+    }
+
+    std::vector<unsigned char> dst_rows;
+    unsigned char* dst = job.dst;
+    if (dst_stride != out_packed)
+    {
+        dst_rows.resize(out_packed * outh);
+        dst = dst_rows.data();
+    }
+
+    ncnn::Mat inimage(job.w, job.h, (void*)src, (size_t)job.channels, job.channels);
+    ncnn::Mat outimage(job.w * scale, outh, (void*)dst, (size_t)job.channels, job.channels);
+
+    if (instance->engine->process(inimage, outimage) != 0)
+        return ENGINE_C_ERROR_PROCESS;
+
+    if (dst != job.dst)
+    {
+        for (int y = 0; y < outh; y++)
+        {
+            memcpy(job.dst + y * dst_stride, dst + y * out_packed, out_packed);
+        }
+    }
+
+    return ENGINE_C_OK;
+}
+
+template<class Instance>
+static void* engine_c_worker(void* args)
+{
+    Instance* instance = (Instance*)args;
+
+    for (;;)
+    {
+        instance->lock.lock();
+
+        while (instance->jobs.empty() && !instance->quit)
+        {
+            instance->condition.wait(instance->lock);
+        }
+
+        // destroy lets the queue drain first
+        if (instance->jobs.empty())
+        {
+            instance->lock.unlock();
+            break;
+        }
+
+        typename Instance::Job job = instance->jobs.front();
+        instance->jobs.pop();
+
+        instance->lock.unlock();
+
+        const int error = engine_c_run(instance, job);
+        if (job.callback)
+            job.callback(job.userdata, (typename Instance::error_type)error);
+
+        instance->lock.lock();
+        instance->pending--;
+        instance->lock.unlock();
+
+        // wakes engine_c_wait as well
+        instance->condition.broadcast();
+    }
+
+    return 0;
+}
+
+#if _WIN32
+static inline std::wstring engine_c_path_from_utf8(const char* s)
+{
+    int length = MultiByteToWideChar(CP_UTF8, 0, s, -1, NULL, 0);
+    std::vector<wchar_t> buffer(length > 0 ? length : 1, 0);
+    MultiByteToWideChar(CP_UTF8, 0, s, -1, buffer.data(), length);
+    return std::wstring(buffer.data());
+}
+#else
+static inline std::string engine_c_path_from_utf8(const char* s)
+{
+    return std::string(s);
+}
+#endif
+
+// the engine goes with the instance, and so does the gpu instance reference taken for it
+template<class Instance>
+static void engine_c_destroy(Instance* instance)
+{
+    if (!instance)
+        return;
+
+    if (instance->worker)
+    {
+        instance->lock.lock();
+        instance->quit = true;
+        instance->lock.unlock();
+
+        instance->condition.broadcast();
+
+        instance->worker->join();
+        delete instance->worker;
+    }
+
+    delete instance->engine;
+
+    if (instance->gpu)
+        engine_c_gpu_release();
+
+    delete instance;
+}
+
+// utf-8 paths
+template<class Instance>
+static int engine_c_load(Instance* instance, const char* parampath, const char* modelpath)
+{
+    if (!instance)
+        return ENGINE_C_ERROR_NULL_INSTANCE;
+
+    if (!parampath || !modelpath)
+        return ENGINE_C_ERROR_NULL_DATA;
+
+    // the pipelines are built once, a second model needs another instance
+    if (instance->loaded)
+        return ENGINE_C_ERROR_INVALID_PARAMETERS;
+
+    if (instance->engine->load(engine_c_path_from_utf8(parampath), engine_c_path_from_utf8(modelpath)) != 0)
+        return ENGINE_C_ERROR_LOAD_MODEL;
+
+    instance->loaded = true;
+    return ENGINE_C_OK;
+}
+
+template<class Instance>
+static int engine_c_process(const Instance* instance,
+    const unsigned char* src, int w, int h, int channels, size_t src_stride,
+    unsigned char* dst, size_t dst_stride)
+{
+    typename Instance::Job job;
+    job.src = src;
+    job.w = w;
+    job.h = h;
+    job.channels = channels;
+    job.src_stride = src_stride;
+    job.dst = dst;
+    job.dst_stride = dst_stride;
+    job.callback = 0;
+    job.userdata = 0;
+
+    int error = engine_c_check(instance, job);
+    if (error != ENGINE_C_OK)
+        return error;
+
+    return engine_c_run(instance, job);
+}
+
+template<class Instance, typename Callback>
+static int engine_c_submit(Instance* instance,
+    const unsigned char* src, int w, int h, int channels, size_t src_stride,
+    unsigned char* dst, size_t dst_stride,
+    Callback callback, void* userdata)
+{
+    typename Instance::Job job;
+    job.src = src;
+    job.w = w;
+    job.h = h;
+    job.channels = channels;
+    job.src_stride = src_stride;
+    job.dst = dst;
+    job.dst_stride = dst_stride;
+    job.callback = callback;
+    job.userdata = userdata;
+
+    int error = engine_c_check(instance, job);
+    if (error != ENGINE_C_OK)
+        return error;
+
+    instance->lock.lock();
+
+    if (!instance->worker)
+        instance->worker = new ncnn::Thread(engine_c_worker<Instance>, (void*)instance);
+
+    instance->jobs.push(job);
+    instance->pending++;
+
+    instance->lock.unlock();
+
+    instance->condition.broadcast();
+
+    return ENGINE_C_OK;
+}
+
+// blocks until every submitted job has called back
+template<class Instance>
+static void engine_c_wait(Instance* instance)
+{
+    if (!instance)
+        return;
+
+    instance->lock.lock();
+
+    while (instance->pending > 0)
+    {
+        instance->condition.wait(instance->lock);
+    }
+
+    instance->lock.unlock();
+}
+
+#endif // ENGINE_C_H
@@ -0,0 +1,200 @@
+// input image decoding straight from a mapped file, include after the stb/wic and webp headers
+
+#ifndef IMAGE_LOADER_H
+#define IMAGE_LOADER_H
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "filesystem_utils.h"
+
+// read only view of a whole file, a heap copy where the file can not be mapped
+class MappedFile
+{
+public:
+    MappedFile() : data(0), length(0), mapped(false)
+    {
+    }
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    int open(const path_t& path)
+    {
+        close();
+
+#if _WIN32
+        HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return -1;
+
+        LARGE_INTEGER size;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0 && size.QuadPart <= INT_MAX)
+        {
+            length = (int)size.QuadPart;
+
+            HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping)
+            {
+                // the view keeps the mapping alive
+                data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(mapping);
+            }
+        }
+
+        CloseHandle(file);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return -1;
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0 && st.st_size <= INT_MAX)
+        {
+            length = (int)st.st_size;
+
+            void* addr = mmap(0, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED)
+            {
+                // decoders walk the file front to back once
+                madvise(addr, length, MADV_SEQUENTIAL);
+                data = (const unsigned char*)addr;
+            }
+        }
+
+        ::close(fd);
+#endif
+
+        if (length == 0)
+            return -1;
+
+        if (data)
+        {
+            mapped = true;
+            return 0;
+        }
+
+        return read_whole(path);
+    }
+
+    void close()
+    {
+        if (data)
+        {
+            if (mapped)
+            {
+#if _WIN32
+                UnmapViewOfFile(data);
+#else
+                munmap((void*)data, length);
+#endif
+            }
+            else
+            {
+                free((void*)data);
+            }
+        }
+
+        data = 0;
+        length = 0;
+        mapped = false;
+    }
+
+public:
+    const unsigned char* data;
+    int length;
+
+private:
+    int read_whole(const path_t& path)
+    {
+#if _WIN32
+        FILE* fp = _wfopen(path.c_str(), L"rb");
+#else
+        FILE* fp = fopen(path.c_str(), "rb");
+#endif
+        if (!fp)
+        {
+            length = 0;
+            return -1;
+        }
+
+        unsigned char* filedata = (unsigned char*)malloc(length);
+        if (filedata && fread(filedata, 1, length, fp) != (size_t)length)
+        {
+            free(filedata);
+            filedata = 0;
+        }
+
+        fclose(fp);
+
+        if (!filedata)
+        {
+            length = 0;
+            return -1;
+        }
+
+        data = filedata;
+        return 0;
+    }
+
+    bool mapped;
+};
+
+static bool image_is_webp(const unsigned char* data, int length)
+{
+    return length >= 12 && memcmp(data, "RIFF", 4) == 0 && memcmp(data + 8, "WEBP", 4) == 0;
+}
+
+// packed rgb or rgba, bgr order on windows, grayscale comes out expanded from the same decode
+// webp is set when the pixels are to be released with free rather than stbi_image_free
+static unsigned char* image_load(const path_t& path, int* w, int* h, int* c, int* webp)
+{
+    *webp = 0;
+
+    MappedFile file;
+    if (file.open(path) != 0)
+        return 0;
+
+    if (image_is_webp(file.data, file.length))
+    {
+        unsigned char* pixeldata = webp_load(file.data, file.length, w, h, c);
+        if (pixeldata)
+            *webp = 1;
+        return pixeldata;
+    }
+
+#if _WIN32
+    // wic reads the file on its own
+    file.close();
+    return wic_decode_image(path.c_str(), w, h, c);
+#else
+    // the header alone tells the channel count, so the decode can expand in place
+    int channels = 0;
+    if (!stbi_info_from_memory(file.data, file.length, w, h, &channels))
+        return 0;
+
+    // grayscale -> rgb, grayscale + alpha -> rgba
+    const int desired = channels == 1 ? 3 : channels == 2 ? 4 : 0;
+
+    unsigned char* pixeldata = stbi_load_from_memory(file.data, file.length, w, h, c, desired);
+    if (pixeldata && desired)
+        *c = desired;
+
+    return pixeldata;
+#endif
+}
+
+#endif // IMAGE_LOADER_H
@@ -0,0 +1,218 @@
+// one flat json object per line, for the jobs of the server mode
+
+#ifndef JSON_LINE_H
+#define JSON_LINE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <map>
+#include <string>
+
+// string, number and bool values of a flat object, kept as text
+// nested objects and arrays are rejected, returns 0 on success
+static int json_line_parse(const std::string& line, std::map<std::string, std::string>& values)
+{
+    values.clear();
+
+    size_t i = 0;
+    const size_t n = line.size();
+
+    struct
+    {
+        const std::string& s;
+        size_t& i;
+        size_t n;
+
+        void skip()
+        {
+            while (i < n && (s[i] == ' ' || s[i] == '\t' || s[i] == '\r' || s[i] == '\n'))
+                i++;
+        }
+
+        int string(std::string& out)
+        {
+            if (i >= n || s[i] != '"')
+                return -1;
+            i++;
+
+            out.clear();
+            while (i < n && s[i] != '"')
+            {
+                char ch = s[i++];
+                if (ch != '\\')
+                {
+                    out += ch;
+                    continue;
+                }
+
+                if (i >= n)
+                    return -1;
+
+                ch = s[i++];
+                if (ch == 'n')
+                    out += '\n';
+                else if (ch == 't')
+                    out += '\t';
+                else if (ch == 'r')
+                    out += '\r';
+                else if (ch == 'b')
+                    out += '\b';
+                else if (ch == 'f')
+                    out += '\f';
+                else if (ch == 'u')
+                {
+                    if (i + 4 > n)
+                        return -1;
+
+                    unsigned int cp = (unsigned int)strtoul(s.substr(i, 4).c_str(), 0, 16);
+                    i += 4;
+
+                    // surrogate pair
+                    if (cp >= 0xd800 && cp < 0xdc00 && i + 6 <= n && s[i] == '\\' && s[i + 1] == 'u')
+                    {
+                        unsigned int lo = (unsigned int)strtoul(s.substr(i + 2, 4).c_str(), 0, 16);
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                        i += 6;
+                    }
+
+                    // back to utf-8
+                    if (cp < 0x80)
+                    {
+                        out += (char)cp;
+                    }
+                    else if (cp < 0x800)
+                    {
+                        out += (char)(0xc0 | (cp >> 6));
+                        out += (char)(0x80 | (cp & 0x3f));
+                    }
+                    else if (cp < 0x10000)
+                    {
+                        out += (char)(0xe0 | (cp >> 12));
+                        out += (char)(0x80 | ((cp >> 6) & 0x3f));
+                        out += (char)(0x80 | (cp & 0x3f));
+                    }
+                    else
+                    {
+                        out += (char)(0xf0 | (cp >> 18));
+                        out += (char)(0x80 | ((cp >> 12) & 0x3f));
+                        out += (char)(0x80 | ((cp >> 6) & 0x3f));
+                        out += (char)(0x80 | (cp & 0x3f));
+                    }
+                }
+                else
+                {
+                    // \" \\ \/
+                    out += ch;
+                }
+            }
+
+            if (i >= n)
+                return -1;
+            i++;
+            return 0;
+        }
+    } p = {line, i, n};
+
+    p.skip();
+    if (i >= n || line[i] != '{')
+        return -1;
+    i++;
+
+    p.skip();
+    if (i < n && line[i] == '}')
+        return 0;
+
+    while (i < n)
+    {
+        std::string key;
+        p.skip();
+        if (p.string(key) != 0)
+            return -1;
+
+        p.skip();
+        if (i >= n || line[i] != ':')
+            return -1;
+        i++;
+
+        p.skip();
+        std::string value;
+        if (i < n && line[i] == '"')
+        {
+            if (p.string(value) != 0)
+                return -1;
+        }
+        else
+        {
+            // number, true, false or null up to the next separator
+            const size_t begin = i;
+            while (i < n && line[i] != ',' && line[i] != '}' && line[i] != ' ' && line[i] != '\t')
+                i++;
+            value = line.substr(begin, i - begin);
+
+            if (value.empty() || value[0] == '{' || value[0] == '[')
+                return -1;
+            if (value == "true")
+                value = "1";
+            else if (value == "false" || value == "null")
+                value = "0";
+        }
+        values[key] = value;
+
+        p.skip();
+        if (i < n && line[i] == ',')
+        {
+            i++;
+            continue;
+        }
+        if (i < n && line[i] == '}')
+            return 0;
+
+        return -1;
+    }
+
+    return -1;
+}
+
+// value of key as an int, fallback when it is missing
+static int json_line_int(const std::map<std::string, std::string>& values, const char* key, int fallback)
+{
+    std::map<std::string, std::string>::const_iterator it = values.find(key);
+    return it == values.end() ? fallback : atoi(it->second.c_str());
+}
+
+// quoted and escaped for a reply
+static std::string json_line_quote(const std::string& s)
+{
+    std::string out = "\"";
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        const unsigned char ch = s[i];
+        if (ch == '"' || ch == '\\')
+        {
+            out += '\\';
+            out += (char)ch;
+        }
+        else if (ch < 0x20)
+        {
+            char buf[8];
+            sprintf(buf, "\\u%04x", ch);
+            out += buf;
+        }
+        else
+        {
+            out += (char)ch;
+        }
+    }
+    out += '"';
+    return out;
+}
+
+// a progress reply, userdata is the std::string of the quoted job id
+static void json_line_progress(void* userdata, float progress)
+{
+    const std::string* id = (const std::string*)userdata;
+    fprintf(stdout, "{\"id\":%s,\"status\":\"progress\",\"progress\":%.4f}\n", id->c_str(), progress);
+    fflush(stdout);
+}
+
+#endif // JSON_LINE_H
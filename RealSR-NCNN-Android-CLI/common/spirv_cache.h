@@ -0,0 +1,184 @@
+// compiled pre/post shader spirv kept on disk, so later runs skip glslang
+
+#ifndef SPIRV_CACHE_H
+#define SPIRV_CACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#if _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// ncnn
+#include "gpu.h"
+#include "option.h"
+#include "platform.h"
+
+// the path_t of filesystem_utils.h, which the engines do not include
+#if _WIN32
+typedef std::wstring spirv_cache_path_t;
+#else
+typedef std::string spirv_cache_path_t;
+#endif
+
+// empty keeps the cache off, inline so that main and the engines see the same one
+inline spirv_cache_path_t& spirv_cache_directory()
+{
+    static spirv_cache_path_t directory;
+    return directory;
+}
+
+// created on first use, a directory that can not be written leaves the cache off
+static inline void spirv_cache_set_directory(const spirv_cache_path_t& directory)
+{
+#if _WIN32
+    CreateDirectoryW(directory.c_str(), NULL);
+#else
+    mkdir(directory.c_str(), 0755);
+#endif
+    spirv_cache_directory() = directory;
+}
+
+static inline uint64_t spirv_cache_hash(uint64_t hash, const void* data, size_t size)
+{
+    // fnv-1a
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// the shader source, the options that become glslang defines, the device and its driver
+static inline uint64_t spirv_cache_key(const char* comp_data, int comp_data_size, const ncnn::Option& opt, const ncnn::VulkanDevice* vkdev)
+{
+    uint64_t hash = 14695981039346656037ull;
+    hash = spirv_cache_hash(hash, comp_data, comp_data_size);
+
+    // every option compile_spirv_module turns into a define, one that does not only costs a miss
+    const unsigned char flags[] = {
+        opt.use_fp16_packed, opt.use_fp16_storage, opt.use_fp16_arithmetic,
+        opt.use_int8_packed, opt.use_int8_storage, opt.use_int8_arithmetic,
+        opt.use_bf16_storage, opt.use_shader_pack8,
+        opt.use_subgroup_basic, opt.use_subgroup_vote, opt.use_subgroup_ballot, opt.use_subgroup_shuffle,
+        opt.use_image_storage, opt.use_tensor_storage,
+        opt.use_shader_local_memory, opt.use_cooperative_matrix
+    };
+    hash = spirv_cache_hash(hash, flags, sizeof(flags));
+
+    const ncnn::GpuInfo& info = vkdev->info;
+    const uint32_t ids[] = {info.vendor_id(), info.device_id(), info.driver_version(), info.api_version()};
+    hash = spirv_cache_hash(hash, ids, sizeof(ids));
+    hash = spirv_cache_hash(hash, info.pipeline_cache_uuid(), 16);
+
+#ifdef NCNN_VERSION_STRING
+    hash = spirv_cache_hash(hash, NCNN_VERSION_STRING, sizeof(NCNN_VERSION_STRING));
+#endif
+
+    return hash;
+}
+
+static inline FILE* spirv_cache_open(const spirv_cache_path_t& path, bool write)
+{
+#if _WIN32
+    return _wfopen(path.c_str(), write ? L"wb" : L"rb");
+#else
+    return fopen(path.c_str(), write ? "wb" : "rb");
+#endif
+}
+
+static inline spirv_cache_path_t spirv_cache_path(uint64_t key, const char* suffix)
+{
+    char name[64];
+    sprintf(name, "%016llx.spv%s", (unsigned long long)key, suffix);
+
+    spirv_cache_path_t path = spirv_cache_directory();
+#if _WIN32
+    path += L'\\';
+    for (const char* p = name; *p; p++)
+        path += (wchar_t)*p;
+#else
+    path += '/';
+    path += name;
+#endif
+    return path;
+}
+
+static inline int spirv_cache_load(uint64_t key, std::vector<uint32_t>& spirv)
+{
+    FILE* fp = spirv_cache_open(spirv_cache_path(key, ""), false);
+    if (!fp)
+        return -1;
+
+    uint64_t filekey = 0;
+    uint32_t count = 0;
+    int ret = -1;
+    if (fread(&filekey, sizeof(filekey), 1, fp) == 1 && filekey == key && fread(&count, sizeof(count), 1, fp) == 1 && count > 0 && count < 16 * 1024 * 1024)
+    {
+        spirv.resize(count);
+        // a valid module starts with the spirv magic
+        if (fread(spirv.data(), sizeof(uint32_t), count, fp) == count && spirv[0] == 0x07230203)
+            ret = 0;
+        else
+            spirv.clear();
+    }
+
+    fclose(fp);
+    return ret;
+}
+
+static inline void spirv_cache_save(uint64_t key, const std::vector<uint32_t>& spirv)
+{
+    // concurrent runs each write their own temporary file and the last rename wins
+    char suffix[32];
+#if _WIN32
+    sprintf(suffix, ".%lu", (unsigned long)GetCurrentProcessId());
+#else
+    sprintf(suffix, ".%ld", (long)getpid());
+#endif
+    const spirv_cache_path_t tmppath = spirv_cache_path(key, suffix);
+    const spirv_cache_path_t path = spirv_cache_path(key, "");
+
+    FILE* fp = spirv_cache_open(tmppath, true);
+    if (!fp)
+        return;
+
+    const uint32_t count = (uint32_t)spirv.size();
+    bool ok = fwrite(&key, sizeof(key), 1, fp) == 1 && fwrite(&count, sizeof(count), 1, fp) == 1 && fwrite(spirv.data(), sizeof(uint32_t), count, fp) == count;
+    ok = fclose(fp) == 0 && ok;
+
+#if _WIN32
+    if (!ok || !MoveFileExW(tmppath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+        DeleteFileW(tmppath.c_str());
+#else
+    if (!ok || rename(tmppath.c_str(), path.c_str()) != 0)
+        unlink(tmppath.c_str());
+#endif
+}
+
+// compile_spirv_module with the on-disk cache in front of it
+static inline int compile_spirv_module_cached(const char* comp_data, int comp_data_size, const ncnn::Option& opt, const ncnn::VulkanDevice* vkdev, std::vector<uint32_t>& spirv)
+{
+    if (spirv_cache_directory().empty())
+        return ncnn::compile_spirv_module(comp_data, comp_data_size, opt, spirv);
+
+    const uint64_t key = spirv_cache_key(comp_data, comp_data_size, opt, vkdev);
+    if (spirv_cache_load(key, spirv) == 0)
+        return 0;
+
+    int ret = ncnn::compile_spirv_module(comp_data, comp_data_size, opt, spirv);
+    if (ret == 0)
+        spirv_cache_save(key, spirv);
+
+    return ret;
+}
+
+#endif // SPIRV_CACHE_H
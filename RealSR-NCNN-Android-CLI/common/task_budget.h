@@ -0,0 +1,115 @@
+// memory ceiling for the images held between the load, proc and save threads
+
+#ifndef TASK_BUDGET_H
+#define TASK_BUDGET_H
+
+#include <stddef.h>
+
+#if _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+// ncnn
+#include "platform.h"
+
+// a quarter of the physical memory, 1GB when it can not be queried
+static size_t task_budget_default()
+{
+    unsigned long long total = 0;
+#if _WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status))
+        total = status.ullTotalPhys;
+#else
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGE_SIZE);
+    if (pages > 0 && page_size > 0)
+        total = (unsigned long long)pages * page_size;
+#endif
+
+    unsigned long long ceiling = total ? total / 4 : 1024ull * 1024 * 1024;
+
+    // 32bit address space
+    if (ceiling > (size_t)-1 / 2)
+        ceiling = (size_t)-1 / 2;
+
+    return (size_t)ceiling;
+}
+
+// loaders block here instead of on a fixed queue length, so small images prefetch deep
+// and large ones only as far as the memory allows
+class TaskBudget
+{
+public:
+    TaskBudget() : ceiling(task_budget_default()), in_flight(0)
+    {
+    }
+
+    // 0 keeps the default
+    void set_ceiling(size_t bytes)
+    {
+        lock.lock();
+        ceiling = bytes ? bytes : task_budget_default();
+        lock.unlock();
+    }
+
+    size_t get_ceiling() const
+    {
+        return ceiling;
+    }
+
+    // a task larger than the whole ceiling still runs, alone
+    void acquire(size_t bytes)
+    {
+        lock.lock();
+
+        while (in_flight > 0 && in_flight + bytes > ceiling)
+        {
+            condition.wait(lock);
+        }
+
+        in_flight += bytes;
+
+        lock.unlock();
+    }
+
+    void release(size_t bytes)
+    {
+        lock.lock();
+
+        in_flight -= bytes;
+
+        lock.unlock();
+
+        condition.broadcast();
+    }
+
+private:
+    ncnn::Mutex lock;
+    ncnn::ConditionVariable condition;
+    size_t ceiling;
+    size_t in_flight;
+};
+
+// gives the bytes back when the saved task goes out of scope
+class TaskBudgetScope
+{
+public:
+    TaskBudgetScope(TaskBudget& _budget, size_t _bytes) : budget(_budget), bytes(_bytes)
+    {
+    }
+
+    ~TaskBudgetScope()
+    {
+        budget.release(bytes);
+    }
+
+private:
+    TaskBudget& budget;
+    size_t bytes;
+};
+
+#endif // TASK_BUDGET_H
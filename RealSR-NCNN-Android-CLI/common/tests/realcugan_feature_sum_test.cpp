@@ -0,0 +1,165 @@
+// the syncgap running sum on the gpu against the cpu path of tta_add_row, on padded and packed features
+
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+// ncnn
+#include "command.h"
+#include "gpu.h"
+#include "mat.h"
+#include "pipeline.h"
+
+#include "realcugan_feature_sum.h"
+#include "realcugan_feature_sum.comp.hex.h"
+
+// w * h is odd so the channels of every layout are padded
+static const int FEATURE_W = 5;
+static const int FEATURE_H = 3;
+static const int FEATURE_C = 8;
+static const int FEATURE_COUNT = 6;
+
+static ncnn::Mat random_feature(int w, int h, int c, unsigned int seed)
+{
+    ncnn::Mat feat(w, h, c);
+    for (int q = 0; q < c; q++)
+    {
+        float* ptr = feat.channel(q);
+        for (int k = 0; k < w * h; k++)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            ptr[k] = (int)(seed >> 16) / 32768.f - 1.f;
+        }
+    }
+
+    return feat;
+}
+
+static int run(const char* name, ncnn::VulkanDevice* vkdev, const ncnn::Pipeline* feature_sum, const ncnn::Option& opt, bool fp16)
+{
+    ncnn::VkCompute cmd(vkdev);
+
+    FeatureSum gpu_sum;
+    FeatureSum cpu_sum;
+    for (int i = 0; i < FEATURE_COUNT; i++)
+    {
+        ncnn::Mat feat = random_feature(FEATURE_W, FEATURE_H, FEATURE_C, 7 + i);
+
+        // the cpu sum gets what the gpu holds
+        if (fp16)
+        {
+            ncnn::Mat feat_fp16;
+            ncnn::cast_float32_to_float16(feat, feat_fp16, opt);
+            ncnn::cast_float16_to_float32(feat_fp16, feat, opt);
+        }
+
+        ncnn::VkMat feat_gpu;
+        cmd.record_upload(feat, feat_gpu, opt);
+
+        if (gpu_sum.add(feat_gpu, feature_sum, cmd, opt) != 0 || cpu_sum.add(feat) != 0)
+        {
+            fprintf(stderr, "%s: feature %d refused\n", name, i);
+            return -1;
+        }
+    }
+
+    // another layout is left to the caller
+    {
+        ncnn::VkMat transposed;
+        cmd.record_upload(random_feature(FEATURE_H, FEATURE_W, FEATURE_C, 1), transposed, opt);
+
+        ncnn::VkMat fewer;
+        cmd.record_upload(random_feature(FEATURE_W, FEATURE_H, FEATURE_C / 2, 2), fewer, opt);
+
+        if (gpu_sum.add(transposed, feature_sum, cmd, opt) == 0 || gpu_sum.add(fewer, feature_sum, cmd, opt) == 0)
+        {
+            fprintf(stderr, "%s: another layout was summed\n", name);
+            return -1;
+        }
+    }
+
+    const ncnn::Mat gpu_result = gpu_sum.download(cmd, opt);
+    const ncnn::Mat cpu_result = cpu_sum.download(opt);
+
+    if (gpu_result.w != FEATURE_W || gpu_result.h != FEATURE_H || gpu_result.c != FEATURE_C || gpu_result.elempack != 1)
+    {
+        fprintf(stderr, "%s: sum is %d x %d x %d pack %d\n", name, gpu_result.w, gpu_result.h, gpu_result.c, gpu_result.elempack);
+        return -1;
+    }
+
+    for (int q = 0; q < FEATURE_C; q++)
+    {
+        const float* gptr = gpu_result.channel(q);
+        const float* cptr = cpu_result.channel(q);
+        for (int k = 0; k < FEATURE_W * FEATURE_H; k++)
+        {
+            if (fabsf(gptr[k] - cptr[k]) > 1e-4f)
+            {
+                fprintf(stderr, "%s: channel %d at %d is %f, the cpu has %f\n", name, q, k, gptr[k], cptr[k]);
+                return -1;
+            }
+        }
+    }
+
+    fprintf(stderr, "%s: ok\n", name);
+    return 0;
+}
+
+int main()
+{
+    ncnn::create_gpu_instance();
+
+    if (ncnn::get_gpu_count() == 0)
+    {
+        fprintf(stderr, "no vulkan device, skipped\n");
+        ncnn::destroy_gpu_instance();
+        return 0;
+    }
+
+    int ret = 0;
+    {
+        ncnn::VulkanDevice* vkdev = ncnn::get_gpu_device(0);
+
+        ncnn::VkAllocator* blob_vkallocator = vkdev->acquire_blob_allocator();
+        ncnn::VkAllocator* staging_vkallocator = vkdev->acquire_staging_allocator();
+
+        ncnn::Option opt;
+        opt.use_vulkan_compute = true;
+        opt.blob_vkallocator = blob_vkallocator;
+        opt.workspace_vkallocator = blob_vkallocator;
+        opt.staging_vkallocator = staging_vkallocator;
+        opt.use_fp16_packed = false;
+        opt.use_fp16_storage = false;
+        opt.use_fp16_arithmetic = false;
+
+        std::vector<uint32_t> spirv;
+        ncnn::compile_spirv_module(realcugan_feature_sum_comp_data, sizeof(realcugan_feature_sum_comp_data), opt, spirv);
+
+        ncnn::Pipeline feature_sum(vkdev);
+        feature_sum.set_optimal_local_size_xyz(64, 1, 1);
+        feature_sum.create(spirv.data(), spirv.size() * 4, std::vector<ncnn::vk_specialization_type>());
+
+        {
+            ncnn::Option opt_pack1 = opt;
+            opt_pack1.use_packing_layout = false;
+            ret |= run("fp32 elempack 1", vkdev, &feature_sum, opt_pack1, false);
+        }
+
+        ret |= run("fp32 elempack 4", vkdev, &feature_sum, opt, false);
+
+        // half pairs, with fp16 storage where the device has it
+        {
+            ncnn::Option opt_fp16 = opt;
+            opt_fp16.use_fp16_packed = true;
+            opt_fp16.use_fp16_storage = vkdev->info.support_fp16_storage();
+            ret |= run("fp16 elempack 4", vkdev, &feature_sum, opt_fp16, true);
+        }
+
+        vkdev->reclaim_blob_allocator(blob_vkallocator);
+        vkdev->reclaim_staging_allocator(staging_vkallocator);
+    }
+
+    ncnn::destroy_gpu_instance();
+
+    return ret == 0 ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+// tile_split_process with a worker whose device fails, the live workers have to finish its bands
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "tile_split.h"
+
+// nearest neighbour upscale, fail_after bands succeed before every call fails
+class FakeEngine
+{
+public:
+    FakeEngine(int _fail_after, int _delay_ms) : scale(2), tilesize(16), prepadding(4), fail_after(_fail_after), delay_ms(_delay_ms), calls(0)
+    {
+    }
+
+    int process(const ncnn::Mat& inimage, ncnn::Mat& outimage) const
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+
+        lock.lock();
+        const bool fail = fail_after >= 0 && calls >= fail_after;
+        calls++;
+        lock.unlock();
+
+        if (fail)
+            return -1;
+
+        const int c = inimage.elempack;
+        for (int y = 0; y < outimage.h; y++)
+        {
+            const unsigned char* src = (const unsigned char*)inimage.data + (size_t)(y / scale) * inimage.w * c;
+            unsigned char* dst = (unsigned char*)outimage.data + (size_t)y * outimage.w * c;
+            for (int x = 0; x < outimage.w; x++)
+            {
+                memcpy(dst + x * c, src + (x / scale) * c, c);
+            }
+        }
+
+        return 0;
+    }
+
+public:
+    int scale;
+    int tilesize;
+    int prepadding;
+
+    // -1 never fails
+    int fail_after;
+    int delay_ms;
+
+private:
+    mutable ncnn::Mutex lock;
+    mutable int calls;
+};
+
+static int run(const char* name, const std::vector<const FakeEngine*>& engines, bool expect_ok)
+{
+    const int w = 37;
+    const int h = 211;
+    const int c = 3;
+    const int scale = 2;
+
+    std::vector<unsigned char> pixels(w * h * c);
+    for (size_t i = 0; i < pixels.size(); i++)
+    {
+        pixels[i] = (unsigned char)((i * 2654435761u) >> 24);
+    }
+
+    ncnn::Mat inimage(w, h, (void*)pixels.data(), (size_t)c, c);
+    ncnn::Mat outimage(w * scale, h * scale, (size_t)c, c);
+    memset(outimage.data, 0, (size_t)w * scale * h * scale * c);
+
+    const int ret = tile_split_process(engines, inimage, outimage);
+
+    if (!expect_ok)
+    {
+        if (ret == 0)
+        {
+            fprintf(stderr, "%s: expected a failure\n", name);
+            return -1;
+        }
+
+        fprintf(stderr, "%s: ok\n", name);
+        return 0;
+    }
+
+    if (ret != 0)
+    {
+        fprintf(stderr, "%s: tile_split_process returned %d\n", name, ret);
+        return -1;
+    }
+
+    for (int y = 0; y < h * scale; y++)
+    {
+        for (int x = 0; x < w * scale; x++)
+        {
+            for (int k = 0; k < c; k++)
+            {
+                const unsigned char expected = pixels[((y / scale) * w + x / scale) * c + k];
+                const unsigned char got = ((const unsigned char*)outimage.data)[((size_t)y * w * scale + x) * c + k];
+                if (got != expected)
+                {
+                    fprintf(stderr, "%s: mismatch at %d,%d\n", name, x, y);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    fprintf(stderr, "%s: ok\n", name);
+    return 0;
+}
+
+int main()
+{
+    int ret = 0;
+
+    // the slow device fails its first band after the fast one has taken everything else
+    {
+        FakeEngine fast(-1, 1);
+        FakeEngine slow(0, 200);
+        std::vector<const FakeEngine*> engines;
+        engines.push_back(&fast);
+        engines.push_back(&slow);
+        ret |= run("late failure", engines, true);
+    }
+
+    // the failing device gives up a band in the middle of the image
+    {
+        FakeEngine good(-1, 5);
+        FakeEngine bad(2, 5);
+        std::vector<const FakeEngine*> engines;
+        engines.push_back(&good);
+        engines.push_back(&bad);
+        ret |= run("failure mid image", engines, true);
+    }
+
+    // no device left, the job ends and reports it
+    {
+        FakeEngine bad0(1, 1);
+        FakeEngine bad1(0, 1);
+        std::vector<const FakeEngine*> engines;
+        engines.push_back(&bad0);
+        engines.push_back(&bad1);
+        ret |= run("all failed", engines, false);
+    }
+
+    return ret == 0 ? 0 : 1;
+}
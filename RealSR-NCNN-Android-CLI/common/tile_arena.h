@@ -0,0 +1,75 @@
+// reusable pool allocators for the cpu tile loop
+
+#ifndef TILE_ARENA_H
+#define TILE_ARENA_H
+
+#include <vector>
+
+// ncnn
+#include "net.h"
+
+// every tile has the same size except at the image edges,
+// so after the first tile all blobs and pre/post buffers come from the pool
+class TileArena
+{
+public:
+    TileArena()
+    {
+        // the smaller edge tiles may reuse the full size buffers
+        blob_allocator.set_size_compare_ratio(0.f);
+        workspace_allocator.set_size_compare_ratio(0.f);
+    }
+
+    void set_option(ncnn::Option& opt)
+    {
+        opt.blob_allocator = &blob_allocator;
+        opt.workspace_allocator = &workspace_allocator;
+    }
+
+    void set_extractor(ncnn::Extractor& ex)
+    {
+        ex.set_blob_allocator(&blob_allocator);
+        ex.set_workspace_allocator(&workspace_allocator);
+    }
+
+public:
+    ncnn::UnlockedPoolAllocator blob_allocator;
+    ncnn::UnlockedPoolAllocator workspace_allocator;
+};
+
+// arenas are handed to one worker at a time and kept for the next image
+class TileArenaPool
+{
+public:
+    ~TileArenaPool()
+    {
+        for (size_t i = 0; i < arenas.size(); i++)
+        {
+            delete arenas[i];
+        }
+        arenas.clear();
+    }
+
+    TileArena* acquire()
+    {
+        ncnn::MutexLockGuard guard(lock);
+        if (arenas.empty())
+            return new TileArena;
+
+        TileArena* arena = arenas.back();
+        arenas.pop_back();
+        return arena;
+    }
+
+    void reclaim(TileArena* arena)
+    {
+        ncnn::MutexLockGuard guard(lock);
+        arenas.push_back(arena);
+    }
+
+private:
+    ncnn::Mutex lock;
+    std::vector<TileArena*> arenas;
+};
+
+#endif // TILE_ARENA_H
@@ -0,0 +1,288 @@
+// tile size autotune with a per device result cache
+
+#ifndef TILE_AUTOTUNE_H
+#define TILE_AUTOTUNE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// ncnn
+#include "gpu.h"
+#include "mat.h"
+
+#include "filesystem_utils.h"
+
+// the steps used by the static heap budget policies plus a few in between
+static const int tile_autotune_sizes[] = {32, 64, 100, 128, 160, 200, 256, 300, 400, 512};
+static const int tile_autotune_size_count = sizeof(tile_autotune_sizes) / sizeof(int);
+
+static path_t tile_autotune_cache_path()
+{
+    return get_executable_directory() + PATHSTR("tilesize.cache");
+}
+
+// device, driver, model, scale, tta, thread count and concurrent tile rows all change the best tile size
+static std::string tile_autotune_key(int gpuid, int num_threads, int row_jobs, const path_t& model, int scale, int tta_mode)
+{
+    // fnv-1a of the model path, keeps the cache file narrow on windows too
+    unsigned long long model_hash = 14695981039346656037ull;
+    for (size_t i = 0; i < model.size(); i++)
+    {
+        model_hash ^= (unsigned long long)model[i];
+        model_hash *= 1099511628211ull;
+    }
+
+    char key[512];
+    if (gpuid == -1)
+    {
+        snprintf(key, sizeof(key), "cpu|j%d|w%d|%016llx|x%d|tta%d", num_threads, row_jobs, model_hash, scale, tta_mode);
+    }
+    else
+    {
+        const ncnn::GpuInfo& info = ncnn::get_gpu_info(gpuid);
+        snprintf(key, sizeof(key), "%s|%u|%u|j%d|w%d|%016llx|x%d|tta%d", info.device_name(), info.device_id(), info.driver_version(), num_threads, row_jobs, model_hash, scale, tta_mode);
+    }
+
+    // one key per line
+    for (char* p = key; *p; p++)
+    {
+        if (*p == '\n' || *p == '\r')
+            *p = ' ';
+    }
+
+    return std::string(key);
+}
+
+// cache file lines are "tilesize key"
+static void tile_autotune_read_cache(const path_t& path, std::vector<std::string>& keys, std::vector<int>& tilesizes)
+{
+#if _WIN32
+    FILE* fp = _wfopen(path.c_str(), L"rb");
+#else
+    FILE* fp = fopen(path.c_str(), "rb");
+#endif
+    if (!fp)
+        return;
+
+    char line[600];
+    while (fgets(line, sizeof(line), fp))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+
+        int tilesize = 0;
+        int offset = 0;
+        if (sscanf(line, "%d %n", &tilesize, &offset) != 1 || tilesize < 32 || offset == 0)
+            continue;
+
+        keys.push_back(std::string(line + offset));
+        tilesizes.push_back(tilesize);
+    }
+
+    fclose(fp);
+}
+
+// returns 0 when the key is not cached yet
+static int tile_autotune_load(const path_t& path, const std::string& key)
+{
+    std::vector<std::string> keys;
+    std::vector<int> tilesizes;
+    tile_autotune_read_cache(path, keys, tilesizes);
+
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        if (keys[i] == key)
+            return tilesizes[i];
+    }
+
+    return 0;
+}
+
+static int tile_autotune_store(const path_t& path, const std::string& key, int tilesize)
+{
+    std::vector<std::string> keys;
+    std::vector<int> tilesizes;
+    tile_autotune_read_cache(path, keys, tilesizes);
+
+    bool found = false;
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        if (keys[i] == key)
+        {
+            tilesizes[i] = tilesize;
+            found = true;
+        }
+    }
+    if (!found)
+    {
+        keys.push_back(key);
+        tilesizes.push_back(tilesize);
+    }
+
+#if _WIN32
+    FILE* fp = _wfopen(path.c_str(), L"wb");
+#else
+    FILE* fp = fopen(path.c_str(), "wb");
+#endif
+    if (!fp)
+    {
+        fprintf(stderr, "tilesize cache is not writable\n");
+        return -1;
+    }
+
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        fprintf(fp, "%d %s\n", tilesizes[i], keys[i].c_str());
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+// device local memory this process holds in MB, -1 when the driver does not report it
+static int tile_autotune_heap_usage(int gpuid)
+{
+    if (gpuid == -1)
+        return -1;
+
+    const ncnn::GpuInfo& info = ncnn::get_gpu_info(gpuid);
+    if (!info.support_VK_EXT_memory_budget() || !ncnn::vkGetPhysicalDeviceMemoryProperties2KHR)
+        return -1;
+
+    VkPhysicalDeviceMemoryBudgetPropertiesEXT budget;
+    budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+    budget.pNext = 0;
+
+    VkPhysicalDeviceMemoryProperties2KHR properties;
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+    properties.pNext = &budget;
+
+    ncnn::vkGetPhysicalDeviceMemoryProperties2KHR(info.physical_device(), &properties);
+
+    VkDeviceSize usage = 0;
+    for (uint32_t i = 0; i < properties.memoryProperties.memoryHeapCount; i++)
+    {
+        if (properties.memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+            usage += budget.heapUsage[i];
+    }
+
+    return (int)(usage / 1024 / 1024);
+}
+
+// time each candidate on a 2x2 tile probe and keep the fastest per output pixel
+// the pool allocators keep what a run grew, so the heap usage after the warm up run is the peak so far,
+// candidates go up in size and stop before the next one would take more than its share of the heap budget
+// without a usage report the static policy result stays the ceiling
+// two tile rows let an engine that overlaps rows do so in the probe as well
+template<class T>
+static int tile_autotune(T* engine, int channels, int static_tilesize, int gpuid, int jobs, int verbose)
+{
+    const int usage_base = tile_autotune_heap_usage(gpuid);
+    const bool measured = usage_base >= 0;
+
+    // the proc threads of a device run side by side, 1/5 of the budget is left to the driver and the stripes
+    double limit = 0;
+    if (measured)
+    {
+        const int heap_budget = (int)ncnn::get_gpu_device(gpuid)->get_heap_budget();
+        limit = std::max(heap_budget - usage_base, 0) * 0.8 / std::max(jobs, 1);
+
+        if (verbose)
+            fprintf(stderr, "autotune heap budget %d MB, in use %d MB, %.0f MB per job\n", heap_budget, usage_base, limit);
+    }
+
+    std::vector<int> candidates;
+    for (int i = 0; i < tile_autotune_size_count; i++)
+    {
+        if (tile_autotune_sizes[i] < static_tilesize || (measured && tile_autotune_sizes[i] > static_tilesize))
+            candidates.push_back(tile_autotune_sizes[i]);
+    }
+    candidates.push_back(static_tilesize);
+    std::sort(candidates.begin(), candidates.end());
+
+    const int scale = engine->scale;
+
+    int best_tilesize = static_tilesize;
+    double best_cost = 0;
+    std::vector<double> costs;
+    int last_tilesize = 0;
+    int last_peak = 0;
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        const int tilesize = candidates[i];
+        const int probesize = tilesize * 2;
+
+        // the tile blobs grow with the area
+        if (measured && last_tilesize > 0 && tilesize > static_tilesize)
+        {
+            const double predicted = last_peak * ((double)tilesize * tilesize) / ((double)last_tilesize * last_tilesize);
+            if (predicted > limit)
+            {
+                if (verbose)
+                    fprintf(stderr, "autotune tilesize=%d would take %.0f MB, stop\n", tilesize, predicted);
+                break;
+            }
+        }
+
+        // noise, so that no tile is cheaper than a real one
+        std::vector<unsigned char> pixels(probesize * probesize * channels);
+        for (size_t j = 0; j < pixels.size(); j++)
+        {
+            pixels[j] = (unsigned char)((j * 2654435761u) >> 24);
+        }
+
+        ncnn::Mat inimage(probesize, probesize, (void*)pixels.data(), (size_t)channels, channels);
+        ncnn::Mat outimage(probesize * scale, probesize * scale, (size_t)channels, channels);
+
+        engine->tilesize = tilesize;
+
+        // the first run grows the allocators and warms up the pipelines
+        engine->process(inimage, outimage);
+
+        if (measured)
+        {
+            const int peak = std::max(tile_autotune_heap_usage(gpuid) - usage_base, 0);
+            if (verbose)
+                fprintf(stderr, "autotune tilesize=%d peak %d MB\n", tilesize, peak);
+
+            // a static choice over the budget is still timed, it is what would run anyway
+            if (peak > limit && tilesize > static_tilesize)
+                break;
+
+            last_tilesize = tilesize;
+            last_peak = peak;
+        }
+
+        std::chrono::high_resolution_clock::time_point begin = std::chrono::high_resolution_clock::now();
+        engine->process(inimage, outimage);
+        std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+
+        const double cost = std::chrono::duration<double>(end - begin).count() / ((double)probesize * probesize);
+        costs.push_back(cost);
+
+        if (verbose)
+            fprintf(stderr, "autotune tilesize=%d %.3f us/pixel\n", tilesize, cost * 1e6);
+
+        if (best_cost == 0 || cost < best_cost)
+            best_cost = cost;
+    }
+
+    // the smallest tile within 5% of the best keeps the memory headroom
+    for (size_t i = 0; i < costs.size(); i++)
+    {
+        if (costs[i] <= best_cost * 1.05)
+        {
+            best_tilesize = candidates[i];
+            break;
+        }
+    }
+
+    engine->tilesize = best_tilesize;
+
+    return best_tilesize;
+}
+
+#endif // TILE_AUTOTUNE_H
@@ -0,0 +1,443 @@
+// fused u8 <-> fp32 tile conversion for the cpu path
+
+#ifndef TILE_PIXELS_H
+#define TILE_PIXELS_H
+
+#include <algorithm>
+#include <string.h>
+
+#if __ARM_NEON
+#include <arm_neon.h>
+#endif
+#if __SSE2__
+#include <emmintrin.h>
+#if __SSSE3__
+#include <tmmintrin.h>
+#endif
+#endif
+
+// ncnn
+#include "mat.h"
+
+// interleaved u8 pixels to three planar rows, c0 c1 c2 follow the pixel byte order
+// one instance per channel count, so that the pixel loops carry no channel branch
+// without scaled the values are only converted, for models with the 1/255 in their weights
+template<int channels, bool scaled = true>
+static void tile_unpack_row(const unsigned char* p, int n, float norm, float* c0, float* c1, float* c2)
+{
+    int j = 0;
+#if __ARM_NEON
+    float32x4_t _norm = vdupq_n_f32(norm);
+    for (; j + 15 < n; j += 16)
+    {
+        uint8x16_t _p0, _p1, _p2;
+        if (channels == 3)
+        {
+            uint8x16x3_t _p = vld3q_u8(p);
+            _p0 = _p.val[0];
+            _p1 = _p.val[1];
+            _p2 = _p.val[2];
+        }
+        else
+        {
+            uint8x16x4_t _p = vld4q_u8(p);
+            _p0 = _p.val[0];
+            _p1 = _p.val[1];
+            _p2 = _p.val[2];
+        }
+
+        uint8x16_t _pp[3] = {_p0, _p1, _p2};
+        float* outptr[3] = {c0, c1, c2};
+        for (int q = 0; q < 3; q++)
+        {
+            uint16x8_t _lo = vmovl_u8(vget_low_u8(_pp[q]));
+            uint16x8_t _hi = vmovl_u8(vget_high_u8(_pp[q]));
+            float32x4_t _v[4] = {
+                vcvtq_f32_u32(vmovl_u16(vget_low_u16(_lo))),
+                vcvtq_f32_u32(vmovl_u16(vget_high_u16(_lo))),
+                vcvtq_f32_u32(vmovl_u16(vget_low_u16(_hi))),
+                vcvtq_f32_u32(vmovl_u16(vget_high_u16(_hi)))
+            };
+            for (int k = 0; k < 4; k++)
+            {
+                vst1q_f32(outptr[q] + k * 4, scaled ? vmulq_f32(_v[k], _norm) : _v[k]);
+            }
+        }
+
+        p += 16 * channels;
+        c0 += 16;
+        c1 += 16;
+        c2 += 16;
+    }
+#elif __SSE2__
+    __m128 _norm = _mm_set1_ps(norm);
+    __m128i _zero = _mm_setzero_si128();
+#if __SSSE3__
+    // rgb rgb rgb rgb -> rgbx rgbx rgbx rgbx
+    __m128i _rgb2rgbx = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    // the 16 byte load must stay inside the row for rgb
+    const int nn = channels == 3 ? n - 2 : n;
+#else
+    const int nn = channels == 3 ? 0 : n;
+#endif
+    for (; j + 3 < nn; j += 4)
+    {
+        __m128i _p = _mm_loadu_si128((const __m128i*)p);
+#if __SSSE3__
+        if (channels == 3)
+            _p = _mm_shuffle_epi8(_p, _rgb2rgbx);
+#endif
+        __m128i _lo = _mm_unpacklo_epi8(_p, _zero);
+        __m128i _hi = _mm_unpackhi_epi8(_p, _zero);
+        __m128 _v0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_lo, _zero));
+        __m128 _v1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(_lo, _zero));
+        __m128 _v2 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_hi, _zero));
+        __m128 _v3 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(_hi, _zero));
+        _MM_TRANSPOSE4_PS(_v0, _v1, _v2, _v3);
+        _mm_storeu_ps(c0, scaled ? _mm_mul_ps(_v0, _norm) : _v0);
+        _mm_storeu_ps(c1, scaled ? _mm_mul_ps(_v1, _norm) : _v1);
+        _mm_storeu_ps(c2, scaled ? _mm_mul_ps(_v2, _norm) : _v2);
+
+        p += 4 * channels;
+        c0 += 4;
+        c1 += 4;
+        c2 += 4;
+    }
+#endif
+    for (; j < n; j++)
+    {
+        *c0++ = scaled ? p[0] * norm : p[0];
+        *c1++ = scaled ? p[1] * norm : p[1];
+        *c2++ = scaled ? p[2] * norm : p[2];
+        p += channels;
+    }
+}
+
+// three planar rows back to interleaved u8, c = c * denorm + 0.5 and alpha as is, both saturated
+// without scaled c is taken as is too, for models with the * 255 + 0.5 in their last layer
+template<int channels, bool scaled = true>
+static void tile_pack_row(const float* c0, const float* c1, const float* c2, const float* a, int n, float denorm, unsigned char* p)
+{
+    int j = 0;
+#if __ARM_NEON
+    float32x4_t _denorm = vdupq_n_f32(denorm);
+    float32x4_t _half = vdupq_n_f32(0.5f);
+    for (; j + 7 < n; j += 8)
+    {
+        const float* ptr[3] = {c0, c1, c2};
+        uint8x8_t _pp[4];
+        for (int q = 0; q < 3; q++)
+        {
+            float32x4_t _v0 = vld1q_f32(ptr[q]);
+            float32x4_t _v1 = vld1q_f32(ptr[q] + 4);
+            if (scaled)
+            {
+                _v0 = vmlaq_f32(_half, _v0, _denorm);
+                _v1 = vmlaq_f32(_half, _v1, _denorm);
+            }
+            uint32x4_t _lo = vcvtq_u32_f32(_v0);
+            uint32x4_t _hi = vcvtq_u32_f32(_v1);
+            _pp[q] = vqmovn_u16(vcombine_u16(vqmovn_u32(_lo), vqmovn_u32(_hi)));
+        }
+
+        if (channels == 3)
+        {
+            uint8x8x3_t _p;
+            _p.val[0] = _pp[0];
+            _p.val[1] = _pp[1];
+            _p.val[2] = _pp[2];
+            vst3_u8(p, _p);
+        }
+        else
+        {
+            uint32x4_t _lo = vcvtq_u32_f32(vld1q_f32(a));
+            uint32x4_t _hi = vcvtq_u32_f32(vld1q_f32(a + 4));
+
+            uint8x8x4_t _p;
+            _p.val[0] = _pp[0];
+            _p.val[1] = _pp[1];
+            _p.val[2] = _pp[2];
+            _p.val[3] = vqmovn_u16(vcombine_u16(vqmovn_u32(_lo), vqmovn_u32(_hi)));
+            vst4_u8(p, _p);
+
+            a += 8;
+        }
+
+        p += 8 * channels;
+        c0 += 8;
+        c1 += 8;
+        c2 += 8;
+    }
+#elif __SSE2__
+    __m128 _denorm = _mm_set1_ps(denorm);
+    __m128 _half = _mm_set1_ps(0.5f);
+    __m128 _zero = _mm_setzero_ps();
+    __m128 _255 = _mm_set1_ps(255.f);
+#if __SSSE3__
+    // rgbx rgbx rgbx rgbx -> rgb rgb rgb rgb
+    __m128i _rgbx2rgb = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const int nn = n;
+#else
+    const int nn = channels == 3 ? 0 : n;
+#endif
+    for (; j + 3 < nn; j += 4)
+    {
+        __m128 _v0 = _mm_loadu_ps(c0);
+        __m128 _v1 = _mm_loadu_ps(c1);
+        __m128 _v2 = _mm_loadu_ps(c2);
+        if (scaled)
+        {
+            _v0 = _mm_add_ps(_mm_mul_ps(_v0, _denorm), _half);
+            _v1 = _mm_add_ps(_mm_mul_ps(_v1, _denorm), _half);
+            _v2 = _mm_add_ps(_mm_mul_ps(_v2, _denorm), _half);
+        }
+        __m128 _v3 = channels == 4 ? _mm_loadu_ps(a) : _zero;
+        _MM_TRANSPOSE4_PS(_v0, _v1, _v2, _v3);
+
+        // clamp before the int conversion so that overflow can not wrap
+        __m128i _i0 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_v0, _zero), _255));
+        __m128i _i1 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_v1, _zero), _255));
+        __m128i _i2 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_v2, _zero), _255));
+        __m128i _i3 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_v3, _zero), _255));
+        __m128i _p = _mm_packus_epi16(_mm_packs_epi32(_i0, _i1), _mm_packs_epi32(_i2, _i3));
+
+        if (channels == 4)
+        {
+            _mm_storeu_si128((__m128i*)p, _p);
+            a += 4;
+        }
+#if __SSSE3__
+        else
+        {
+            _p = _mm_shuffle_epi8(_p, _rgbx2rgb);
+            _mm_storel_epi64((__m128i*)p, _p);
+            int v = _mm_cvtsi128_si32(_mm_srli_si128(_p, 8));
+            memcpy(p + 8, &v, 4);
+        }
+#endif
+
+        p += 4 * channels;
+        c0 += 4;
+        c1 += 4;
+        c2 += 4;
+    }
+#endif
+    for (; j < n; j++)
+    {
+        const float v0 = scaled ? *c0++ * denorm + 0.5f : *c0++;
+        const float v1 = scaled ? *c1++ * denorm + 0.5f : *c1++;
+        const float v2 = scaled ? *c2++ * denorm + 0.5f : *c2++;
+        p[0] = (unsigned char)std::min(std::max((int)v0, 0), 255);
+        p[1] = (unsigned char)std::min(std::max((int)v1, 0), 255);
+        p[2] = (unsigned char)std::min(std::max((int)v2, 0), 255);
+        if (channels == 4)
+            p[3] = (unsigned char)std::min(std::max((int)*a++, 0), 255);
+        p += channels;
+    }
+}
+
+typedef void (*tile_unpack_row_func)(const unsigned char*, int, float, float*, float*, float*);
+typedef void (*tile_pack_row_func)(const float*, const float*, const float*, const float*, int, float, unsigned char*);
+
+// the row kernels of an engine, picked once at load for the norm its model takes
+// [0] is for rgb pixels and [1] for rgba, the tile calls only index them by the channel count
+class TilePixels
+{
+public:
+    TilePixels()
+    {
+        select(1 / 255.f, 255.f);
+    }
+
+    // a norm or denorm of 1 takes the kernels that only convert
+    void select(float _norm, float _denorm)
+    {
+        norm = _norm;
+        denorm = _denorm;
+
+        if (norm == 1.f)
+        {
+            unpack_row[0] = tile_unpack_row<3, false>;
+            unpack_row[1] = tile_unpack_row<4, false>;
+        }
+        else
+        {
+            unpack_row[0] = tile_unpack_row<3, true>;
+            unpack_row[1] = tile_unpack_row<4, true>;
+        }
+
+        if (denorm == 1.f)
+        {
+            pack_row[0] = tile_pack_row<3, false>;
+            pack_row[1] = tile_pack_row<4, false>;
+        }
+        else
+        {
+            pack_row[0] = tile_pack_row<3, true>;
+            pack_row[1] = tile_pack_row<4, true>;
+        }
+    }
+
+public:
+    float norm;
+    float denorm;
+    tile_unpack_row_func unpack_row[2];
+    tile_pack_row_func pack_row[2];
+};
+
+// map an index outside [0, n) back inside, same as ncnn copy_make_border
+static inline int tile_border_index(int i, int n, int border_type)
+{
+    if (border_type == ncnn::BORDER_REFLECT)
+        i = i < 0 ? -i : (i >= n ? 2 * n - 2 - i : i);
+    return std::min(std::max(i, 0), n - 1);
+}
+
+// crop roi from interleaved rgb(a) pixels, normalize into planar rgb and pad the border in one pass
+// replaces from_pixels_roi + the norm loop + copy_make_border, bgr reads bgr(a) pixels
+static inline void tile_from_pixels(const unsigned char* pixels, int w, int channels, int roix, int roiy, int roiw, int roih,
+                                    int pad_top, int pad_bottom, int pad_left, int pad_right, int border_type, const TilePixels& kernels,
+                                    ncnn::Mat& out, ncnn::Allocator* allocator, bool bgr)
+{
+    const int outw = roiw + pad_left + pad_right;
+    const int outh = roih + pad_top + pad_bottom;
+
+    // a mat of this size with extra channels keeps them, only the first three planes are written
+    if (out.dims != 3 || out.w != outw || out.h != outh || out.c < 3 || out.elemsize != 4u)
+        out.create(outw, outh, 3, (size_t)4u, allocator);
+
+    ncnn::Mat plane0 = out.channel(bgr ? 2 : 0);
+    ncnn::Mat plane2 = out.channel(bgr ? 0 : 2);
+    ncnn::Mat plane1 = out.channel(1);
+    ncnn::Mat* planes[3] = {&plane0, &plane1, &plane2};
+
+    const tile_unpack_row_func unpack_row = kernels.unpack_row[channels == 4 ? 1 : 0];
+    const float norm = kernels.norm;
+
+    for (int i = 0; i < roih; i++)
+    {
+        const unsigned char* p = pixels + ((roiy + i) * w + roix) * channels;
+
+        unpack_row(p, roiw, norm, plane0.row(pad_top + i) + pad_left, plane1.row(pad_top + i) + pad_left, plane2.row(pad_top + i) + pad_left);
+
+        for (int q = 0; q < 3; q++)
+        {
+            float* outptr = planes[q]->row(pad_top + i) + pad_left;
+            for (int x = 0; x < pad_left; x++)
+            {
+                outptr[x - pad_left] = outptr[tile_border_index(x - pad_left, roiw, border_type)];
+            }
+            for (int x = 0; x < pad_right; x++)
+            {
+                outptr[roiw + x] = outptr[tile_border_index(roiw + x, roiw, border_type)];
+            }
+        }
+    }
+
+    for (int q = 0; q < 3; q++)
+    {
+        ncnn::Mat& plane = *planes[q];
+        for (int y = 0; y < pad_top; y++)
+        {
+            memcpy(plane.row(y), plane.row(pad_top + tile_border_index(y - pad_top, roih, border_type)), outw * sizeof(float));
+        }
+        for (int y = 0; y < pad_bottom; y++)
+        {
+            memcpy(plane.row(pad_top + roih + y), plane.row(pad_top + tile_border_index(roih + y, roih, border_type)), outw * sizeof(float));
+        }
+    }
+}
+
+// the alpha channel of roi as a float plane, values stay in 0~255
+static inline void tile_alpha_from_pixels(const unsigned char* pixels, int w, int roix, int roiy, int roiw, int roih, ncnn::Mat& alpha, ncnn::Allocator* allocator)
+{
+    alpha.create(roiw, roih, 1, (size_t)4u, allocator);
+
+    for (int i = 0; i < roih; i++)
+    {
+        const unsigned char* p = pixels + ((roiy + i) * w + roix) * 4 + 3;
+        float* outptr = alpha.row(i);
+
+        for (int j = 0; j < roiw; j++)
+        {
+            outptr[j] = p[j * 4];
+        }
+    }
+}
+
+// denormalize planar rgb starting at (offx, offy), merge alpha and write interleaved pixels in one pass
+// replaces the * 255 + 0.5 loop + alpha memcpy + to_pixels, bgr writes bgr(a) pixels
+// a denorm of 1 takes values that already carry the + 0.5 and only saturates them
+static inline void tile_to_pixels(const ncnn::Mat& in, int offx, int offy, int outw, int outh, const ncnn::Mat& alpha, const TilePixels& kernels,
+                                  unsigned char* pixels, int stride, int channels, bool bgr)
+{
+    const ncnn::Mat plane0 = in.channel(bgr ? 2 : 0);
+    const ncnn::Mat plane2 = in.channel(bgr ? 0 : 2);
+    const ncnn::Mat plane1 = in.channel(1);
+
+    const tile_pack_row_func pack_row = kernels.pack_row[channels == 4 ? 1 : 0];
+    const float denorm = kernels.denorm;
+
+    for (int i = 0; i < outh; i++)
+    {
+        const float* alphaptr = channels == 4 ? alpha.row(i) : 0;
+
+        pack_row(plane0.row(offy + i) + offx, plane1.row(offy + i) + offx, plane2.row(offy + i) + offx, alphaptr, outw, denorm, pixels + i * stride);
+    }
+}
+
+// outptr = ptr + the residual row upscaled by rscale with nearest, 4x gets one broadcast add per four pixels
+static inline void tile_residual_row(const float* ptr, const float* rptr, int n, int rscale, float* outptr)
+{
+    int j = 0;
+    if (rscale == 4)
+    {
+#if __ARM_NEON
+        for (; j + 3 < n; j += 4)
+        {
+            vst1q_f32(outptr + j, vaddq_f32(vld1q_f32(ptr + j), vdupq_n_f32(rptr[j / 4])));
+        }
+#elif __SSE2__
+        for (; j + 3 < n; j += 4)
+        {
+            _mm_storeu_ps(outptr + j, _mm_add_ps(_mm_loadu_ps(ptr + j), _mm_set1_ps(rptr[j / 4])));
+        }
+#endif
+    }
+    for (; j < n; j++)
+    {
+        outptr[j] = ptr[j] + rptr[j / rscale];
+    }
+}
+
+// tile_to_pixels with the input added back on the way, for the models whose input skips over the net
+// output pixel (x, y) gets residual pixel (roffx + x / rscale, roffy + y / rscale) before the denorm
+// replaces the separate full tile residual loop, the sum only lives in one row that stays in cache
+static inline void tile_to_pixels_residual(const ncnn::Mat& in, int offx, int offy, int outw, int outh,
+                                           const ncnn::Mat& residual, int roffx, int roffy, int rscale,
+                                           const ncnn::Mat& alpha, const TilePixels& kernels, unsigned char* pixels, int stride, int channels, bool bgr)
+{
+    const int planes[3] = {bgr ? 2 : 0, 1, bgr ? 0 : 2};
+
+    const tile_pack_row_func pack_row = kernels.pack_row[channels == 4 ? 1 : 0];
+    const float denorm = kernels.denorm;
+
+    ncnn::Mat sum(outw, 3, (size_t)4u);
+
+    for (int i = 0; i < outh; i++)
+    {
+        for (int q = 0; q < 3; q++)
+        {
+            const float* ptr = in.channel(planes[q]).row(offy + i) + offx;
+            const float* rptr = residual.channel(planes[q]).row(roffy + i / rscale) + roffx;
+
+            tile_residual_row(ptr, rptr, outw, rscale, sum.row(q));
+        }
+
+        const float* alphaptr = channels == 4 ? alpha.row(i) : 0;
+
+        pack_row(sum.row(0), sum.row(1), sum.row(2), alphaptr, outw, denorm, pixels + i * stride);
+    }
+}
+
+#endif // TILE_PIXELS_H
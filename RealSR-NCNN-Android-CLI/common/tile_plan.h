@@ -0,0 +1,116 @@
+// tile layout of one image, shared by the engines
+
+#ifndef TILE_PLAN_H
+#define TILE_PLAN_H
+
+#include <vector>
+
+// tiles of tile_w x tile_h from the top left, the last column and row take what is left
+struct TilePlan
+{
+    int tile_w;
+    int tile_h;
+    int xtiles;
+    int ytiles;
+};
+
+static inline int tile_plan_align(int v, int align)
+{
+    return (v + align - 1) / align * align;
+}
+
+// tilesize is the square the memory budget was picked for, any tile whose padded area fits in the padded
+// square is allowed, the split with the fewest padded pixels wins and its tiles are balanced, so that no
+// edge tile is a thin strip of mostly padding
+// no side of a split is shorter than half the square, a long thin tile pays its padding on the short side
+// tile sides are multiples of align for nets that take aligned inputs, so only the last tile is padded up
+static inline TilePlan tile_plan(int w, int h, int tilesize, int prepadding, int align = 1)
+{
+    const long long budget = (long long)(tilesize + 2 * prepadding) * (tilesize + 2 * prepadding);
+    const int min_side = tilesize / 2 > 1 ? tilesize / 2 : 1;
+
+    // the square grid always fits
+    TilePlan plan;
+    plan.tile_w = tilesize;
+    plan.tile_h = tilesize;
+    plan.xtiles = (w + tilesize - 1) / tilesize;
+    plan.ytiles = (h + tilesize - 1) / tilesize;
+    long long best = (long long)(w + 2 * prepadding * plan.xtiles) * (h + 2 * prepadding * plan.ytiles);
+
+    for (int rows = 1; rows <= h; rows++)
+    {
+        // one column of tiles is the cheapest any row count can get
+        if ((long long)(w + 2 * prepadding) * (h + 2 * prepadding * rows) > best)
+            break;
+
+        const int tile_h = tile_plan_align((h + rows - 1) / rows, align);
+        const int ytiles = (h + tile_h - 1) / tile_h;
+
+        // tile_h only gets shorter with more rows
+        if (ytiles > 1 && tile_h < min_side)
+            break;
+
+        if (ytiles != rows)
+            continue;
+
+        const long long max_w = (budget / (tile_h + 2 * prepadding) - 2 * prepadding) / align * align;
+        if (max_w < 1)
+            continue;
+
+        const int columns = (int)((w + max_w - 1) / max_w);
+        const int tile_w = tile_plan_align((w + columns - 1) / columns, align);
+        const int xtiles = (w + tile_w - 1) / tile_w;
+
+        if (xtiles > 1 && tile_w < min_side)
+            continue;
+
+        const long long cost = (long long)(w + 2 * prepadding * xtiles) * (h + 2 * prepadding * ytiles);
+        if (cost < best || (cost == best && xtiles * ytiles < plan.xtiles * plan.ytiles))
+        {
+            plan.tile_w = tile_w;
+            plan.tile_h = tile_h;
+            plan.xtiles = xtiles;
+            plan.ytiles = ytiles;
+            best = cost;
+        }
+    }
+
+    // a single tile only needs to cover the image
+    if (plan.xtiles == 1)
+        plan.tile_w = w;
+    if (plan.ytiles == 1)
+        plan.tile_h = h;
+
+    return plan;
+}
+
+// windows of a fixed size along one axis, for engines whose input shape can not change
+// the windows are spread evenly and the cores meet in the middle of each overlap, so every core keeps at
+// least prepadding of context except at the image edges, window i starts at origins[i] and its core is
+// [cores[i], cores[i + 1]), a single window longer than the image starts at 0 and is padded past the end
+static inline void tile_plan_windows(int length, int window, int prepadding, std::vector<int>& origins, std::vector<int>& cores)
+{
+    origins.clear();
+    cores.clear();
+
+    int count = 1;
+    if (length > window)
+    {
+        const int step = window - 2 * prepadding > 1 ? window - 2 * prepadding : 1;
+        count = 1 + (length - window + step - 1) / step;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        origins.push_back(count == 1 ? 0 : (int)((long long)i * (length - window) / (count - 1)));
+    }
+
+    cores.push_back(0);
+    for (int i = 0; i + 1 < count; i++)
+    {
+        cores.push_back((origins[i] + window + origins[i + 1]) / 2);
+    }
+    cores.push_back(length);
+}
+
+#endif // TILE_PLAN_H
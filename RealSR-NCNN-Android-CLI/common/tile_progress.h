@@ -0,0 +1,15 @@
+// progress of one image as its tiles finish, shared by the engines and the tile drivers
+
+#ifndef TILE_PROGRESS_H
+#define TILE_PROGRESS_H
+
+// progress runs from 0 to 1, userdata comes back as it was set
+// an engine without a callback keeps printing its progress to stderr
+typedef void (*tile_progress_callback)(void* userdata, float progress);
+
+// for engines run by a driver that reports the whole image itself
+static inline void tile_progress_ignore(void* /*userdata*/, float /*progress*/)
+{
+}
+
+#endif // TILE_PROGRESS_H
@@ -0,0 +1,231 @@
+// split one image into tile row bands shared by several engines, gpu and cpu alike
+
+#ifndef TILE_SPLIT_H
+#define TILE_SPLIT_H
+
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// ncnn
+#include "mat.h"
+#include "platform.h"
+
+#include "tile_progress.h"
+
+template<class T>
+class TileSplitJob;
+
+template<class T>
+class TileSplitWorker
+{
+public:
+    const T* engine;
+    TileSplitJob<T>* job;
+
+    // measured throughput, 0 until the first band is done
+    double seconds_per_row;
+    bool failed;
+};
+
+template<class T>
+class TileSplitJob
+{
+public:
+    const ncnn::Mat* inimage;
+    ncnn::Mat* outimage;
+
+    ncnn::Mutex lock;
+    // a band ended or was given back, the waiting workers look again
+    ncnn::ConditionVariable changed;
+    int next_row;
+    int done_rows;
+    // bands being processed, any of them may still come back
+    int running_bands;
+    std::vector<int> returned_bands;
+    std::vector<TileSplitWorker<T> > workers;
+
+    // whole image progress as bands finish, optional
+    tile_progress_callback progress;
+    void* progress_userdata;
+
+    // next band of rows for the worker, false when it should stop
+    bool take(TileSplitWorker<T>& worker, int& y0, int& y1)
+    {
+        const int h = inimage->h;
+        const int prepadding = worker.engine->prepadding;
+
+        // one tile row per band, the context rows on both sides come from the neighbours
+        int window_rows = worker.engine->tilesize;
+        while (window_rows < prepadding * 4)
+            window_rows += worker.engine->tilesize;
+        const int band_rows = window_rows - prepadding * 2;
+
+        lock.lock();
+
+        // a worker only leaves when no band can come back to it,
+        // the tail it leaves to a faster device may still be given up
+        for (;;)
+        {
+            if (worker.failed)
+            {
+                lock.unlock();
+                return false;
+            }
+
+            // bands given up by a failed worker go first, as they are
+            if (!returned_bands.empty())
+            {
+                y1 = returned_bands.back();
+                returned_bands.pop_back();
+                y0 = returned_bands.back();
+                returned_bands.pop_back();
+                running_bands++;
+
+                lock.unlock();
+                return true;
+            }
+
+            const int remaining = h - next_row;
+            if (remaining <= 0 && running_bands == 0)
+            {
+                lock.unlock();
+                return false;
+            }
+
+            // leave the tail to a faster device when it would finish everything left
+            // before this worker finishes a single band
+            bool wait = remaining <= 0;
+            if (!wait && worker.seconds_per_row > 0)
+            {
+                double fastest = worker.seconds_per_row;
+                for (size_t i = 0; i < workers.size(); i++)
+                {
+                    if (!workers[i].failed && workers[i].seconds_per_row > 0)
+                        fastest = std::min(fastest, workers[i].seconds_per_row);
+                }
+
+                wait = std::min(band_rows, remaining) * worker.seconds_per_row > remaining * fastest;
+            }
+
+            if (!wait)
+                break;
+
+            changed.wait(lock);
+        }
+
+        y0 = next_row;
+        y1 = std::min(y0 + band_rows, h);
+        next_row = y1;
+        running_bands++;
+
+        lock.unlock();
+        return true;
+    }
+};
+
+template<class T>
+static void* tile_split_worker(void* args)
+{
+    TileSplitWorker<T>& worker = *(TileSplitWorker<T>*)args;
+    TileSplitJob<T>& job = *worker.job;
+
+    const ncnn::Mat& inimage = *job.inimage;
+    ncnn::Mat& outimage = *job.outimage;
+
+    const int w = inimage.w;
+    const int h = inimage.h;
+    const int c = inimage.elempack;
+    const int scale = worker.engine->scale;
+    const int prepadding = worker.engine->prepadding;
+
+    const size_t instride = (size_t)w * c;
+    const size_t outstride = (size_t)w * scale * c;
+
+    ncnn::Mat outband;
+
+    int y0;
+    int y1;
+    while (job.take(worker, y0, y1))
+    {
+        const int wy0 = std::max(y0 - prepadding, 0);
+        const int wy1 = std::min(y1 + prepadding, h);
+
+        // the input window is a view, the output band is copied out without its context rows
+        ncnn::Mat inband(w, wy1 - wy0, (void*)((const unsigned char*)inimage.data + wy0 * instride), (size_t)c, c);
+        outband.create(w * scale, (wy1 - wy0) * scale, (size_t)c, c);
+
+        std::chrono::high_resolution_clock::time_point begin = std::chrono::high_resolution_clock::now();
+        int ret = worker.engine->process(inband, outband);
+        std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+
+        if (ret == 0)
+        {
+            memcpy((unsigned char*)outimage.data + y0 * scale * outstride, (const unsigned char*)outband.data + (y0 - wy0) * scale * outstride, (y1 - y0) * scale * outstride);
+        }
+
+        const double seconds_per_row = std::chrono::duration<double>(end - begin).count() / (y1 - y0);
+
+        job.lock.lock();
+        job.running_bands--;
+        if (ret != 0)
+        {
+            // the band goes back to the others
+            worker.failed = true;
+            job.returned_bands.push_back(y0);
+            job.returned_bands.push_back(y1);
+        }
+        else
+        {
+            job.done_rows += y1 - y0;
+            worker.seconds_per_row = worker.seconds_per_row == 0 ? seconds_per_row : worker.seconds_per_row * 0.5 + seconds_per_row * 0.5;
+
+            if (job.progress)
+                job.progress(job.progress_userdata, (float)job.done_rows / h);
+        }
+        job.changed.broadcast();
+        job.lock.unlock();
+    }
+
+    return 0;
+}
+
+// engines may repeat to run several bands on one device, all of them share scale and prepadding
+template<class T>
+static int tile_split_process(const std::vector<const T*>& engines, const ncnn::Mat& inimage, ncnn::Mat& outimage, tile_progress_callback progress = 0, void* userdata = 0)
+{
+    TileSplitJob<T> job;
+    job.inimage = &inimage;
+    job.outimage = &outimage;
+    job.next_row = 0;
+    job.done_rows = 0;
+    job.running_bands = 0;
+    job.progress = progress;
+    job.progress_userdata = userdata;
+    job.workers.resize(engines.size());
+
+    for (size_t i = 0; i < engines.size(); i++)
+    {
+        job.workers[i].engine = engines[i];
+        job.workers[i].job = &job;
+        job.workers[i].seconds_per_row = 0;
+        job.workers[i].failed = false;
+    }
+
+    std::vector<ncnn::Thread*> threads(engines.size());
+    for (size_t i = 0; i < engines.size(); i++)
+    {
+        threads[i] = new ncnn::Thread(tile_split_worker<T>, (void*)&job.workers[i]);
+    }
+
+    for (size_t i = 0; i < engines.size(); i++)
+    {
+        threads[i]->join();
+        delete threads[i];
+    }
+
+    return job.done_rows == inimage.h ? 0 : -1;
+}
+
+#endif // TILE_SPLIT_H
@@ -0,0 +1,710 @@
+// stripe processing for images too large to upscale in memory
+// png rows are decoded and encoded incrementally with zlib, only a few tile rows are held at once
+
+#ifndef TILE_STRIPE_H
+#define TILE_STRIPE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include <zlib.h>
+
+// ncnn
+#include "mat.h"
+
+#include "filesystem_utils.h"
+#include "tile_progress.h"
+
+static const unsigned char stripe_png_signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+
+static unsigned int stripe_png_get_u32(const unsigned char* p)
+{
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | (unsigned int)p[3];
+}
+
+static void stripe_png_put_u32(unsigned char* p, unsigned int v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char)v;
+}
+
+static int stripe_png_paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return a;
+    if (pb <= pc)
+        return b;
+    return c;
+}
+
+static FILE* stripe_fopen(const path_t& path, bool write)
+{
+#if _WIN32
+    return _wfopen(path.c_str(), write ? L"wb" : L"rb");
+#else
+    return fopen(path.c_str(), write ? "wb" : "rb");
+#endif
+}
+
+// row source of the stripe loop, a streamed png or pixels already decoded by the caller
+class StripeReader
+{
+public:
+    StripeReader() : w(0), h(0), c(0), bgr(false), fp(0), zinit(false), pixels(0), y(0)
+    {
+    }
+
+    ~StripeReader()
+    {
+        close();
+    }
+
+    // 8/16 bit gray, gray alpha, rgb, rgba and 8 bit palette without interlace
+    // anything else returns -1 and goes through the regular decoder
+    // rows come out in bgr(a) order when _bgr is set, pass the input_bgr of the engine
+    int open_png(const path_t& path, bool _bgr)
+    {
+        close();
+
+        bgr = _bgr;
+
+        fp = stripe_fopen(path, false);
+        if (!fp)
+            return -1;
+
+        unsigned char sig[8];
+        if (fread(sig, 1, 8, fp) != 8 || memcmp(sig, stripe_png_signature, 8) != 0)
+            return fail();
+
+        bool has_ihdr = false;
+        bool has_trns = false;
+        for (;;)
+        {
+            unsigned int length;
+            unsigned char type[4];
+            if (read_chunk_header(length, type) != 0)
+                return fail();
+
+            if (memcmp(type, "IHDR", 4) == 0)
+            {
+                unsigned char ihdr[13];
+                if (length != 13 || fread(ihdr, 1, 13, fp) != 13 || fseek(fp, 4, SEEK_CUR) != 0)
+                    return fail();
+
+                w = (int)stripe_png_get_u32(ihdr);
+                h = (int)stripe_png_get_u32(ihdr + 4);
+                depth = ihdr[8];
+                color_type = ihdr[9];
+
+                // compression, filter method and interlace
+                if (w <= 0 || h <= 0 || ihdr[10] != 0 || ihdr[11] != 0 || ihdr[12] != 0)
+                    return fail();
+
+                if (color_type != 0 && color_type != 2 && color_type != 3 && color_type != 4 && color_type != 6)
+                    return fail();
+
+                if (color_type == 3 ? depth != 8 : (depth != 8 && depth != 16))
+                    return fail();
+
+                has_ihdr = true;
+            }
+            else if (memcmp(type, "PLTE", 4) == 0)
+            {
+                if (length % 3 != 0 || length > 256 * 3)
+                    return fail();
+
+                unsigned char plte[256 * 3];
+                if (fread(plte, 1, length, fp) != length || fseek(fp, 4, SEEK_CUR) != 0)
+                    return fail();
+
+                palette.assign(256 * 4, 255);
+                for (unsigned int i = 0; i < length / 3; i++)
+                {
+                    palette[i * 4] = plte[i * 3];
+                    palette[i * 4 + 1] = plte[i * 3 + 1];
+                    palette[i * 4 + 2] = plte[i * 3 + 2];
+                }
+            }
+            else if (memcmp(type, "tRNS", 4) == 0)
+            {
+                // color key transparency is left to the regular decoder
+                if (!has_ihdr || color_type != 3 || palette.empty() || length > 256)
+                    return fail();
+
+                unsigned char trns[256];
+                if (fread(trns, 1, length, fp) != length || fseek(fp, 4, SEEK_CUR) != 0)
+                    return fail();
+
+                for (unsigned int i = 0; i < length; i++)
+                {
+                    palette[i * 4 + 3] = trns[i];
+                }
+                has_trns = true;
+            }
+            else if (memcmp(type, "IDAT", 4) == 0)
+            {
+                idat_left = length;
+                break;
+            }
+            else if (memcmp(type, "IEND", 4) == 0)
+            {
+                return fail();
+            }
+            else
+            {
+                if (fseek(fp, (long)length + 4, SEEK_CUR) != 0)
+                    return fail();
+            }
+        }
+
+        if (!has_ihdr || (color_type == 3 && palette.empty()))
+            return fail();
+
+        const int raw_channels = color_type == 2 ? 3 : color_type == 4 ? 2 : color_type == 6 ? 4 : 1;
+
+        bpp = raw_channels * depth / 8;
+        rowbytes = (size_t)w * bpp;
+        c = (color_type == 4 || color_type == 6 || (color_type == 3 && has_trns)) ? 4 : 3;
+
+        memset(&zs, 0, sizeof(zs));
+        if (inflateInit(&zs) != Z_OK)
+            return fail();
+        zinit = true;
+
+        inbuf.resize(65536);
+        prev_row.assign(rowbytes + 1, 0);
+        cur_row.resize(rowbytes + 1);
+        idat_end = false;
+        y = 0;
+
+        return 0;
+    }
+
+    // the pixels stay owned by the caller
+    void open_memory(const unsigned char* _pixels, int _w, int _h, int _c)
+    {
+        close();
+
+        pixels = _pixels;
+        w = _w;
+        h = _h;
+        c = _c;
+        y = 0;
+    }
+
+    // next count rows as packed 8 bit pixels with c channels
+    int read_rows(unsigned char* dst, int count)
+    {
+        if (count <= 0)
+            return 0;
+
+        if (y + count > h)
+            return -1;
+
+        const size_t stride = (size_t)w * c;
+
+        if (pixels)
+        {
+            memcpy(dst, pixels + y * stride, count * stride);
+            y += count;
+            return 0;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            if (inflate_row() != 0)
+                return -1;
+
+            expand_row(dst + i * stride);
+            y++;
+        }
+
+        return 0;
+    }
+
+    void close()
+    {
+        if (zinit)
+        {
+            inflateEnd(&zs);
+            zinit = false;
+        }
+        if (fp)
+        {
+            fclose(fp);
+            fp = 0;
+        }
+        pixels = 0;
+    }
+
+public:
+    int w;
+    int h;
+    int c;
+
+private:
+    int fail()
+    {
+        close();
+        return -1;
+    }
+
+    int read_chunk_header(unsigned int& length, unsigned char type[4])
+    {
+        unsigned char header[8];
+        if (fread(header, 1, 8, fp) != 8)
+            return -1;
+
+        length = stripe_png_get_u32(header);
+        memcpy(type, header + 4, 4);
+        return length > 0x7fffffff ? -1 : 0;
+    }
+
+    // next compressed bytes across consecutive idat chunks
+    int refill()
+    {
+        while (idat_left == 0)
+        {
+            unsigned int length;
+            unsigned char type[4];
+            if (idat_end || fseek(fp, 4, SEEK_CUR) != 0 || read_chunk_header(length, type) != 0 || memcmp(type, "IDAT", 4) != 0)
+            {
+                idat_end = true;
+                return -1;
+            }
+            idat_left = length;
+        }
+
+        const size_t n = std::min((size_t)idat_left, inbuf.size());
+        if (fread(inbuf.data(), 1, n, fp) != n)
+            return -1;
+
+        idat_left -= (unsigned int)n;
+        zs.next_in = inbuf.data();
+        zs.avail_in = (uInt)n;
+        return 0;
+    }
+
+    int inflate_row()
+    {
+        zs.next_out = cur_row.data();
+        zs.avail_out = (uInt)(rowbytes + 1);
+
+        while (zs.avail_out > 0)
+        {
+            if (zs.avail_in == 0 && refill() != 0)
+                return -1;
+
+            int ret = inflate(&zs, Z_NO_FLUSH);
+            if (ret == Z_STREAM_END && zs.avail_out > 0)
+                return -1;
+            if (ret != Z_OK && ret != Z_STREAM_END)
+                return -1;
+        }
+
+        // undo the row filter against the previous row, prev_row[0] keeps a zero left edge
+        const int filter = cur_row[0];
+        unsigned char* p = cur_row.data() + 1;
+        const unsigned char* up = prev_row.data() + 1;
+        switch (filter)
+        {
+        case 0:
+            break;
+        case 1:
+            for (size_t i = bpp; i < rowbytes; i++)
+                p[i] = (unsigned char)(p[i] + p[i - bpp]);
+            break;
+        case 2:
+            for (size_t i = 0; i < rowbytes; i++)
+                p[i] = (unsigned char)(p[i] + up[i]);
+            break;
+        case 3:
+            for (size_t i = 0; i < rowbytes; i++)
+            {
+                const int left = i >= (size_t)bpp ? p[i - bpp] : 0;
+                p[i] = (unsigned char)(p[i] + ((left + up[i]) >> 1));
+            }
+            break;
+        case 4:
+            for (size_t i = 0; i < rowbytes; i++)
+            {
+                const int left = i >= (size_t)bpp ? p[i - bpp] : 0;
+                const int upleft = i >= (size_t)bpp ? up[i - bpp] : 0;
+                p[i] = (unsigned char)(p[i] + stripe_png_paeth(left, up[i], upleft));
+            }
+            break;
+        default:
+            return -1;
+        }
+
+        std::swap(cur_row, prev_row);
+        return 0;
+    }
+
+    // the unfiltered row sits in prev_row after inflate_row
+    void expand_row(unsigned char* dst) const
+    {
+        const unsigned char* p = prev_row.data() + 1;
+        const int step = depth / 8;
+
+        if (color_type == 3)
+        {
+            for (int x = 0; x < w; x++)
+            {
+                const unsigned char* rgba = &palette[p[x] * 4];
+                for (int k = 0; k < c; k++)
+                    *dst++ = rgba[k];
+            }
+        }
+        else if (color_type == 0 || color_type == 4)
+        {
+            // gray to rgb, big endian samples keep the high byte first
+            const int raw_channels = color_type == 0 ? 1 : 2;
+            for (int x = 0; x < w; x++)
+            {
+                const unsigned char v = p[0];
+                *dst++ = v;
+                *dst++ = v;
+                *dst++ = v;
+                if (raw_channels == 2)
+                    *dst++ = p[step];
+                p += raw_channels * step;
+            }
+        }
+        else
+        {
+            for (int x = 0; x < w; x++)
+            {
+                for (int k = 0; k < c; k++)
+                    *dst++ = p[k * step];
+                p += c * step;
+            }
+        }
+
+        if (bgr)
+        {
+            dst -= (size_t)w * c;
+            for (int x = 0; x < w; x++)
+            {
+                std::swap(dst[x * c], dst[x * c + 2]);
+            }
+        }
+    }
+
+private:
+    bool bgr;
+    FILE* fp;
+    z_stream zs;
+    bool zinit;
+    int depth;
+    int color_type;
+    int bpp;
+    size_t rowbytes;
+    unsigned int idat_left;
+    bool idat_end;
+    std::vector<unsigned char> palette;
+    std::vector<unsigned char> inbuf;
+    std::vector<unsigned char> prev_row;
+    std::vector<unsigned char> cur_row;
+
+    const unsigned char* pixels;
+    int y;
+};
+
+// png encoder taking rows as they are produced
+class StripeWriter
+{
+public:
+    StripeWriter() : fp(0), zinit(false), failed(false), bgr(false)
+    {
+    }
+
+    ~StripeWriter()
+    {
+        if (zinit)
+            deflateEnd(&zs);
+        if (fp)
+            fclose(fp);
+    }
+
+    // rows are taken in bgr(a) order when _bgr is set, pass the output_bgr of the engine
+    int open_png(const path_t& path, int _w, int _h, int _c, bool _bgr)
+    {
+        w = _w;
+        h = _h;
+        c = _c;
+        bgr = _bgr;
+
+        fp = stripe_fopen(path, true);
+        if (!fp)
+            return -1;
+
+        memset(&zs, 0, sizeof(zs));
+        // fast level, the filter choice does most of the work on upscaled content
+        if (deflateInit(&zs, 1) != Z_OK)
+            return -1;
+        zinit = true;
+
+        const size_t rowbytes = (size_t)w * c;
+        prev_row.assign(rowbytes, 0);
+        cur_row.resize(rowbytes);
+        filtered.resize(rowbytes + 1);
+        candidate.resize(rowbytes + 1);
+        outbuf.resize(65536);
+
+        unsigned char ihdr[13];
+        stripe_png_put_u32(ihdr, (unsigned int)w);
+        stripe_png_put_u32(ihdr + 4, (unsigned int)h);
+        ihdr[8] = 8;
+        ihdr[9] = c == 4 ? 6 : 2;
+        ihdr[10] = 0;
+        ihdr[11] = 0;
+        ihdr[12] = 0;
+
+        if (fwrite(stripe_png_signature, 1, 8, fp) != 8 || write_chunk("IHDR", ihdr, 13) != 0)
+            return -1;
+
+        return 0;
+    }
+
+    int write_rows(const unsigned char* src, int count)
+    {
+        const size_t rowbytes = (size_t)w * c;
+
+        for (int i = 0; i < count && !failed; i++)
+        {
+            memcpy(cur_row.data(), src + i * rowbytes, rowbytes);
+            if (bgr)
+            {
+                for (int x = 0; x < w; x++)
+                {
+                    std::swap(cur_row[x * c], cur_row[x * c + 2]);
+                }
+            }
+
+            filter_row();
+
+            zs.next_in = filtered.data();
+            zs.avail_in = (uInt)(rowbytes + 1);
+            if (deflate_out(Z_NO_FLUSH) != 0)
+                failed = true;
+
+            std::swap(cur_row, prev_row);
+        }
+
+        return failed ? -1 : 0;
+    }
+
+    int close()
+    {
+        if (!fp)
+            return -1;
+
+        if (!failed && (deflate_out(Z_FINISH) != 0 || write_chunk("IEND", 0, 0) != 0))
+            failed = true;
+
+        deflateEnd(&zs);
+        zinit = false;
+
+        if (fclose(fp) != 0)
+            failed = true;
+        fp = 0;
+
+        return failed ? -1 : 0;
+    }
+
+private:
+    // per row filter with the smallest sum of absolute residuals, as stb_image_write does
+    void filter_row()
+    {
+        const size_t rowbytes = (size_t)w * c;
+        const unsigned char* p = cur_row.data();
+        const unsigned char* up = prev_row.data();
+
+        long best_cost = -1;
+        for (int filter = 0; filter < 5; filter++)
+        {
+            unsigned char* f = candidate.data() + 1;
+            candidate[0] = (unsigned char)filter;
+
+            long cost = 0;
+            for (size_t i = 0; i < rowbytes; i++)
+            {
+                const int left = i >= (size_t)c ? p[i - c] : 0;
+                const int upleft = i >= (size_t)c ? up[i - c] : 0;
+
+                int pred = 0;
+                if (filter == 1)
+                    pred = left;
+                else if (filter == 2)
+                    pred = up[i];
+                else if (filter == 3)
+                    pred = (left + up[i]) >> 1;
+                else if (filter == 4)
+                    pred = stripe_png_paeth(left, up[i], upleft);
+
+                f[i] = (unsigned char)(p[i] - pred);
+                cost += abs((signed char)f[i]);
+            }
+
+            if (best_cost < 0 || cost < best_cost)
+            {
+                best_cost = cost;
+                std::swap(candidate, filtered);
+            }
+        }
+    }
+
+    int deflate_out(int flush)
+    {
+        for (;;)
+        {
+            zs.next_out = outbuf.data();
+            zs.avail_out = (uInt)outbuf.size();
+
+            int ret = deflate(&zs, flush);
+            if (ret == Z_STREAM_ERROR)
+                return -1;
+
+            const unsigned int n = (unsigned int)(outbuf.size() - zs.avail_out);
+            if (n > 0 && write_chunk("IDAT", outbuf.data(), n) != 0)
+                return -1;
+
+            if (flush == Z_FINISH ? ret == Z_STREAM_END : (zs.avail_in == 0 && zs.avail_out > 0))
+                return 0;
+        }
+    }
+
+    int write_chunk(const char* type, const unsigned char* data, unsigned int length)
+    {
+        unsigned char header[8];
+        stripe_png_put_u32(header, length);
+        memcpy(header + 4, type, 4);
+
+        uLong crc = crc32(0L, header + 4, 4);
+        if (length > 0)
+            crc = crc32(crc, data, length);
+
+        unsigned char footer[4];
+        stripe_png_put_u32(footer, (unsigned int)crc);
+
+        if (fwrite(header, 1, 8, fp) != 8)
+            return -1;
+        if (length > 0 && fwrite(data, 1, length, fp) != length)
+            return -1;
+        if (fwrite(footer, 1, 4, fp) != 4)
+            return -1;
+
+        return 0;
+    }
+
+private:
+    FILE* fp;
+    z_stream zs;
+    bool zinit;
+    bool failed;
+    bool bgr;
+    int w;
+    int h;
+    int c;
+    std::vector<unsigned char> prev_row;
+    std::vector<unsigned char> cur_row;
+    std::vector<unsigned char> filtered;
+    std::vector<unsigned char> candidate;
+    std::vector<unsigned char> outbuf;
+};
+
+// output bytes one stripe window may hold
+static const size_t stripe_window_bytes = 64 * 1024 * 1024;
+
+// every window but the last recomputes 2 * prepadding rows of context, so a window is made
+// 32 prepaddings tall to keep that under 7%, in whole tiles, unless its output rows
+// outgrow stripe_window_bytes, and never less than 4 prepaddings
+// the whole tile rounding goes down so the byte cap holds, the floor may then be a partial tile
+static inline int stripe_window_rows(int tilesize, int prepadding, int w, int h, int c, int scale)
+{
+    const size_t row_bytes = std::max((size_t)w * scale * c * scale, (size_t)1);
+    const int budget_rows = (int)std::min(stripe_window_bytes / row_bytes, (size_t)h);
+
+    int window_rows = std::max(prepadding * 32, tilesize);
+    window_rows = std::min(window_rows, budget_rows);
+    if (window_rows >= tilesize)
+        window_rows = window_rows / tilesize * tilesize;
+    window_rows = std::max(window_rows, prepadding * 4);
+
+    return std::min(window_rows, h);
+}
+
+// feed the engine one window of tile rows at a time, each window keeps prepadding rows of real context
+// above and below its stripe so the seams see the same overlap as the tiles inside the engine
+template<class T>
+static int stripe_process(const T* engine, StripeReader& reader, StripeWriter& writer, tile_progress_callback progress = 0, void* userdata = 0)
+{
+    const int w = reader.w;
+    const int h = reader.h;
+    const int c = reader.c;
+    const int scale = engine->scale;
+    const int prepadding = engine->prepadding;
+
+    const int window_rows = stripe_window_rows(engine->tilesize, prepadding, w, h, c, scale);
+
+    const size_t instride = (size_t)w * c;
+    const size_t outstride = (size_t)w * scale * c;
+
+    std::vector<unsigned char> inrows(window_rows * instride);
+    std::vector<unsigned char> outrows(window_rows * scale * outstride);
+
+    int wy0 = 0;
+    int wrows = 0;
+    for (int y0 = 0; y0 < h;)
+    {
+        // drop the rows above the context of this stripe
+        const int drop = std::max(y0 - prepadding, 0) - wy0;
+        if (drop > 0)
+        {
+            memmove(inrows.data(), inrows.data() + drop * instride, (wrows - drop) * instride);
+            wy0 += drop;
+            wrows -= drop;
+        }
+
+        const int wy1 = std::min(wy0 + window_rows, h);
+        if (reader.read_rows(inrows.data() + wrows * instride, wy1 - wy0 - wrows) != 0)
+        {
+            fprintf(stderr, "stripe decode failed at row %d\n", wy0 + wrows);
+            return -1;
+        }
+        wrows = wy1 - wy0;
+
+        const int y1 = wy1 == h ? h : wy1 - prepadding;
+
+        ncnn::Mat inimage(w, wrows, (void*)inrows.data(), (size_t)c, c);
+        ncnn::Mat outimage(w * scale, wrows * scale, (void*)outrows.data(), (size_t)c, c);
+
+        if (engine->process(inimage, outimage) != 0)
+            return -1;
+
+        if (writer.write_rows(outrows.data() + (y0 - wy0) * scale * outstride, (y1 - y0) * scale) != 0)
+        {
+            fprintf(stderr, "stripe encode failed at row %d\n", y0 * scale);
+            return -1;
+        }
+
+        y0 = y1;
+
+        if (progress)
+            progress(userdata, (float)y0 / h);
+    }
+
+    return 0;
+}
+
+#endif // TILE_STRIPE_H
@@ -0,0 +1,257 @@
+// cache blocked tta transform and merge for the cpu path
+
+#ifndef TILE_TTA_H
+#define TILE_TTA_H
+
+#include <algorithm>
+#include <string.h>
+
+#if __ARM_NEON
+#include <arm_neon.h>
+#endif
+#if __SSE2__
+#include <emmintrin.h>
+#endif
+
+// ncnn
+#include "mat.h"
+
+// dst[x][y] = src[y][x], walked in 16x16 blocks so that both sides stay in cache
+static void tta_transpose(const float* src, int srcstride, float* dst, int dststride, int h, int w)
+{
+    for (int by = 0; by < h; by += 16)
+    {
+        const int ey = std::min(by + 16, h);
+        for (int bx = 0; bx < w; bx += 16)
+        {
+            const int ex = std::min(bx + 16, w);
+
+            int y = by;
+#if __ARM_NEON || __SSE2__
+            for (; y + 3 < ey; y += 4)
+            {
+                const float* p = src + y * srcstride;
+                int x = bx;
+                for (; x + 3 < ex; x += 4)
+                {
+#if __ARM_NEON
+                    float32x4x2_t _t01 = vtrnq_f32(vld1q_f32(p + x), vld1q_f32(p + srcstride + x));
+                    float32x4x2_t _t23 = vtrnq_f32(vld1q_f32(p + srcstride * 2 + x), vld1q_f32(p + srcstride * 3 + x));
+                    vst1q_f32(dst + x * dststride + y, vcombine_f32(vget_low_f32(_t01.val[0]), vget_low_f32(_t23.val[0])));
+                    vst1q_f32(dst + (x + 1) * dststride + y, vcombine_f32(vget_low_f32(_t01.val[1]), vget_low_f32(_t23.val[1])));
+                    vst1q_f32(dst + (x + 2) * dststride + y, vcombine_f32(vget_high_f32(_t01.val[0]), vget_high_f32(_t23.val[0])));
+                    vst1q_f32(dst + (x + 3) * dststride + y, vcombine_f32(vget_high_f32(_t01.val[1]), vget_high_f32(_t23.val[1])));
+#else
+                    __m128 _r0 = _mm_loadu_ps(p + x);
+                    __m128 _r1 = _mm_loadu_ps(p + srcstride + x);
+                    __m128 _r2 = _mm_loadu_ps(p + srcstride * 2 + x);
+                    __m128 _r3 = _mm_loadu_ps(p + srcstride * 3 + x);
+                    _MM_TRANSPOSE4_PS(_r0, _r1, _r2, _r3);
+                    _mm_storeu_ps(dst + x * dststride + y, _r0);
+                    _mm_storeu_ps(dst + (x + 1) * dststride + y, _r1);
+                    _mm_storeu_ps(dst + (x + 2) * dststride + y, _r2);
+                    _mm_storeu_ps(dst + (x + 3) * dststride + y, _r3);
+#endif
+                }
+                for (; x < ex; x++)
+                {
+                    dst[x * dststride + y] = p[x];
+                    dst[x * dststride + y + 1] = p[srcstride + x];
+                    dst[x * dststride + y + 2] = p[srcstride * 2 + x];
+                    dst[x * dststride + y + 3] = p[srcstride * 3 + x];
+                }
+            }
+#endif
+            for (; y < ey; y++)
+            {
+                const float* p = src + y * srcstride;
+                for (int x = bx; x < ex; x++)
+                {
+                    dst[x * dststride + y] = p[x];
+                }
+            }
+        }
+    }
+}
+
+// dst[j] = src[n - 1 - j]
+static void tta_reverse_row(const float* src, float* dst, int n)
+{
+    const float* p = src + n;
+    int j = 0;
+#if __ARM_NEON
+    for (; j + 3 < n; j += 4)
+    {
+        p -= 4;
+        float32x4_t _v = vrev64q_f32(vld1q_f32(p));
+        vst1q_f32(dst, vcombine_f32(vget_high_f32(_v), vget_low_f32(_v)));
+        dst += 4;
+    }
+#elif __SSE2__
+    for (; j + 3 < n; j += 4)
+    {
+        p -= 4;
+        __m128 _v = _mm_loadu_ps(p);
+        _mm_storeu_ps(dst, _mm_shuffle_ps(_v, _v, _MM_SHUFFLE(0, 1, 2, 3)));
+        dst += 4;
+    }
+#endif
+    for (; j < n; j++)
+    {
+        *dst++ = *--p;
+    }
+}
+
+// dst[j] = (dst[j] + a[j] + b[j] + c[-j] + d[-j]) * scale, dst is overwritten when accumulate is false
+template<bool accumulate>
+static void tta_sum_row(const float* a, const float* b, const float* c, const float* d, int n, float scale, float* dst)
+{
+    int j = 0;
+#if __ARM_NEON
+    float32x4_t _scale = vdupq_n_f32(scale);
+    for (; j + 3 < n; j += 4)
+    {
+        float32x4_t _c = vrev64q_f32(vld1q_f32(c - j - 3));
+        float32x4_t _d = vrev64q_f32(vld1q_f32(d - j - 3));
+        _c = vcombine_f32(vget_high_f32(_c), vget_low_f32(_c));
+        _d = vcombine_f32(vget_high_f32(_d), vget_low_f32(_d));
+
+        float32x4_t _v = vaddq_f32(vaddq_f32(vld1q_f32(a + j), vld1q_f32(b + j)), vaddq_f32(_c, _d));
+        if (accumulate)
+            _v = vaddq_f32(vld1q_f32(dst + j), _v);
+        vst1q_f32(dst + j, vmulq_f32(_v, _scale));
+    }
+#elif __SSE2__
+    __m128 _scale = _mm_set1_ps(scale);
+    for (; j + 3 < n; j += 4)
+    {
+        __m128 _c = _mm_loadu_ps(c - j - 3);
+        __m128 _d = _mm_loadu_ps(d - j - 3);
+        _c = _mm_shuffle_ps(_c, _c, _MM_SHUFFLE(0, 1, 2, 3));
+        _d = _mm_shuffle_ps(_d, _d, _MM_SHUFFLE(0, 1, 2, 3));
+
+        __m128 _v = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(a + j), _mm_loadu_ps(b + j)), _mm_add_ps(_c, _d));
+        if (accumulate)
+            _v = _mm_add_ps(_mm_loadu_ps(dst + j), _v);
+        _mm_storeu_ps(dst + j, _mm_mul_ps(_v, _scale));
+    }
+#endif
+    for (; j < n; j++)
+    {
+        float v = a[j] + b[j] + c[-j] + d[-j];
+        if (accumulate)
+            v += dst[j];
+        dst[j] = v * scale;
+    }
+}
+
+// dst[j] += a[j], the running sums of the feature cache
+static inline void tta_add_row(const float* a, int n, float* dst)
+{
+    int j = 0;
+#if __ARM_NEON
+    for (; j + 3 < n; j += 4)
+    {
+        vst1q_f32(dst + j, vaddq_f32(vld1q_f32(dst + j), vld1q_f32(a + j)));
+    }
+#elif __SSE2__
+    for (; j + 3 < n; j += 4)
+    {
+        _mm_storeu_ps(dst + j, _mm_add_ps(_mm_loadu_ps(dst + j), _mm_loadu_ps(a + j)));
+    }
+#endif
+    for (; j < n; j++)
+    {
+        dst[j] += a[j];
+    }
+}
+
+// fill in_tile[1..7] with the flipped and transposed copies of in_tile[0]
+// 1 vflip, 2 hflip, 3 both, 4 transpose, 5..7 are 1..3 applied to 4
+static void tta_transform(ncnn::Mat in_tile[8], ncnn::Allocator* allocator)
+{
+    const int w = in_tile[0].w;
+    const int h = in_tile[0].h;
+
+    // like tile_from_pixels, extra channels of a preallocated tile are left alone
+    for (int ti = 1; ti < 8; ti++)
+    {
+        const int tw = ti < 4 ? w : h;
+        const int th = ti < 4 ? h : w;
+        if (in_tile[ti].dims != 3 || in_tile[ti].w != tw || in_tile[ti].h != th || in_tile[ti].c < 3 || in_tile[ti].elemsize != 4u)
+            in_tile[ti].create(tw, th, 3, (size_t)4u, allocator);
+    }
+
+    for (int q = 0; q < 3; q++)
+    {
+        const ncnn::Mat in_tile_0 = in_tile[0].channel(q);
+        ncnn::Mat in_tile_4 = in_tile[4].channel(q);
+
+        tta_transpose(in_tile_0, w, in_tile_4, h, h, w);
+
+        for (int base = 0; base < 8; base += 4)
+        {
+            const ncnn::Mat m = in_tile[base].channel(q);
+            ncnn::Mat m1 = in_tile[base + 1].channel(q);
+            ncnn::Mat m2 = in_tile[base + 2].channel(q);
+            ncnn::Mat m3 = in_tile[base + 3].channel(q);
+
+            for (int i = 0; i < m.h; i++)
+            {
+                memcpy(m1.row(m.h - 1 - i), m.row(i), m.w * sizeof(float));
+                tta_reverse_row(m.row(i), m2.row(i), m.w);
+                tta_reverse_row(m.row(i), m3.row(m.h - 1 - i), m.w);
+            }
+        }
+    }
+}
+
+// average the 8 outputs back in the original orientation, starting at (offx, offy) of out_tile[0]
+static void tta_merge(const ncnn::Mat out_tile[8], int offx, int offy, int outw, int outh, ncnn::Mat& out, ncnn::Allocator* allocator)
+{
+    const int w = out_tile[0].w;
+    const int h = out_tile[0].h;
+
+    out.create(outw, outh, 3, (size_t)4u, allocator);
+
+    // the transposed outputs are summed in their own orientation first, then transposed once
+    ncnn::Mat sum_t;
+    sum_t.create(outh, outw, (size_t)4u, allocator);
+
+    for (int q = 0; q < 3; q++)
+    {
+        const ncnn::Mat out_tile_0 = out_tile[0].channel(q);
+        const ncnn::Mat out_tile_1 = out_tile[1].channel(q);
+        const ncnn::Mat out_tile_2 = out_tile[2].channel(q);
+        const ncnn::Mat out_tile_3 = out_tile[3].channel(q);
+        const ncnn::Mat out_tile_4 = out_tile[4].channel(q);
+        const ncnn::Mat out_tile_5 = out_tile[5].channel(q);
+        const ncnn::Mat out_tile_6 = out_tile[6].channel(q);
+        const ncnn::Mat out_tile_7 = out_tile[7].channel(q);
+        ncnn::Mat outq = out.channel(q);
+
+        for (int j = 0; j < outw; j++)
+        {
+            const float* ptr4 = out_tile_4.row(j + offx) + offy;
+            const float* ptr5 = out_tile_5.row(w - 1 - j - offx) + offy;
+            const float* ptr6 = out_tile_6.row(j + offx) + h - 1 - offy;
+            const float* ptr7 = out_tile_7.row(w - 1 - j - offx) + h - 1 - offy;
+
+            tta_sum_row<false>(ptr4, ptr5, ptr6, ptr7, outh, 1.f, sum_t.row(j));
+        }
+
+        tta_transpose(sum_t, outh, outq, outw, outw, outh);
+
+        for (int i = 0; i < outh; i++)
+        {
+            const float* ptr0 = out_tile_0.row(i + offy) + offx;
+            const float* ptr1 = out_tile_1.row(h - 1 - i - offy) + offx;
+            const float* ptr2 = out_tile_2.row(i + offy) + w - 1 - offx;
+            const float* ptr3 = out_tile_3.row(h - 1 - i - offy) + w - 1 - offx;
+
+            tta_sum_row<true>(ptr0, ptr1, ptr2, ptr3, outw, 1 / 8.f, outq.row(i));
+        }
+    }
+}
+
+#endif // TILE_TTA_H